@@ -0,0 +1,507 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench
+ * Author(s):
+ * Purpose: Microbenchmarks of the hot paths of the OBSW. Every bench_*.c file
+ *          includes the module it measures, static functions included, and
+ *          is linked against stubs instead of the rest of the system.
+ * -----------------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <ftw.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "global_utils.h"
+#include "arena.h"
+#include "bench.h"
+
+/* version of the json report, bumped when a field changes meaning */
+#define BENCH_SCHEMA 2
+
+/* shortest timed batch, shorter ones are dominated by the clock */
+#define BENCH_BATCH_NS 20000
+
+#define BENCH_MIN_SAMPLES 20
+#define BENCH_MAX_SAMPLES 2000
+#define BENCH_MAX_RESULTS 64
+
+typedef struct{
+    const char* name;
+    long batch;
+    int samples;
+    double ns_per_op;
+    double p50, p90, p99, max;
+    double allocs_per_op;
+    double bytes_per_op;
+    double faults_per_op;
+    double dtlb_misses_per_op;   /* negative if the counter is unavailable */
+} bench_result_t;
+
+static int64_t batch_ns(bench_op_t op, void* ctx, long batch);
+static int cmp_double(const void* a, const void* b);
+static double percentile(const double* sorted, int count, double q);
+static void write_json(FILE* fp);
+static int make_scratch(void);
+static int open_dtlb(void);
+static long thread_faults(void);
+static long process_faults(void);
+static long huge_kb(void);
+static int remove_entry(const char* path, const struct stat* sb, int flag,
+        struct FTW* ftw);
+
+static bench_result_t results[BENCH_MAX_RESULTS];
+static int result_count = 0;
+
+static const char* filter = NULL;
+static int64_t run_ns = 1000000000;
+
+/* data TLB read misses of this thread, -1 if perf events are not allowed */
+static int dtlb_fd = -1;
+
+static const char* arena_names[] = {"none", "hugetlb", "thp", "small"};
+
+/* page faults of the whole run, to compare the arena with ARENA_MALLOC */
+static long faults_init, faults_total;
+
+/* defined by global_utils, not exported in its header */
+extern int debug_mode;
+
+static char scratch[] = "/tmp/irisc-bench-XXXXXX";
+static char top_dir[100];
+
+/* allocations are counted while timing */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static atomic_int counting;
+static atomic_ulong alloc_count, alloc_bytes;
+
+void* malloc(size_t size){
+    if(atomic_load_explicit(&counting, memory_order_relaxed)){
+        atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&alloc_bytes, size, memory_order_relaxed);
+    }
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size){
+    if(atomic_load_explicit(&counting, memory_order_relaxed)){
+        atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&alloc_bytes, count * size,
+                memory_order_relaxed);
+    }
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size){
+    if(atomic_load_explicit(&counting, memory_order_relaxed)){
+        atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&alloc_bytes, size, memory_order_relaxed);
+    }
+    return __libc_realloc(ptr, size);
+}
+
+/* usage: bench [-f filter] [-t seconds] [-o report.json]
+ *      -f: only run benchmarks whose name contains filter
+ *      -t: time spent on each benchmark, default 1 s
+ *      -o: json report, default stdout
+ */
+int main(int argc, char** argv){
+
+    const char* out_fn = NULL;
+    int opt;
+
+    while((opt = getopt(argc, argv, "f:t:o:")) != -1){
+        switch(opt){
+            case 'f':
+                filter = optarg;
+                break;
+            case 't':
+                run_ns = (int64_t)(atof(optarg) * 1e9);
+                break;
+            case 'o':
+                out_fn = optarg;
+                break;
+            default:
+                fprintf(stderr,
+                        "usage: %s [-f filter] [-t seconds] [-o report.json]\n",
+                        argv[0]);
+                return FAILURE;
+        }
+    }
+
+    if(make_scratch()){
+        return FAILURE;
+    }
+
+    /* the modules log below <scratch>/output, found from the binary path */
+    char launch[sizeof(scratch) + 16];
+    snprintf(launch, sizeof(launch), "%s/bin/bench", scratch);
+    init_global_utils(launch);
+
+    /* only warnings and errors from the modules */
+    debug_mode = 0;
+
+    /* the long lived buffers of the modules, as in flight */
+    init_arena(NULL);
+    faults_init = process_faults();
+
+    dtlb_fd = open_dtlb();
+    if(dtlb_fd < 0){
+        fprintf(stderr, "dTLB counter unavailable: %s\n", strerror(errno));
+    }
+
+    fprintf(stderr, "%-32s %12s %12s %12s %12s %10s %10s %10s\n",
+            "benchmark", "ns/op", "p50", "p99", "max", "allocs/op",
+            "faults/op", "dTLB/op");
+
+    bench_kalman_filter();
+    bench_pid();
+    bench_data_queue();
+    bench_downlink_queue();
+    bench_gps();
+    bench_encoder();
+    bench_camera();
+    bench_compression();
+    bench_selection();
+    bench_logging();
+
+    /* most faults come from setting up the modules, the timed samples take
+     * none once warm */
+    faults_total = process_faults();
+    fprintf(stderr, "page faults: %ld at start up, %ld in total, "
+            "anonymous huge pages: %ld kB\n", faults_init, faults_total, huge_kb());
+
+    FILE* fp = stdout;
+    if(out_fn != NULL){
+        fp = fopen(out_fn, "w");
+        if(fp == NULL){
+            fprintf(stderr, "Could not open %s: %s\n", out_fn, strerror(errno));
+            fp = stdout;
+        }
+    }
+
+    write_json(fp);
+    if(fp != stdout){
+        fclose(fp);
+    }
+
+    nftw(scratch, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    return SUCCESS;
+}
+
+/* bench_run:
+ * Time an operation and add the result to the report. The operation is run
+ * in batches long enough to be timed reliably, the percentiles are those of
+ * the time per operation of each batch.
+ *
+ * input:
+ *      name: stable name used to compare runs, "<module>/<operation>"
+ *      op: operation to time
+ *      ctx: passed to op
+ */
+void bench_run(const char* name, bench_op_t op, void* ctx){
+
+    if(filter != NULL && strstr(name, filter) == NULL){
+        return;
+    }
+    if(result_count == BENCH_MAX_RESULTS){
+        fprintf(stderr, "Too many benchmarks, %s skipped\n", name);
+        return;
+    }
+
+    /* warm up, the first call often opens files or faults in pages */
+    batch_ns(op, ctx, 1);
+
+    /* smallest batch that takes long enough, the faster of two runs */
+    long batch = 1;
+    while(batch < (1L << 24)){
+        int64_t first = batch_ns(op, ctx, batch);
+        int64_t second = batch_ns(op, ctx, batch);
+        if((first < second ? first : second) >= BENCH_BATCH_NS){
+            break;
+        }
+        batch *= 2;
+    }
+
+    static double samples[BENCH_MAX_SAMPLES];
+    int count = 0;
+    int64_t total = 0;
+
+    atomic_store(&alloc_count, 0);
+    atomic_store(&alloc_bytes, 0);
+    atomic_store(&counting, 1);
+
+    long faults = thread_faults();
+    if(dtlb_fd >= 0){
+        ioctl(dtlb_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(dtlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    while(count < BENCH_MIN_SAMPLES ||
+            (total < run_ns && count < BENCH_MAX_SAMPLES)){
+
+        int64_t ns = batch_ns(op, ctx, batch);
+        samples[count++] = (double)ns / batch;
+        total += ns;
+    }
+
+    uint64_t misses = 0;
+    if(dtlb_fd >= 0){
+        ioctl(dtlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if(read(dtlb_fd, &misses, sizeof(misses)) != sizeof(misses)){
+            misses = 0;
+        }
+    }
+    faults = thread_faults() - faults;
+
+    atomic_store(&counting, 0);
+
+    double ops = (double)count * batch;
+
+    bench_result_t* res = &results[result_count++];
+    res->name = name;
+    res->batch = batch;
+    res->samples = count;
+    res->ns_per_op = total / ops;
+    res->allocs_per_op = atomic_load(&alloc_count) / ops;
+    res->bytes_per_op = atomic_load(&alloc_bytes) / ops;
+    res->faults_per_op = faults / ops;
+    res->dtlb_misses_per_op = dtlb_fd >= 0 ? misses / ops : -1;
+
+    qsort(samples, count, sizeof(*samples), cmp_double);
+    res->p50 = percentile(samples, count, 0.5);
+    res->p90 = percentile(samples, count, 0.9);
+    res->p99 = percentile(samples, count, 0.99);
+    res->max = samples[count - 1];
+
+    fprintf(stderr, "%-32s %12.1lf %12.1lf %12.1lf %12.1lf %10.2lf %10.3lf %10.2lf\n",
+            res->name, res->ns_per_op, res->p50, res->p99, res->max,
+            res->allocs_per_op, res->faults_per_op, res->dtlb_misses_per_op);
+}
+
+/* top directory of the scratch tree the benchmarked modules log into */
+const char* bench_dir(void){
+    return top_dir;
+}
+
+/* fill a buffer with a synthetic 12 bit sky frame: noise, gradient and stars,
+ * shifted to the upper bits as delivered by the cameras */
+void bench_frame(uint16_t* buffer, int width, int height){
+
+    /* the same frame on every run */
+    uint32_t state = 0x1215;
+
+    for(long ii=0; ii<(long)width*height; ++ii){
+
+        /* xorshift, two uniform draws summed give a rough gaussian */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        double noise = ((state & 0xFFFF) + (state >> 16)) / 65536.0 - 1;
+
+        long row = ii / width;
+        buffer[ii] = (uint16_t)(300 + 100.0 * row / height + 40 * noise);
+    }
+
+    for(int star=0; star<60; ++star){
+
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        int cx = state % width;
+        int cy = (state >> 12) % height;
+        double peak = 200 + (state >> 20) % 3000;
+
+        for(int yy=cy-4; yy<=cy+4; ++yy){
+            for(int xx=cx-4; xx<=cx+4; ++xx){
+                if(xx < 0 || yy < 0 || xx >= width || yy >= height){
+                    continue;
+                }
+                double r2 = (xx - cx) * (xx - cx) + (yy - cy) * (yy - cy);
+                double val = buffer[(long)yy*width + xx] + peak * exp(-r2 / 3);
+                buffer[(long)yy*width + xx] = val > 4095 ? 4095 : (uint16_t)val;
+            }
+        }
+    }
+
+    for(long ii=0; ii<(long)width*height; ++ii){
+        buffer[ii] <<= 4;
+    }
+}
+
+static int64_t batch_ns(bench_op_t op, void* ctx, long batch){
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(long ii=0; ii<batch; ++ii){
+        op(ctx);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    return (int64_t)(stop.tv_sec - start.tv_sec) * 1000000000 +
+            (stop.tv_nsec - start.tv_nsec);
+}
+
+static int cmp_double(const void* a, const void* b){
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+/* nearest rank percentile of sorted samples */
+static double percentile(const double* sorted, int count, double q){
+    int rank = (int)ceil(q * count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/* write_json:
+ * Write the report, keys and benchmark order are stable between runs:
+ *      {"schema": 2, "arena": ..., "faults_init": ..., "faults_total": ...,
+ *       "huge_kb": ..., "benchmarks": [{"name": ..., "batch": ...,
+ *       "samples": ..., "ns_per_op": ..., "p50_ns": ..., "p90_ns": ...,
+ *       "p99_ns": ..., "max_ns": ..., "allocs_per_op": ..., "bytes_per_op": ...,
+ *       "faults_per_op": ..., "dtlb_misses_per_op": ...}, ...]}
+ * arena is the backing of the arena, see arena.h, faults_* are the page
+ * faults of the process after reserving the arena and after the last
+ * benchmark, huge_kb the anonymous memory on huge pages, -1 if unknown.
+ * dtlb_misses_per_op is null where perf events are not allowed.
+ */
+static void write_json(FILE* fp){
+
+    fprintf(fp, "{\n  \"schema\": %d,\n  \"arena\": \"%s\",\n  \"faults_init\": %ld,\n"
+            "  \"faults_total\": %ld,\n  \"huge_kb\": %ld,\n  \"benchmarks\": [",
+            BENCH_SCHEMA, arena_names[arena_backing()], faults_init, faults_total,
+            huge_kb());
+
+    for(int ii=0; ii<result_count; ++ii){
+        bench_result_t* res = &results[ii];
+
+        fprintf(fp, "%s\n    {\"name\": \"%s\", \"batch\": %ld, "
+                "\"samples\": %d, \"ns_per_op\": %.1lf, \"p50_ns\": %.1lf, "
+                "\"p90_ns\": %.1lf, \"p99_ns\": %.1lf, \"max_ns\": %.1lf, "
+                "\"allocs_per_op\": %.3lf, \"bytes_per_op\": %.1lf, "
+                "\"faults_per_op\": %.4lf, \"dtlb_misses_per_op\": ",
+                ii ? "," : "", res->name, res->batch, res->samples,
+                res->ns_per_op, res->p50, res->p90, res->p99, res->max,
+                res->allocs_per_op, res->bytes_per_op, res->faults_per_op);
+
+        if(res->dtlb_misses_per_op < 0){
+            fprintf(fp, "null}");
+        }
+        else{
+            fprintf(fp, "%.3lf}", res->dtlb_misses_per_op);
+        }
+    }
+
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+/* open_dtlb:
+ * Open a counter of the data TLB read misses of the calling thread in user
+ * space, disabled until enabled around the timed samples.
+ *
+ * return:
+ *      file descriptor of the counter, -1 if unavailable, errno is set
+ */
+static int open_dtlb(void){
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* page faults of the calling thread so far, minor and major */
+static long thread_faults(void){
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+/* page faults of the whole process so far, minor and major */
+static long process_faults(void){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+/* anonymous memory of the process backed by huge pages, unit: kB, -1 if
+ * unknown. Explicit huge pages from hugetlbfs are not counted here. */
+static long huge_kb(void){
+
+    FILE* fp = fopen("/proc/self/smaps_rollup", "r");
+    if(fp == NULL){
+        return -1;
+    }
+
+    char line[128];
+    long kb = -1;
+    while(fgets(line, sizeof(line), fp) != NULL){
+        if(sscanf(line, "AnonHugePages: %ld kB", &kb) == 1){
+            break;
+        }
+    }
+
+    fclose(fp);
+    return kb;
+}
+
+/* make_scratch:
+ * Create a throwaway copy of the output tree for the logs of the modules,
+ * removed again when the benchmarks are done.
+ */
+static int make_scratch(void){
+
+    if(mkdtemp(scratch) == NULL){
+        fprintf(stderr, "Could not create scratch directory: %s\n",
+                strerror(errno));
+        return FAILURE;
+    }
+
+    snprintf(top_dir, sizeof(top_dir), "%s/", scratch);
+
+    const char* dirs[] = {"bin", "output", "output/logs", "output/logs/kf",
+            "output/logs/kf/az", "output/logs/kf/alt", "output/compression"};
+
+    for(size_t ii=0; ii<sizeof(dirs)/sizeof(*dirs); ++ii){
+        char path[200];
+        snprintf(path, sizeof(path), "%s%s", top_dir, dirs[ii]);
+        if(mkdir(path, 0755)){
+            fprintf(stderr, "Could not create %s: %s\n", path, strerror(errno));
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+static int remove_entry(const char* path, const struct stat* sb, int flag,
+        struct FTW* ftw){
+    return remove(path);
+}
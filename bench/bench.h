@@ -0,0 +1,50 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench
+ * Author(s):
+ * Purpose: Microbenchmarks of the hot paths of the OBSW. Every bench_*.c file
+ *          includes the module it measures, static functions included, and
+ *          is linked against stubs instead of the rest of the system.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* size of the frames used by the camera and compression benchmarks */
+#define BENCH_FRAME_W 1280
+#define BENCH_FRAME_H 1024
+
+/* one operation of a benchmark, ctx as given to bench_run */
+typedef void (*bench_op_t)(void* ctx);
+
+/* bench_run:
+ * Time an operation and add the result to the report. The operation is run
+ * in batches long enough to be timed reliably, the percentiles are those of
+ * the time per operation of each batch.
+ *
+ * input:
+ *      name: stable name used to compare runs, "<module>/<operation>"
+ *      op: operation to time
+ *      ctx: passed to op
+ */
+void bench_run(const char* name, bench_op_t op, void* ctx);
+
+/* top directory of the scratch tree the benchmarked modules log into */
+const char* bench_dir(void);
+
+/* fill a buffer with a synthetic 12 bit sky frame: noise, gradient and stars,
+ * shifted to the upper bits as delivered by the cameras */
+void bench_frame(uint16_t* buffer, int width, int height);
+
+/* benchmarks of each module, called in this order by main */
+void bench_kalman_filter(void);
+void bench_pid(void);
+void bench_data_queue(void);
+void bench_downlink_queue(void);
+void bench_gps(void);
+void bench_encoder(void);
+void bench_camera(void);
+void bench_compression(void);
+void bench_selection(void);
+void bench_logging(void);
@@ -0,0 +1,36 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench Camera
+ * Parent Component: Bench
+ * Author(s):
+ * Purpose: Time the passes over a frame after it is fetched from a camera.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "../src/camera/camera_utils/camera_utils.c"
+
+#include "bench.h"
+
+static unsigned short* frame;
+
+static void shift(void* ctx){
+    to_12bit(frame, (long)BENCH_FRAME_W * BENCH_FRAME_H);
+}
+
+static void flip(void* ctx){
+    yflip(frame, BENCH_FRAME_W, BENCH_FRAME_H);
+}
+
+void bench_camera(void){
+
+    frame = malloc((long)BENCH_FRAME_W * BENCH_FRAME_H * sizeof(*frame));
+    if(frame == NULL){
+        fprintf(stderr, "Could not allocate frame, skipped\n");
+        return;
+    }
+    bench_frame(frame, BENCH_FRAME_W, BENCH_FRAME_H);
+
+    bench_run("camera/to_12bit", shift, NULL);
+    bench_run("camera/yflip", flip, NULL);
+
+    free(frame);
+}
@@ -0,0 +1,85 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench Compression
+ * Parent Component: Bench
+ * Author(s):
+ * Purpose: Time compression of a frame saved by the camera before downlink.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "../src/img_processing/image_handler/image_handler.c"
+
+#include "bench.h"
+
+#define FITS_BLOCK 2880
+#define FITS_CARD 80
+
+static char frame_fn[200];
+static char out_fn[200];
+
+static void compress(void* ctx){
+    compress_file(frame_fn, out_fn, COMPRESSION_LEVEL, 0, NULL);
+}
+
+/* write_frame:
+ * Write a synthetic frame as save_img does: a fits header and 16 bit big
+ * endian pixels with an offset of 32768, padded to whole blocks.
+ */
+static int write_frame(const char* fn){
+
+    long pixels = (long)BENCH_FRAME_W * BENCH_FRAME_H;
+    uint16_t* frame = malloc(pixels * sizeof(*frame));
+    if(frame == NULL){
+        return ENOMEM;
+    }
+    bench_frame(frame, BENCH_FRAME_W, BENCH_FRAME_H);
+
+    FILE* fp = fopen(fn, "wb");
+    if(fp == NULL){
+        free(frame);
+        return errno;
+    }
+
+    char header[FITS_BLOCK];
+    memset(header, ' ', FITS_BLOCK);
+
+    char cards[][FITS_CARD + 1] = {"SIMPLE  = T", "BITPIX  = 16", "NAXIS   = 2",
+            "NAXIS1  = ", "NAXIS2  = ", "BZERO   = 32768", "BSCALE  = 1", "END"};
+    snprintf(cards[3], FITS_CARD + 1, "NAXIS1  = %d", BENCH_FRAME_W);
+    snprintf(cards[4], FITS_CARD + 1, "NAXIS2  = %d", BENCH_FRAME_H);
+
+    for(size_t ii=0; ii<sizeof(cards)/sizeof(*cards); ++ii){
+        memcpy(&header[ii * FITS_CARD], cards[ii], strlen(cards[ii]));
+    }
+    fwrite(header, 1, FITS_BLOCK, fp);
+
+    for(long ii=0; ii<pixels; ++ii){
+        /* 12 bit as written by save_img */
+        uint16_t val = (frame[ii] >> 4) ^ 0x8000;
+        unsigned char be[2] = {val >> 8, val & 0xFF};
+        fwrite(be, 1, 2, fp);
+    }
+
+    long pad = (FITS_BLOCK - pixels * 2 % FITS_BLOCK) % FITS_BLOCK;
+    for(long ii=0; ii<pad; ++ii){
+        fputc(0, fp);
+    }
+
+    fclose(fp);
+    free(frame);
+
+    return SUCCESS;
+}
+
+void bench_compression(void){
+
+    snprintf(frame_fn, sizeof(frame_fn), "%soutput/bench.fit", bench_dir());
+    snprintf(out_fn, sizeof(out_fn), "%soutput/compression/bench.fit.zst",
+            bench_dir());
+
+    if(write_frame(frame_fn)){
+        fprintf(stderr, "Could not write sample frame, skipped\n");
+        return;
+    }
+
+    bench_run("compress_file/frame", compress, NULL);
+}
@@ -0,0 +1,41 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench Data Queue
+ * Parent Component: Bench
+ * Author(s):
+ * Purpose: Time pushing and popping files on the image processing queue.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "../src/img_processing/data_queue/data_queue.c"
+
+#include "bench.h"
+
+/* files waiting in the queue while timing */
+#define BENCH_QUEUE_DEPTH 32
+
+/* priorities of the files queued in flight */
+static const int prios[] = {20, 30, 40, 41, 50};
+#define BENCH_PRIOS (sizeof(prios)/sizeof(*prios))
+
+static void push_pop(void* ctx){
+
+    static unsigned long count = 0;
+
+    push_data(&data_queue, "output/nir/nir_0000000000.fit",
+            prios[count++ % BENCH_PRIOS], 1);
+    pop_data(&data_queue);
+}
+
+void bench_data_queue(void){
+
+    for(int ii=0; ii<BENCH_QUEUE_DEPTH; ++ii){
+        push_data(&data_queue, "output/nir/nir_0000000000.fit",
+                prios[ii % BENCH_PRIOS], 1);
+    }
+
+    bench_run("data_queue/push_pop", push_pop, NULL);
+
+    while(!is_empty_data(&data_queue)){
+        pop_data(&data_queue);
+    }
+}
@@ -0,0 +1,37 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench Downlink Queue
+ * Parent Component: Bench
+ * Author(s):
+ * Purpose: Time queueing and dequeueing telemetry for downlink.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "../src/telemetry/downlink_queue/downlink_queue.c"
+
+#include "bench.h"
+
+/* messages waiting in the queue while timing */
+#define BENCH_QUEUE_DEPTH 32
+
+static void push_pop(void* ctx){
+
+    static unsigned long count = 0;
+
+    send_telemetry_local("output/compression/nir_0000000000.zst",
+            count++ % 4, 0, 0);
+    read_downlink_queue();
+}
+
+void bench_downlink_queue(void){
+
+    for(int ii=0; ii<BENCH_QUEUE_DEPTH; ++ii){
+        send_telemetry_local("output/compression/nir_0000000000.zst",
+                ii % 4, 0, 0);
+    }
+
+    bench_run("downlink_queue/push_pop", push_pop, NULL);
+
+    while(!is_empty(&downlink_queue)){
+        read_downlink_queue();
+    }
+}
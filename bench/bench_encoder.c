@@ -0,0 +1,34 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench Encoder
+ * Parent Component: Bench
+ * Author(s):
+ * Purpose: Time the parity check of a word read from an encoder.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "../src/sensors/sensor_poller/encoder_poller/encoder_poller.c"
+
+#include "bench.h"
+
+#define BENCH_WORDS 256
+
+static unsigned char words[BENCH_WORDS][2];
+
+static void chksum(void* ctx){
+
+    static unsigned int next = 0;
+
+    checksum_ctl_enc(words[next++ % BENCH_WORDS]);
+}
+
+void bench_encoder(void){
+
+    /* every count an encoder can send, the parity bits varied as well */
+    for(int ii=0; ii<BENCH_WORDS; ++ii){
+        unsigned short word = (unsigned short)(ii * 0x9E37);
+        words[ii][0] = word >> 8;
+        words[ii][1] = word & 0xFF;
+    }
+
+    bench_run("encoder/checksum_ctl_enc", chksum, NULL);
+}
@@ -0,0 +1,45 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench GPS
+ * Parent Component: Bench
+ * Author(s):
+ * Purpose: Time parsing of GGA messages as received from the gps.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "../src/sensors/sensor_poller/gps_poller/gps_poller.c"
+
+#include "bench.h"
+
+static unsigned char gga[BUFFER_S];
+
+static void process(void* ctx){
+    process_gps(gga);
+}
+
+static void chksum(void* ctx){
+    check_chksum(gga);
+}
+
+void bench_gps(void){
+
+    char log_fn[200];
+    snprintf(log_fn, sizeof(log_fn), "%soutput/logs/gps.log", bench_dir());
+
+    gps_log = fopen(log_fn, "a");
+    if(gps_log == NULL){
+        fprintf(stderr, "Could not open gps log, skipped\n");
+        return;
+    }
+
+    /* as left in the buffer by the poller, checksum appended */
+    strcpy((char*)gga, "$GPGGA,101530.00,6753.4032,N,02110.1251,E,1,09,0.9,"
+            "27412.3,M,23.1,M,,*");
+    unsigned char ascii[3];
+    calc_chksum(gga, ascii);
+    strcat((char*)gga, (char*)ascii);
+
+    bench_run("gps/process_gga", process, NULL);
+    bench_run("gps/check_chksum", chksum, NULL);
+
+    fclose(gps_log);
+}
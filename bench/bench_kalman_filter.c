@@ -0,0 +1,47 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench Kalman Filter
+ * Parent Component: Bench
+ * Author(s):
+ * Purpose: Time a prediction and a measurement update of one filter axis.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "../src/control_sys/kalman_filter/kalman_filter.c"
+
+#include "bench.h"
+
+/* gyro samples between two star tracker fixes, re-propagated on each fix */
+#define BENCH_FIX_SAMPLES (5L * SENS_FREQ)
+
+static void predict(void* ctx){
+
+    kf_axis(az, 0.01, NULL);
+
+    if(++hist_index == BENCH_FIX_SAMPLES){
+        hist_index = 0;
+    }
+}
+
+static void update(void* ctx){
+
+    double fix = az.x_prev[0][0] + 0.001;
+
+    hist_index = BENCH_FIX_SAMPLES;
+    kf_axis(az, 0.01, &fix);
+}
+
+void bench_kalman_filter(void){
+
+    if(init_kalman_filter(NULL)){
+        fprintf(stderr, "Kalman filter not initialised, skipped\n");
+        return;
+    }
+
+    /* a full history to re-propagate from */
+    for(long ii=0; ii<BENCH_FIX_SAMPLES; ++ii){
+        predict(NULL);
+    }
+
+    bench_run("kf_axis/predict", predict, NULL);
+    bench_run("kf_axis/update", update, NULL);
+}
@@ -0,0 +1,32 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench Logging
+ * Parent Component: Bench
+ * Author(s):
+ * Purpose: Time writing a line to a csv log, done by most modules every cycle.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+
+#include "global_utils.h"
+#include "bench.h"
+
+static void write_line(void* ctx){
+    logging_csv((FILE*)ctx, "%+.10e,%+.10e", 12.3456789, -0.000123);
+}
+
+void bench_logging(void){
+
+    char log_fn[200];
+    snprintf(log_fn, sizeof(log_fn), "%soutput/logs/bench.log", bench_dir());
+
+    FILE* fp = fopen(log_fn, "a");
+    if(fp == NULL){
+        fprintf(stderr, "Could not open log, skipped\n");
+        return;
+    }
+
+    bench_run("logging_csv", write_line, fp);
+
+    fclose(fp);
+}
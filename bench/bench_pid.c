@@ -0,0 +1,34 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench PID
+ * Parent Component: Bench
+ * Author(s):
+ * Purpose: Time one iteration of the pid controller of both axes.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "../src/control_sys/pid/pid.c"
+
+#include "bench.h"
+
+static void update(void* ctx){
+
+    static long step = 0;
+
+    /* small tracking errors around a slowly moving target */
+    telescope_att_t att = {10 + 0.01 * (step % 100), 45 - 0.01 * (step % 50)};
+    motor_step_t out;
+
+    pid_update(&att, &out);
+    step++;
+}
+
+void bench_pid(void){
+
+    init_pid(NULL);
+    if(pid_log == NULL){
+        fprintf(stderr, "PID not initialised, skipped\n");
+        return;
+    }
+
+    bench_run("pid_update", update, NULL);
+}
@@ -0,0 +1,24 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench Target Selection
+ * Parent Component: Bench
+ * Author(s):
+ * Purpose: Time the conversion of a target to horizontal coordinates.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "../src/control_sys/target_selection/target_selection.c"
+
+#include "bench.h"
+
+static void convert(void* ctx){
+
+    static unsigned int next = 0;
+    double az_ang, alt_ang;
+
+    /* hour angle sweeping a turn, as over the targets of a night */
+    angle_calc(40.5, (next++ % 360) - 180.0, 67.9, &az_ang, &alt_ang);
+}
+
+void bench_selection(void){
+    bench_run("selection/angle_calc", convert, NULL);
+}
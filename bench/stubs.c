@@ -0,0 +1,116 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bench Stubs
+ * Parent Component: Bench
+ * Author(s):
+ * Purpose: Stand-ins for the parts of the OBSW the benchmarked modules call
+ *          but that are not benchmarked. No hardware is touched.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "global_utils.h"
+#include "camera.h"
+#include "cam_supervisor.h"
+#include "exp_timing.h"
+#include "sensors.h"
+#include "data_bus.h"
+#include "current_target.h"
+#include "control_sys.h"
+#include "gimbal.h"
+#include "exposure_planner.h"
+#include "attitude_recorder.h"
+#include "pointing_model.h"
+#include "img_processing.h"
+#include "quick_look.h"
+#include "telemetry.h"
+#include "e_link.h"
+#include "mode.h"
+
+/* camera supervisor, every camera is offline */
+int cam_sup_acquire(int id){ return ENODEV; }
+void cam_sup_release(int id){}
+void cam_sup_lost(int id){}
+void cam_sup_register(ASI_CAMERA_INFO* cam_info, char cam_name, char online){}
+void cam_sup_settings(int id, long exp, long gain){}
+ASI_CAMERA_INFO* cam_sup_info(char cam_name){ return NULL; }
+int cam_sup_id(const ASI_CAMERA_INFO* cam_info){ return cam_info->CameraID; }
+void cam_sup_exposing(int id, char exposing){}
+char cam_sup_busy(int id){ return 0; }
+
+/* exposure timing */
+char exp_timing_hw(int id){ return 0; }
+int exp_timing_setup(ASI_CAMERA_INFO* cam_info, char* cam_name){ return SUCCESS; }
+void exp_timing_stamp(int id, exp_stamp_t* stamp){ memset(stamp, 0, sizeof(*stamp)); }
+int exp_timing_start(int id, long exp){ return ENODEV; }
+int exp_timing_stop(int id){ return ENODEV; }
+
+/* nir camera */
+int expose_nir(int exp, int gain){ return ENODEV; }
+int save_img_nir(void){ return ENODEV; }
+int abort_exp_nir(void){ return ENODEV; }
+int get_nir_frame_id(void){ return 0; }
+int lucky_start_nir(int frames, int exp, int gain, int keep){ return ENODEV; }
+int lucky_step_nir(void){ return ENODEV; }
+int lucky_abort_nir(void){ return ENODEV; }
+
+/* image processing and telemetry */
+int queue_image(char* filepath, int type){ return SUCCESS; }
+void ref_keyframe(void){}
+int send_telemetry(char* filepath, int p, int flag, unsigned short packets_sent){
+    return SUCCESS;
+}
+long downlink_backlog(void){ return 0; }
+
+/* quick look, not benchmarked */
+int quick_look(const char* in_fn, const char* out_fn, double step){
+    return ENODEV;
+}
+
+/* e-link, nominal rate */
+double get_datarate(void){ return 1e6; }
+
+/* sensors, at rest */
+void get_gyro(gyro_t* gyro){ memset(gyro, 0, sizeof(*gyro)); }
+void get_star_tracker(star_tracker_t* st){ memset(st, 0, sizeof(*st)); }
+int get_st_exp(void){ return 100000; }
+void get_encoder(encoder_t* encoder){ memset(encoder, 0, sizeof(*encoder)); }
+void set_encoder(encoder_t* encoder){}
+void encoder_out_of_date(void){}
+int enc_single_samp(encoder_t* enc){ return FAILURE; }
+void get_gps(gps_t* gps){ memset(gps, 0, sizeof(*gps)); gps->lat = 67.9; }
+void set_gps(gps_t* gps){}
+void gps_out_of_date(void){}
+
+/* control system */
+void get_telescope_att(telescope_att_t* telescope_att){
+    memset(telescope_att, 0, sizeof(*telescope_att));
+}
+void set_telescope_att(telescope_att_t* telescope_att){}
+void set_tracking_angles(double az, double alt){}
+void get_tracking_angles(double* az, double* alt){
+    *az = 10.5;
+    *alt = 45.2;
+}
+void move_az_to(double target){}
+void move_alt_to(double target){}
+void reset_field_rotator(void){}
+int step_roll(motor_step_t* steps){ return SUCCESS; }
+void exp_planner_cancel(void){}
+int exp_planner_ready(double exp_s){ return SUCCESS; }
+void att_rec_start(int frame_id){}
+int att_rec_stop(char keep){ return SUCCESS; }
+
+/* pointing model, no correction */
+void pm_sample(double az, double alt, const struct timespec* mid){}
+void pm_enc_to_pointing(double enc_az, double enc_alt, double* az, double* alt){
+    *az = enc_az;
+    *alt = enc_alt;
+}
+
+/* data bus, nothing is published */
+void publish_topic(bus_topic_t topic, const void* msg){}
+
+char get_mode(void){ return RESET; }
@@ -0,0 +1,311 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Alloc Check
+ * Author(s):
+ * Purpose: Find heap allocations made by the real-time threads after init.
+ *          Built with ALLOC_CHECK, malloc, calloc, realloc and free are
+ *          interposed and every call from a thread started by create_thread
+ *          after init is counted per call site, with its backtrace written
+ *          to output/logs/alloc_check.log.
+ * -----------------------------------------------------------------------------
+ */
+
+/**
+ * A call site is the backtrace of the call, the same function reached from
+ * two paths gives two sites. Every ALLOC_REPORT_S the sites that were hit
+ * since the last report are written to the log as
+ *      time,site,kind,thread,count,bytes
+ * followed by the backtrace the first time a site is reported, which also
+ * logs a warning. Resolve addresses in the backtraces with addr2line.
+ *
+ * Without ALLOC_CHECK only the empty hooks called by create_thread and init
+ * remain.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "global_utils.h"
+#include "alloc_check.h"
+
+#ifdef ALLOC_CHECK
+
+/* most threads tagged as real-time */
+#define ALLOC_THREADS 64
+
+/* most call sites recorded, later ones are only counted as dropped */
+#define ALLOC_SITES 256
+
+/* frames kept per call site */
+#define ALLOC_DEPTH 12
+
+/* time between two reports, unit: seconds */
+#define ALLOC_REPORT_S 60
+
+#define KIND_MALLOC 0
+#define KIND_CALLOC 1
+#define KIND_REALLOC 2
+#define KIND_FREE 3
+
+/* start routine of a tagged thread, its argument and name */
+typedef struct {
+    const char* name;
+    void* (*func)(void*);
+    void* arg;
+} alloc_start_t;
+
+typedef struct {
+    void* frames[ALLOC_DEPTH];
+    int depth;
+    int kind;
+    char thread[16];
+    unsigned long count;
+    unsigned long bytes;
+    unsigned long reported;     /* count at the last report */
+} alloc_site_t;
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static void record(int kind, size_t size) __attribute__((noinline));
+static void* rt_start(void* arg);
+static void* thread_func(void* arg);
+static void report(FILE* fp);
+
+static const char* kind_names[] = {"malloc", "calloc", "realloc", "free"};
+
+/* plain mutex, a lock_t can be profiled and allocate itself */
+static pthread_mutex_t mutex_sites = PTHREAD_MUTEX_INITIALIZER;
+static alloc_site_t sites[ALLOC_SITES];
+static int site_count = 0;
+static unsigned long dropped = 0;
+
+static alloc_start_t rt_starts[ALLOC_THREADS];
+static atomic_int rt_count;
+
+static atomic_int armed;
+
+/* set in the real-time threads */
+static __thread int rt_self = 0;
+
+/* set while recording, backtrace and the lookups must not be recorded */
+static __thread int in_hook = 0;
+
+static FILE* check_log;
+
+void* malloc(size_t size){
+    record(KIND_MALLOC, size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size){
+    record(KIND_CALLOC, count * size);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size){
+    record(KIND_REALLOC, size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr){
+    if(ptr != NULL){
+        record(KIND_FREE, 0);
+    }
+    __libc_free(ptr);
+}
+
+#endif
+
+int init_alloc_check(void* args){
+
+#ifdef ALLOC_CHECK
+    char log_fn[100];
+
+    strcpy(log_fn, get_top_dir());
+    strcat(log_fn, "output/logs/alloc_check.log");
+
+    check_log = fopen(log_fn, "a");
+    if(check_log == NULL){
+        logging(ERROR, "Alloc Chk", "Failed to open log: %m");
+        return errno;
+    }
+
+    /* the first backtrace loads the unwinder, which allocates */
+    void* frame;
+    backtrace(&frame, 1);
+
+    return create_thread("alloc_check", thread_func, 7);
+#else
+    return SUCCESS;
+#endif
+}
+
+void alloc_check_thread(const char* name, void* (**start)(void*), void** arg){
+
+#ifdef ALLOC_CHECK
+    int idx = atomic_fetch_add(&rt_count, 1);
+    if(idx >= ALLOC_THREADS){
+        logging(WARN, "Alloc Chk", "Too many threads, not tagged");
+        return;
+    }
+
+    rt_starts[idx].name = name;
+    rt_starts[idx].func = *start;
+    rt_starts[idx].arg = *arg;
+
+    *start = rt_start;
+    *arg = &rt_starts[idx];
+#endif
+}
+
+void alloc_check_arm(void){
+
+#ifdef ALLOC_CHECK
+    atomic_store(&armed, 1);
+    logging(INFO, "Alloc Chk",
+            "Recording allocations of %d real-time threads",
+            atomic_load(&rt_count) < ALLOC_THREADS ? atomic_load(&rt_count) : ALLOC_THREADS);
+#endif
+}
+
+#ifdef ALLOC_CHECK
+
+/* record:
+ * Count an allocation or free by a real-time thread after init against its
+ * call site.
+ *
+ * input:
+ *      kind: KIND_*
+ *      size: requested size, unit: bytes
+ */
+static void record(int kind, size_t size){
+
+    if(!rt_self || in_hook || !atomic_load_explicit(&armed, memory_order_relaxed)){
+        return;
+    }
+
+    in_hook = 1;
+
+    /* drop record and the interposed function */
+    void* frames[ALLOC_DEPTH + 2];
+    int depth = backtrace(frames, ALLOC_DEPTH + 2) - 2;
+    if(depth < 0){
+        depth = 0;
+    }
+
+    pthread_mutex_lock(&mutex_sites);
+
+    alloc_site_t* site = NULL;
+    for(int ii=0; ii<site_count; ++ii){
+        if(sites[ii].kind == kind && sites[ii].depth == depth &&
+                !memcmp(sites[ii].frames, frames + 2, depth * sizeof(void*))){
+            site = &sites[ii];
+            break;
+        }
+    }
+
+    if(site == NULL && site_count < ALLOC_SITES){
+        site = &sites[site_count++];
+        memcpy(site->frames, frames + 2, depth * sizeof(void*));
+        site->depth = depth;
+        site->kind = kind;
+        pthread_getname_np(pthread_self(), site->thread, sizeof(site->thread));
+    }
+
+    if(site != NULL){
+        site->count++;
+        site->bytes += size;
+    }
+    else{
+        dropped++;
+    }
+
+    pthread_mutex_unlock(&mutex_sites);
+
+    in_hook = 0;
+}
+
+/* start routine of the real-time threads */
+static void* rt_start(void* arg){
+
+    alloc_start_t* start = arg;
+
+    /* named here as well, the creator names it only once it returns */
+    pthread_setname_np(pthread_self(), start->name);
+    rt_self = 1;
+
+    return start->func(start->arg);
+}
+
+static void* thread_func(void* arg){
+
+    /* the report allocates, do not report this thread itself */
+    rt_self = 0;
+
+    while(1){
+        sleep(ALLOC_REPORT_S);
+        report(check_log);
+    }
+
+    return NULL;
+}
+
+/* report:
+ * Write the sites hit since the last report, the backtrace of new sites and
+ * warn about them.
+ */
+static void report(FILE* fp){
+
+    static alloc_site_t snapshot[ALLOC_SITES];
+
+    pthread_mutex_lock(&mutex_sites);
+    int count = site_count;
+    unsigned long lost = dropped;
+    for(int ii=0; ii<count; ++ii){
+        snapshot[ii] = sites[ii];
+        sites[ii].reported = sites[ii].count;
+    }
+    pthread_mutex_unlock(&mutex_sites);
+
+    for(int ii=0; ii<count; ++ii){
+
+        alloc_site_t* site = &snapshot[ii];
+        if(site->count == site->reported){
+            continue;
+        }
+
+        logging_csv(fp, "%d,%s,%s,%lu,%lu", ii, kind_names[site->kind],
+                site->thread, site->count, site->bytes);
+
+        if(site->reported > 0){
+            continue;
+        }
+
+        logging(WARN, "Alloc Chk", "%s in %s thread after init, site %d",
+                kind_names[site->kind], site->thread, ii);
+
+        char** symbols = backtrace_symbols(site->frames, site->depth);
+        for(int jj=0; jj<site->depth; ++jj){
+            fprintf(fp, "    %s\n", symbols != NULL ? symbols[jj] : "?");
+        }
+        fflush(fp);
+        free(symbols);
+    }
+
+    if(lost > 0){
+        logging(WARN, "Alloc Chk",
+                "%lu allocations not recorded, more than %d sites", lost, ALLOC_SITES);
+    }
+}
+
+#endif
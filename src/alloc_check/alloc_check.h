@@ -0,0 +1,35 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Alloc Check
+ * Author(s):
+ * Purpose: Find heap allocations made by the real-time threads after init.
+ *          Built with ALLOC_CHECK, malloc, calloc, realloc and free are
+ *          interposed and every call from a thread started by create_thread
+ *          after init is counted per call site, with its backtrace written
+ *          to output/logs/alloc_check.log.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+int init_alloc_check(void* args);
+
+/* alloc_check_thread:
+ * Tag a thread as real-time, called by create_thread before pthread_create.
+ * Replaces the start routine with one that tags the thread before its first
+ * instruction, a new thread may run before pthread_create returns.
+ *
+ * input:
+ *      name: name of the thread, must outlive it
+ *      start: start routine of the new thread
+ *      arg: argument of the start routine
+ *
+ * output:
+ *      start, arg: to be passed to pthread_create instead
+ */
+void alloc_check_thread(const char* name, void* (**start)(void*), void** arg);
+
+/* alloc_check_arm:
+ * Mark the end of init, allocations from real-time threads are recorded from
+ * here on.
+ */
+void alloc_check_arm(void);
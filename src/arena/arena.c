@@ -0,0 +1,181 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Arena
+ * Author(s):
+ * Purpose: One large region reserved at start up, backed by huge pages when
+ *          the kernel allows it, that long lived buffers are carved from.
+ *          Keeps the histories and rings walked by the control loop on few
+ *          TLB entries and takes every page fault before flight starts.
+ * -----------------------------------------------------------------------------
+ */
+
+/**
+ * The region is reserved from the hugetlb pool when huge pages have been set
+ * aside (vm.nr_hugepages), otherwise as anonymous memory aligned to a huge
+ * page with MADV_HUGEPAGE, otherwise as normal pages. Since mlockall is in
+ * effect every page is faulted in here, during init.
+ *
+ * Built with ARENA_MALLOC every allocation comes from malloc instead, to
+ * compare the page faults and TLB misses in the benchmarks.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "global_utils.h"
+#include "lock.h"
+#include "arena.h"
+
+/* size of the arena: the Kalman filter histories, the recorders, the
+ * compression buffers and one frame per camera, unit: bytes */
+#define ARENA_SIZE (64L << 20)
+
+/* size of a huge page on the flight computer, unit: bytes */
+#define ARENA_HUGE_PAGE (2L << 20)
+
+/* alignment of every buffer, unit: bytes */
+#define ARENA_ALIGN 64
+
+#ifndef ARENA_MALLOC
+static int reserve(void);
+#endif
+
+static lock_t mutex_arena = LOCK_INITIALIZER("mutex_arena");
+
+static char* base = NULL;
+static size_t used = 0;
+static int backing = ARENA_NONE;
+
+#ifndef ARENA_MALLOC
+static const char* backing_names[] = {"none", "hugetlb", "transparent huge pages", "normal pages"};
+#endif
+
+int init_arena(void* args){
+
+#ifdef ARENA_MALLOC
+    logging(INFO, "Arena", "Built with ARENA_MALLOC, buffers come from malloc");
+    return SUCCESS;
+#else
+    if(reserve()){
+        logging(WARN, "Arena", "Cannot reserve the arena, buffers come from malloc: %m");
+        return SUCCESS;
+    }
+
+    logging(INFO, "Arena", "Reserved %ld MiB backed by %s",
+            ARENA_SIZE >> 20, backing_names[backing]);
+
+    return SUCCESS;
+#endif
+}
+
+void* arena_alloc(size_t size, const char* owner){
+
+    void* buffer = NULL;
+
+    lock_acquire(&mutex_arena);
+
+    size_t start = (used + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+
+    if(base != NULL && start + size <= ARENA_SIZE){
+        buffer = base + start;
+        used = start + size;
+    }
+
+    lock_release(&mutex_arena);
+
+    if(buffer != NULL){
+        #ifdef ARENA_DEBUG
+        logging(DEBUG, "Arena", "%zu bytes to %s, %zu of %ld bytes used",
+                size, owner, start + size, ARENA_SIZE);
+        #endif
+        /* the arena is zeroed by the kernel and never reused */
+        return buffer;
+    }
+
+    #ifndef ARENA_MALLOC
+    if(base != NULL){
+        logging(WARN, "Arena", "Arena full, %zu bytes to %s from malloc", size, owner);
+    }
+    #endif
+
+    buffer = calloc(1, size);
+    if(buffer == NULL){
+        logging(ERROR, "Arena", "Cannot allocate %zu bytes to %s: %m", size, owner);
+    }
+
+    return buffer;
+}
+
+int arena_backing(void){
+    return backing;
+}
+
+size_t arena_used(void){
+    lock_acquire(&mutex_arena);
+    size_t ret = used;
+    lock_release(&mutex_arena);
+    return ret;
+}
+
+#ifndef ARENA_MALLOC
+
+/* reserve:
+ * Map the arena, trying explicit huge pages, then transparent huge pages,
+ * then normal pages.
+ *
+ * return:
+ *      SUCCESS: base and backing are set
+ *      FAILURE: no memory could be mapped, errno is set
+ */
+static int reserve(void){
+
+    void* addr = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+
+    if(addr != MAP_FAILED){
+        base = addr;
+        backing = ARENA_HUGETLB;
+        return SUCCESS;
+    }
+
+    /* Reserve without access first so the advice is given before mlockall
+     * faults the pages in, over allocate to align to a huge page */
+    size_t len = ARENA_SIZE + ARENA_HUGE_PAGE;
+    addr = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(addr == MAP_FAILED){
+        return FAILURE;
+    }
+
+    uintptr_t start = ((uintptr_t)addr + ARENA_HUGE_PAGE - 1) & ~((uintptr_t)ARENA_HUGE_PAGE - 1);
+    size_t head = start - (uintptr_t)addr;
+
+    if(head > 0){
+        munmap(addr, head);
+    }
+    if(len - head > ARENA_SIZE){
+        munmap((char*)start + ARENA_SIZE, len - head - ARENA_SIZE);
+    }
+
+    backing = madvise((void*)start, ARENA_SIZE, MADV_HUGEPAGE) ? ARENA_SMALL : ARENA_THP;
+
+    if(mprotect((void*)start, ARENA_SIZE, PROT_READ | PROT_WRITE)){
+        munmap((void*)start, ARENA_SIZE);
+        backing = ARENA_NONE;
+        return FAILURE;
+    }
+
+#ifdef MADV_POPULATE_WRITE
+    /* fault everything in now if mlockall has not already */
+    madvise((void*)start, ARENA_SIZE, MADV_POPULATE_WRITE);
+#endif
+
+    base = (char*)start;
+
+    return SUCCESS;
+}
+
+#endif
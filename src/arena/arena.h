@@ -0,0 +1,42 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Arena
+ * Author(s):
+ * Purpose: One large region reserved at start up, backed by huge pages when
+ *          the kernel allows it, that long lived buffers are carved from.
+ *          Keeps the histories and rings walked by the control loop on few
+ *          TLB entries and takes every page fault before flight starts.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/* arena_backing() */
+#define ARENA_NONE 0        /* not reserved, everything comes from malloc */
+#define ARENA_HUGETLB 1     /* explicit huge pages from the hugetlb pool */
+#define ARENA_THP 2         /* transparent huge pages */
+#define ARENA_SMALL 3       /* normal pages, huge pages unavailable */
+
+/* reserve the arena, must come before any component that allocates from it */
+int init_arena(void* args);
+
+/* arena_alloc:
+ * Carve a buffer out of the arena. Buffers are aligned to a cache line and
+ * are never freed. Falls back to malloc, with a warning, if the arena is
+ * full or was not reserved.
+ *
+ * input:
+ *      size: size of the buffer, unit: bytes
+ *      owner: name of the allocating component, for the log
+ *
+ * return:
+ *      zeroed buffer, NULL if no memory is available at all
+ */
+void* arena_alloc(size_t size, const char* owner);
+
+/* how the arena is backed, see ARENA_* */
+int arena_backing(void);
+
+/* bytes handed out from the arena so far */
+size_t arena_used(void);
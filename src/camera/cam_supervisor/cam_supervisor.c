@@ -0,0 +1,335 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Camera Supervisor
+ * Parent Component: Camera
+ * Author(s):
+ * Purpose: Detect cameras dropping off the USB bus and reopen them without
+ *          restarting the rest of the software. Serialises access to each
+ *          camera so a reconnection never races an ongoing camera call.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "global_utils.h"
+#include "lock.h"
+#include "camera_utils.h"
+#include "cam_supervisor.h"
+
+/* period of the liveness check and reconnection attempts, unit: s */
+#define CAM_SUP_PERIOD 1
+
+/* log every n:th failed reconnection attempt */
+#define CAM_SUP_LOG_EVERY 60
+
+#define CAM_SUP_MAX 2
+
+typedef struct{
+    ASI_CAMERA_INFO* info;
+    atomic_int id;          /* current camera id, changes on reconnection */
+    char name;
+    volatile char online;
+    volatile char exposing;
+    long exp, gain;
+    int attempts;
+    struct timespec lost;
+    lock_t lock;
+} cam_slot_t;
+
+static void* thread_func(void* arg);
+static cam_slot_t* find_slot(int id);
+static void probe(cam_slot_t* slot);
+static void reconnect(cam_slot_t* slot);
+static char* cam_str(char name);
+
+static lock_t mutex_slots = LOCK_INITIALIZER("mutex_slots");
+
+static cam_slot_t slots[CAM_SUP_MAX];
+static int slot_count = 0;
+
+int init_cam_supervisor(void* args){
+    return create_thread("cam_supervisor", thread_func, 18);
+}
+
+/* cam_sup_register:
+ * Put a camera under supervision. Called by cam_setup, also when the camera
+ * is not connected so it is opened as soon as it appears.
+ *
+ * input:
+ *      cam_info: info object of the camera, updated in place on reconnection
+ *      cam_name: 'n' for nir camera, 'g' for guiding camera
+ *      online: 1 if the camera was opened successfully
+ */
+void cam_sup_register(ASI_CAMERA_INFO* cam_info, char cam_name, char online){
+
+    lock_acquire(&mutex_slots);
+
+    if(slot_count == CAM_SUP_MAX){
+        lock_release(&mutex_slots);
+        logging(ERROR, "Cam Sup", "Too many cameras registered");
+        return;
+    }
+
+    cam_slot_t* slot = &slots[slot_count];
+
+    /* nested locking, save_img calls fetch_img */
+    lock_init(&slot->lock, cam_name == 'n' ? "cam_slot_nir" : "cam_slot_guiding",
+            LOCK_RECURSIVE);
+
+    slot->info = cam_info;
+    slot->name = cam_name;
+    slot->exp = -1;
+    slot->gain = -1;
+    slot->attempts = 0;
+    slot->exposing = 0;
+    clock_gettime(CLOCK_MONOTONIC, &slot->lost);
+
+    /* no camera id is known for a camera that has never been seen */
+    if(!online){
+        cam_info->CameraID = -1;
+    }
+    atomic_store(&slot->id, cam_info->CameraID);
+    slot->online = online;
+
+    slot_count++;
+
+    lock_release(&mutex_slots);
+}
+
+/* cam_sup_acquire:
+ * Take exclusive access to a camera before calling the SDK. Calls may be
+ * nested by the same thread, every successful call must be matched by
+ * cam_sup_release.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *
+ * return:
+ *      SUCCESS: camera is online and locked
+ *      ENODEV: camera disconnected or being reopened, nothing locked
+ */
+int cam_sup_acquire(int id){
+
+    cam_slot_t* slot = find_slot(id);
+
+    /* fail fast instead of waiting for an ongoing reconnection */
+    if(slot == NULL || !slot->online){
+        return ENODEV;
+    }
+
+    lock_acquire(&slot->lock);
+
+    /* reopened under a new id while waiting for the lock */
+    if(!slot->online || atomic_load(&slot->id) != id){
+        lock_release(&slot->lock);
+        return ENODEV;
+    }
+
+    return SUCCESS;
+}
+
+/* release a camera locked by cam_sup_acquire */
+void cam_sup_release(int id){
+
+    cam_slot_t* slot = find_slot(id);
+    if(slot != NULL){
+        lock_release(&slot->lock);
+    }
+}
+
+/* cam_sup_lost:
+ * Mark a camera as disconnected after the SDK reported it gone. The
+ * supervisor reopens it in the background.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ */
+void cam_sup_lost(int id){
+
+    cam_slot_t* slot = find_slot(id);
+    if(slot == NULL || !slot->online){
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &slot->lost);
+    slot->attempts = 0;
+    slot->online = 0;
+
+    logging(ERROR, "Cam Sup", "%s camera lost, reconnecting",
+            cam_str(slot->name));
+}
+
+/* info object of a supervised camera, NULL if not registered */
+ASI_CAMERA_INFO* cam_sup_info(char cam_name){
+
+    for(int ii=0; ii<slot_count; ++ii){
+        if(slots[ii].name == cam_name){
+            return slots[ii].info;
+        }
+    }
+    return NULL;
+}
+
+/* cam_sup_id:
+ * Current id of a supervised camera. The CameraID of the info object is left
+ * as found at start up, the camera threads read it without any lock while a
+ * reconnection may give the camera a new id.
+ *
+ * input:
+ *      cam_info: info object passed to cam_setup
+ *
+ * return:
+ *      camera id, -1 if the camera has never been opened
+ */
+int cam_sup_id(const ASI_CAMERA_INFO* cam_info){
+
+    for(int ii=0; ii<slot_count; ++ii){
+        if(slots[ii].info == cam_info){
+            return atomic_load(&slots[ii].id);
+        }
+    }
+    return cam_info->CameraID;
+}
+
+/* store the latest exposure time and gain, restored after reconnection */
+void cam_sup_settings(int id, long exp, long gain){
+
+    cam_slot_t* slot = find_slot(id);
+    if(slot != NULL){
+        slot->exp = exp;
+        slot->gain = gain;
+    }
+}
+
+/* cam_sup_exposing:
+ * Track the exposure of a camera, set when it is started and cleared when its
+ * image is read out, it fails or it is stopped.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *      exposing: 1 for a started exposure, 0 when it is done with
+ */
+void cam_sup_exposing(int id, char exposing){
+
+    cam_slot_t* slot = find_slot(id);
+    if(slot != NULL){
+        slot->exposing = exposing;
+    }
+}
+
+/* 1 if an exposure of the camera is started and its image not yet read out */
+char cam_sup_busy(int id){
+
+    cam_slot_t* slot = find_slot(id);
+    return slot != NULL && slot->exposing;
+}
+
+static void* thread_func(void* arg){
+
+    struct timespec wake;
+    clock_gettime(CLOCK_MONOTONIC, &wake);
+
+    while(1){
+
+        wake.tv_sec += CAM_SUP_PERIOD;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+
+        for(int ii=0; ii<slot_count; ++ii){
+            if(slots[ii].online){
+                probe(&slots[ii]);
+            }
+            else{
+                reconnect(&slots[ii]);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static cam_slot_t* find_slot(int id){
+
+    for(int ii=0; ii<slot_count; ++ii){
+        if(atomic_load(&slots[ii].id) == id){
+            return &slots[ii];
+        }
+    }
+    return NULL;
+}
+
+/* probe:
+ * Check that an idle camera still answers. A camera in use is left alone,
+ * errors from the ongoing call are reported through cam_sup_lost.
+ */
+static void probe(cam_slot_t* slot){
+
+    if(lock_try(&slot->lock)){
+        return;
+    }
+
+    long val;
+    ASI_BOOL pb_auto;
+    int id = atomic_load(&slot->id);
+    int ret = ASIGetControlValue(id, ASI_TEMPERATURE, &val, &pb_auto);
+
+    if(disconnected(ret)){
+        cam_sup_lost(id);
+    }
+
+    lock_release(&slot->lock);
+}
+
+/* reconnect:
+ * Close the stale handle, enumerate the cameras again and reopen the camera
+ * with its previous settings. Other cameras are not touched.
+ */
+static void reconnect(cam_slot_t* slot){
+
+    lock_acquire(&slot->lock);
+
+    int id = atomic_load(&slot->id);
+    if(id >= 0){
+        ASICloseCamera(id);
+    }
+
+    /* opened into a copy, the camera threads read the info object unlocked */
+    ASI_CAMERA_INFO info;
+    int ret = cam_open(&info, slot->name);
+    if(ret != SUCCESS){
+        if(slot->attempts++ % CAM_SUP_LOG_EVERY == 0){
+            logging(WARN, "Cam Sup", "%s camera not reopened after %d attempts",
+                    cam_str(slot->name), slot->attempts);
+        }
+        lock_release(&slot->lock);
+        return;
+    }
+
+    id = info.CameraID;
+    if(slot->exp >= 0){
+        ASISetControlValue(id, ASI_EXPOSURE, slot->exp, ASI_FALSE);
+    }
+    if(slot->gain >= 0){
+        ASISetControlValue(id, ASI_GAIN, slot->gain, ASI_FALSE);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    /* an exposure ongoing when the camera was lost is gone with it. The new
+     * id is published with the slot locked, a thread that read the old id
+     * gets ENODEV from cam_sup_acquire */
+    slot->exposing = 0;
+    atomic_store(&slot->id, id);
+    slot->online = 1;
+    lock_release(&slot->lock);
+
+    logging(INFO, "Cam Sup", "%s camera reopened %.1lf s after being lost",
+            cam_str(slot->name), (now.tv_sec - slot->lost.tv_sec) +
+            (now.tv_nsec - slot->lost.tv_nsec) / 1000000000.0);
+}
+
+static char* cam_str(char name){
+    return name == 'n' ? "NIR" : "Guiding";
+}
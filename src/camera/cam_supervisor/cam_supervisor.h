@@ -0,0 +1,86 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Camera Supervisor
+ * Parent Component: Camera
+ * Author(s):
+ * Purpose: Detect cameras dropping off the USB bus and reopen them without
+ *          restarting the rest of the software. Serialises access to each
+ *          camera so a reconnection never races an ongoing camera call.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "ASICamera2.h"
+
+/* initialise the camera supervisor component */
+int init_cam_supervisor(void* args);
+
+/* cam_sup_register:
+ * Put a camera under supervision. Called by cam_setup, also when the camera
+ * is not connected so it is opened as soon as it appears.
+ *
+ * input:
+ *      cam_info: info object of the camera, its CameraID is not updated on
+ *          reconnection, use cam_sup_id
+ *      cam_name: 'n' for nir camera, 'g' for guiding camera
+ *      online: 1 if the camera was opened successfully
+ */
+void cam_sup_register(ASI_CAMERA_INFO* cam_info, char cam_name, char online);
+
+/* cam_sup_acquire:
+ * Take exclusive access to a camera before calling the SDK. Calls may be
+ * nested by the same thread, every successful call must be matched by
+ * cam_sup_release.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *
+ * return:
+ *      SUCCESS: camera is online and locked
+ *      ENODEV: camera disconnected or being reopened, nothing locked
+ */
+int cam_sup_acquire(int id);
+
+/* release a camera locked by cam_sup_acquire */
+void cam_sup_release(int id);
+
+/* cam_sup_lost:
+ * Mark a camera as disconnected after the SDK reported it gone. The
+ * supervisor reopens it in the background.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ */
+void cam_sup_lost(int id);
+
+/* info object of a supervised camera, NULL if not registered */
+ASI_CAMERA_INFO* cam_sup_info(char cam_name);
+
+/* cam_sup_id:
+ * Current id of a supervised camera. The CameraID of the info object is left
+ * as found at start up, the camera threads read it without any lock while a
+ * reconnection may give the camera a new id.
+ *
+ * input:
+ *      cam_info: info object passed to cam_setup
+ *
+ * return:
+ *      camera id, -1 if the camera has never been opened
+ */
+int cam_sup_id(const ASI_CAMERA_INFO* cam_info);
+
+/* store the latest exposure time and gain, restored after reconnection */
+void cam_sup_settings(int id, long exp, long gain);
+
+/* cam_sup_exposing:
+ * Track the exposure of a camera, set when it is started and cleared when its
+ * image is read out, it fails or it is stopped.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *      exposing: 1 for a started exposure, 0 when it is done with
+ */
+void cam_sup_exposing(int id, char exposing);
+
+/* 1 if an exposure of the camera is started and its image not yet read out */
+char cam_sup_busy(int id);
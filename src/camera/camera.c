@@ -10,17 +10,26 @@
 
 #include "global_utils.h"
 
+#include "exp_timing.h"
 #include "sanity_camera.h"
 #include "guiding_camera.h"
 #include "nir_camera.h"
+#include "cam_supervisor.h"
+#include "readout_bench.h"
+#include "camera_utils.h"
+#include "lucky_imaging.h"
 
-#define MODULE_COUNT 3
+#define MODULE_COUNT 7
 
 /* This list controls the order of initialisation */
 static const module_init_t init_sequence[MODULE_COUNT] = {
+    {"exp_timing", &init_exp_timing},
     {"sanity_camera", &init_sanity_camera},
     {"guiding_camera", &init_guiding_camera},
-    {"nir_camera", &init_nir_camera}
+    {"nir_camera", &init_nir_camera},
+    {"cam_supervisor", &init_cam_supervisor},
+    {"readout_bench", &init_readout_bench},
+    {"lucky_imaging", &init_lucky_imaging}
 };
 
 int init_camera(void* args){
@@ -145,10 +154,103 @@ int abort_exp_nir(void){
     return abort_exp_nir_local();
 }
 
+/* lucky_start_nir:
+ * Start a lucky imaging burst of short NIR exposures. Call lucky_step_nir
+ * until it stops returning EXP_NOT_READY.
+ *
+ * input:
+ *      frames: number of exposures in the burst
+ *      exp: exposure time of each frame in microseconds
+ *      gain: the sensor gain
+ *      keep: number of sharpest frames stacked into the saved image
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EINVAL: keep out of range or larger than frames
+ *      EREMOTEIO: starting exposure failed
+ *      EIO: setting camera control values failed
+ *      ENODEV: Camera not connected
+ */
+int lucky_start_nir(int frames, int exp, int gain, int keep){
+    return lucky_start_nir_local(frames, exp, gain, keep);
+}
+
+/* lucky_step_nir:
+ * Fetch and score the latest frame of the burst and start the next one. When
+ * the burst is complete the kept frames are stacked, saved and queued.
+ *
+ * return:
+ *      SUCCESS: burst complete and image saved
+ *      EXP_NOT_READY: burst still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and the burst must be retried
+ *      FAILURE: saving the image failed, log written to stderr
+ *      EPERM: calling lucky_step_nir before starting a burst
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int lucky_step_nir(void){
+    return lucky_step_nir_local();
+}
+
+/* lucky_abort_nir:
+ * Abort an ongoing burst and save the stack of the frames taken so far.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_FAILED: no frame with stars was taken, nothing saved
+ *      FAILURE: saving the image failed, log written to stderr
+ */
+int lucky_abort_nir(void){
+    return lucky_abort_nir_local();
+}
+
 double get_guiding_temp(void){
     return get_guiding_temp_l();
 }
 
+/* CLOCK_MONOTONIC at the middle of the latest guiding exposure, zero if the
+ * camera has not exposed */
+void get_guiding_mid_exp(struct timespec* mid){
+    get_guiding_mid_exp_l(mid);
+}
+
+/* frame id of the next NIR image, used in file names and the FRAMEID key */
+int get_nir_frame_id(void){
+    return get_nir_frame_id_l();
+}
+
 double get_nir_temp(void){
     return get_nir_temp_l();
 }
+
+/* set_readout:
+ * Set the USB readout settings of a camera, kept over reconnections.
+ *
+ * input:
+ *      cam_name: 'n' for nir camera, 'g' for guiding camera
+ *      bandwidth: USB bandwidth in percent, -1 for the camera default
+ *      high_speed: 1 for high speed mode, 0 for normal, -1 for default
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EINVAL: incorrect camera name or setting out of range
+ *      EIO: the camera rejected the settings
+ *      ENODEV: camera disconnected, settings applied when it is reopened
+ */
+int set_readout(char cam_name, int bandwidth, int high_speed){
+    cam_readout_t settings = {bandwidth, high_speed};
+    return set_cam_readout(cam_name, &settings);
+}
+
+void sanity_image(void){
+    sanity_image_local();
+}
+
+void sanity_cadence(int period){
+    sanity_cadence_local(period);
+}
+
+/* start a readout benchmark of a camera, see readout_bench_start */
+int bench_readout(char cam_name, int frames){
+    return readout_bench_start(cam_name, frames);
+}
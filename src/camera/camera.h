@@ -8,12 +8,17 @@
 
 #pragma once
 
+#include <time.h>
+
 /* initialise the camera component */
 int init_camera(void* args);
 
 /* take a picture using the sanity camera */
 void sanity_image( void );
 
+/* set the time between sanity camera snapshots, see sanity_cadence_local */
+void sanity_cadence(int period);
+
 /* expose_guiding:
  * Start an exposure of the guiding camera. Call save_img to store store
  * image after exposure
@@ -118,6 +123,76 @@ int save_img_nir(void);
  */
 int abort_exp_nir(void);
 
+/* lucky_start_nir:
+ * Start a lucky imaging burst of short NIR exposures. Call lucky_step_nir
+ * until it stops returning EXP_NOT_READY.
+ *
+ * input:
+ *      frames: number of exposures in the burst
+ *      exp: exposure time of each frame in microseconds
+ *      gain: the sensor gain
+ *      keep: number of sharpest frames stacked into the saved image
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EINVAL: keep out of range or larger than frames
+ *      EREMOTEIO: starting exposure failed
+ *      EIO: setting camera control values failed
+ *      ENODEV: Camera not connected
+ */
+int lucky_start_nir(int frames, int exp, int gain, int keep);
+
+/* lucky_step_nir:
+ * Fetch and score the latest frame of the burst and start the next one. When
+ * the burst is complete the kept frames are stacked, saved and queued.
+ *
+ * return:
+ *      SUCCESS: burst complete and image saved
+ *      EXP_NOT_READY: burst still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and the burst must be retried
+ *      FAILURE: saving the image failed, log written to stderr
+ *      EPERM: calling lucky_step_nir before starting a burst
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int lucky_step_nir(void);
+
+/* lucky_abort_nir:
+ * Abort an ongoing burst and save the stack of the frames taken so far.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_FAILED: no frame with stars was taken, nothing saved
+ *      FAILURE: saving the image failed, log written to stderr
+ */
+int lucky_abort_nir(void);
+
 double get_guiding_temp(void);
 
+/* CLOCK_MONOTONIC at the middle of the latest guiding exposure, zero if the
+ * camera has not exposed */
+void get_guiding_mid_exp(struct timespec* mid);
+
 double get_nir_temp(void);
+
+/* frame id of the next NIR image, used in file names and the FRAMEID key */
+int get_nir_frame_id(void);
+
+/* set_readout:
+ * Set the USB readout settings of a camera, kept over reconnections.
+ *
+ * input:
+ *      cam_name: 'n' for nir camera, 'g' for guiding camera
+ *      bandwidth: USB bandwidth in percent, -1 for the camera default
+ *      high_speed: 1 for high speed mode, 0 for normal, -1 for default
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EINVAL: incorrect camera name or setting out of range
+ *      EIO: the camera rejected the settings
+ *      ENODEV: camera disconnected, settings applied when it is reopened
+ */
+int set_readout(char cam_name, int bandwidth, int high_speed);
+
+/* start a readout benchmark of a camera, see readout_bench_start */
+int bench_readout(char cam_name, int frames);
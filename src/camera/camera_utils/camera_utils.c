@@ -18,18 +18,51 @@
 #include <math.h>
 
 #include "global_utils.h"
+#include "lock.h"
+#include "arena.h"
 #include "camera_utils.h"
-
-static struct timespec start_time[2];
-static char exp_start_datetime[2][20];
-static int timeref[2];
-
-static int write_img(unsigned short* buffer,
-        ASI_CAMERA_INFO* cam_info, char* fn, struct timespec* exp_time);
+#include "exp_timing.h"
+#include "cam_supervisor.h"
+
+/* camera ids are not reused when a camera reconnects */
+static long frame_id[ASICAMERA_ID_MAX];
+
+/* readout settings of the nir and guiding camera, SDK defaults until set */
+static cam_readout_t readout[2] = {{-1, -1}, {-1, -1}};
+
+/* frame buffers of the nir and guiding camera */
+#define FRAME_BUFFERS 2
+
+/* Frame buffer of one camera, taken from the arena on first use and reused
+ * for every frame. Kept by cam_info, which outlives camera reconnects. The
+ * lock is held from fetching the frame until it is written to file. */
+typedef struct {
+    ASI_CAMERA_INFO* cam_info;
+    unsigned short* buffer;
+    size_t size;
+    char saved;     /* buffer holds the last frame written by save_img */
+    lock_t lock;
+} frame_buffer_t;
+
+static lock_t mutex_frames = LOCK_INITIALIZER("cam_frames");
+static frame_buffer_t frames[FRAME_BUFFERS] = {
+    {NULL, NULL, 0, 0, LOCK_INITIALIZER("cam_frame_0")},
+    {NULL, NULL, 0, 0, LOCK_INITIALIZER("cam_frame_1")}
+};
+
+static int write_img(unsigned short* buffer, ASI_CAMERA_INFO* cam_info,
+        char* fn, struct timespec* exp_time, exp_stamp_t* span);
 static void yflip(unsigned short* buffer, int width, int height);
+static void to_12bit(unsigned short* buffer, long pixels);
+static frame_buffer_t* get_frame(ASI_CAMERA_INFO* cam_info);
+static void format_utc(const struct timespec* ts, char* str);
+static int exp_ready(ASI_CAMERA_INFO* cam_info, char* cam_name);
+static int apply_readout(int id, char cam_name);
+static void log_controls(int id, char* cam_name);
 
 /* cam_setup:
- * Set up and initialize a given ZWO ASI camera.
+ * Set up and initialize a given ZWO ASI camera and put it under supervision
+ * of the camera supervisor, which reopens it if it is disconnected.
  *
  * input:
  *      cam_name specifies which camera to initialize:
@@ -38,7 +71,6 @@ static void yflip(unsigned short* buffer, int width, int height);
  *
  * output:
  *      cam_info: info object for relevant camera
- *      cam_name: name of camera for logging
  *
  * return:
  *      SUCCESS: operation is successful
@@ -47,7 +79,38 @@ static void yflip(unsigned short* buffer, int width, int height);
  */
 int cam_setup(ASI_CAMERA_INFO* cam_info, char cam_name){
 
+    if(cam_name != 'n' && cam_name != 'g'){
+        logging(ERROR, "INIT", "Incorrect camera name: %c", cam_name);
+        return FAILURE;
+    }
+
+    int ret = cam_open(cam_info, cam_name);
+
+    cam_sup_register(cam_info, cam_name, ret == SUCCESS);
+
+    return ret;
+}
+
+/* cam_open:
+ * Find a camera among the connected cameras, open and initialise it. Used by
+ * cam_setup and by the camera supervisor when reconnecting.
+ *
+ * input:
+ *      cam_name: 'n' for nir camera, 'g' for guiding camera
+ *
+ * output:
+ *      cam_info: info object for relevant camera, only written on success
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: failure to set up camera, log written to stderr
+ *      ENODEV: incorrect camera name or camera disconnected
+ */
+int cam_open(ASI_CAMERA_INFO* cam_info, char cam_name){
+
     int ret, height, width;
+    char* name = cam_name == 'n' ? "NIR" : "guiding";
+    ASI_CAMERA_INFO info;
 
     switch(cam_name){
         case 'n':
@@ -59,26 +122,25 @@ int cam_setup(ASI_CAMERA_INFO* cam_info, char cam_name){
             width = GUIDE_WIDTH;
             break;
         default:
-            logging(ERROR, "INIT", "Incorrect camera name: %c", cam_name);
-            return FAILURE;
+            return ENODEV;
     }
 
-    /* seems like this one has to be called */
-    ASIGetNumOfConnectedCameras();
+    /* enumerates the cameras, has to be called before anything else */
+    int count = ASIGetNumOfConnectedCameras();
 
     /* identify the correct camera */
-    for(int ii=0; ii<2; ++ii){
-        ret = ASIGetCameraProperty(cam_info, ii);
-
-        if(ret == ASI_ERROR_INVALID_INDEX){
-            return ENODEV;
-        }
+    int ii;
+    for(ii=0; ii<count; ++ii){
+        ret = ASIGetCameraProperty(&info, ii);
 
-        if(cam_info->MaxHeight == height){
+        if(ret == ASI_SUCCESS && info.MaxHeight == height){
             break;
         }
     }
-    int id = cam_info->CameraID;
+    if(ii == count){
+        return ENODEV;
+    }
+    int id = info.CameraID;
 
     /* opening and initializating */
     ret = ASIOpenCamera(id);
@@ -93,6 +155,7 @@ int cam_setup(ASI_CAMERA_INFO* cam_info, char cam_name){
         logging(ERROR, "Camera",
                 "Failed to initialise camera: %c. Return value: %d",
                 cam_name, ret);
+        ASICloseCamera(id);
         return FAILURE;
     }
 
@@ -102,9 +165,23 @@ int cam_setup(ASI_CAMERA_INFO* cam_info, char cam_name){
         logging(ERROR, "Camera",
             "Failed to set image format for camera: %c. Return value: %d",
             cam_name, ret);
+        ASICloseCamera(id);
         return FAILURE;
     }
 
+    #ifdef CAMERA_DEBUG
+        log_controls(id, name);
+    #endif
+
+    /* readout settings are kept over reconnections */
+    apply_readout(id, cam_name);
+
+    /* trigger mode is optional, continue with software start if it fails */
+    exp_timing_setup(&info, name);
+
+    frame_id[id] = -1;
+    *cam_info = info;
+
     return ASI_SUCCESS;
 }
 
@@ -126,39 +203,45 @@ int cam_setup(ASI_CAMERA_INFO* cam_info, char cam_name){
  */
 int expose(int id, int exp, int gain, char* cam_name){
 
-    int ret;
+    int ret = cam_sup_acquire(id);
+    if(ret){
+        return ret;
+    }
+
+    cam_sup_settings(id, exp, gain);
 
     /* set exposure time in micro sec */
     ret = ASISetControlValue(id, ASI_EXPOSURE, exp, ASI_FALSE);
-    if(ret == ASI_ERROR_INVALID_ID){
+    if(disconnected(ret)){
         logging(ERROR, "Camera",
                 "Camera disconnected when starting exposure: %s", cam_name);
-        return ENODEV;
+        cam_sup_lost(id);
+        ret = ENODEV;
     }
-    if(ret != ASI_SUCCESS){
+    else if(ret != ASI_SUCCESS){
         logging(ERROR, "Camera",
                 "Failed to set exposure time for %s camera.", cam_name);
-        return EIO;
+        ret = EIO;
     }
 
     /* set sensor gain */
-    ret = ASISetControlValue(id, ASI_GAIN, gain, ASI_FALSE);
-    if(ret != ASI_SUCCESS){
+    else if(ASISetControlValue(id, ASI_GAIN, gain, ASI_FALSE) != ASI_SUCCESS){
         logging(ERROR, "Camera",
                 "Failed to set sensor gain for %s camera.", cam_name);
-        return EIO;
+        ret = EIO;
     }
 
-    ffgstm(exp_start_datetime[id], &timeref[id], &ret);
-    clock_gettime(CLOCK_REALTIME, &start_time[id]);
-    ASIStartExposure(id, ASI_FALSE);
-    if(ret != ASI_SUCCESS){
+    else if(exp_timing_start(id, exp) != ASI_SUCCESS){
         logging(ERROR, "Camera",
                 "Failed to start exposure of %s camera.", cam_name);
-        return EREMOTEIO;
+        ret = EREMOTEIO;
+    }
+    else{
+        cam_sup_exposing(id, 1);
     }
 
-    return SUCCESS;
+    cam_sup_release(id);
+    return ret;
 }
 
 /* save_img:
@@ -188,43 +271,189 @@ int expose(int id, int exp, int gain, char* cam_name){
 int save_img(ASI_CAMERA_INFO* cam_info, char* fn,
         char* cam_name, struct timespec* exp_time){
 
-    int id = cam_info->CameraID, ret;
+    int id = cam_sup_id(cam_info);
 
-    /* check current exposure status */
-    ASI_EXPOSURE_STATUS exp_stat;
-    ASIGetExpStatus(id, &exp_stat);
-    switch(exp_stat){
-        case ASI_EXP_WORKING:
-            return EXP_NOT_READY;
-        case ASI_EXP_FAILED:
-            logging(ERROR, "Camera",
-                    "Exposure of %s camera failed", cam_name);
-            return EXP_FAILED;
-        case ASI_EXP_IDLE:
-            logging(ERROR, "Camera",
-                    "save_img called before starting exposure");
-            return EPERM;
-        default:
-            break;
+    int ret = cam_sup_acquire(id);
+    if(ret){
+        return ret;
+    }
+
+    ret = exp_ready(cam_info, cam_name);
+    if(ret){
+        cam_sup_release(id);
+        return ret;
     }
 
     /* buffer for bitmap */
-    int width = cam_info->MaxWidth;
-    int height = cam_info->MaxHeight;
-    int buffer_size = width*height*2;
-    unsigned char* buffer = (unsigned char*) malloc(buffer_size);
+    frame_buffer_t* frame = get_frame(cam_info);
 
-    if(buffer == NULL){
+    if(frame == NULL){
         logging(ERROR, "Camera",
                 "Cannot allocate memory for image buffer");
+        cam_sup_release(id);
         return ENOMEM;
     }
 
+    ret = fetch_img(cam_info, frame->buffer, cam_name);
+    cam_sup_release(id);
+
+    if(ret == SUCCESS){
+        ret = write_img(frame->buffer, cam_info, fn, exp_time, NULL);
+    }
+    frame->saved = ret == SUCCESS;
+
+    lock_release(&frame->lock);
+    return ret;
+}
+
+/* copy_frame:
+ * Copy the last frame saved by save_img, e.g. to process it while the camera
+ * exposes the next one.
+ *
+ * input:
+ *      cam_info: info for relevant camera
+ *
+ * output:
+ *      buffer: bitmap of size [MaxHeight*MaxWidth]
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENODATA: no frame saved, or the last save_img failed
+ */
+int copy_frame(ASI_CAMERA_INFO* cam_info, unsigned short* buffer){
+
+    size_t size = (size_t)cam_info->MaxWidth * cam_info->MaxHeight * 2;
+    frame_buffer_t* frame = NULL;
+
+    lock_acquire(&mutex_frames);
+    for(int ii=0; ii<FRAME_BUFFERS; ++ii){
+        if(frames[ii].cam_info == cam_info){
+            frame = &frames[ii];
+            break;
+        }
+    }
+    lock_release(&mutex_frames);
+
+    if(frame == NULL){
+        return ENODATA;
+    }
+
+    int ret = ENODATA;
+
+    lock_acquire(&frame->lock);
+    if(frame->saved && frame->size >= size){
+        memcpy(buffer, frame->buffer, size);
+        ret = SUCCESS;
+    }
+    lock_release(&frame->lock);
+
+    return ret;
+}
+
+/* get_frame:
+ * Find the frame buffer of a camera, allocating it on first use.
+ *
+ * input:
+ *      cam_info: info for relevant camera
+ *
+ * return:
+ *      frame buffer with its lock held, NULL if no memory is available
+ */
+static frame_buffer_t* get_frame(ASI_CAMERA_INFO* cam_info){
+
+    size_t size = (size_t)cam_info->MaxWidth * cam_info->MaxHeight * 2;
+    frame_buffer_t* frame = NULL;
+
+    lock_acquire(&mutex_frames);
+
+    for(int ii=0; ii<FRAME_BUFFERS; ++ii){
+        if(frames[ii].cam_info == cam_info || frames[ii].cam_info == NULL){
+            frame = &frames[ii];
+            frame->cam_info = cam_info;
+            break;
+        }
+    }
+
+    lock_release(&mutex_frames);
+
+    if(frame == NULL){
+        return NULL;
+    }
+
+    lock_acquire(&frame->lock);
+
+    /* a different sensor after a reconnect, the old buffer stays in the arena */
+    if(frame->size < size){
+        frame->buffer = arena_alloc(size, "Camera");
+        frame->size = frame->buffer == NULL ? 0 : size;
+    }
+
+    if(frame->buffer == NULL){
+        lock_release(&frame->lock);
+        return NULL;
+    }
+
+    return frame;
+}
+
+/* fetch_img:
+ * Fetch the image of a finished exposure into a buffer supplied by the caller,
+ * scaled to 12 bits and flipped to the orientation written by save_img.
+ *
+ * input:
+ *      cam_info: info for relevant camera
+ *      cam_name: name of camera for logging
+ *
+ * output:
+ *      buffer: bitmap of size [MaxHeight*MaxWidth]
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_NOT_READY: exposure still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and must be retried
+ *      EPERM: calling fetch_img before starting exposure
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int fetch_img(ASI_CAMERA_INFO* cam_info, unsigned short* buffer, char* cam_name){
+
+    int id = cam_sup_id(cam_info);
+    int width = cam_info->MaxWidth;
+    int height = cam_info->MaxHeight;
+    long buffer_size = (long)width * height * 2;
+
+    int ret = cam_sup_acquire(id);
+    if(ret){
+        return ret;
+    }
+
+    ret = exp_ready(cam_info, cam_name);
+    if(ret){
+        cam_sup_release(id);
+        return ret;
+    }
+
     /* fetch data */
-    ret = ASIGetDataAfterExp(id, buffer, buffer_size);
-    if(ret == ASI_ERROR_INVALID_ID){
+    if(exp_timing_hw(id)){
+        ret = ASIGetVideoData(id, (unsigned char*)buffer, buffer_size, 500);
+        if(ret == ASI_ERROR_TIMEOUT){
+            cam_sup_release(id);
+            return EXP_NOT_READY;
+        }
+    }
+    else{
+        ret = ASIGetDataAfterExp(id, (unsigned char*)buffer, buffer_size);
+    }
+
+    if(disconnected(ret)){
         logging(ERROR, "Camera",
                 "Camera disconnected when fetching data: %s", cam_name);
+        cam_sup_lost(id);
+    }
+    cam_sup_exposing(id, 0);
+    cam_sup_release(id);
+
+    if(disconnected(ret)){
         return ENODEV;
     }
     else if(ret != ASI_SUCCESS){
@@ -233,18 +462,111 @@ int save_img(ASI_CAMERA_INFO* cam_info, char* fn,
         return EIO;
     }
 
-    unsigned short* buff = (unsigned short*)buffer;
+    to_12bit(buffer, buffer_size/2);
+    yflip(buffer, width, height);
+
+    return SUCCESS;
+}
+
+/* save_buffer:
+ * Write an image already held in memory, e.g. a stacked image, to a .fit file
+ * with the same header as save_img.
+ *
+ * input:
+ *      exp_time: total exposure time of the image
+ *      span: time stamps from the start of the first exposure to the end of
+ *            the last, NULL for the latest exposure of the camera
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: write failed, fits error written to stderr
+ */
+int save_buffer(ASI_CAMERA_INFO* cam_info, unsigned short* buffer, char* fn,
+        struct timespec* exp_time, exp_stamp_t* span){
+    return write_img(buffer, cam_info, fn, exp_time, span);
+}
+
+/* update_img_key:
+ * Add or update an integer key in the primary header of a saved image and
+ * update the checksum.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: update failed, fits error written to stderr
+ */
+int update_img_key(char* fn, char* key, long value, char* comment){
+    fitsfile* fptr;
+    int ret = 0;
+
+    fits_open_file(&fptr, fn, READWRITE, &ret);
+    fits_update_key(fptr, TLONG, key, &value, comment, &ret);
+    fits_write_chksum(fptr, &ret);
+    fits_close_file(fptr, &ret);
+    if(ret != 0){
+        fits_report_error(stderr, ret);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/* exp_ready:
+ * Check if the latest exposure of a camera is finished.
+ *
+ * return:
+ *      SUCCESS: exposure finished, image can be fetched
+ *      EXP_NOT_READY: exposure still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and must be retried
+ *      EPERM: no exposure started
+ */
+static int exp_ready(ASI_CAMERA_INFO* cam_info, char* cam_name){
+
+    int id = cam_sup_id(cam_info);
+
+    if(exp_timing_hw(id)){
+        /* triggered exposures have no status, wait for the predicted end */
+        exp_stamp_t stamp;
+        struct timespec now;
+
+        exp_timing_stamp(id, &stamp);
+        clock_gettime(CLOCK_MONOTONIC, &now);
 
-    for(int ii=0; ii<buffer_size/2; ++ii){
-        buff[ii] = buff[ii]>>4;
+        if(now.tv_sec < stamp.mono_end.tv_sec ||
+                (now.tv_sec == stamp.mono_end.tv_sec &&
+                 now.tv_nsec < stamp.mono_end.tv_nsec)){
+            return EXP_NOT_READY;
+        }
+        return SUCCESS;
     }
 
-    yflip(buff, width, height);
+    /* check current exposure status */
+    ASI_EXPOSURE_STATUS exp_stat;
+    int ret = ASIGetExpStatus(id, &exp_stat);
+    if(disconnected(ret)){
+        logging(ERROR, "Camera",
+                "Camera disconnected when checking exposure: %s", cam_name);
+        cam_sup_lost(id);
+        return ENODEV;
+    }
 
-    ret = write_img(buff, cam_info, fn, exp_time);
+    switch(exp_stat){
+        case ASI_EXP_WORKING:
+            return EXP_NOT_READY;
+        case ASI_EXP_FAILED:
+            logging(ERROR, "Camera",
+                    "Exposure of %s camera failed", cam_name);
+            cam_sup_exposing(id, 0);
+            return EXP_FAILED;
+        case ASI_EXP_IDLE:
+            logging(ERROR, "Camera",
+                    "save_img called before starting exposure");
+            cam_sup_exposing(id, 0);
+            return EPERM;
+        default:
+            break;
+    }
 
-    free(buffer);
-    return ret;
+    return SUCCESS;
 }
 
 /* write_img:
@@ -256,15 +578,17 @@ int save_img(ASI_CAMERA_INFO* cam_info, char* fn,
  *      fn: filename to save image as
  *      exp_time: calculated exposure time if the exposure was aborted
  *                NULL if not
+ *      span: time stamps of the image, NULL for the latest exposure
  *
  * return:
  *      SUCCESS: operation is successful
  *      FAILURE: write failed, fits error written to stderr
  */
-static int write_img(unsigned short* buffer,
-        ASI_CAMERA_INFO* cam_info, char* fn, struct timespec* exp_time){
+static int write_img(unsigned short* buffer, ASI_CAMERA_INFO* cam_info,
+        char* fn, struct timespec* exp_time, exp_stamp_t* span){
     fitsfile* fptr;
     int ret = 0;
+    int id = cam_sup_id(cam_info);
 
     long fpixel=1, naxis=2, nelements;
     long naxes[2] = {cam_info->MaxWidth, cam_info->MaxHeight};
@@ -311,7 +635,7 @@ static int write_img(unsigned short* buffer,
         #endif
     }
     else{
-        ASIGetControlValue(cam_info->CameraID, ASI_EXPOSURE, &exposure, &pb_auto);
+        ASIGetControlValue(id, ASI_EXPOSURE, &exposure, &pb_auto);
     }
     fits_update_key(fptr, TLONG, "EXPOINUS", &exposure,
             "Exposure time in us", &ret);
@@ -320,7 +644,7 @@ static int write_img(unsigned short* buffer,
         return FAILURE;
     }
 
-    ASIGetControlValue(cam_info->CameraID, ASI_GAIN, &gain, &pb_auto);
+    ASIGetControlValue(id, ASI_GAIN, &gain, &pb_auto);
     fits_update_key(fptr, TLONG, "GAIN", &gain,
             "The ratio of output / input", &ret);
     if(ret != 0){
@@ -340,13 +664,65 @@ static int write_img(unsigned short* buffer,
     #ifdef CAMERA_DEBUG
         logging(DEBUG, "Camera", "writing data");
     #endif
-    fits_update_key(fptr, TSTRING, "DATE", exp_start_datetime[cam_info->CameraID],
+    exp_stamp_t stamp;
+    if(span != NULL){
+        stamp = *span;
+    }
+    else{
+        exp_timing_stamp(id, &stamp);
+    }
+
+    char date_obs[30], date_end[30];
+    format_utc(&stamp.real_start, date_obs);
+    format_utc(&stamp.real_end, date_end);
+
+    /* DATE without fraction of seconds, as written before DATE-OBS was added */
+    char date[20];
+    strncpy(date, date_obs, 19);
+    date[19] = '\0';
+
+    double mjd_obs = 40587 + (stamp.real_start.tv_sec +
+            stamp.real_start.tv_nsec / 1e9) / 86400;
+    double mjd_end = 40587 + (stamp.real_end.tv_sec +
+            stamp.real_end.tv_nsec / 1e9) / 86400;
+    double mono_start = stamp.mono_start.tv_sec + stamp.mono_start.tv_nsec / 1e9;
+    double mono_end = stamp.mono_end.tv_sec + stamp.mono_end.tv_nsec / 1e9;
+    char* trig_mode = stamp.hw_trigger ? "HARDWARE" : "SOFTWARE";
+
+    fits_update_key(fptr, TSTRING, "DATE", date,
             "Exposure start time (YYYY-MM-DDThh:mm:ss UTC)", &ret);
+    fits_update_key(fptr, TSTRING, "DATE-OBS", date_obs,
+            "Exposure start time (UTC)", &ret);
+    fits_update_key(fptr, TSTRING, "DATE-END", date_end,
+            "Exposure end time (UTC)", &ret);
+    fits_update_key(fptr, TDOUBLE, "MJD-OBS", &mjd_obs,
+            "Exposure start time (MJD UTC)", &ret);
+    fits_update_key(fptr, TDOUBLE, "MJD-END", &mjd_end,
+            "Exposure end time (MJD UTC)", &ret);
+    fits_update_key(fptr, TDOUBLE, "TMONOSTA", &mono_start,
+            "Exposure start, CLOCK_MONOTONIC in s", &ret);
+    fits_update_key(fptr, TDOUBLE, "TMONOEND", &mono_end,
+            "Exposure end, CLOCK_MONOTONIC in s", &ret);
+    fits_update_key(fptr, TDOUBLE, "TSTAUNC", &stamp.start_unc,
+            "Uncertainty of exposure start in s", &ret);
+    fits_update_key(fptr, TDOUBLE, "TENDUNC", &stamp.end_unc,
+            "Uncertainty of exposure end in s", &ret);
+    fits_update_key(fptr, TSTRING, "TRIGMODE", trig_mode,
+            "How the exposure was started", &ret);
     if(ret != 0){
         fits_report_error(stderr, ret);
         return FAILURE;
     }
 
+    if(frame_id[id] >= 0){
+        fits_update_key(fptr, TLONG, "FRAMEID", &frame_id[id],
+                "Frame id, matches the attitude sidecar", &ret);
+        if(ret != 0){
+            fits_report_error(stderr, ret);
+            return FAILURE;
+        }
+    }
+
     #ifdef CAMERA_DEBUG
         logging(DEBUG, "Camera", "writing checksum");
     #endif
@@ -368,6 +744,13 @@ static int write_img(unsigned short* buffer,
     return SUCCESS;
 }
 
+/* the cameras deliver 12 bit data in the upper bits of each pixel */
+static void to_12bit(unsigned short* buffer, long pixels){
+    for(long ii=0; ii<pixels; ++ii){
+        buffer[ii] = buffer[ii]>>4;
+    }
+}
+
 /* yflip:
  * vertically flips a bitmap
  *
@@ -389,6 +772,42 @@ static void yflip(unsigned short* buffer, int width, int height){
     }
 }
 
+/* stop_exp:
+ * Stop an ongoing exposure without saving the image.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *      cam_name: name of camera for logging
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EIO: stopping the exposure failed
+ *      ENODEV: camera disconnected
+ */
+int stop_exp(int id, char* cam_name){
+
+    int ret = cam_sup_acquire(id);
+    if(ret){
+        return ret;
+    }
+
+    ret = exp_timing_stop(id);
+    if(disconnected(ret)){
+        logging(ERROR, "Camera",
+            "Camera disconnected when aborting exposure: %s", cam_name);
+        cam_sup_lost(id);
+        ret = ENODEV;
+    }
+    else if(ret != ASI_SUCCESS){
+        logging(ERROR, "Camera", "Failed to abort exposure of %s camera", cam_name);
+        ret = EIO;
+    }
+
+    cam_sup_exposing(id, 0);
+    cam_sup_release(id);
+    return ret;
+}
+
 /* abort_exp:
  * Abort an ongoing exposure and save the image.
  *
@@ -408,50 +827,133 @@ static void yflip(unsigned short* buffer, int width, int height){
  */
 int abort_exp(ASI_CAMERA_INFO* cam_info, char* fn, char* cam_name){
 
-    struct timespec stop_time, exp_time;
+    struct timespec exp_time;
+    exp_stamp_t stamp;
     logging(WARN, "Camera", "Aborting exposure of %s camera", cam_name);
 
-    clock_gettime(CLOCK_REALTIME, &stop_time);
-    int ret = ASIStopExposure(cam_info->CameraID);
-    if(ret == ASI_ERROR_INVALID_ID){
-        logging(ERROR, "Camera",
-            "Camera disconnected when aborting exposure: %s", cam_name);
+    /* held until the aborted image is read, nothing may expose in between */
+    int id = cam_sup_id(cam_info);
+    int ret = cam_sup_acquire(id);
+    if(ret){
+        return ret;
     }
-    else if(ret != SUCCESS){
-        logging(ERROR, "Camera", "Failed to abort exposure of %s camera", cam_name);
+
+    ret = stop_exp(id, cam_name);
+    if(ret == ENODEV){
+        cam_sup_release(id);
+        return ret;
+    }
+
+    /* a triggered exposure is dropped when stopped, nothing to save */
+    if(exp_timing_hw(id)){
+        cam_sup_release(id);
+        return EXP_FAILED;
     }
 
-    if(stop_time.tv_nsec < start_time[cam_info->CameraID].tv_nsec){
-        exp_time.tv_sec = stop_time.tv_sec - start_time[cam_info->CameraID].tv_sec - 1;
-        exp_time.tv_nsec = stop_time.tv_nsec + 1000000000 - start_time[cam_info->CameraID].tv_nsec;
+    exp_timing_stamp(id, &stamp);
+
+    if(stamp.mono_end.tv_nsec < stamp.mono_start.tv_nsec){
+        exp_time.tv_sec = stamp.mono_end.tv_sec - stamp.mono_start.tv_sec - 1;
+        exp_time.tv_nsec = stamp.mono_end.tv_nsec + 1000000000 - stamp.mono_start.tv_nsec;
     }
     else{
-        exp_time.tv_sec = stop_time.tv_sec - start_time[cam_info->CameraID].tv_sec;
-        exp_time.tv_nsec = stop_time.tv_nsec - start_time[cam_info->CameraID].tv_nsec;
+        exp_time.tv_sec = stamp.mono_end.tv_sec - stamp.mono_start.tv_sec;
+        exp_time.tv_nsec = stamp.mono_end.tv_nsec - stamp.mono_start.tv_nsec;
     }
 
-    return save_img(cam_info, fn, cam_name, &exp_time);
+    ret = save_img(cam_info, fn, cam_name, &exp_time);
+    cam_sup_release(id);
+    return ret;
 }
 
-#if 0
-    // printing available controls, not necessary for functionality
-    int cont_num;
-    ASIGetNumOfControls(id, &cont_num);
-    ASI_CONTROL_CAPS cont[1];
-    for(int i=0; i<cont_num; ++i){
-        ASIGetControlCaps(id, i, cont);
-        printf("%s\n", cont->Name);
-        printf("\t%s\n\n", cont->Description);
-        if(i == 9){
-            //printf("%ld\n%ld\n%ld\n", cont->MaxValue, cont->MinValue, cont->DefaultValue);
-        }
+/* format_utc:
+ * Format a CLOCK_REALTIME time stamp as YYYY-MM-DDThh:mm:ss.ssssss (UTC)
+ *
+ * output:
+ *      str: formatted time, at least 27 characters long
+ */
+static void format_utc(const struct timespec* ts, char* str){
+    struct tm date_time;
+
+    gmtime_r(&ts->tv_sec, &date_time);
+    sprintf(str, "%04d-%02d-%02dT%02d:%02d:%02d.%06ld",
+            date_time.tm_year + 1900, date_time.tm_mon + 1, date_time.tm_mday,
+            date_time.tm_hour, date_time.tm_min, date_time.tm_sec,
+            ts->tv_nsec / 1000);
+}
+
+/* set_frame_id:
+ * Set the frame id written to the FRAMEID key of the next image from a camera.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *      frame: frame id, negative to leave out the key
+ */
+void set_frame_id(int id, long frame){
+    if(id >= 0 && id < ASICAMERA_ID_MAX){
+        frame_id[id] = frame;
+    }
+}
+
+/* set_cam_readout:
+ * Set the USB readout settings of a camera. The settings are applied at once
+ * if the camera is connected and again whenever it is reopened.
+ *
+ * input:
+ *      cam_name: 'n' for nir camera, 'g' for guiding camera
+ *      settings: new readout settings, -1 leaves a control at its default
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EINVAL: incorrect camera name or setting out of range
+ *      EIO: the camera rejected the settings
+ *      ENODEV: camera disconnected, settings applied when it is reopened
+ */
+int set_cam_readout(char cam_name, const cam_readout_t* settings){
+
+    if(     (cam_name != 'n' && cam_name != 'g') ||
+            settings->bandwidth > 100 || settings->high_speed > 1){
+        return EINVAL;
+    }
+
+    readout[cam_name == 'g'] = *settings;
+
+    ASI_CAMERA_INFO* info = cam_sup_info(cam_name);
+    if(info == NULL){
+        return ENODEV;
+    }
+
+    int id = cam_sup_id(info);
+    int ret = cam_sup_acquire(id);
+    if(ret){
+        return ret;
     }
-#endif
+
+    ret = apply_readout(id, cam_name);
+
+    cam_sup_release(id);
+    return ret;
+}
+
+/* current readout settings of a camera */
+void get_cam_readout(char cam_name, cam_readout_t* settings){
+    *settings = readout[cam_name == 'g'];
+}
+
 
 double get_cam_temp(int id, char* cam_name){
     long val;
     ASI_BOOL pbAuto;
+
+    if(cam_sup_acquire(id)){
+        return NAN;
+    }
     ASI_ERROR_CODE stat = ASIGetControlValue(id, ASI_TEMPERATURE, &val, &pbAuto);
+    if(disconnected(stat)){
+        cam_sup_lost(id);
+    }
+    cam_sup_release(id);
+
     if(stat != ASI_SUCCESS){
         logging(WARN, "Camera", "Failed to fetch temperature of %s camera sensor",
                 cam_name);
@@ -460,3 +962,52 @@ double get_cam_temp(int id, char* cam_name){
 
     return (double)val/10;
 }
+
+/* SDK return values meaning the camera is no longer reachable */
+char disconnected(int ret){
+    return  ret == ASI_ERROR_INVALID_ID ||
+            ret == ASI_ERROR_CAMERA_REMOVED ||
+            ret == ASI_ERROR_CAMERA_CLOSED;
+}
+
+/* write the stored readout settings of a camera to the camera */
+static int apply_readout(int id, char cam_name){
+
+    cam_readout_t* ro = &readout[cam_name == 'g'];
+    int ret = ASI_SUCCESS;
+
+    if(ro->bandwidth >= 0){
+        ret = ASISetControlValue(id, ASI_BANDWIDTHOVERLOAD, ro->bandwidth,
+                ASI_FALSE);
+    }
+    if(ret == ASI_SUCCESS && ro->high_speed >= 0){
+        ret = ASISetControlValue(id, ASI_HIGH_SPEED_MODE, ro->high_speed,
+                ASI_FALSE);
+    }
+
+    if(ret != ASI_SUCCESS){
+        logging(ERROR, "Camera",
+                "Failed to set readout of %c camera. Return value: %d",
+                cam_name, ret);
+        return EIO;
+    }
+
+    return SUCCESS;
+}
+
+/* list the controls of a camera with their range, for tuning */
+static void log_controls(int id, char* cam_name){
+
+    int count;
+    ASI_CONTROL_CAPS caps;
+
+    ASIGetNumOfControls(id, &count);
+    for(int ii=0; ii<count; ++ii){
+        if(ASIGetControlCaps(id, ii, &caps) != ASI_SUCCESS){
+            continue;
+        }
+        logging(DEBUG, "Camera", "%s camera control %s: %ld..%ld, default %ld",
+                cam_name, caps.Name, caps.MinValue, caps.MaxValue,
+                caps.DefaultValue);
+    }
+}
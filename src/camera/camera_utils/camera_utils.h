@@ -10,6 +10,12 @@
 #pragma once
 
 #include "ASICamera2.h"
+#include "exp_timing.h"
+
+typedef struct{
+    int bandwidth;      /* ASI_BANDWIDTHOVERLOAD in percent, -1 for default */
+    int high_speed;     /* ASI_HIGH_SPEED_MODE 0 or 1, -1 for default */
+} cam_readout_t;
 
 /* camera resolutions */
 #define NIR_WIDTH 5496
@@ -18,7 +24,8 @@
 #define GUIDE_HEIGHT 1096
 
 /* cam_setup:
- * Set up and initialize a given ZWO ASI camera.
+ * Set up and initialize a given ZWO ASI camera and put it under supervision
+ * of the camera supervisor, which reopens it if it is disconnected.
  *
  * input:
  *      cam_name specifies which camera to initialize:
@@ -35,6 +42,23 @@
  */
 int cam_setup(ASI_CAMERA_INFO* cam_info, char cam_name);
 
+/* cam_open:
+ * Find a camera among the connected cameras, open and initialise it. Used by
+ * cam_setup and by the camera supervisor when reconnecting.
+ *
+ * input:
+ *      cam_name: 'n' for nir camera, 'g' for guiding camera
+ *
+ * output:
+ *      cam_info: info object for relevant camera, only written on success
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: failure to set up camera, log written to stderr
+ *      ENODEV: incorrect camera name or camera disconnected
+ */
+int cam_open(ASI_CAMERA_INFO* cam_info, char cam_name);
+
 /* expose:
  * Start an exposure of a ZWO ASI camera. Call save_img to store store
  * image after exposure
@@ -79,6 +103,83 @@ int expose(int id, int exp, int gain, char* cam_name);
  */
 int save_img(ASI_CAMERA_INFO* cam_info, char* fn, char* cam_name, struct timespec* exp_time);
 
+/* fetch_img:
+ * Fetch the image of a finished exposure into a buffer supplied by the caller,
+ * scaled to 12 bits and flipped to the orientation written by save_img.
+ *
+ * input:
+ *      cam_info: info for relevant camera
+ *      cam_name: name of camera for logging
+ *
+ * output:
+ *      buffer: bitmap of size [MaxHeight*MaxWidth]
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_NOT_READY: exposure still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and must be retried
+ *      EPERM: calling fetch_img before starting exposure
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int fetch_img(ASI_CAMERA_INFO* cam_info, unsigned short* buffer, char* cam_name);
+
+/* copy_frame:
+ * Copy the last frame saved by save_img, e.g. to process it while the camera
+ * exposes the next one.
+ *
+ * input:
+ *      cam_info: info for relevant camera
+ *
+ * output:
+ *      buffer: bitmap of size [MaxHeight*MaxWidth]
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENODATA: no frame saved, or the last save_img failed
+ */
+int copy_frame(ASI_CAMERA_INFO* cam_info, unsigned short* buffer);
+
+/* save_buffer:
+ * Write an image already held in memory, e.g. a stacked image, to a .fit file
+ * with the same header as save_img.
+ *
+ * input:
+ *      exp_time: total exposure time of the image
+ *      span: time stamps from the start of the first exposure to the end of
+ *            the last, NULL for the latest exposure of the camera
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: write failed, fits error written to stderr
+ */
+int save_buffer(ASI_CAMERA_INFO* cam_info, unsigned short* buffer, char* fn,
+        struct timespec* exp_time, exp_stamp_t* span);
+
+/* update_img_key:
+ * Add or update an integer key in the primary header of a saved image and
+ * update the checksum.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      FAILURE: update failed, fits error written to stderr
+ */
+int update_img_key(char* fn, char* key, long value, char* comment);
+
+/* stop_exp:
+ * Stop an ongoing exposure without saving the image.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *      cam_name: name of camera for logging
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EIO: stopping the exposure failed
+ *      ENODEV: camera disconnected
+ */
+int stop_exp(int id, char* cam_name);
+
 /* abort_exp:
  * Abort an ongoing exposure and save the image.
  *
@@ -99,3 +200,34 @@ int save_img(ASI_CAMERA_INFO* cam_info, char* fn, char* cam_name, struct timespe
 int abort_exp(ASI_CAMERA_INFO* cam_info, char* fn, char* cam_name);
 
 double get_cam_temp(int id, char* cam_name);
+
+/* SDK return values meaning the camera is no longer reachable */
+char disconnected(int ret);
+
+/* set_frame_id:
+ * Set the frame id written to the FRAMEID key of the next image from a camera.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *      frame: frame id, negative to leave out the key
+ */
+void set_frame_id(int id, long frame);
+
+/* set_cam_readout:
+ * Set the USB readout settings of a camera. The settings are applied at once
+ * if the camera is connected and again whenever it is reopened.
+ *
+ * input:
+ *      cam_name: 'n' for nir camera, 'g' for guiding camera
+ *      settings: new readout settings, -1 leaves a control at its default
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EINVAL: incorrect camera name or setting out of range
+ *      EIO: the camera rejected the settings
+ *      ENODEV: camera disconnected, settings applied when it is reopened
+ */
+int set_cam_readout(char cam_name, const cam_readout_t* settings);
+
+/* current readout settings of a camera */
+void get_cam_readout(char cam_name, cam_readout_t* settings);
@@ -0,0 +1,333 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Exposure Timing
+ * Parent Component: Camera
+ * Author(s):
+ * Purpose: Start and stop camera exposures while time stamping them in
+ *          monotonic and UTC time, and keep track of the USB command latency.
+ *          Uses the hardware trigger input of the camera when available.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "global_utils.h"
+#include "lock.h"
+#include "gpio.h"
+#include "exp_timing.h"
+
+/* number of round trips measured when a camera is set up */
+#define CALIB_COUNT 16
+
+typedef struct{
+    long count;
+    double min, max, sum;   /* unit: s */
+} latency_t;
+
+static void stamp_pair(struct timespec* mono, struct timespec* real);
+static double ts_diff(const struct timespec* a, const struct timespec* b);
+static void ts_mid(const struct timespec* a, const struct timespec* b,
+        struct timespec* mid);
+static void ts_add_us(struct timespec* ts, long us);
+static void ts_add_ns(struct timespec* ts, long ns);
+static void add_latency(latency_t* lat, double val);
+static int cmp_double(const void* a, const void* b);
+
+static lock_t mutex_stamp = LOCK_INITIALIZER("mutex_stamp");
+
+/* camera ids are not reused when a camera reconnects */
+static exp_stamp_t stamps[ASICAMERA_ID_MAX];
+static latency_t start_latency[ASICAMERA_ID_MAX];
+static double calib_rtt[ASICAMERA_ID_MAX];
+static char hw_trigger[ASICAMERA_ID_MAX];
+
+static FILE* timing_log;
+
+int init_exp_timing(void* args){
+
+    char log_fn[100];
+
+    strcpy(log_fn, get_top_dir());
+    strcat(log_fn, "output/logs/exp_timing.log");
+
+    timing_log = fopen(log_fn, "a");
+
+    #ifdef CAM_HW_TRIGGER
+        gpio_export(CAM_TRIG_PIN);
+        gpio_direction(CAM_TRIG_PIN, OUT);
+        gpio_write(CAM_TRIG_PIN, LOW);
+    #endif
+
+    return SUCCESS;
+}
+
+/* exp_timing_setup:
+ * Measure the command round trip latency of a camera, which places software
+ * started exposures within their start window, and select how its
+ * exposures are started. With CAM_HW_TRIGGER defined, cameras supporting a
+ * rising edge trigger are put in trigger mode and started from CAM_TRIG_PIN.
+ *
+ * input:
+ *      cam_info: info object for the camera, camera must be initialised
+ *      cam_name: name of camera for logging
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EIO: failed to set up trigger mode, camera left in normal mode
+ */
+int exp_timing_setup(ASI_CAMERA_INFO* cam_info, char* cam_name){
+
+    int id = cam_info->CameraID;
+    struct timespec before, after;
+    double rtt[CALIB_COUNT];
+    long val;
+    ASI_BOOL pb_auto;
+
+    /* round trip of a command without side effects */
+    for(int ii=0; ii<CALIB_COUNT; ++ii){
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        ASIGetControlValue(id, ASI_TEMPERATURE, &val, &pb_auto);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        rtt[ii] = ts_diff(&after, &before);
+    }
+    qsort(rtt, CALIB_COUNT, sizeof(*rtt), cmp_double);
+    calib_rtt[id] = rtt[CALIB_COUNT / 2];
+
+    logging(INFO, "Exp Timing",
+            "%s camera round trip: min %.1lf us, median %.1lf us, max %.1lf us",
+            cam_name, rtt[0] * 1e6, rtt[CALIB_COUNT / 2] * 1e6,
+            rtt[CALIB_COUNT - 1] * 1e6);
+
+    memset(&start_latency[id], 0, sizeof(start_latency[id]));
+    hw_trigger[id] = 0;
+
+    #ifdef CAM_HW_TRIGGER
+        if(!cam_info->IsTriggerCam){
+            return SUCCESS;
+        }
+
+        ASI_SUPPORTED_MODE modes;
+        if(ASIGetCameraSupportMode(id, &modes) != ASI_SUCCESS){
+            logging(ERROR, "Exp Timing",
+                    "Failed to read trigger modes of %s camera", cam_name);
+            return EIO;
+        }
+
+        for(int ii=0; ii<16 && modes.SupportedCameraMode[ii] != ASI_MODE_END; ++ii){
+            if(modes.SupportedCameraMode[ii] != ASI_MODE_TRIG_RISE_EDGE){
+                continue;
+            }
+
+            if(     ASISetCameraMode(id, ASI_MODE_TRIG_RISE_EDGE) != ASI_SUCCESS ||
+                    ASIStartVideoCapture(id) != ASI_SUCCESS){
+
+                logging(ERROR, "Exp Timing",
+                        "Failed to set trigger mode of %s camera", cam_name);
+                ASISetCameraMode(id, ASI_MODE_NORMAL);
+                return EIO;
+            }
+
+            hw_trigger[id] = 1;
+            logging(INFO, "Exp Timing", "%s camera in hardware trigger mode",
+                    cam_name);
+            break;
+        }
+    #endif
+
+    return SUCCESS;
+}
+
+/* exp_timing_start:
+ * Start an exposure and stamp the start time. Exposure time and gain must
+ * already be set.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *      exp: exposure time in microseconds, used to predict the end time
+ *
+ * return:
+ *      ASI_SUCCESS: operation is successful
+ *      ASI error code from the SDK or FAILURE if the trigger pulse failed
+ */
+int exp_timing_start(int id, long exp){
+
+    struct timespec mono_b, real_b, mono_a, real_a;
+    int ret;
+
+    /* the exposure starts somewhere between the two stamps */
+    if(hw_trigger[id]){
+        #ifdef CAM_HW_TRIGGER
+            stamp_pair(&mono_b, &real_b);
+            ret = gpio_write(CAM_TRIG_PIN, HIGH);
+            stamp_pair(&mono_a, &real_a);
+            gpio_write(CAM_TRIG_PIN, LOW);
+            ret = ret ? FAILURE : ASI_SUCCESS;
+        #else
+            return FAILURE;
+        #endif
+    }
+    else{
+        stamp_pair(&mono_b, &real_b);
+        ret = ASIStartExposure(id, ASI_FALSE);
+        stamp_pair(&mono_a, &real_a);
+    }
+
+    if(ret != ASI_SUCCESS){
+        return ret;
+    }
+
+    double window = ts_diff(&mono_a, &mono_b);
+
+    lock_acquire(&mutex_stamp);
+
+    exp_stamp_t* st = &stamps[id];
+    if(hw_trigger[id]){
+        ts_mid(&mono_b, &mono_a, &st->mono_start);
+        ts_mid(&real_b, &real_a, &st->real_start);
+        st->start_unc = window / 2;
+    }
+    else{
+        /* the camera starts when the command arrives, half a round trip
+         * after the call. Time in the SDK beyond the calibrated round trip
+         * can be on either side, the error is bounded by the window */
+        double delay = (calib_rtt[id] < window ? calib_rtt[id] : window) / 2;
+        st->mono_start = mono_b;
+        ts_add_ns(&st->mono_start, delay * 1e9);
+        st->real_start = real_b;
+        ts_add_ns(&st->real_start, delay * 1e9);
+        st->start_unc = window - delay;
+    }
+    st->hw_trigger = hw_trigger[id];
+    st->aborted = 0;
+
+    /* the camera times the exposure itself */
+    st->mono_end = st->mono_start;
+    ts_add_us(&st->mono_end, exp);
+    st->real_end = st->real_start;
+    ts_add_us(&st->real_end, exp);
+    st->end_unc = st->start_unc;
+
+    add_latency(&start_latency[id], window);
+
+    lock_release(&mutex_stamp);
+
+    logging_csv(timing_log, "%d,%d,%.1lf,%.1lf,%.1lf,%.1lf", id, hw_trigger[id],
+            window * 1e6, start_latency[id].min * 1e6,
+            start_latency[id].sum / start_latency[id].count * 1e6,
+            calib_rtt[id] * 1e6);
+
+    return ASI_SUCCESS;
+}
+
+/* exp_timing_stop:
+ * Stop an ongoing exposure and stamp the end time.
+ *
+ * return:
+ *      ASI_SUCCESS: operation is successful
+ *      ASI error code from the SDK
+ */
+int exp_timing_stop(int id){
+
+    struct timespec mono_b, real_b, mono_a, real_a;
+    int ret;
+
+    stamp_pair(&mono_b, &real_b);
+    if(hw_trigger[id]){
+        /* a triggered exposure can not be stopped, drop it by restarting */
+        ret = ASIStopVideoCapture(id);
+        if(ret == ASI_SUCCESS){
+            ret = ASIStartVideoCapture(id);
+        }
+    }
+    else{
+        ret = ASIStopExposure(id);
+    }
+    stamp_pair(&mono_a, &real_a);
+
+    lock_acquire(&mutex_stamp);
+
+    exp_stamp_t* st = &stamps[id];
+    ts_mid(&mono_b, &mono_a, &st->mono_end);
+    ts_mid(&real_b, &real_a, &st->real_end);
+    st->end_unc = ts_diff(&mono_a, &mono_b) / 2;
+    st->aborted = 1;
+
+    lock_release(&mutex_stamp);
+
+    return ret;
+}
+
+/* 1 if the camera is in hardware trigger mode, images are then read with
+ * ASIGetVideoData instead of ASIGetDataAfterExp
+ */
+char exp_timing_hw(int id){
+    return hw_trigger[id];
+}
+
+/* copy the time stamps of the latest exposure of a camera */
+void exp_timing_stamp(int id, exp_stamp_t* stamp){
+
+    lock_acquire(&mutex_stamp);
+    *stamp = stamps[id];
+    lock_release(&mutex_stamp);
+}
+
+/* stamp both clocks as close together as possible */
+static void stamp_pair(struct timespec* mono, struct timespec* real){
+    clock_gettime(CLOCK_MONOTONIC, mono);
+    clock_gettime(CLOCK_REALTIME, real);
+}
+
+/* a - b in seconds */
+static double ts_diff(const struct timespec* a, const struct timespec* b){
+    return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1000000000.0;
+}
+
+static void ts_mid(const struct timespec* a, const struct timespec* b,
+        struct timespec* mid){
+
+    long long ns_a = (long long)a->tv_sec * 1000000000 + a->tv_nsec;
+    long long ns_b = (long long)b->tv_sec * 1000000000 + b->tv_nsec;
+    long long ns = ns_a + (ns_b - ns_a) / 2;
+
+    mid->tv_sec = ns / 1000000000;
+    mid->tv_nsec = ns % 1000000000;
+}
+
+static void ts_add_us(struct timespec* ts, long us){
+    ts->tv_sec += us / 1000000;
+    ts->tv_nsec += (us % 1000000) * 1000;
+    if(ts->tv_nsec >= 1000000000){
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void ts_add_ns(struct timespec* ts, long ns){
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec += ns % 1000000000;
+    if(ts->tv_nsec >= 1000000000){
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void add_latency(latency_t* lat, double val){
+    if(!lat->count || val < lat->min){
+        lat->min = val;
+    }
+    if(!lat->count || val > lat->max){
+        lat->max = val;
+    }
+    lat->sum += val;
+    lat->count++;
+}
+
+static int cmp_double(const void* a, const void* b){
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
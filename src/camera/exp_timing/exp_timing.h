@@ -0,0 +1,74 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Exposure Timing
+ * Parent Component: Camera
+ * Author(s):
+ * Purpose: Start and stop camera exposures while time stamping them in
+ *          monotonic and UTC time, and keep track of the USB command latency.
+ *          Uses the hardware trigger input of the camera when available.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <time.h>
+
+#include "ASICamera2.h"
+
+typedef struct{
+    struct timespec mono_start, real_start;
+    struct timespec mono_end, real_end;
+    double start_unc;   /* largest error of the start time, unit: s */
+    double end_unc;     /* half width of the end time window, unit: s */
+    char hw_trigger;    /* exposure started by the hardware trigger */
+    char aborted;
+} exp_stamp_t;
+
+/* initialise the exposure timing component */
+int init_exp_timing(void* args);
+
+/* exp_timing_setup:
+ * Measure the command round trip latency of a camera, which places software
+ * started exposures within their start window, and select how its
+ * exposures are started. With CAM_HW_TRIGGER defined, cameras supporting a
+ * rising edge trigger are put in trigger mode and started from CAM_TRIG_PIN.
+ *
+ * input:
+ *      cam_info: info object for the camera, camera must be initialised
+ *      cam_name: name of camera for logging
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EIO: failed to set up trigger mode, camera left in normal mode
+ */
+int exp_timing_setup(ASI_CAMERA_INFO* cam_info, char* cam_name);
+
+/* exp_timing_start:
+ * Start an exposure and stamp the start time. Exposure time and gain must
+ * already be set.
+ *
+ * input:
+ *      id: camera id found in ASI_CAMERA_INFO
+ *      exp: exposure time in microseconds, used to predict the end time
+ *
+ * return:
+ *      ASI_SUCCESS: operation is successful
+ *      ASI error code from the SDK or FAILURE if the trigger pulse failed
+ */
+int exp_timing_start(int id, long exp);
+
+/* exp_timing_stop:
+ * Stop an ongoing exposure and stamp the end time.
+ *
+ * return:
+ *      ASI_SUCCESS: operation is successful
+ *      ASI error code from the SDK
+ */
+int exp_timing_stop(int id);
+
+/* 1 if the camera is in hardware trigger mode, images are then read with
+ * ASIGetVideoData instead of ASIGetDataAfterExp
+ */
+char exp_timing_hw(int id);
+
+/* copy the time stamps of the latest exposure of a camera */
+void exp_timing_stamp(int id, exp_stamp_t* stamp);
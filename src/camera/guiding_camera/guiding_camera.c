@@ -12,6 +12,8 @@
 
 #include "global_utils.h"
 #include "camera_utils.h"
+#include "cam_supervisor.h"
+#include "exp_timing.h"
 
 static ASI_CAMERA_INFO cam_info;
 
@@ -48,7 +50,7 @@ int init_guiding_camera(void* args){
  *      ENODEV: Camera not connected
  */
 int expose_guiding_local(int exp, int gain){
-    return expose(cam_info.CameraID, exp, gain, "guiding");
+    return expose(cam_sup_id(&cam_info), exp, gain, "guiding");
 }
 
 /* save_img_guiding:
@@ -94,5 +96,26 @@ int abort_exp_guiding_local(char* fn){
 }
 
 double get_guiding_temp_l(void){
-    return get_cam_temp(cam_info.CameraID, "guiding");
+    return get_cam_temp(cam_sup_id(&cam_info), "guiding");
+}
+
+/* CLOCK_MONOTONIC at the middle of the latest guiding exposure, zero if the
+ * camera has not exposed */
+void get_guiding_mid_exp_l(struct timespec* mid){
+
+    exp_stamp_t stamp;
+    exp_timing_stamp(cam_sup_id(&cam_info), &stamp);
+
+    long long start = stamp.mono_start.tv_sec * 1000000000LL + stamp.mono_start.tv_nsec;
+    long long end = stamp.mono_end.tv_sec * 1000000000LL + stamp.mono_end.tv_nsec;
+
+    if(start == 0 || end < start){
+        mid->tv_sec = 0;
+        mid->tv_nsec = 0;
+        return;
+    }
+
+    long long t = start + (end - start) / 2;
+    mid->tv_sec = t / 1000000000;
+    mid->tv_nsec = t % 1000000000;
 }
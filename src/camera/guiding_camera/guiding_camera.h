@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <time.h>
+
 /* init_guiding_camera:
  * Set up and initialise the guiding camera.
  *
@@ -73,3 +75,7 @@ int save_img_guiding_local(char* fn);
 int abort_exp_guiding_local(char* fn);
 
 double get_guiding_temp_l(void);
+
+/* CLOCK_MONOTONIC at the middle of the latest guiding exposure, zero if the
+ * camera has not exposed */
+void get_guiding_mid_exp_l(struct timespec* mid);
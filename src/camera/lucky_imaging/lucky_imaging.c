@@ -0,0 +1,365 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Lucky Imaging
+ * Parent Component: Camera
+ * Author(s):
+ * Purpose: Score short exposures by the sharpness of their brightest stars,
+ *          keep the best ones of a burst, and shift and add them into a
+ *          single image.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global_utils.h"
+#include "camera_utils.h"
+#include "lucky_imaging.h"
+
+#define PIXEL_MAX 4095          /* data is scaled to 12 bits by fetch_img */
+#define SATURATION 4000         /* saturated stars have no meaningful peak */
+#define BG_STRIDE 16            /* pixel stride when estimating background */
+#define BLOCK 64                /* at most one star candidate per block */
+#define STAR_R 12               /* half size of the window around a star */
+#define DETECT_SIGMA 10         /* detection threshold above background */
+#define MAX_CANDIDATES 32
+
+typedef struct{
+    int peak, x, y;
+} star_t;
+
+static void score_frame(const unsigned short* img, lucky_score_t* sc);
+static void background(const unsigned short* img, double* bg, double* sigma);
+static void add_candidate(star_t* cand, int* count, int peak, int x, int y);
+
+static unsigned short* pool[LUCKY_MAX_KEEP + 1];
+static int width, height;
+
+static unsigned short* capture;
+static unsigned short* kept[LUCKY_MAX_KEEP];
+static lucky_score_t kept_score[LUCKY_MAX_KEEP];
+static int kept_count, keep_target;
+
+/* init_lucky_imaging:
+ * Allocate the frame buffers for the largest burst once, a burst started in
+ * flight must not fail for lack of memory.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOMEM: no memory available for frame buffers
+ */
+int init_lucky_imaging(void* args){
+
+    /* one buffer more than kept frames to capture into. Far larger than the
+     * arena, the pages are locked and faulted in here by mlockall */
+    size_t frame = (size_t)NIR_WIDTH * NIR_HEIGHT;
+    unsigned short* buffers = calloc((LUCKY_MAX_KEEP + 1) * frame, sizeof(*buffers));
+    if(buffers == NULL){
+        logging(ERROR, "Lucky", "Cannot allocate memory for frame buffers");
+        return ENOMEM;
+    }
+
+    for(int ii=0; ii<LUCKY_MAX_KEEP+1; ++ii){
+        pool[ii] = buffers + ii * frame;
+    }
+
+    return SUCCESS;
+}
+
+/* lucky_reset:
+ * Start a new burst keeping the best keep frames.
+ *
+ * input:
+ *      keep: number of frames kept per burst, at most LUCKY_MAX_KEEP
+ *      w, h: frame size in pixels, at most NIR_WIDTH x NIR_HEIGHT
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EINVAL: keep out of range or frames larger than the buffers
+ */
+int lucky_reset(int keep, int w, int h){
+
+    if(keep < 1 || keep > LUCKY_MAX_KEEP || (long)w * h > (long)NIR_WIDTH * NIR_HEIGHT){
+        return EINVAL;
+    }
+
+    width = w;
+    height = h;
+    keep_target = keep;
+    kept_count = 0;
+
+    capture = pool[0];
+    for(int ii=0; ii<keep_target; ++ii){
+        kept[ii] = pool[ii+1];
+    }
+
+    return SUCCESS;
+}
+
+/* buffer the next frame of the burst is fetched into */
+unsigned short* lucky_capture_buffer(void){
+    return capture;
+}
+
+/* lucky_add_frame:
+ * Score the frame in the capture buffer and keep it if it is among the best
+ * of the burst so far. Kept frames are swapped out of the capture buffer,
+ * no pixels are copied.
+ *
+ * output:
+ *      score: score of the frame, may be NULL
+ *
+ * return:
+ *      1: frame kept
+ *      0: frame dropped
+ */
+int lucky_add_frame(lucky_score_t* score){
+
+    lucky_score_t sc;
+    score_frame(capture, &sc);
+
+    if(score != NULL){
+        *score = sc;
+    }
+
+    /* frames without stars can not be aligned */
+    if(!sc.stars || keep_target < 1){
+        return 0;
+    }
+
+    int slot = kept_count;
+    if(kept_count == keep_target){
+        slot = 0;
+        for(int ii=1; ii<kept_count; ++ii){
+            if(kept_score[ii].score < kept_score[slot].score){
+                slot = ii;
+            }
+        }
+        if(kept_score[slot].score >= sc.score){
+            return 0;
+        }
+    }
+    else{
+        kept_count++;
+    }
+
+    unsigned short* tmp = kept[slot];
+    kept[slot] = capture;
+    capture = tmp;
+    kept_score[slot] = sc;
+
+    return 1;
+}
+
+/* lucky_stack:
+ * Shift the kept frames to the brightest star of the best frame and add them.
+ *
+ * output:
+ *      out: pointer to the stacked image, valid until the next lucky_reset
+ *
+ * return:
+ *      number of frames in the stack, 0 if no frame was kept
+ */
+int lucky_stack(unsigned short** out){
+
+    if(!kept_count){
+        return 0;
+    }
+
+    int best = 0;
+    for(int ii=1; ii<kept_count; ++ii){
+        if(kept_score[ii].score > kept_score[best].score){
+            best = ii;
+        }
+    }
+
+    /* the capture buffer is free once the burst is over */
+    unsigned short* sum = capture;
+    memset(sum, 0, (size_t)width * height * sizeof(*sum));
+
+    for(int kk=0; kk<kept_count; ++kk){
+        int dx = lround(kept_score[best].cx - kept_score[kk].cx);
+        int dy = lround(kept_score[best].cy - kept_score[kk].cy);
+
+        int x0 = dx > 0 ? dx : 0, x1 = dx < 0 ? width + dx : width;
+        int y0 = dy > 0 ? dy : 0, y1 = dy < 0 ? height + dy : height;
+
+        for(int yy=y0; yy<y1; ++yy){
+            unsigned short* dst = &sum[(long)yy * width];
+            const unsigned short* src = &kept[kk][(long)(yy - dy) * width - dx];
+            for(int xx=x0; xx<x1; ++xx){
+                dst[xx] += src[xx];
+            }
+        }
+    }
+
+    *out = sum;
+    return kept_count;
+}
+
+/* score_frame:
+ * Find the brightest unsaturated stars, one per BLOCK sized block, and score
+ * the frame by their mean peak/FWHM. The FWHM is estimated from the area above
+ * half maximum, which is cheap and works for undersampled stars.
+ */
+static void score_frame(const unsigned short* img, lucky_score_t* sc){
+
+    double bg, sigma;
+    background(img, &bg, &sigma);
+    int thr = bg + DETECT_SIGMA * sigma;
+
+    star_t cand[MAX_CANDIDATES];
+    int cand_count = 0;
+
+    for(int by=0; by<height; by+=BLOCK){
+        for(int bx=0; bx<width; bx+=BLOCK){
+            int peak = 0, px = 0, py = 0;
+            int ye = by + BLOCK < height ? by + BLOCK : height;
+            int xe = bx + BLOCK < width ? bx + BLOCK : width;
+
+            for(int yy=by; yy<ye; ++yy){
+                const unsigned short* row = &img[(long)yy * width];
+                for(int xx=bx; xx<xe; ++xx){
+                    if(row[xx] > peak){
+                        peak = row[xx];
+                        px = xx;
+                        py = yy;
+                    }
+                }
+            }
+
+            if(peak > thr && peak < SATURATION){
+                add_candidate(cand, &cand_count, peak, px, py);
+            }
+        }
+    }
+
+    /* pick the brightest candidates not belonging to an already picked star */
+    star_t stars[LUCKY_MAX_STARS];
+    int star_count = 0;
+    for(int ii=0; ii<cand_count && star_count<LUCKY_MAX_STARS; ++ii){
+        char dup = 0;
+        for(int jj=0; jj<star_count; ++jj){
+            if(     abs(cand[ii].x - stars[jj].x) <= 2 * STAR_R &&
+                    abs(cand[ii].y - stars[jj].y) <= 2 * STAR_R){
+                dup = 1;
+                break;
+            }
+        }
+        if(!dup){
+            stars[star_count++] = cand[ii];
+        }
+    }
+
+    sc->score = 0;
+    sc->stars = star_count;
+    sc->cx = 0;
+    sc->cy = 0;
+
+    for(int ss=0; ss<star_count; ++ss){
+        double half = bg + (stars[ss].peak - bg) / 2;
+        double wsum = 0, wx = 0, wy = 0;
+        int area = 0;
+
+        int y0 = stars[ss].y - STAR_R < 0 ? 0 : stars[ss].y - STAR_R;
+        int y1 = stars[ss].y + STAR_R >= height ? height - 1 : stars[ss].y + STAR_R;
+        int x0 = stars[ss].x - STAR_R < 0 ? 0 : stars[ss].x - STAR_R;
+        int x1 = stars[ss].x + STAR_R >= width ? width - 1 : stars[ss].x + STAR_R;
+
+        for(int yy=y0; yy<=y1; ++yy){
+            for(int xx=x0; xx<=x1; ++xx){
+                double val = img[(long)yy * width + xx];
+                if(val >= half){
+                    area++;
+                    wsum += val - bg;
+                    wx += (val - bg) * xx;
+                    wy += (val - bg) * yy;
+                }
+            }
+        }
+
+        double fwhm = 2 * sqrt(area / M_PI);
+        sc->score += (stars[ss].peak - bg) / fwhm;
+
+        /* the brightest star is used for alignment */
+        if(ss == 0){
+            sc->cx = wx / wsum;
+            sc->cy = wy / wsum;
+        }
+    }
+
+    if(star_count){
+        sc->score /= star_count;
+    }
+}
+
+/* background:
+ * Estimate the background level and noise from a sparse grid of pixels using
+ * the median and the median absolute deviation, which ignore the few pixels
+ * belonging to stars.
+ */
+static void background(const unsigned short* img, double* bg, double* sigma){
+
+    static unsigned int hist[PIXEL_MAX + 1], dev[PIXEL_MAX + 1];
+    long count = 0, cum = 0;
+    int median = 0, mad = 0;
+
+    memset(hist, 0, sizeof(hist));
+    memset(dev, 0, sizeof(dev));
+
+    for(int yy=0; yy<height; yy+=BG_STRIDE){
+        for(int xx=0; xx<width; xx+=BG_STRIDE){
+            hist[img[(long)yy * width + xx] & PIXEL_MAX]++;
+            count++;
+        }
+    }
+
+    for(median=0; median<PIXEL_MAX; ++median){
+        cum += hist[median];
+        if(cum >= count / 2){
+            break;
+        }
+    }
+
+    for(int ii=0; ii<=PIXEL_MAX; ++ii){
+        dev[abs(ii - median)] += hist[ii];
+    }
+
+    cum = 0;
+    for(mad=0; mad<PIXEL_MAX; ++mad){
+        cum += dev[mad];
+        if(cum >= count / 2){
+            break;
+        }
+    }
+
+    *bg = median;
+    *sigma = mad > 0 ? 1.4826 * mad : 1;
+}
+
+/* keep the MAX_CANDIDATES brightest candidates sorted by peak */
+static void add_candidate(star_t* cand, int* count, int peak, int x, int y){
+
+    int pos = *count;
+    while(pos > 0 && cand[pos-1].peak < peak){
+        pos--;
+    }
+
+    if(pos >= MAX_CANDIDATES){
+        return;
+    }
+
+    int last = *count < MAX_CANDIDATES ? *count : MAX_CANDIDATES - 1;
+    for(int ii=last; ii>pos; --ii){
+        cand[ii] = cand[ii-1];
+    }
+
+    cand[pos].peak = peak;
+    cand[pos].x = x;
+    cand[pos].y = y;
+
+    if(*count < MAX_CANDIDATES){
+        (*count)++;
+    }
+}
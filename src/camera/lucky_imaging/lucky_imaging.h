@@ -0,0 +1,74 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Lucky Imaging
+ * Parent Component: Camera
+ * Author(s):
+ * Purpose: Score short exposures by the sharpness of their brightest stars,
+ *          keep the best ones of a burst, and shift and add them into a
+ *          single image.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+/* The stack is summed in 16 bits, 8 frames of 12 bit data fit in a signed
+ * 16 bit FITS image
+ */
+#define LUCKY_MAX_KEEP 8
+#define LUCKY_MAX_STARS 5
+
+typedef struct{
+    double score;       /* mean of peak/FWHM of the scored stars */
+    double cx, cy;      /* centroid of the brightest star, unit: pixels */
+    int stars;          /* number of stars scored */
+} lucky_score_t;
+
+/* init_lucky_imaging:
+ * Allocate the frame buffers for the largest burst once, a burst started in
+ * flight must not fail for lack of memory.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOMEM: no memory available for frame buffers
+ */
+int init_lucky_imaging(void* args);
+
+/* lucky_reset:
+ * Start a new burst keeping the best keep frames.
+ *
+ * input:
+ *      keep: number of frames kept per burst, at most LUCKY_MAX_KEEP
+ *      w, h: frame size in pixels, at most NIR_WIDTH x NIR_HEIGHT
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EINVAL: keep out of range or frames larger than the buffers
+ */
+int lucky_reset(int keep, int w, int h);
+
+/* buffer the next frame of the burst is fetched into */
+unsigned short* lucky_capture_buffer(void);
+
+/* lucky_add_frame:
+ * Score the frame in the capture buffer and keep it if it is among the best
+ * of the burst so far. Kept frames are swapped out of the capture buffer,
+ * no pixels are copied.
+ *
+ * output:
+ *      score: score of the frame, may be NULL
+ *
+ * return:
+ *      1: frame kept
+ *      0: frame dropped
+ */
+int lucky_add_frame(lucky_score_t* score);
+
+/* lucky_stack:
+ * Shift the kept frames to the brightest star of the best frame and add them.
+ *
+ * output:
+ *      out: pointer to the stacked image, valid until the next lucky_reset
+ *
+ * return:
+ *      number of frames in the stack, 0 if no frame was kept
+ */
+int lucky_stack(unsigned short** out);
@@ -13,11 +13,25 @@
 
 #include "global_utils.h"
 #include "camera_utils.h"
+#include "cam_supervisor.h"
+#include "exp_timing.h"
 #include "img_processing.h"
+#include "lucky_imaging.h"
 
 static ASI_CAMERA_INFO cam_info;
 
-static char out_fn[100], out_fp[100], tmp_fn[100];
+static char out_fp[100], tmp_fn[100];
+static char out_fn[sizeof(out_fp) + 20];
+
+static int save_lucky(void);
+static void catalog(int frame);
+
+/* state of the ongoing lucky imaging burst */
+static struct{
+    int frames, exp, gain, keep;
+    int taken, kept;
+    exp_stamp_t first;  /* time stamps of the first frame */
+} burst;
 
 /* init_nir_camera:
  * Set up and initialise the nir camera.
@@ -58,12 +72,14 @@ int init_nir_camera(void* args){
  *      EIO: setting camera control values failed
  *      ENODEV: Camera not connected
  */
+static int img_cntr = 0;
+
 int expose_nir_local(int exp, int gain){
-    return expose(cam_info.CameraID, exp, gain, "NIR");
+    int id = cam_sup_id(&cam_info);
+    set_frame_id(id, img_cntr);
+    return expose(id, exp, gain, "NIR");
 }
 
-static int img_cntr = 0;
-
 /* save_img_nir:
  * save_img_nir will first check if exposure is still ongoing or has failed
  * and return if that is the case. Otherwise the image will be fetched from
@@ -88,8 +104,10 @@ int save_img_nir_local(void){
         return ret;
     }
 
+    catalog(img_cntr);
+
     /* make temporary file name for nir images */
-    snprintf(out_fn, 100, "%snir%04d.fit", out_fp, img_cntr++);
+    snprintf(out_fn, sizeof(out_fn), "%snir%04d.fit", out_fp, img_cntr++);
     rename(tmp_fn, out_fn);
 
     queue_image(out_fn, IMAGE_MAIN);
@@ -112,17 +130,202 @@ int save_img_nir_local(void){
  *      ENODEV: camera disconnected
  */
 int abort_exp_nir_local(void){
-    snprintf(out_fn, 100, "%snir%04d.fit", out_fp, img_cntr++);
+    int frame = img_cntr++;
+    snprintf(out_fn, sizeof(out_fn), "%snir%04d.fit", out_fp, frame);
 
     int ret = abort_exp(&cam_info, out_fn, "NIR");
     if(ret){
         return ret;
     }
 
+    catalog(frame);
     queue_image(out_fn, IMAGE_MAIN);
     return SUCCESS;
 }
 
+/* lucky_start_nir_local:
+ * Start a lucky imaging burst of short exposures. Call lucky_step_nir_local
+ * until it stops returning EXP_NOT_READY.
+ *
+ * input:
+ *      frames: number of exposures in the burst
+ *      exp: exposure time of each frame in microseconds
+ *      gain: the sensor gain
+ *      keep: number of sharpest frames stacked into the saved image
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EINVAL: keep out of range or larger than frames
+ *      EREMOTEIO: starting exposure failed
+ *      EIO: setting camera control values failed
+ *      ENODEV: Camera not connected
+ */
+int lucky_start_nir_local(int frames, int exp, int gain, int keep){
+
+    if(frames < keep){
+        return EINVAL;
+    }
+
+    int ret = lucky_reset(keep, cam_info.MaxWidth, cam_info.MaxHeight);
+    if(ret){
+        return ret;
+    }
+
+    burst.frames = frames;
+    burst.exp = exp;
+    burst.gain = gain;
+    burst.keep = keep;
+    burst.taken = 0;
+    burst.kept = 0;
+
+    /* the stack is saved as the next image, its FRAMEID must match the
+     * attitude recorded from the start of the burst */
+    int id = cam_sup_id(&cam_info);
+    set_frame_id(id, img_cntr);
+    return expose(id, exp, gain, "NIR");
+}
+
+/* lucky_step_nir_local:
+ * Fetch and score the latest frame of the burst and start the next one. When
+ * the burst is complete the kept frames are stacked, saved and queued.
+ *
+ * return:
+ *      SUCCESS: burst complete and image saved
+ *      EXP_NOT_READY: burst still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and the burst must be retried
+ *      FAILURE: saving the image failed, log written to stderr
+ *      EPERM: calling lucky_step_nir before starting a burst
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int lucky_step_nir_local(void){
+
+    int ret = fetch_img(&cam_info, lucky_capture_buffer(), "NIR");
+    if(ret){
+        return ret;
+    }
+
+    if(burst.taken == 0){
+        exp_timing_stamp(cam_sup_id(&cam_info), &burst.first);
+    }
+
+    lucky_score_t score;
+    burst.kept += lucky_add_frame(&score);
+    burst.taken++;
+
+    #ifdef CAMERA_DEBUG
+        logging(DEBUG, "Camera", "Lucky frame %d: score %.1lf, %d stars",
+                burst.taken, score.score, score.stars);
+    #endif
+
+    if(burst.taken < burst.frames){
+        int id = cam_sup_id(&cam_info);
+        set_frame_id(id, img_cntr);
+        ret = expose(id, burst.exp, burst.gain, "NIR");
+        return ret ? ret : EXP_NOT_READY;
+    }
+
+    return save_lucky();
+}
+
+/* lucky_abort_nir_local:
+ * Abort an ongoing burst and save the stack of the frames taken so far.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_FAILED: no frame with stars was taken, nothing saved
+ *      FAILURE: saving the image failed, log written to stderr
+ */
+int lucky_abort_nir_local(void){
+
+    logging(WARN, "Camera", "Aborting lucky imaging burst after %d frames",
+            burst.taken);
+    stop_exp(cam_sup_id(&cam_info), "NIR");
+
+    return save_lucky();
+}
+
+/* stack the kept frames of the burst, save them and queue the image */
+static int save_lucky(void){
+
+    unsigned short* stack;
+    int count = lucky_stack(&stack);
+    if(!count){
+        logging(ERROR, "Camera", "No frame with stars in lucky imaging burst");
+        return EXP_FAILED;
+    }
+
+    /* the stack is exposed for the sum of the kept frames */
+    struct timespec exp_time;
+    long total = (long)count * burst.exp;
+    exp_time.tv_sec = total / 1000000;
+    exp_time.tv_nsec = (total % 1000000) * 1000;
+
+    /* the stack spans from the start of the first frame to the end of the
+     * last frame fetched */
+    exp_stamp_t span;
+    exp_timing_stamp(cam_sup_id(&cam_info), &span);
+    span.mono_start = burst.first.mono_start;
+    span.real_start = burst.first.real_start;
+    span.start_unc = burst.first.start_unc;
+
+    snprintf(out_fn, sizeof(out_fn), "%snir%04d.fit", out_fp, img_cntr++);
+
+    int ret = save_buffer(&cam_info, stack, out_fn, &exp_time, &span);
+    if(ret == SUCCESS){
+        ret = update_img_key(out_fn, "LUCKYN", burst.taken,
+                "frames taken in lucky imaging burst");
+    }
+    if(ret == SUCCESS){
+        ret = update_img_key(out_fn, "LUCKYK", count, "frames stacked");
+    }
+    if(ret == SUCCESS){
+        ret = update_img_key(out_fn, "LUCKYEXP", burst.exp,
+                "exposure of each frame [us]");
+    }
+    if(ret){
+        return ret;
+    }
+
+    logging(INFO, "Camera", "Lucky imaging stack of %d/%d frames saved as %s",
+            count, burst.taken, out_fn);
+
+    queue_image(out_fn, IMAGE_MAIN);
+    return SUCCESS;
+}
+
+/* catalog:
+ * Hand a copy of the frame just saved to the source catalog, which is sent
+ * ahead of the image. Skipped while the previous frame is still measured.
+ * Lucky imaging stacks are sums of frames and get no catalog.
+ *
+ * input:
+ *      frame: frame id of the saved image
+ */
+static void catalog(int frame){
+
+    unsigned short* buffer = catalog_buffer(cam_info.MaxWidth,
+            cam_info.MaxHeight);
+    if(buffer == NULL){
+        return;
+    }
+
+    if(copy_frame(&cam_info, buffer)){
+        catalog_submit(-1, 0);
+        return;
+    }
+
+    exp_stamp_t stamp;
+    exp_timing_stamp(cam_sup_id(&cam_info), &stamp);
+    catalog_submit(frame, (long long)stamp.real_start.tv_sec * 1000000000 +
+            stamp.real_start.tv_nsec);
+}
+
+/* frame id of the next image, used in file names and the FRAMEID key */
+int get_nir_frame_id_l(void){
+    return img_cntr;
+}
+
 double get_nir_temp_l(void){
-    return get_cam_temp(cam_info.CameraID, "nir");
+    return get_cam_temp(cam_sup_id(&cam_info), "nir");
 }
@@ -69,4 +69,51 @@ int save_img_nir_local(void);
  */
 int abort_exp_nir_local(void);
 
+/* lucky_start_nir_local:
+ * Start a lucky imaging burst of short exposures. Call lucky_step_nir_local
+ * until it stops returning EXP_NOT_READY.
+ *
+ * input:
+ *      frames: number of exposures in the burst
+ *      exp: exposure time of each frame in microseconds
+ *      gain: the sensor gain
+ *      keep: number of sharpest frames stacked into the saved image
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EINVAL: keep out of range or larger than frames
+ *      EREMOTEIO: starting exposure failed
+ *      EIO: setting camera control values failed
+ *      ENODEV: Camera not connected
+ */
+int lucky_start_nir_local(int frames, int exp, int gain, int keep);
+
+/* lucky_step_nir_local:
+ * Fetch and score the latest frame of the burst and start the next one. When
+ * the burst is complete the kept frames are stacked, saved and queued.
+ *
+ * return:
+ *      SUCCESS: burst complete and image saved
+ *      EXP_NOT_READY: burst still ongoing, wait a bit and call again
+ *      EXP_FAILED: exposure failed and the burst must be retried
+ *      FAILURE: saving the image failed, log written to stderr
+ *      EPERM: calling lucky_step_nir before starting a burst
+ *      EIO: failed to fetch data from camera
+ *      ENODEV: camera disconnected
+ */
+int lucky_step_nir_local(void);
+
+/* lucky_abort_nir_local:
+ * Abort an ongoing burst and save the stack of the frames taken so far.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EXP_FAILED: no frame with stars was taken, nothing saved
+ *      FAILURE: saving the image failed, log written to stderr
+ */
+int lucky_abort_nir_local(void);
+
+/* frame id of the next image, used in file names and the FRAMEID key */
+int get_nir_frame_id_l(void);
+
 double get_nir_temp_l(void);
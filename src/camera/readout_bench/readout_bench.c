@@ -0,0 +1,344 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Readout Bench
+ * Parent Component: Camera
+ * Author(s):
+ * Purpose: Measure the image readout time, throughput and dropped frames of
+ *          a camera for a range of USB readout settings.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "global_utils.h"
+#include "lock.h"
+#include "camera_utils.h"
+#include "cam_supervisor.h"
+#include "exp_timing.h"
+#include "readout_bench.h"
+
+/* exposure of the benchmark frames, short so readout dominates, unit: us */
+#define BENCH_EXP 1000
+
+/* longest wait for an exposure to finish before it is counted as dropped */
+#define BENCH_TIMEOUT 2
+
+static const int bench_bandwidth[] = {40, 60, 80, 100};
+static const int bench_high_speed[] = {0, 1};
+
+typedef struct{
+    int frames, dropped;
+    double min, max, sum;   /* readout time, unit: s */
+} bench_stat_t;
+
+static void* thread_func(void* arg);
+static void run_bench(char cam_name, int frames);
+static int bench_setting(int id, unsigned short* buffer, long size,
+        int frames, bench_stat_t* stat);
+static int read_frame(int id, unsigned short* buffer, long size, double* time);
+static double mono_diff(const struct timespec* a, const struct timespec* b);
+
+static lock_t mutex_bench = LOCK_INITIALIZER("mutex_bench");
+static pthread_cond_t cond_bench = PTHREAD_COND_INITIALIZER;
+
+static char bench_cam;
+static int bench_frames;
+static char running = 0;
+
+static FILE* bench_log;
+
+int init_readout_bench(void* args){
+
+    char log_fn[100];
+
+    strcpy(log_fn, get_top_dir());
+    strcat(log_fn, "output/logs/readout_bench.log");
+
+    bench_log = fopen(log_fn, "a");
+
+    return create_thread("readout_bench", thread_func, 12);
+}
+
+/* readout_bench_start:
+ * Start a benchmark of a camera in the background. Every combination of USB
+ * bandwidth and high speed mode is tested with a number of short exposures and
+ * the results are written to output/logs/readout_bench.log. The camera is
+ * locked for the duration, other users of it will wait. A camera with an
+ * exposure ongoing or not yet read out is not benchmarked.
+ *
+ * input:
+ *      cam_name: 'n' for nir camera, 'g' for guiding camera
+ *      frames: number of frames read out per setting
+ *
+ * return:
+ *      SUCCESS: benchmark started
+ *      EINVAL: incorrect camera name or number of frames
+ *      EBUSY: a benchmark is already running or the camera is exposing
+ */
+int readout_bench_start(char cam_name, int frames){
+
+    if((cam_name != 'n' && cam_name != 'g') || frames < 1){
+        return EINVAL;
+    }
+
+    ASI_CAMERA_INFO* info = cam_sup_info(cam_name);
+    if(info != NULL && cam_sup_busy(cam_sup_id(info))){
+        return EBUSY;
+    }
+
+    lock_acquire(&mutex_bench);
+
+    if(running){
+        lock_release(&mutex_bench);
+        return EBUSY;
+    }
+
+    bench_cam = cam_name;
+    bench_frames = frames;
+    running = 1;
+
+    pthread_cond_signal(&cond_bench);
+    lock_release(&mutex_bench);
+
+    return SUCCESS;
+}
+
+static void* thread_func(void* arg){
+
+    lock_acquire(&mutex_bench);
+
+    while(1){
+
+        while(!running){
+            lock_cond_wait(&cond_bench, &mutex_bench);
+        }
+
+        char cam_name = bench_cam;
+        int frames = bench_frames;
+        lock_release(&mutex_bench);
+
+        run_bench(cam_name, frames);
+
+        lock_acquire(&mutex_bench);
+        running = 0;
+    }
+
+    return NULL;
+}
+
+/* run_bench:
+ * Test every readout setting on a camera and restore the previous settings.
+ */
+static void run_bench(char cam_name, int frames){
+
+    char* name = cam_name == 'n' ? "NIR" : "guiding";
+
+    ASI_CAMERA_INFO* info = cam_sup_info(cam_name);
+    int id = info == NULL ? -1 : cam_sup_id(info);
+    if(id < 0 || cam_sup_acquire(id)){
+        logging(ERROR, "Bench", "%s camera not connected", name);
+        return;
+    }
+
+    /* checked again with the camera held, an exposure may have started since
+     * the command */
+    if(cam_sup_busy(id)){
+        logging(WARN, "Bench", "%s camera exposing, not benchmarked", name);
+        cam_sup_release(id);
+        return;
+    }
+
+    if(exp_timing_hw(id)){
+        logging(ERROR, "Bench", "%s camera in trigger mode, not benchmarked",
+                name);
+        cam_sup_release(id);
+        return;
+    }
+
+    long size = (long)info->MaxWidth * info->MaxHeight * 2;
+    unsigned short* buffer = malloc(size);
+    if(buffer == NULL){
+        logging(ERROR, "Bench", "Cannot allocate memory for image buffer");
+        cam_sup_release(id);
+        return;
+    }
+
+    /* settings to restore afterwards */
+    long bandwidth, high_speed;
+    ASI_BOOL pb_auto;
+    ASIGetControlValue(id, ASI_BANDWIDTHOVERLOAD, &bandwidth, &pb_auto);
+    ASIGetControlValue(id, ASI_HIGH_SPEED_MODE, &high_speed, &pb_auto);
+
+    ASISetControlValue(id, ASI_EXPOSURE, BENCH_EXP, ASI_FALSE);
+
+    logging(INFO, "Bench", "Benchmarking readout of %s camera, %d frames "
+            "per setting", name, frames);
+
+    double best_rate = 0;
+    int best_bw = 0, best_hs = 0;
+
+    int bw_count = sizeof(bench_bandwidth) / sizeof(*bench_bandwidth);
+    int hs_count = sizeof(bench_high_speed) / sizeof(*bench_high_speed);
+
+    for(int bb=0; bb<bw_count; ++bb){
+        for(int hh=0; hh<hs_count; ++hh){
+
+            int bw = bench_bandwidth[bb];
+            int hs = bench_high_speed[hh];
+
+            if(     ASISetControlValue(id, ASI_BANDWIDTHOVERLOAD, bw,
+                        ASI_FALSE) != ASI_SUCCESS ||
+                    ASISetControlValue(id, ASI_HIGH_SPEED_MODE, hs,
+                        ASI_FALSE) != ASI_SUCCESS){
+
+                logging(WARN, "Bench", "%s camera rejected bandwidth %d%%, "
+                        "high speed %d", name, bw, hs);
+                continue;
+            }
+
+            bench_stat_t stat;
+            if(bench_setting(id, buffer, size, frames, &stat) == ENODEV){
+                logging(ERROR, "Bench", "%s camera lost during benchmark",
+                        name);
+                cam_sup_lost(id);
+                cam_sup_release(id);
+                free(buffer);
+                return;
+            }
+
+            int read = stat.frames - stat.dropped;
+            double mean = read ? stat.sum / read : 0;
+            double rate = read ? size / mean / 1000000 : 0;
+
+            logging_csv(bench_log, "%c,%d,%d,%d,%d,%.2lf,%.2lf,%.2lf,%.2lf",
+                    cam_name, bw, hs, stat.frames, stat.dropped,
+                    stat.min * 1000, mean * 1000, stat.max * 1000, rate);
+
+            logging(INFO, "Bench", "%s bandwidth %3d%%, high speed %d: "
+                    "%.1lf ms, %.1lf MB/s, %d/%d dropped", name, bw, hs,
+                    mean * 1000, rate, stat.dropped, stat.frames);
+
+            /* a setting dropping frames is not usable */
+            if(!stat.dropped && rate > best_rate){
+                best_rate = rate;
+                best_bw = bw;
+                best_hs = hs;
+            }
+        }
+    }
+
+    ASISetControlValue(id, ASI_BANDWIDTHOVERLOAD, bandwidth, ASI_FALSE);
+    ASISetControlValue(id, ASI_HIGH_SPEED_MODE, high_speed, ASI_FALSE);
+
+    cam_sup_release(id);
+    free(buffer);
+
+    if(best_rate > 0){
+        logging(INFO, "Bench", "Best %s readout without drops: bandwidth "
+                "%d%%, high speed %d, %.1lf MB/s", name, best_bw, best_hs,
+                best_rate);
+    }
+    else{
+        logging(WARN, "Bench", "No %s readout setting without drops", name);
+    }
+}
+
+/* bench_setting:
+ * Expose and read out frames with the current settings.
+ *
+ * return:
+ *      SUCCESS: all frames attempted, drops counted in stat
+ *      ENODEV: camera disconnected
+ */
+static int bench_setting(int id, unsigned short* buffer, long size,
+        int frames, bench_stat_t* stat){
+
+    memset(stat, 0, sizeof(*stat));
+
+    for(int ii=0; ii<frames; ++ii){
+        double time;
+        int ret = read_frame(id, buffer, size, &time);
+
+        stat->frames++;
+
+        if(ret == ENODEV){
+            return ENODEV;
+        }
+        if(ret != SUCCESS){
+            stat->dropped++;
+            continue;
+        }
+
+        int read = stat->frames - stat->dropped;
+        if(read == 1 || time < stat->min){
+            stat->min = time;
+        }
+        if(read == 1 || time > stat->max){
+            stat->max = time;
+        }
+        stat->sum += time;
+    }
+
+    return SUCCESS;
+}
+
+/* read_frame:
+ * Take one exposure and time its readout.
+ *
+ * return:
+ *      SUCCESS: frame read, readout time in time
+ *      EIO: exposure failed, timed out or readout failed
+ *      ENODEV: camera disconnected
+ */
+static int read_frame(int id, unsigned short* buffer, long size, double* time){
+
+    struct timespec start, before, after;
+    ASI_EXPOSURE_STATUS status;
+
+    int ret = ASIStartExposure(id, ASI_FALSE);
+    if(ret != ASI_SUCCESS){
+        return disconnected(ret) ? ENODEV : EIO;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct timespec poll = {0, 1000000};
+
+    do{
+        nanosleep(&poll, NULL);
+
+        ret = ASIGetExpStatus(id, &status);
+        if(disconnected(ret)){
+            return ENODEV;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        if(mono_diff(&before, &start) > BENCH_TIMEOUT){
+            ASIStopExposure(id);
+            return EIO;
+        }
+    } while(status == ASI_EXP_WORKING);
+
+    if(status != ASI_EXP_SUCCESS){
+        return EIO;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    ret = ASIGetDataAfterExp(id, (unsigned char*)buffer, size);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+
+    if(ret != ASI_SUCCESS){
+        return disconnected(ret) ? ENODEV : EIO;
+    }
+
+    *time = mono_diff(&after, &before);
+    return SUCCESS;
+}
+
+/* a - b in seconds */
+static double mono_diff(const struct timespec* a, const struct timespec* b){
+    return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1000000000.0;
+}
@@ -0,0 +1,31 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Readout Bench
+ * Parent Component: Camera
+ * Author(s):
+ * Purpose: Measure the image readout time, throughput and dropped frames of
+ *          a camera for a range of USB readout settings.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+/* initialise the readout bench component */
+int init_readout_bench(void* args);
+
+/* readout_bench_start:
+ * Start a benchmark of a camera in the background. Every combination of USB
+ * bandwidth and high speed mode is tested with a number of short exposures and
+ * the results are written to output/logs/readout_bench.log. The camera is
+ * locked for the duration, other users of it will wait. A camera with an
+ * exposure ongoing or not yet read out is not benchmarked.
+ *
+ * input:
+ *      cam_name: 'n' for nir camera, 'g' for guiding camera
+ *      frames: number of frames read out per setting
+ *
+ * return:
+ *      SUCCESS: benchmark started
+ *      EINVAL: incorrect camera name or number of frames
+ *      EBUSY: a benchmark is already running or the camera is exposing
+ */
+int readout_bench_start(char cam_name, int frames);
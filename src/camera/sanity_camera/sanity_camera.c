@@ -1,14 +1,638 @@
 /* -----------------------------------------------------------------------------
  * Component Name: Sanity Camera
  * Parent Component: Camera
- * Author(s): 
+ * Author(s):
  * Purpose: Provide an interface to the sanity camera to enable the capturing
  *          of images.
  * -----------------------------------------------------------------------------
  */
 
+/**
+ * The sanity camera is a V4L2 device, e.g. a USB webcam, streamed through
+ * mmap'd driver buffers. Snapshots are taken at a configurable cadence or on
+ * request and queued for downlink at a lower priority than every science
+ * image. Frames are written straight from the driver buffer:
+ *      MJPEG: the frame as is, a JPEG without huffman tables if the camera
+ *             leaves them out (the MJPEG default tables apply)
+ *      YUYV:  a binary PGM thumbnail of the luma, SANITY_THUMB times smaller
+ *
+ * The camera is opened on the first snapshot and reopened after it has been
+ * disconnected, a missing camera does not stop the OBSW. The kernel module
+ * vivid provides a test device. Built with SANITY_STANDIN, frames are read
+ * from output/sanity/standin.jpg, or a raw SANITY_WIDTH x SANITY_HEIGHT YUYV
+ * frame in output/sanity/standin.yuv, instead.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "global_utils.h"
+#include "lock.h"
+#include "img_processing.h"
+#include "sanity_camera.h"
+
+/* V4L2 device of the sanity camera */
+#define SANITY_DEV "/dev/video0"
+
+/* requested frame size, the driver may choose the nearest it supports */
+#define SANITY_WIDTH 640
+#define SANITY_HEIGHT 480
+
+/* mmap'd streaming buffers requested from the driver */
+#define SANITY_BUFFERS 4
+
+/* frames dropped after the stream starts while auto exposure settles */
+#define SANITY_SETTLE 5
+
+/* thumbnails of YUYV frames are the mean of SANITY_THUMB x SANITY_THUMB pixels */
+#define SANITY_THUMB 4
+
+/* widest thumbnail, unit: pixels */
+#define SANITY_THUMB_MAX 1024
+
+/* default time between snapshots, unit: seconds */
+#define SANITY_PERIOD_S 300
+
+/* longest wait for a frame, unit: milliseconds */
+#define SANITY_FRAME_TIMEOUT 2000
+
+typedef struct {
+    void* start;
+    size_t length;
+} sanity_buf_t;
+
+static void* thread_func(void* arg);
+static int snapshot(void);
+static int open_dev(void);
+static void close_dev(void);
+static int start_stream(void);
+static void stop_stream(void);
+static int grab(int* index, size_t* bytes);
+static int release(int index);
+static int write_jpeg(const void* frame, size_t bytes, const char* fn);
+static int write_thumb(const uint8_t* frame, const char* fn);
+#ifndef SANITY_STANDIN
+static int xioctl(int fd, unsigned long request, void* arg);
+#endif
+
+static lock_t mutex_sanity = LOCK_INITIALIZER("mutex_sanity");
+static pthread_cond_t cond_sanity;
+
+/* guarded by mutex_sanity */
+static int period_s = SANITY_PERIOD_S;
+static char pending = 0;
+
+/* owned by the sanity camera thread */
+static int fd = -1;
+static sanity_buf_t bufs[SANITY_BUFFERS];
+static int buf_count = 0;
+static struct v4l2_pix_format pix;
+static int img_cntr = 0;
+
+static char out_fp[100];
+
+#ifdef SANITY_STANDIN
+static char standin_fp[100];
+#endif
 
 int init_sanity_camera(void* args){
+
+    strcpy(out_fp, get_top_dir());
+    strcat(out_fp, "output/compression/");
+
+#ifdef SANITY_STANDIN
+    strcpy(standin_fp, get_top_dir());
+    strcat(standin_fp, "output/sanity/standin");
+#endif
+
+    /* the cadence is kept on the monotonic clock */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int ret = pthread_cond_init(&cond_sanity, &attr);
+    pthread_condattr_destroy(&attr);
+    if(ret){
+        logging(ERROR, "Sanity Cam", "Failed to create condition: %s",
+                strerror(ret));
+        return ret;
+    }
+
+    return create_thread("sanity_cam", thread_func, 9);
+}
+
+/* sanity_image_local:
+ * Take a snapshot with the sanity camera as soon as possible, it is queued
+ * for downlink. Never blocks on the camera.
+ */
+void sanity_image_local(void){
+
+    lock_acquire(&mutex_sanity);
+    pending = 1;
+    pthread_cond_signal(&cond_sanity);
+    lock_release(&mutex_sanity);
+}
+
+/* sanity_cadence_local:
+ * Set the time between snapshots and take one right away, the cadence
+ * starts over from it.
+ *
+ * input:
+ *      period: time between snapshots, 0 for snapshots on request only,
+ *              unit: seconds
+ */
+void sanity_cadence_local(int period){
+
+    lock_acquire(&mutex_sanity);
+    period_s = period > 0 ? period : 0;
+    pending = 1;
+    pthread_cond_signal(&cond_sanity);
+    lock_release(&mutex_sanity);
+
+    logging(INFO, "Sanity Cam", "Snapshot every %d s (0: on request)", period_s);
+}
+
+static void* thread_func(void* arg){
+
+    lock_acquire(&mutex_sanity);
+
+    while(1){
+
+        struct timespec wake;
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        wake.tv_sec += period_s;
+
+        while(!pending){
+            int ret = period_s > 0 ?
+                    lock_cond_timedwait(&cond_sanity, &mutex_sanity, &wake) :
+                    lock_cond_wait(&cond_sanity, &mutex_sanity);
+
+            if(ret == ETIMEDOUT){
+                break;
+            }
+        }
+        pending = 0;
+
+        lock_release(&mutex_sanity);
+
+        int ret = snapshot();
+        if(ret){
+            logging(WARN, "Sanity Cam", "No snapshot taken: %s", strerror(ret));
+        }
+
+        lock_acquire(&mutex_sanity);
+    }
+
+    return NULL;
+}
+
+/* snapshot:
+ * Stream until auto exposure settles, write one frame and queue it.
+ *
+ * return:
+ *      SUCCESS: snapshot queued
+ *      otherwise an error number, the camera is closed if it is gone
+ */
+static int snapshot(void){
+
+    int ret;
+
+    if(fd == -1){
+        ret = open_dev();
+        if(ret){
+            return ret;
+        }
+    }
+
+    ret = start_stream();
+    if(ret){
+        close_dev();
+        return ret;
+    }
+
+    int index = -1;
+    size_t bytes = 0;
+
+    for(int ii=0; ii<=SANITY_SETTLE; ++ii){
+        if(index >= 0 && (ret = release(index))){
+            break;
+        }
+        index = -1;
+
+        ret = grab(&index, &bytes);
+        if(ret){
+            break;
+        }
+    }
+
+    if(ret == SUCCESS){
+        char fn[120];
+        char jpeg = pix.pixelformat != V4L2_PIX_FMT_YUYV;
+
+        snprintf(fn, sizeof(fn), "%ssanity%04d.%s", out_fp, img_cntr++,
+                jpeg ? "jpg" : "pgm");
+
+        ret = jpeg ? write_jpeg(bufs[index].start, bytes, fn) :
+                write_thumb(bufs[index].start, fn);
+
+        if(ret == SUCCESS){
+            queue_image(fn, IMAGE_SANITY);
+        }
+    }
+
+    stop_stream();
+
+    /* unplugged or wedged, start over on the next snapshot */
+    if(ret == ENODEV || ret == EIO || ret == ETIMEDOUT){
+        close_dev();
+    }
+
+    return ret;
+}
+
+#ifndef SANITY_STANDIN
+
+/* open_dev:
+ * Open the camera, choose MJPEG or YUYV and map its streaming buffers.
+ *
+ * return:
+ *      SUCCESS: camera ready to stream
+ *      otherwise an error number, nothing is left open
+ */
+static int open_dev(void){
+
+    fd = open(SANITY_DEV, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if(fd == -1){
+        return errno;
+    }
+
+    struct v4l2_capability cap;
+    if(xioctl(fd, VIDIOC_QUERYCAP, &cap) ||
+            !(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+            !(cap.capabilities & V4L2_CAP_STREAMING)){
+        logging(ERROR, "Sanity Cam", "%s cannot stream video", SANITY_DEV);
+        close_dev();
+        return ENODEV;
+    }
+
+    /* compressed by the camera if it can, else a thumbnail is made */
+    const uint32_t formats[] = {V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_JPEG,
+            V4L2_PIX_FMT_YUYV};
+    struct v4l2_format fmt;
+
+    size_t ii;
+    for(ii=0; ii<sizeof(formats)/sizeof(*formats); ++ii){
+        memset(&fmt, 0, sizeof(fmt));
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmt.fmt.pix.width = SANITY_WIDTH;
+        fmt.fmt.pix.height = SANITY_HEIGHT;
+        fmt.fmt.pix.pixelformat = formats[ii];
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+
+        if(xioctl(fd, VIDIOC_S_FMT, &fmt) == 0 &&
+                fmt.fmt.pix.pixelformat == formats[ii]){
+            break;
+        }
+    }
+
+    if(ii == sizeof(formats)/sizeof(*formats)){
+        logging(ERROR, "Sanity Cam", "%s supports neither MJPEG nor YUYV",
+                SANITY_DEV);
+        close_dev();
+        return ENOTSUP;
+    }
+
+    pix = fmt.fmt.pix;
+
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = SANITY_BUFFERS;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+
+    if(xioctl(fd, VIDIOC_REQBUFS, &req) || req.count < 2){
+        int ret = req.count < 2 ? ENOMEM : errno;
+        logging(ERROR, "Sanity Cam", "No streaming buffers: %s", strerror(ret));
+        close_dev();
+        return ret;
+    }
+
+    for(buf_count=0; buf_count < (int)req.count && buf_count < SANITY_BUFFERS;
+            ++buf_count){
+
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = buf_count;
+
+        if(xioctl(fd, VIDIOC_QUERYBUF, &buf)){
+            int ret = errno;
+            close_dev();
+            return ret;
+        }
+
+        bufs[buf_count].length = buf.length;
+        bufs[buf_count].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, buf.m.offset);
+
+        if(bufs[buf_count].start == MAP_FAILED){
+            int ret = errno;
+            close_dev();
+            return ret;
+        }
+    }
+
+    logging(INFO, "Sanity Cam", "%s: %s, %ux%u %.4s, %d buffers", SANITY_DEV,
+            cap.card, pix.width, pix.height, (char*)&pix.pixelformat, buf_count);
+
     return SUCCESS;
 }
+
+static void close_dev(void){
+
+    for(int ii=0; ii<buf_count; ++ii){
+        if(bufs[ii].start != MAP_FAILED){
+            munmap(bufs[ii].start, bufs[ii].length);
+        }
+    }
+    buf_count = 0;
+
+    if(fd != -1){
+        close(fd);
+        fd = -1;
+    }
+}
+
+/* queue every buffer and start streaming */
+static int start_stream(void){
+
+    for(int ii=0; ii<buf_count; ++ii){
+        int ret = release(ii);
+        if(ret){
+            return ret;
+        }
+    }
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if(xioctl(fd, VIDIOC_STREAMON, &type)){
+        return errno;
+    }
+
+    return SUCCESS;
+}
+
+/* stop streaming, which also takes back every buffer from the driver */
+static void stop_stream(void){
+
+    if(fd == -1){
+        return;
+    }
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd, VIDIOC_STREAMOFF, &type);
+}
+
+/* grab:
+ * Wait for the next frame and take its buffer from the driver.
+ *
+ * output:
+ *      index: buffer holding the frame, give it back with release
+ *      bytes: size of the frame, unit: bytes
+ *
+ * return:
+ *      SUCCESS: frame in bufs[index]
+ *      otherwise an error number
+ */
+static int grab(int* index, size_t* bytes){
+
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    while(1){
+        int ret = poll(&pfd, 1, SANITY_FRAME_TIMEOUT);
+        if(ret == 0){
+            return ETIMEDOUT;
+        }
+        if(ret < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return errno;
+        }
+
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+
+        if(xioctl(fd, VIDIOC_DQBUF, &buf)){
+            if(errno == EAGAIN){
+                continue;
+            }
+            return errno;
+        }
+
+        /* a corrupt frame is dropped */
+        if(buf.flags & V4L2_BUF_FLAG_ERROR){
+            int ret = release(buf.index);
+            if(ret){
+                return ret;
+            }
+            continue;
+        }
+
+        *index = buf.index;
+        *bytes = buf.bytesused;
+        return SUCCESS;
+    }
+}
+
+/* give a buffer back to the driver, returns SUCCESS or an error number */
+static int release(int index){
+
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+
+    if(xioctl(fd, VIDIOC_QBUF, &buf)){
+        return errno;
+    }
+
+    return SUCCESS;
+}
+
+/* ioctl restarted when interrupted by a signal */
+static int xioctl(int fd, unsigned long request, void* arg){
+
+    int ret;
+    do{
+        ret = ioctl(fd, request, arg);
+    } while(ret == -1 && errno == EINTR);
+
+    return ret;
+}
+
+#else
+
+/* open_dev:
+ * Load the stand-in frame, a JPEG or a raw YUYV frame, into one buffer.
+ */
+static int open_dev(void){
+
+    char fn[120];
+    FILE* fp;
+
+    snprintf(fn, sizeof(fn), "%s.jpg", standin_fp);
+    pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+    fp = fopen(fn, "rb");
+
+    if(fp == NULL){
+        snprintf(fn, sizeof(fn), "%s.yuv", standin_fp);
+        pix.pixelformat = V4L2_PIX_FMT_YUYV;
+        fp = fopen(fn, "rb");
+    }
+
+    if(fp == NULL){
+        logging(ERROR, "Sanity Cam", "No stand-in frame in %s.{jpg,yuv}",
+                standin_fp);
+        return ENODEV;
+    }
+
+    pix.width = SANITY_WIDTH;
+    pix.height = SANITY_HEIGHT;
+    pix.bytesperline = SANITY_WIDTH * 2;
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+
+    if(pix.pixelformat == V4L2_PIX_FMT_YUYV &&
+            size < (long)pix.bytesperline * pix.height){
+        logging(ERROR, "Sanity Cam", "%s is not a %dx%d YUYV frame", fn,
+                SANITY_WIDTH, SANITY_HEIGHT);
+        fclose(fp);
+        return EINVAL;
+    }
+
+    bufs[0].start = malloc(size);
+    bufs[0].length = size;
+    if(bufs[0].start == NULL || fread(bufs[0].start, 1, size, fp) != (size_t)size){
+        free(bufs[0].start);
+        fclose(fp);
+        return EIO;
+    }
+    fclose(fp);
+
+    buf_count = 1;
+    fd = 0;
+
+    logging(INFO, "Sanity Cam", "Stand-in frame %s", fn);
+
+    return SUCCESS;
+}
+
+static void close_dev(void){
+
+    if(buf_count){
+        free(bufs[0].start);
+        buf_count = 0;
+    }
+    fd = -1;
+}
+
+static int start_stream(void){
+    return SUCCESS;
+}
+
+static void stop_stream(void){
+}
+
+static int grab(int* index, size_t* bytes){
+    *index = 0;
+    *bytes = bufs[0].length;
+    return SUCCESS;
+}
+
+static int release(int index){
+    return SUCCESS;
+}
+
+#endif
+
+/* write a compressed frame as is */
+static int write_jpeg(const void* frame, size_t bytes, const char* fn){
+
+    FILE* fp = fopen(fn, "wb");
+    if(fp == NULL){
+        int ret = errno;
+        logging(ERROR, "Sanity Cam", "Could not open %s: %s", fn, strerror(ret));
+        return ret;
+    }
+
+    size_t written = fwrite(frame, 1, bytes, fp);
+    fclose(fp);
+
+    return written == bytes ? SUCCESS : EIO;
+}
+
+/* write_thumb:
+ * Write a binary PGM thumbnail of the luma of a YUYV frame, each pixel the
+ * mean of a SANITY_THUMB x SANITY_THUMB block.
+ */
+static int write_thumb(const uint8_t* frame, const char* fn){
+
+    int width = pix.width / SANITY_THUMB;
+    int height = pix.height / SANITY_THUMB;
+    if(width > SANITY_THUMB_MAX){
+        width = SANITY_THUMB_MAX;
+    }
+
+    FILE* fp = fopen(fn, "wb");
+    if(fp == NULL){
+        int ret = errno;
+        logging(ERROR, "Sanity Cam", "Could not open %s: %s", fn, strerror(ret));
+        return ret;
+    }
+
+    fprintf(fp, "P5\n%d %d\n255\n", width, height);
+
+    uint8_t row[SANITY_THUMB_MAX];
+
+    for(int yy=0; yy<height; ++yy){
+        for(int xx=0; xx<width; ++xx){
+
+            unsigned sum = 0;
+            for(int dy=0; dy<SANITY_THUMB; ++dy){
+                /* Y0 U Y1 V, luma at every even byte */
+                const uint8_t* line = frame +
+                        (size_t)(yy * SANITY_THUMB + dy) * pix.bytesperline;
+                for(int dx=0; dx<SANITY_THUMB; ++dx){
+                    sum += line[2 * (xx * SANITY_THUMB + dx)];
+                }
+            }
+
+            row[xx] = sum / (SANITY_THUMB * SANITY_THUMB);
+        }
+
+        fwrite(row, 1, width, fp);
+    }
+
+    int ret = ferror(fp) ? EIO : SUCCESS;
+    fclose(fp);
+
+    return ret;
+}
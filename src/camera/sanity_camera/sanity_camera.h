@@ -16,3 +16,13 @@ int init_sanity_camera(void* args);
  * provided to external components
  */
 void sanity_image_local( void );
+
+/* sanity_cadence_local:
+ * Set the time between snapshots of the sanity camera and take one right
+ * away, provided to external components
+ *
+ * input:
+ *      period: time between snapshots, 0 for snapshots on request only,
+ *              unit: seconds
+ */
+void sanity_cadence_local(int period);
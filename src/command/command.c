@@ -7,6 +7,7 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
 #include <pthread.h>
 #include <limits.h>
 #include <stdlib.h>
@@ -24,6 +25,11 @@
 #include "gpio.h"
 #include "current_target.h"
 #include "pid.h"
+#include "lucky_imaging.h"
+#include "camera.h"
+#include "pointing_model.h"
+#include "flight_recorder.h"
+#include "img_processing.h"
 
 static void* thread_command(void* param);
 static int handle_command(char command);
@@ -124,6 +130,10 @@ static int handle_command(char command){
             if(set_enc_offsets()){
                 send_telemetry_local("Setting encoder offsets failed.", 1, 0, 0);
             }
+            else{
+                /* the model was fitted to the old encoder angles */
+                set_pointing_model(PM_RESET);
+            }
             break;
 
         case CMD_CENTER:
@@ -201,6 +211,180 @@ static int handle_command(char command){
             gpio_write(4, HIGH);
             break;
 
+        case CMD_EXP_SYNC:
+
+            /* 0 disables, otherwise the maximum delay of an exposure in s */
+            read_elink(buffer, 4);
+            value = *(int*)&buffer[0];
+
+            if(value > 0){
+                set_exp_sync_max_wait(value);
+            }
+            set_exp_sync(value > 0);
+
+            break;
+
+        case CMD_NIR_MODE:
+            {
+                /* frames, exposure per frame in us, frames kept. 0 frames
+                 * selects long exposures */
+                read_elink(buffer, 12);
+                int frames = *(int*)&buffer[0];
+                int exp = *(int*)&buffer[4];
+                int keep = *(int*)&buffer[8];
+
+                if(frames < 0 || (frames > 0 && (exp <= 0 || keep < 1 ||
+                        keep > LUCKY_MAX_KEEP || keep > frames))){
+                    logging(ERROR, "Command", "Invalid NIR mode: %d %d %d",
+                            frames, exp, keep);
+                    break;
+                }
+
+                set_lucky_mode(frames, exp, keep);
+            }
+            break;
+
+        case CMD_CAM_READOUT:
+            {
+                /* camera (0 nir, 1 guiding), bandwidth in %, high speed mode.
+                 * -1 leaves a control at the camera default */
+                read_elink(buffer, 12);
+                char cam = *(int*)&buffer[0] ? 'g' : 'n';
+                int bandwidth = *(int*)&buffer[4];
+                int high_speed = *(int*)&buffer[8];
+
+                int ret = set_readout(cam, bandwidth, high_speed);
+                if(ret != SUCCESS && ret != ENODEV){
+                    logging(ERROR, "Command", "Invalid readout setting: "
+                            "%d %d, return value: %d", bandwidth, high_speed,
+                            ret);
+                }
+            }
+            break;
+
+        case CMD_READOUT_BENCH:
+            {
+                /* camera (0 nir, 1 guiding), frames per setting */
+                read_elink(buffer, 8);
+                char cam = *(int*)&buffer[0] ? 'g' : 'n';
+                int frames = *(int*)&buffer[4];
+
+                if(bench_readout(cam, frames) != SUCCESS){
+                    logging(ERROR, "Command",
+                            "Readout benchmark not started");
+                }
+            }
+            break;
+
+        case CMD_KF_ADAPT:
+
+            /* bit 0 adapts R, bit 1 adapts Q */
+            read_elink(buffer, 4);
+            value = *(int*)&buffer[0];
+
+            set_kf_adapt(value & 1, (value >> 1) & 1);
+
+            break;
+
+        case CMD_KF_GATE:
+
+            /* chi-square gate in hundredths, 0 disables gating */
+            read_elink(buffer, 4);
+            value = *(int*)&buffer[0];
+
+            set_kf_gate(value / 100.0);
+
+            break;
+
+        case CMD_FR_DUMP:
+
+            if(fr_trigger(FR_TRIG_COMMAND, "ground command") == SUCCESS){
+                send_telemetry_local("Flight recorder dump triggered", 1, 0, 0);
+            }
+            else{
+                send_telemetry_local("Flight recorder dump already pending",
+                        1, 0, 0);
+            }
+            break;
+
+        case CMD_SANITY:
+
+            /* seconds between snapshots, 0 on request only, negative keeps
+             * the cadence, a snapshot is taken either way */
+            read_elink(buffer, 4);
+            value = *(int*)&buffer[0];
+
+            if(value < 0){
+                sanity_image();
+            }
+            else{
+                sanity_cadence(value);
+            }
+
+            break;
+
+        case CMD_POINT_MODEL:
+
+            /* 0 off, 1 on, 2 reset, see PM_* */
+            read_elink(buffer, 4);
+            value = *(int*)&buffer[0];
+
+            set_pointing_model(value);
+
+            break;
+
+        case CMD_REF_FRAMES:
+
+            /* images from one keyframe to the next, 0 compresses every image
+             * on its own */
+            read_elink(buffer, 4);
+            value = *(int*)&buffer[0];
+
+            set_ref_frames(value);
+
+            break;
+
+        case CMD_QUICK_LOOK:
+            {
+                /* 0 off, 1 on, 2 while the downlink is saturated, see QL_*.
+                 * Step in hundredths of sigma, 0 keeps the step */
+                read_elink(buffer, 8);
+                int mode = *(int*)&buffer[0];
+                int step = *(int*)&buffer[4];
+
+                set_quick_look(mode, step / 100.0);
+            }
+            break;
+
+        case CMD_CATALOG:
+            {
+                /* 1 on, 0 off. Threshold in tenths of sigma and aperture
+                 * radius in tenths of pixels, 0 keeps the value */
+                read_elink(buffer, 12);
+                int enable = *(int*)&buffer[0];
+                int sigma = *(int*)&buffer[4];
+                int radius = *(int*)&buffer[8];
+
+                set_catalog(enable, sigma / 10.0, radius / 10.0);
+            }
+            break;
+
+        case CMD_SEND_RANGE:
+            {
+                /* file name as sent, 64 characters with the terminating
+                 * null, offset and length in bytes of the decompressed file */
+                read_elink(buffer, 72);
+                buffer[63] = '\0';
+                int offset = *(int*)&buffer[64];
+                int len = *(int*)&buffer[68];
+
+                if(queue_range(buffer, offset, len) != SUCCESS){
+                    logging(ERROR, "Command", "Invalid range: %s %d %d",
+                            buffer, offset, len);
+                }
+            }
+            break;
+
         case CMD_ROT_CYCLE:
             move_az_to(60);
             sleep(1);
@@ -11,7 +11,18 @@
 #define CMD_ENC_OFFSETS 0
 #define CMD_ROT_CYCLE 1
 #define CMD_UPD_PID 2
+#define CMD_CAM_READOUT 3
+#define CMD_READOUT_BENCH 4
+#define CMD_KF_ADAPT 5
+#define CMD_KF_GATE 6
+#define CMD_FR_DUMP 7
+#define CMD_SANITY 8
+#define CMD_POINT_MODEL 9
 #define CMD_REBOOT 10
+#define CMD_SEND_RANGE 11
+#define CMD_REF_FRAMES 12
+#define CMD_QUICK_LOOK 13
+#define CMD_CATALOG 14
 #define CMD_DATARATE 20
 #define CMD_MODE 30
 #define CMD_PING 40
@@ -27,6 +38,8 @@
 #define CMD_ALT_ERR 105
 #define CMD_STOP_MOTORS 110
 #define CMD_START_MOTORS 115
+#define CMD_EXP_SYNC 120
+#define CMD_NIR_MODE 125
 
 
 /* initialise the command component */
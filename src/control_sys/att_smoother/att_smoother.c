@@ -0,0 +1,397 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Attitude Smoother
+ * Parent Component: Control System
+ * Author(s):
+ * Purpose: Refine the attitude recorded during each NIR exposure with a
+ *          fixed-lag Rauch-Tung-Striebel smoother, using the star tracker
+ *          fixes that arrive after the exposure has ended. Runs at low
+ *          priority and appends the smoothed track to the attitude sidecar
+ *          before it is queued for compression.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "global_utils.h"
+#include "lock.h"
+#include "arena.h"
+#include "ring.h"
+#include "img_processing.h"
+#include "current_target.h"
+#include "kalman_filter.h"
+#include "attitude_recorder.h"
+#include "att_smoother.h"
+
+/* time after the end of an exposure before it is smoothed, unit: seconds.
+ * Covers a few star tracker fixes after the exposure. */
+#define SMOOTH_LAG_S 60
+
+/* longest exposure smoothed in full, matches the attitude recorder */
+#define SMOOTH_EXP_S 300
+
+#define SMOOTH_RATE (1000000000 / CONTROL_SYS_WAIT)
+#define SMOOTH_LEN ((SMOOTH_EXP_S + SMOOTH_LAG_S + 30) * SMOOTH_RATE)
+
+/* entries left untouched when copying, the control loop keeps writing */
+#define SMOOTH_GUARD SMOOTH_RATE
+
+#define SMOOTH_JOBS 8
+
+typedef struct{
+    double x[2];            /* angle, gyro bias */
+    double p[2][2];
+    double w;               /* gyro rate propagated into this step */
+    double q, q2;           /* process noise used for this step */
+} smooth_axis_t;
+
+typedef struct{
+    int64_t t_ns;           /* CLOCK_MONOTONIC */
+    long reinits;           /* filter reinitialisations so far */
+    smooth_axis_t az, alt;
+} smooth_entry_t;
+
+typedef struct{
+    char filepath[100];
+    int64_t start_ns;
+    int64_t ready_ns;       /* smoothing starts after this time */
+} smooth_job_t;
+
+static void* thread_func(void* arg);
+static int smooth_job(const smooth_job_t* job);
+static void rts_axis(long count, size_t offset);
+static int append_track(const smooth_job_t* job, long count);
+static int64_t mono_ns(void);
+
+static lock_t mutex_smooth = LOCK_INITIALIZER("mutex_smooth");
+static pthread_cond_t cond_smooth = PTHREAD_COND_INITIALIZER;
+
+static smooth_job_t jobs[SMOOTH_JOBS];
+static int job_head = 0, job_count = 0;
+
+/* written by the control loop only */
+static ring_t ring;
+
+/* owned by the smoother thread */
+static smooth_entry_t* work;
+
+static double dt;
+
+int init_att_smoother(void* args){
+
+    dt = (double)CONTROL_SYS_WAIT / 1000000000;
+
+    /* allocate once, the control loop must not allocate memory */
+    work = arena_alloc(SMOOTH_LEN * sizeof(*work), "Smoother");
+    if(ring_init(&ring, SMOOTH_LEN, sizeof(smooth_entry_t), "Smoother") ||
+            work == NULL){
+        logging(ERROR, "Smoother", "Cannot allocate memory: %m");
+        return ENOMEM;
+    }
+
+    return create_thread("att_smoother", thread_func, 5);
+}
+
+/* att_smooth_sample:
+ * Store the current kalman filter estimate. Called once per control system
+ * iteration after the kalman filter update, never blocks.
+ */
+void att_smooth_sample(void){
+
+    kf_state_t kf;
+    kf_get_state(&kf);
+
+    kf_gate_t gate;
+    kf_get_gate(&gate);
+
+    smooth_entry_t* ent = ring_slot(&ring);
+
+    ent->t_ns = mono_ns();
+    ent->reinits = gate.reinits;
+
+    ent->az.x[0] = kf.az;
+    ent->az.x[1] = kf.bias_az;
+    memcpy(ent->az.p, kf.p_az, sizeof(ent->az.p));
+    ent->az.w = kf.w_az;
+    ent->az.q = kf.q_az;
+    ent->az.q2 = kf.q2_az;
+
+    ent->alt.x[0] = kf.alt;
+    ent->alt.x[1] = kf.bias_alt;
+    memcpy(ent->alt.p, kf.p_alt, sizeof(ent->alt.p));
+    ent->alt.w = kf.w_alt;
+    ent->alt.q = kf.q_alt;
+    ent->alt.q2 = kf.q2_alt;
+
+    ring_publish(&ring);
+}
+
+/* att_smooth_submit:
+ * Smooth the attitude of a finished exposure. The smoothed track is appended
+ * to the sidecar once the lag has passed and the sidecar is then queued for
+ * compression. The sidecar must not be touched by the caller afterwards.
+ *
+ * input:
+ *      filepath: attitude sidecar written by the attitude recorder
+ *      start_mono_ns: CLOCK_MONOTONIC at the start of the recording, the
+ *              record times are relative to it
+ *
+ * return:
+ *      SUCCESS: sidecar will be smoothed and queued
+ *      EBUSY: too many exposures waiting, sidecar not taken
+ */
+int att_smooth_submit(const char* filepath, int64_t start_mono_ns){
+
+    lock_acquire(&mutex_smooth);
+
+    if(job_count == SMOOTH_JOBS){
+        lock_release(&mutex_smooth);
+        return EBUSY;
+    }
+
+    smooth_job_t* job = &jobs[(job_head + job_count) % SMOOTH_JOBS];
+    strncpy(job->filepath, filepath, sizeof(job->filepath) - 1);
+    job->filepath[sizeof(job->filepath) - 1] = '\0';
+    job->start_ns = start_mono_ns;
+    job->ready_ns = mono_ns() + (int64_t)SMOOTH_LAG_S * 1000000000;
+    job_count++;
+
+    pthread_cond_signal(&cond_smooth);
+    lock_release(&mutex_smooth);
+
+    return SUCCESS;
+}
+
+static void* thread_func(void* arg){
+
+    lock_acquire(&mutex_smooth);
+
+    while(1){
+
+        while(job_count == 0){
+            lock_cond_wait(&cond_smooth, &mutex_smooth);
+        }
+
+        smooth_job_t job = jobs[job_head];
+        lock_release(&mutex_smooth);
+
+        /* jobs are queued in order, the first one is always ready first */
+        int64_t wait = job.ready_ns - mono_ns();
+        if(wait > 0){
+            struct timespec ts = {wait / 1000000000, wait % 1000000000};
+            nanosleep(&ts, NULL);
+        }
+
+        if(smooth_job(&job)){
+            logging(WARN, "Smoother", "Sending %s without smoothed attitude",
+                    job.filepath);
+        }
+
+        /* sent either way, the filtered attitude is still useful */
+        queue_image(job.filepath, IMAGE_SIDECAR);
+
+        lock_acquire(&mutex_smooth);
+        job_head = (job_head + 1) % SMOOTH_JOBS;
+        job_count--;
+    }
+
+    return NULL;
+}
+
+/* smooth_job:
+ * Run the smoother over the ring buffer and add the track to one sidecar.
+ *
+ * return:
+ *      SUCCESS: track appended
+ *      ERANGE: the ring no longer covers the exposure
+ *      EIO: reading or writing the sidecar failed
+ */
+static int smooth_job(const smooth_job_t* job){
+
+    long count = ring_copy(&ring, work, 0, SMOOTH_GUARD);
+
+    if(count < 2 || work[0].t_ns > job->start_ns){
+        logging(ERROR, "Smoother", "Estimates of %s no longer buffered",
+                job->filepath);
+        return ERANGE;
+    }
+
+    rts_axis(count, offsetof(smooth_entry_t, az));
+    rts_axis(count, offsetof(smooth_entry_t, alt));
+
+    return append_track(job, count);
+}
+
+/* rts_axis:
+ * Rauch-Tung-Striebel backward pass over one axis of the work buffer, the
+ * filtered estimates are replaced by the smoothed ones. Uses the same model
+ * as the kalman filter:
+ *      x(k+1) = Phi*x(k) + Gamma*w(k+1),  Phi = [1 -dt; 0 1], Gamma = [dt; 0]
+ *      P(k+1) = Phi*P(k)*Phi' + diag(dt^2*Q, dt^2*Q2)
+ *
+ * input:
+ *      count: entries in the work buffer
+ *      offset: offset of the axis in smooth_entry_t
+ */
+static void rts_axis(long count, size_t offset){
+
+    #define AXIS(ii) ((smooth_axis_t*)((char*)&work[ii] + offset))
+
+    for(long kk=count-2; kk>=0; --kk){
+
+        smooth_axis_t* f = AXIS(kk);
+        smooth_axis_t* s = AXIS(kk + 1);
+
+        /* the estimates on both sides of a reinitialisation are unrelated */
+        if(work[kk].reinits != work[kk + 1].reinits){
+            continue;
+        }
+
+        /* prediction of step k+1 from the filtered estimate of step k */
+        double xp0 = f->x[0] - dt * f->x[1] + dt * s->w;
+        double xp1 = f->x[1];
+
+        /* Phi*P */
+        double a00 = f->p[0][0] - dt * f->p[1][0];
+        double a01 = f->p[0][1] - dt * f->p[1][1];
+        double a10 = f->p[1][0];
+        double a11 = f->p[1][1];
+
+        /* P_p = Phi*P*Phi' + diag(dt^2*Q, dt^2*Q2) */
+        double pp00 = a00 - dt * a01 + dt * dt * s->q;
+        double pp01 = a01;
+        double pp10 = a10 - dt * a11;
+        double pp11 = a11 + dt * dt * s->q2;
+
+        double det = pp00 * pp11 - pp01 * pp10;
+        if(fabs(det) < 1e-30){
+            continue;
+        }
+
+        /* C = P*Phi'*inv(P_p), P*Phi' is the transpose of Phi*P */
+        double b00 = a00, b01 = a10, b10 = a01, b11 = a11;
+
+        double c00 = ( b00 * pp11 - b01 * pp10) / det;
+        double c01 = (-b00 * pp01 + b01 * pp00) / det;
+        double c10 = ( b10 * pp11 - b11 * pp10) / det;
+        double c11 = (-b10 * pp01 + b11 * pp00) / det;
+
+        /* x_s = x + C*(x_s(k+1) - x_p) */
+        double dx0 = s->x[0] - xp0;
+        double dx1 = s->x[1] - xp1;
+
+        f->x[0] += c00 * dx0 + c01 * dx1;
+        f->x[1] += c10 * dx0 + c11 * dx1;
+
+        /* P_s = P + C*(P_s(k+1) - P_p)*C' */
+        double d00 = s->p[0][0] - pp00;
+        double d01 = s->p[0][1] - pp01;
+        double d10 = s->p[1][0] - pp10;
+        double d11 = s->p[1][1] - pp11;
+
+        double e00 = c00 * d00 + c01 * d10;
+        double e01 = c00 * d01 + c01 * d11;
+        double e10 = c10 * d00 + c11 * d10;
+        double e11 = c10 * d01 + c11 * d11;
+
+        f->p[0][0] += e00 * c00 + e01 * c01;
+        f->p[0][1] += e00 * c10 + e01 * c11;
+        f->p[1][0] += e10 * c00 + e11 * c01;
+        f->p[1][1] += e10 * c10 + e11 * c11;
+    }
+
+    #undef AXIS
+}
+
+/* append_track:
+ * Append one smoothed sample per attitude record to the sidecar and mark it
+ * in the header. Records are matched to the smoothed estimate closest in time.
+ *
+ * return:
+ *      SUCCESS: track appended
+ *      EIO: reading or writing the sidecar failed
+ */
+static int append_track(const smooth_job_t* job, long count){
+
+    FILE* fp = fopen(job->filepath, "r+b");
+    if(fp == NULL){
+        logging(ERROR, "Smoother", "Could not open %s: %m", job->filepath);
+        return EIO;
+    }
+
+    att_header_t header;
+    if(     fread(&header, sizeof(header), 1, fp) != 1 ||
+            header.magic != ATT_MAGIC ||
+            header.record_size != sizeof(att_record_t) ||
+            (header.flags & ATT_FLAG_SMOOTHED)){
+
+        logging(ERROR, "Smoother", "Unexpected sidecar %s", job->filepath);
+        fclose(fp);
+        return EIO;
+    }
+
+    att_smooth_record_t* track = malloc(header.record_count * sizeof(*track));
+    if(track == NULL){
+        logging(ERROR, "Smoother", "Cannot allocate memory: %m");
+        fclose(fp);
+        return EIO;
+    }
+
+    long kk = 0;
+
+    for(uint32_t ii=0; ii<header.record_count; ++ii){
+
+        att_record_t rec;
+        if(fread(&rec, sizeof(rec), 1, fp) != 1){
+            logging(ERROR, "Smoother", "Failed to read %s: %m",
+                    job->filepath);
+            free(track);
+            fclose(fp);
+            return EIO;
+        }
+
+        int64_t t_ns = job->start_ns + (int64_t)rec.t_us * 1000;
+
+        /* records and estimates are both in time order */
+        while(kk + 1 < count &&
+                llabs(work[kk + 1].t_ns - t_ns) <= llabs(work[kk].t_ns - t_ns)){
+            kk++;
+        }
+
+        track[ii].az = work[kk].az.x[0] - header.ref_az;
+        track[ii].alt = work[kk].alt.x[0] - header.ref_alt;
+        track[ii].sig_az = sqrt(fabs(work[kk].az.p[0][0]));
+        track[ii].sig_alt = sqrt(fabs(work[kk].alt.p[0][0]));
+    }
+
+    header.flags |= ATT_FLAG_SMOOTHED;
+
+    /* the records have just been read, the track goes right behind them */
+    int ret = SUCCESS;
+    if(     fseek(fp, 0, SEEK_CUR) ||
+            fwrite(track, sizeof(*track), header.record_count, fp)
+                != header.record_count ||
+            fseek(fp, 0, SEEK_SET) ||
+            fwrite(&header, sizeof(header), 1, fp) != 1){
+
+        logging(ERROR, "Smoother", "Failed to write %s: %m", job->filepath);
+        ret = EIO;
+    }
+
+    free(track);
+    fclose(fp);
+
+    return ret;
+}
+
+static int64_t mono_ns(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -0,0 +1,40 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Attitude Smoother
+ * Parent Component: Control System
+ * Author(s):
+ * Purpose: Refine the attitude recorded during each NIR exposure with a
+ *          fixed-lag Rauch-Tung-Striebel smoother, using the star tracker
+ *          fixes that arrive after the exposure has ended. Runs at low
+ *          priority and appends the smoothed track to the attitude sidecar
+ *          before it is queued for compression.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* initialise the attitude smoother component */
+int init_att_smoother(void* args);
+
+/* att_smooth_sample:
+ * Store the current kalman filter estimate. Called once per control system
+ * iteration after the kalman filter update, never blocks.
+ */
+void att_smooth_sample(void);
+
+/* att_smooth_submit:
+ * Smooth the attitude of a finished exposure. The smoothed track is appended
+ * to the sidecar once the lag has passed and the sidecar is then queued for
+ * compression. The sidecar must not be touched by the caller afterwards.
+ *
+ * input:
+ *      filepath: attitude sidecar written by the attitude recorder
+ *      start_mono_ns: CLOCK_MONOTONIC at the start of the recording, the
+ *              record times are relative to it
+ *
+ * return:
+ *      SUCCESS: sidecar will be smoothed and queued
+ *      EBUSY: too many exposures waiting, sidecar not taken
+ */
+int att_smooth_submit(const char* filepath, int64_t start_mono_ns);
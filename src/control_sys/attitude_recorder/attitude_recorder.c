@@ -0,0 +1,215 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Attitude Recorder
+ * Parent Component: Control System
+ * Author(s):
+ * Purpose: Record the estimated attitude, covariance and motor commands at the
+ *          control system rate during each NIR exposure and store them in a
+ *          binary sidecar file that follows the image to ground.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "global_utils.h"
+#include "lock.h"
+#include "arena.h"
+#include "sensors.h"
+#include "img_processing.h"
+#include "current_target.h"
+#include "kalman_filter.h"
+#include "att_smoother.h"
+#include "attitude_recorder.h"
+
+/* longest exposure that is recorded in full */
+#define ATT_REC_MAX_S 300
+#define ATT_REC_MAX_RECORDS (ATT_REC_MAX_S * (1000000000 / CONTROL_SYS_WAIT))
+
+static lock_t mutex_att_rec = LOCK_INITIALIZER("mutex_att_rec");
+
+static att_header_t header;
+static att_record_t* records;
+static char recording = 0;
+static struct timespec start_mono;
+
+static char out_fp[100];
+
+int init_attitude_recorder(void* args){
+
+    strcpy(out_fp, get_top_dir());
+    strcat(out_fp, "output/compression/");
+
+    /* allocate once, the control loop must not allocate memory */
+    records = arena_alloc(ATT_REC_MAX_RECORDS * sizeof(*records), "Att Rec");
+    if(records == NULL){
+        logging(ERROR, "Att Rec", "Cannot allocate memory: %m");
+        return ENOMEM;
+    }
+
+    return SUCCESS;
+}
+
+/* att_rec_start:
+ * Start recording for a new exposure, any ongoing recording is discarded.
+ *
+ * input:
+ *      frame_id: frame id of the image being exposed
+ */
+void att_rec_start(int frame_id){
+
+    struct timespec real;
+
+    lock_acquire(&mutex_att_rec);
+
+    clock_gettime(CLOCK_MONOTONIC, &start_mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = ATT_MAGIC;
+    header.version = ATT_VERSION;
+    header.record_size = sizeof(att_record_t);
+    header.frame_id = frame_id;
+    header.start_real_ns = (int64_t)real.tv_sec * 1000000000 + real.tv_nsec;
+    header.sample_time_ns = CONTROL_SYS_WAIT;
+
+    recording = 1;
+
+    lock_release(&mutex_att_rec);
+}
+
+/* att_rec_sample:
+ * Add one record if a recording is ongoing. Called once per control system
+ * iteration after the kalman filter update.
+ *
+ * input:
+ *      steps: motor command for this iteration
+ */
+void att_rec_sample(const motor_step_t* steps){
+
+    lock_acquire(&mutex_att_rec);
+
+    if(!recording){
+        lock_release(&mutex_att_rec);
+        return;
+    }
+
+    if(header.record_count == ATT_REC_MAX_RECORDS){
+        header.flags |= ATT_FLAG_TRUNCATED;
+        lock_release(&mutex_att_rec);
+        return;
+    }
+
+    kf_state_t kf;
+    kf_get_state(&kf);
+
+    gyro_t gyro;
+    get_gyro(&gyro);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if(header.record_count == 0){
+        header.ref_az = kf.az;
+        header.ref_alt = kf.alt;
+    }
+
+    att_record_t* rec = &records[header.record_count++];
+
+    rec->t_us = (now.tv_sec - start_mono.tv_sec) * 1000000 +
+            (now.tv_nsec - start_mono.tv_nsec) / 1000;
+
+    rec->az = kf.az - header.ref_az;
+    rec->alt = kf.alt - header.ref_alt;
+
+    double sin_alt = sin(kf.alt * M_PI / 180);
+    double cos_alt = cos(kf.alt * M_PI / 180);
+    rec->rate_az = gyro.x * cos_alt - gyro.y * sin_alt;
+    rec->rate_alt = gyro.z;
+
+    rec->bias_az = kf.bias_az;
+    rec->bias_alt = kf.bias_alt;
+
+    rec->p_az[0] = kf.p_az[0][0];
+    rec->p_az[1] = kf.p_az[0][1];
+    rec->p_az[2] = kf.p_az[1][1];
+    rec->p_alt[0] = kf.p_alt[0][0];
+    rec->p_alt[1] = kf.p_alt[0][1];
+    rec->p_alt[2] = kf.p_alt[1][1];
+
+    rec->step_az = steps->az;
+    rec->step_alt = steps->alt;
+
+    lock_release(&mutex_att_rec);
+}
+
+/* att_rec_stop:
+ * Stop the ongoing recording.
+ *
+ * input:
+ *      keep: 1 to write the sidecar and hand it to the attitude smoother,
+ *              which queues it for downlink, 0 to discard
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EPERM: no recording was ongoing
+ *      EIO: writing the sidecar failed
+ */
+int att_rec_stop(char keep){
+
+    lock_acquire(&mutex_att_rec);
+    char was_recording = recording;
+    recording = 0;
+    lock_release(&mutex_att_rec);
+
+    if(!was_recording){
+        return EPERM;
+    }
+
+    if(!keep){
+        return SUCCESS;
+    }
+
+    /* the control thread no longer touches the buffer */
+    char fn[sizeof(out_fp) + 20];
+    snprintf(fn, sizeof(fn), "%snir%04d.att", out_fp, header.frame_id);
+
+    FILE* fp = fopen(fn, "wb");
+    if(fp == NULL){
+        logging(ERROR, "Att Rec", "Could not open %s: %m", fn);
+        return EIO;
+    }
+
+    if(     fwrite(&header, sizeof(header), 1, fp) != 1 ||
+            fwrite(records, sizeof(*records), header.record_count, fp)
+                != header.record_count){
+
+        logging(ERROR, "Att Rec", "Failed to write %s: %m", fn);
+        fclose(fp);
+        remove(fn);
+        return EIO;
+    }
+    fclose(fp);
+
+    if(header.flags & ATT_FLAG_TRUNCATED){
+        logging(WARN, "Att Rec", "Attitude record of frame %d truncated",
+                header.frame_id);
+    }
+
+    int64_t start_ns = (int64_t)start_mono.tv_sec * 1000000000 +
+            start_mono.tv_nsec;
+
+    /* send it unsmoothed rather than not at all */
+    if(att_smooth_submit(fn, start_ns)){
+        logging(WARN, "Att Rec", "Smoother busy, frame %d not smoothed",
+                header.frame_id);
+        queue_image(fn, IMAGE_SIDECAR);
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,91 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Attitude Recorder
+ * Parent Component: Control System
+ * Author(s):
+ * Purpose: Record the estimated attitude, covariance and motor commands at the
+ *          control system rate during each NIR exposure and store them in a
+ *          binary sidecar file that follows the image to ground.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "control_sys.h"
+
+/* Sidecar file layout, native byte order (little endian):
+ *      att_header_t
+ *      att_record_t[record_count]
+ *      att_smooth_record_t[record_count]   if ATT_FLAG_SMOOTHED is set
+ *
+ * Angles in the records are offsets in degrees from ref_az and ref_alt, which
+ * keeps float precision at the arcsecond level while halving the file size.
+ */
+#define ATT_MAGIC 0x54415249 /* "IRAT" */
+#define ATT_VERSION 2
+
+#define ATT_FLAG_TRUNCATED 0x1 /* exposure longer than the record buffer */
+#define ATT_FLAG_SMOOTHED 0x2  /* smoothed track appended to the records */
+
+typedef struct{
+    uint32_t magic;
+    uint16_t version, record_size;
+    int32_t frame_id;               /* FRAMEID of the matching image */
+    uint32_t record_count;
+    int64_t start_real_ns;          /* CLOCK_REALTIME at exposure start */
+    double ref_az, ref_alt;         /* unit: degrees */
+    uint32_t sample_time_ns;        /* nominal time between records */
+    uint32_t flags;
+} att_header_t;
+
+typedef struct{
+    uint32_t t_us;                  /* time since start_real_ns */
+    float az, alt;                  /* offset from reference, degrees */
+    float rate_az, rate_alt;        /* gyro rate, degrees/second */
+    float bias_az, bias_alt;        /* estimated gyro bias */
+    float p_az[3], p_alt[3];        /* covariance P00, P01, P11 */
+    int16_t step_az, step_alt;      /* motor command of this iteration */
+} att_record_t;
+
+/* attitude of the record with the same index, smoothed with the star tracker
+ * fixes up to a minute after the exposure */
+typedef struct{
+    float az, alt;                  /* offset from reference, degrees */
+    float sig_az, sig_alt;          /* standard deviation, degrees */
+} att_smooth_record_t;
+
+/* initialise the attitude recorder component */
+int init_attitude_recorder(void* args);
+
+/* att_rec_start:
+ * Start recording for a new exposure, any ongoing recording is discarded.
+ *
+ * input:
+ *      frame_id: frame id of the image being exposed
+ */
+void att_rec_start(int frame_id);
+
+/* att_rec_stop:
+ * Stop the ongoing recording.
+ *
+ * input:
+ *      keep: 1 to write the sidecar and hand it to the attitude smoother,
+ *              which queues it for downlink, 0 to discard
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EPERM: no recording was ongoing
+ *      EIO: writing the sidecar failed
+ */
+int att_rec_stop(char keep);
+
+/* att_rec_sample:
+ * Add one record if a recording is ongoing. Called once per control system
+ * iteration after the kalman filter update.
+ *
+ * input:
+ *      steps: motor command for this iteration
+ */
+void att_rec_sample(const motor_step_t* steps);
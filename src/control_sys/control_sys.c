@@ -20,8 +20,12 @@
 #include "target_selection.h"
 #include "kalman_filter.h"
 #include "pid.h"
+#include "exposure_planner.h"
+#include "attitude_recorder.h"
+#include "att_smoother.h"
+#include "pointing_model.h"
 
-#define MODULE_COUNT 6
+#define MODULE_COUNT 10
 
 /* This list controls the order of initialisation */
 static const module_init_t init_sequence[MODULE_COUNT] = {
@@ -30,7 +34,11 @@ static const module_init_t init_sequence[MODULE_COUNT] = {
     {"stabilization", &init_stabilization},
     {"kalman_filter", &init_kalman_filter},
     {"gimbal", &init_gimbal},
-    {"pid", &init_pid}
+    {"pid", &init_pid},
+    {"exp_planner", &init_exposure_planner},
+    {"att_recorder", &init_attitude_recorder},
+    {"att_smoother", &init_att_smoother},
+    {"point_model", &init_pointing_model}
 };
 
 int init_control_sys(void* args){
@@ -87,3 +95,37 @@ void set_nir_exp(int exp){
 void set_nir_gain(int gain){
     set_nir_gain_l(gain);
 }
+
+/* Set the lucky imaging burst of the NIR camera, frames 0 selects long
+ * exposures. exp is the exposure of each frame in microseconds, keep the number
+ * of frames stacked. */
+void set_lucky_mode(int frames, int exp, int keep){
+    set_lucky_mode_l(frames, exp, keep);
+}
+
+/* Adapt the kalman filter measurement noise r and process noise q to the
+ * observed innovations */
+void set_kf_adapt(char r, char q){
+    kf_adapt_enable_l(r, q);
+}
+
+/* Set the chi-square gate of star tracker fixes in the kalman filter, 0
+ * accepts every fix */
+void set_kf_gate(double chi2){
+    kf_gate_l(chi2);
+}
+
+/* Synchronise the start of NIR exposures with the gondola oscillation */
+void set_exp_sync(char enable){
+    exp_planner_enable_l(enable);
+}
+
+/* Set the longest time in seconds an exposure may be delayed by the planner */
+void set_exp_sync_max_wait(double max_wait){
+    exp_planner_max_wait_l(max_wait);
+}
+
+/* Enable, disable or reset the pointing model of the gimbal slews */
+void set_pointing_model(int mode){
+    pm_set_l(mode);
+}
@@ -52,3 +52,25 @@ void set_error_thresholds_alt(double alt_ang);
 
 void set_nir_exp(int exp);
 void set_nir_gain(int gain);
+
+/* Set the lucky imaging burst of the NIR camera, frames 0 selects long
+ * exposures. exp is the exposure of each frame in microseconds, keep the number
+ * of frames stacked. */
+void set_lucky_mode(int frames, int exp, int keep);
+
+/* Adapt the kalman filter measurement noise r and process noise q to the
+ * observed innovations */
+void set_kf_adapt(char r, char q);
+
+/* Set the chi-square gate of star tracker fixes in the kalman filter, 0
+ * accepts every fix */
+void set_kf_gate(double chi2);
+
+/* Synchronise the start of NIR exposures with the gondola oscillation */
+void set_exp_sync(char enable);
+
+/* Set the longest time in seconds an exposure may be delayed by the planner */
+void set_exp_sync_max_wait(double max_wait);
+
+/* Enable, disable or reset the pointing model of the gimbal slews, see PM_* */
+void set_pointing_model(int mode);
@@ -9,18 +9,20 @@
 
 #include <pthread.h>
 
+#include "data_bus.h"
 #include "global_utils.h"
+#include "lock.h"
 #include "control_sys.h"
 #include "current_target.h"
 #include "target_selection.h"
 
-static pthread_mutex_t mutex_telescope_att, mutex_track_ang;
+static lock_t mutex_telescope_att, mutex_track_ang;
 static telescope_att_t telescope_att_local;
 static target_t current_target;
 
 int init_current_target(void* args){
 
-    int ret = pthread_mutex_init( &mutex_telescope_att, NULL );
+    int ret = lock_init(&mutex_telescope_att, "mutex_telescope_att", 0);
     if( ret ){
         logging(ERROR, "Cur Target",
                 "The initialisation of the telescope attitude"
@@ -28,7 +30,7 @@ int init_current_target(void* args){
         return FAILURE;
     }
 
-    ret = pthread_mutex_init( &mutex_track_ang, NULL );
+    ret = lock_init(&mutex_track_ang, "mutex_track_ang", 0);
     if( ret ){
         logging(ERROR, "Cur Target",
                 "The initialisation of the tracking angles"
@@ -46,51 +48,54 @@ int init_current_target(void* args){
 
 void get_telescope_att(telescope_att_t* telescope_att){
 
-    pthread_mutex_lock(&mutex_telescope_att);
+    lock_acquire(&mutex_telescope_att);
 
     telescope_att->az = telescope_att_local.az;
     telescope_att->alt = telescope_att_local.alt;
     telescope_att->out_of_date = telescope_att_local.out_of_date;
 
-    pthread_mutex_unlock(&mutex_telescope_att);
+    lock_release(&mutex_telescope_att);
 }
 
 void set_telescope_att(telescope_att_t* telescope_att){
 
-    pthread_mutex_lock(&mutex_telescope_att);
+    lock_acquire(&mutex_telescope_att);
 
     telescope_att_local.az = telescope_att->az;
     telescope_att_local.alt = telescope_att->alt;
     telescope_att_local.out_of_date = 0;
 
-    pthread_mutex_unlock(&mutex_telescope_att);
+    bus_kf_att_t msg = {telescope_att->az, telescope_att->alt};
+    publish_topic(TOPIC_KF_ATT, &msg);
+
+    lock_release(&mutex_telescope_att);
 }
 
 void telescope_att_out_of_date(void){
 
-    pthread_mutex_lock(&mutex_telescope_att);
+    lock_acquire(&mutex_telescope_att);
 
     telescope_att_local.out_of_date = 1;
 
-    pthread_mutex_unlock(&mutex_telescope_att);
+    lock_release(&mutex_telescope_att);
 }
 
 void get_tracking_angles(double* az, double* alt){
 
-    pthread_mutex_lock(&mutex_telescope_att);
+    lock_acquire(&mutex_telescope_att);
 
     *az = current_target.az;
     *alt = current_target.alt;
 
-    pthread_mutex_unlock(&mutex_telescope_att);
+    lock_release(&mutex_telescope_att);
 }
 
 void set_tracking_angles(double az, double alt){
 
-    pthread_mutex_lock(&mutex_telescope_att);
+    lock_acquire(&mutex_telescope_att);
 
     current_target.az = az;
     current_target.alt = alt;
 
-    pthread_mutex_unlock(&mutex_telescope_att);
+    lock_release(&mutex_telescope_att);
 }
@@ -12,6 +12,9 @@
 /* The out_of_date flag shows if the available data is the latest (value: 0)
  * or if an error occured in the respective module while updating (value: 1).
  * If an error has occured, the data in the struct is the latest valid data.
+ *
+ * az of the telescope attitude and of the tracking angles is continuous, see
+ * ang_unwrap in global_utils, compare them with ang_diff.
  */
 
 typedef struct{
@@ -0,0 +1,403 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Exposure Planner
+ * Parent Component: Control System
+ * Author(s):
+ * Purpose: Estimate the pendulum motion of the gondola from the gyro history
+ *          and time the start of NIR exposures to the quietest predicted window.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "global_utils.h"
+#include "lock.h"
+#include "sensors.h"
+#include "current_target.h"
+#include "exposure_planner.h"
+
+/* the control system runs at 100 Hz, the planner history is kept at 10 Hz */
+#define PLAN_DECIMATION 10
+#define PLAN_DT (PLAN_DECIMATION * CONTROL_SYS_WAIT / 1000000000.0)
+#define PLAN_HIST 640       /* 64 seconds */
+#define PLAN_MIN_HIST 200   /* 20 seconds */
+
+#define PLAN_MIN_PERIOD 1.0     /* unit: seconds */
+#define PLAN_MAX_PERIOD 30.0    /* unit: seconds */
+#define PLAN_MIN_AMP 0.005      /* unit: degrees/second */
+#define PLAN_MIN_R2 0.5         /* minimum part of the variance explained by fit */
+#define PLAN_MIN_GAIN 0.9       /* only wait if the window is at least 10% quieter */
+#define PLAN_STEP 0.1           /* unit: seconds */
+
+#define AXIS_COUNT 2 /* az, alt */
+
+typedef struct{
+    double omega, amp, phase, r2;
+    char valid;
+} axis_fit_t;
+
+static int fit_axis(const double* s, int n, axis_fit_t* fit);
+static double window_cost(const axis_fit_t* fit, double t0, double exp_s);
+static int make_plan(double exp_s);
+static double mono_s(const struct timespec* ts);
+
+static lock_t mutex_planner = LOCK_INITIALIZER("mutex_planner");
+
+static double hist[AXIS_COUNT][PLAN_HIST];
+static unsigned long hist_count;
+static double hist_time;
+static double acc[AXIS_COUNT];
+static int acc_count;
+
+/* set by the command thread, guarded by mutex_planner */
+static char enabled = 0;
+static double max_wait = 20;
+
+/* only used by the tracking thread */
+static double snapshot[AXIS_COUNT][PLAN_HIST];
+static char planned = 0;
+static double plan_start, plan_deadline;
+
+static FILE* planner_log;
+
+int init_exposure_planner(void* args){
+
+    char log_fn[100];
+
+    strcpy(log_fn, get_top_dir());
+    strcat(log_fn, "output/logs/exp_planner.log");
+
+    planner_log = fopen(log_fn, "a");
+
+    return SUCCESS;
+}
+
+/* exp_planner_sample:
+ * Add the current gyro reading to the motion history. Called once per control
+ * system iteration.
+ *
+ * input:
+ *      att: current telescope attitude, used to rotate the gyro reading into
+ *           the az and alt axes
+ */
+void exp_planner_sample(const telescope_att_t* att){
+
+    gyro_t gyro;
+    get_gyro(&gyro);
+
+    if(gyro.out_of_date){
+        return;
+    }
+
+    double sin_alt = sin(att->alt * M_PI / 180);
+    double cos_alt = cos(att->alt * M_PI / 180);
+
+    acc[0] += gyro.x * cos_alt - gyro.y * sin_alt;
+    acc[1] += gyro.z;
+
+    if(++acc_count < PLAN_DECIMATION){
+        return;
+    }
+
+    lock_acquire(&mutex_planner);
+
+    for(int ii=0; ii<AXIS_COUNT; ++ii){
+        hist[ii][hist_count % PLAN_HIST] = acc[ii] / PLAN_DECIMATION;
+        acc[ii] = 0;
+    }
+    hist_count++;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    hist_time = mono_s(&now);
+
+    lock_release(&mutex_planner);
+
+    acc_count = 0;
+}
+
+/* exp_planner_ready:
+ * Decide if an exposure should be started now. The first call plans the start
+ * time from the fitted gondola oscillation, following calls return 1 once the
+ * planned time or the maximum waiting time is reached. If the planner is
+ * disabled or no oscillation could be fitted the exposure starts immediately.
+ *
+ * input:
+ *      exp_s: exposure time in seconds
+ *
+ * return:
+ *      1: start the exposure
+ *      0: keep waiting
+ */
+int exp_planner_ready(double exp_s){
+
+    lock_acquire(&mutex_planner);
+    char on = enabled;
+    lock_release(&mutex_planner);
+
+    if(!on){
+        planned = 0;
+        return 1;
+    }
+
+    if(!planned){
+        if(make_plan(exp_s)){
+            return 1;
+        }
+        planned = 1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if(mono_s(&now) >= plan_start || mono_s(&now) >= plan_deadline){
+        planned = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* drop the current plan, e.g. when the pointing error leaves the thresholds */
+void exp_planner_cancel(void){
+    planned = 0;
+}
+
+/* enable or disable synchronisation of exposures with the gondola motion */
+void exp_planner_enable_l(char enable){
+    lock_acquire(&mutex_planner);
+    enabled = enable;
+    lock_release(&mutex_planner);
+
+    logging(INFO, "Planner", "Exposure synchronisation %s",
+            enable ? "enabled" : "disabled");
+}
+
+/* set the longest time in seconds an exposure may be delayed */
+void exp_planner_max_wait_l(double wait){
+    lock_acquire(&mutex_planner);
+    max_wait = wait;
+    lock_release(&mutex_planner);
+}
+
+/* make_plan:
+ * Fit a sinusoid to the rate history of each axis and find the start time
+ * within the next oscillation period that minimises the predicted integrated
+ * squared rate over the exposure.
+ *
+ * return:
+ *      SUCCESS: plan_start and plan_deadline are set
+ *      FAILURE: too little history or no oscillation found, start immediately
+ */
+static int make_plan(double exp_s){
+
+    struct timespec now;
+    double newest, wait_max;
+
+    lock_acquire(&mutex_planner);
+
+    wait_max = max_wait;
+    unsigned long count = hist_count;
+    int n = count < PLAN_HIST ? count : PLAN_HIST;
+
+    /* copy out oldest first */
+    for(int ii=0; ii<AXIS_COUNT; ++ii){
+        for(int jj=0; jj<n; ++jj){
+            snapshot[ii][jj] = hist[ii][(count - n + jj) % PLAN_HIST];
+        }
+    }
+    newest = hist_time;
+
+    lock_release(&mutex_planner);
+
+    if(n < PLAN_MIN_HIST){
+        return FAILURE;
+    }
+
+    axis_fit_t fits[AXIS_COUNT];
+    char any_valid = 0;
+    double period = 0;
+
+    for(int ii=0; ii<AXIS_COUNT; ++ii){
+        if(fit_axis(snapshot[ii], n, &fits[ii]) == SUCCESS){
+            any_valid = 1;
+            period = fmax(period, 2 * M_PI / fits[ii].omega);
+        }
+    }
+
+    if(!any_valid){
+        return FAILURE;
+    }
+
+    /* times are relative to the newest sample in the history */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double t_now = mono_s(&now) - newest;
+    double horizon = fmin(period, wait_max);
+
+    double cost_now = 0;
+    for(int ii=0; ii<AXIS_COUNT; ++ii){
+        cost_now += window_cost(&fits[ii], t_now, exp_s);
+    }
+
+    double best_cost = cost_now, best_t = t_now;
+    for(double t0=t_now+PLAN_STEP; t0<=t_now+horizon; t0+=PLAN_STEP){
+        double cost = 0;
+        for(int ii=0; ii<AXIS_COUNT; ++ii){
+            cost += window_cost(&fits[ii], t0, exp_s);
+        }
+        if(cost < best_cost){
+            best_cost = cost;
+            best_t = t0;
+        }
+    }
+
+    double wait = best_cost < PLAN_MIN_GAIN * cost_now ? best_t - t_now : 0;
+
+    plan_start = mono_s(&now) + wait;
+    plan_deadline = mono_s(&now) + wait_max;
+
+    logging_csv(planner_log, "%+.4e,%+.4e,%.3f,%+.4e,%+.4e,%.3f,%.2f,%.3f",
+            fits[0].valid ? 2 * M_PI / fits[0].omega : 0, fits[0].amp, fits[0].r2,
+            fits[1].valid ? 2 * M_PI / fits[1].omega : 0, fits[1].amp, fits[1].r2,
+            wait, cost_now > 0 ? best_cost / cost_now : 1);
+
+    #ifdef TRACKING_DEBUG
+        logging(DEBUG, "Planner", "Exposure planned in %.2lf s, cost ratio %.3lf",
+                wait, cost_now > 0 ? best_cost / cost_now : 1);
+    #endif
+
+    return SUCCESS;
+}
+
+/* fit_axis:
+ * Estimate the oscillation period from upward zero crossings of the rate and
+ * fit amp * sin(omega * t + phase) + c by least squares. t = 0 at the newest
+ * sample.
+ *
+ * return:
+ *      SUCCESS: fit is valid
+ *      FAILURE: no clear oscillation, fit->valid is 0
+ */
+static int fit_axis(const double* s, int n, axis_fit_t* fit){
+
+    fit->valid = 0;
+    fit->amp = 0;
+    fit->r2 = 0;
+    fit->omega = 1;
+
+    double mean = 0, var = 0;
+    for(int ii=0; ii<n; ++ii){
+        mean += s[ii];
+    }
+    mean /= n;
+    for(int ii=0; ii<n; ++ii){
+        var += (s[ii] - mean) * (s[ii] - mean);
+    }
+
+    /* hysteresis keeps noise around zero from adding crossings */
+    double hyst = 0.3 * sqrt(var / n);
+    double first = 0, last = 0;
+    int crossings = 0;
+    char low = 0;
+
+    for(int ii=1; ii<n; ++ii){
+        double prev = s[ii-1] - mean, cur = s[ii] - mean;
+        if(cur < -hyst){
+            low = 1;
+        }
+        else if(low && prev < 0 && cur >= 0){
+            double t = (ii - 1 + prev / (prev - cur)) * PLAN_DT;
+            if(!crossings){
+                first = t;
+            }
+            last = t;
+            crossings++;
+            low = 0;
+        }
+    }
+
+    if(crossings < 3){
+        return FAILURE;
+    }
+
+    double period = (last - first) / (crossings - 1);
+    if(period < PLAN_MIN_PERIOD || period > PLAN_MAX_PERIOD){
+        return FAILURE;
+    }
+    double omega = 2 * M_PI / period;
+
+    /* normal equations for the basis sin(wt), cos(wt), 1 */
+    double m[3][4] = {{0}};
+    for(int ii=0; ii<n; ++ii){
+        double t = (ii - (n - 1)) * PLAN_DT;
+        double b[3] = {sin(omega * t), cos(omega * t), 1};
+        for(int jj=0; jj<3; ++jj){
+            for(int kk=0; kk<3; ++kk){
+                m[jj][kk] += b[jj] * b[kk];
+            }
+            m[jj][3] += b[jj] * s[ii];
+        }
+    }
+
+    /* gaussian elimination, the matrix is symmetric positive definite */
+    for(int jj=0; jj<3; ++jj){
+        if(fabs(m[jj][jj]) < 1e-12){
+            return FAILURE;
+        }
+        for(int kk=jj+1; kk<3; ++kk){
+            double f = m[kk][jj] / m[jj][jj];
+            for(int ll=jj; ll<4; ++ll){
+                m[kk][ll] -= f * m[jj][ll];
+            }
+        }
+    }
+    double coef[3];
+    for(int jj=2; jj>=0; --jj){
+        coef[jj] = m[jj][3];
+        for(int kk=jj+1; kk<3; ++kk){
+            coef[jj] -= m[jj][kk] * coef[kk];
+        }
+        coef[jj] /= m[jj][jj];
+    }
+
+    double res = 0;
+    for(int ii=0; ii<n; ++ii){
+        double t = (ii - (n - 1)) * PLAN_DT;
+        double e = s[ii] - coef[0] * sin(omega * t) - coef[1] * cos(omega * t)
+                - coef[2];
+        res += e * e;
+    }
+
+    fit->omega = omega;
+    fit->amp = sqrt(coef[0] * coef[0] + coef[1] * coef[1]);
+    fit->phase = atan2(coef[1], coef[0]);
+    fit->r2 = var > 0 ? 1 - res / var : 0;
+
+    if(fit->amp < PLAN_MIN_AMP || fit->r2 < PLAN_MIN_R2){
+        return FAILURE;
+    }
+
+    fit->valid = 1;
+    return SUCCESS;
+}
+
+/* integral of (amp * sin(omega * t + phase))^2 from t0 to t0 + exp_s */
+static double window_cost(const axis_fit_t* fit, double t0, double exp_s){
+
+    if(!fit->valid){
+        return 0;
+    }
+
+    double a = 2 * (fit->omega * t0 + fit->phase);
+    double b = 2 * (fit->omega * (t0 + exp_s) + fit->phase);
+
+    return fit->amp * fit->amp / 2 *
+            (exp_s - (sin(b) - sin(a)) / (2 * fit->omega));
+}
+
+static double mono_s(const struct timespec* ts){
+    return ts->tv_sec + ts->tv_nsec / 1000000000.0;
+}
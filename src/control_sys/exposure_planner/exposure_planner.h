@@ -0,0 +1,50 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Exposure Planner
+ * Parent Component: Control System
+ * Author(s):
+ * Purpose: Estimate the pendulum motion of the gondola from the gyro history
+ *          and time the start of NIR exposures to the quietest predicted window.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "current_target.h"
+
+/* initialise the exposure planner component */
+int init_exposure_planner(void* args);
+
+/* exp_planner_sample:
+ * Add the current gyro reading to the motion history. Called once per control
+ * system iteration.
+ *
+ * input:
+ *      att: current telescope attitude, used to rotate the gyro reading into
+ *           the az and alt axes
+ */
+void exp_planner_sample(const telescope_att_t* att);
+
+/* exp_planner_ready:
+ * Decide if an exposure should be started now. The first call plans the start
+ * time from the fitted gondola oscillation, following calls return 1 once the
+ * planned time or the maximum waiting time is reached. If the planner is
+ * disabled or no oscillation could be fitted the exposure starts immediately.
+ *
+ * input:
+ *      exp_s: exposure time in seconds
+ *
+ * return:
+ *      1: start the exposure
+ *      0: keep waiting
+ */
+int exp_planner_ready(double exp_s);
+
+/* drop the current plan, e.g. when the pointing error leaves the thresholds */
+void exp_planner_cancel(void);
+
+/* enable or disable synchronisation of exposures with the gondola motion */
+void exp_planner_enable_l(char enable);
+
+/* set the longest time in seconds an exposure may be delayed */
+void exp_planner_max_wait_l(double max_wait);
@@ -26,6 +26,7 @@
 #include "sensors.h"
 #include "i2c.h"
 #include "gpio.h"
+#include "pointing_model.h"
 
 unsigned char addr_az_alt = 8;
 unsigned char addr_roll = 0x0F;
@@ -100,7 +101,7 @@ void center_telescope_l(void){
 }
 
 /* Rotate the telescope to a target in az relative to gondola,
- * with an accuracy of 1 degree
+ * with an accuracy of 1 degree. The target is corrected by the pointing model.
  */
 void move_az_to_l(double target){
 
@@ -109,6 +110,10 @@ void move_az_to_l(double target){
     encoder_t enc;
     motor_step_t steps;
 
+    /* the encoder is signed around the gimbal zero, never take the short way
+     * through the back of the gimbal */
+    target = ang_wrap180(target);
+
     struct timespec wake;
     clock_gettime(CLOCK_MONOTONIC, &wake);
 
@@ -118,7 +123,12 @@ void move_az_to_l(double target){
             continue;
         }
 
-        err = target - enc.az;
+        /* keep the pointing in alt while moving in az */
+        double az, alt, enc_az, enc_alt;
+        pm_enc_to_pointing(enc.az, enc.alt_ang, &az, &alt);
+        pm_pointing_to_enc(target, alt, &enc_az, &enc_alt);
+
+        err = ang_wrap180(enc_az) - enc.az;
         int sign  = err >= 0 ? 1 : -1;
 
         #if STEP_DEBUG
@@ -142,7 +152,7 @@ void move_az_to_l(double target){
 }
 
 /* Rotate the telescope to a target in alt relative to gondola,
- * with an accuracy of 1 degree
+ * with an accuracy of 1 degree. The target is corrected by the pointing model.
  */
 void move_alt_to_l(double target){
 
@@ -160,7 +170,11 @@ void move_alt_to_l(double target){
             continue;
         }
 
-        err = target - enc.alt_ang;
+        double az, alt, enc_az, enc_alt;
+        pm_enc_to_pointing(enc.az, enc.alt_ang, &az, &alt);
+        pm_pointing_to_enc(az, target, &enc_az, &enc_alt);
+
+        err = enc_alt - enc.alt_ang;
         int sign  = err >= 0 ? 1 : -1;
 
         #if STEP_DEBUG
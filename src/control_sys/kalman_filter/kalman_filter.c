@@ -15,15 +15,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "global_utils.h"
+#include "arena.h"
 #include "mode.h"
 #include "current_target.h"
 #include "kalman_filter.h"
 #include "sensors.h"
 #include "control_sys.h"
 #include "target_selection.h"
+#include "data_bus.h"
+#include "pointing_model.h"
 
 /* Kalman filter
  *  double x_prev[2][1], x_upd[2][1], x_next[2][1];
@@ -75,6 +79,48 @@
 #define HIST_LENGTH_S 180 //unit: seconds
 #define SENS_FREQ 1000000000 / GYRO_SAMPLE_TIME
 
+/* adaptive noise estimation, number of star tracker fixes in the window */
+#define ADAPT_WINDOW 16
+
+/* bounds of the adapted noise relative to the nominal values */
+#define ADAPT_R_MIN 1e-4
+#define ADAPT_R_MAX 1e2
+#define ADAPT_Q_MIN 1e-1
+#define ADAPT_Q_MAX 1e1
+
+/* star tracker fixes with a squared Mahalanobis distance above the gate are
+ * rejected, 13.8 is the 99.9 % quantile of chi-square with 2 dof */
+#define GATE_CHI2 13.8
+
+/* consecutive rejections after which the filter is assumed to be wrong and
+ * is reinitialised from the star tracker */
+#define GATE_MAX_REJECT 5
+
+/* Measurement noise of a fix from its match quality, relative to the nominal
+ * R. The pointing error of a solve is about the rms residual over the square
+ * root of the matched stars, bounded to these factors of the nominal R */
+#define FIX_SCALE_MIN 0.25
+#define FIX_SCALE_MAX 25
+
+/* fixes with a log-odds below FIX_LOG_ODDS_GOOD are inflated up to
+ * FIX_MARGINAL times, reached at FIX_LOG_ODDS_MIN, ln(1e9), where the solver
+ * accepts a solution */
+#define FIX_LOG_ODDS_GOOD 50
+#define FIX_LOG_ODDS_MIN 20.7
+#define FIX_MARGINAL 4
+
+/* windowed innovation statistics of one axis */
+typedef struct{
+    double nu2[ADAPT_WINDOW];   /* squared innovation */
+    double hph[ADAPT_WINDOW];   /* predicted measurement covariance H*P*H' */
+    double dq[ADAPT_WINDOW];    /* K*nu^2*K' per step, angle */
+    double dq2[ADAPT_WINDOW];   /* K*nu^2*K' per step, bias */
+    double s[ADAPT_WINDOW];     /* innovation covariance */
+    int count, index;
+    double r_nom, q_nom, q2_nom;
+    double nis;                 /* mean normalised innovation squared */
+} adapt_t;
+
 
 typedef struct{
     double*** var;
@@ -117,6 +163,10 @@ typedef struct{
     /* propagation logs */
     FILE* x_prop_log;
     FILE* p_prop_log;
+
+    /* adaptive noise estimation */
+    adapt_t* adapt;
+    FILE* adapt_log;
 } axis_context_t;
 
 static int open_logs(void);
@@ -141,6 +191,26 @@ static void update_s_next(axis_context_t axis);
 static void comp_k_gain(axis_context_t axis);
 static void update_state(axis_context_t axis);
 static void update_covar(axis_context_t axis);
+static void adapt_noise(axis_context_t axis, size_t steps);
+static double fix_scale(const star_tracker_t* st);
+static long fix_steps_back(const star_tracker_t* st);
+static long fix_index(void);
+static double clamp(double val, double min, double max);
+
+static adapt_t adapt_az, adapt_alt;
+static char adapt_r_flag = 1, adapt_q_flag = 0;
+
+static char gate_fix(double az_ang, double alt_ang);
+static void gate_innovation(axis_context_t axis, double z, double* nu,
+        double* s);
+
+static double gate_chi2 = GATE_CHI2;
+
+/* R of the current fix relative to the adapted R, from its match quality */
+static double fix_r_scale = 1;
+static long fix_back;   /* control steps from the middle of the fix's exposure */
+static kf_gate_t gate_stat;
+static FILE* gate_log;
 
 static axis_context_t az = {
     {
@@ -162,7 +232,8 @@ static axis_context_t az = {
         {&az.nu_next,      NU_NEXT_ROWS,   NU_NEXT_COLS    },
         {&az.S_next,       S_NEXT_ROWS,    S_NEXT_COLS     },
         {&az.K,            K_ROWS,         K_COLS          }
-    }
+    },
+    .adapt = &adapt_az
 };
 
 static axis_context_t alt = {
@@ -185,7 +256,8 @@ static axis_context_t alt = {
         {&alt.nu_next,      NU_NEXT_ROWS,   NU_NEXT_COLS    },
         {&alt.S_next,       S_NEXT_ROWS,    S_NEXT_COLS     },
         {&alt.K,            K_ROWS,         K_COLS          }
-    }
+    },
+    .adapt = &adapt_alt
 };
 
 #ifdef KF_TEST
@@ -202,74 +274,54 @@ int init_kalman_filter(void* args){
         return errno;
     }
 
-    // allocate memory
+    // allocate memory, each matrix and history in one block of the arena
     axis_context_t* arr[2] = {&az, &alt};
     for(int ii=0; ii<2; ++ii){
         for(int jj=0; jj<18; ++jj){
             int rows = arr[ii]->mem[jj].rows;
             int cols = arr[ii]->mem[jj].cols;
 
-            *arr[ii]->mem[jj].var = malloc(rows * sizeof **arr[ii]->mem[jj].var);
-
-            if(*arr[ii]->mem[jj].var == NULL){
+            double** var = arena_alloc(rows * sizeof(*var), "Kalman F");
+            double* data = arena_alloc((size_t)rows * cols * sizeof(*data), "Kalman F");
+            if(var == NULL || data == NULL){
                 logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
                 return ENOMEM;
             }
 
             for(int kk=0; kk < rows; ++kk){
-                (*arr[ii]->mem[jj].var)[kk] = malloc(cols * sizeof **arr[ii]->mem[jj].var[kk]);
-
-                if(*arr[ii]->mem[jj].var == NULL){
-                    logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-                    return ENOMEM;
-                }
+                var[kk] = &data[kk * cols];
             }
+
+            *arr[ii]->mem[jj].var = var;
         }
 
-        /* gyro history */
         size_t hist_elements = (long)HIST_LENGTH_S * SENS_FREQ;
-        arr[ii]->gyro_hist = malloc(hist_elements * sizeof(*arr[ii]->gyro_hist));
-        if(arr[ii]->gyro_hist == NULL){
-            logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-            return ENOMEM;
-        }
 
-        /* estimated state history */
-        arr[ii]->x_hist = malloc(hist_elements * sizeof(*arr[ii]->x_hist));
-        if(arr[ii]->x_hist == NULL){
-            logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-            return ENOMEM;
-        }
+        /* gyro history */
+        arr[ii]->gyro_hist = arena_alloc(hist_elements * sizeof(*arr[ii]->gyro_hist), "Kalman F");
 
-        for(int jj=0; jj < hist_elements; ++jj){
-            arr[ii]->x_hist[jj] = malloc(X_PREV_ROWS * sizeof(*arr[ii]->x_hist[jj]));
-            if(arr[ii]->x_hist[jj] == NULL){
-                logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-                return ENOMEM;
-            }
-        }
+        /* estimated state history */
+        arr[ii]->x_hist = arena_alloc(hist_elements * sizeof(*arr[ii]->x_hist), "Kalman F");
+        double* x_data = arena_alloc(hist_elements * X_PREV_ROWS * sizeof(*x_data), "Kalman F");
 
         /* P matrix history */
-        arr[ii]->p_hist = malloc(hist_elements * sizeof(*arr[ii]->p_hist));
-        if(arr[ii]->p_hist == NULL){
+        arr[ii]->p_hist = arena_alloc(hist_elements * sizeof(*arr[ii]->p_hist), "Kalman F");
+        double** p_rows = arena_alloc(hist_elements * P_PREV_ROWS * sizeof(*p_rows), "Kalman F");
+        double* p_data = arena_alloc(hist_elements * P_PREV_ROWS * P_PREV_COLS * sizeof(*p_data),
+                "Kalman F");
+
+        if(arr[ii]->gyro_hist == NULL || arr[ii]->x_hist == NULL || x_data == NULL ||
+                arr[ii]->p_hist == NULL || p_rows == NULL || p_data == NULL){
             logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
             return ENOMEM;
         }
 
-        for(int jj=0; jj < hist_elements; ++jj){
-            arr[ii]->p_hist[jj] = malloc(P_PREV_ROWS * sizeof(*arr[ii]->p_hist[jj]));
-            if(arr[ii]->p_hist[jj] == NULL){
-                logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-                return ENOMEM;
-            }
+        for(size_t jj=0; jj < hist_elements; ++jj){
+            arr[ii]->x_hist[jj] = &x_data[jj * X_PREV_ROWS];
 
+            arr[ii]->p_hist[jj] = &p_rows[jj * P_PREV_ROWS];
             for(int kk=0; kk<P_PREV_ROWS; ++kk){
-                arr[ii]->p_hist[jj][kk] = malloc(P_PREV_COLS * sizeof(*arr[ii]->p_hist[jj][kk]));
-                if(arr[ii]->p_hist[jj][kk] == NULL){
-                    logging(ERROR, "Kalman F", "Cannot allocate memory: %m");
-                    return ENOMEM;
-                }
-
+                arr[ii]->p_hist[jj][kk] = &p_data[(jj * P_PREV_ROWS + kk) * P_PREV_COLS];
             }
         }
     }
@@ -339,13 +391,20 @@ static void init_kalman_vars(double az_init, double alt_init){
         arr[ii]->Q[0][0] = ARW/dt;
         arr[ii]->Q2[0][0] = RRW/dt;
         arr[ii]->R[0][0] = s_init*s_init;
+
+        /* adaptation starts over from the nominal values */
+        memset(arr[ii]->adapt, 0, sizeof(*arr[ii]->adapt));
+        arr[ii]->adapt->r_nom = arr[ii]->R[0][0];
+        arr[ii]->adapt->q_nom = arr[ii]->Q[0][0];
+        arr[ii]->adapt->q2_nom = arr[ii]->Q2[0][0];
+        arr[ii]->adapt->nis = 1;
     }
 }
 
 static int open_logs(void){
 
     char* axes[2] = {"az", "alt"};
-    char* vars[] = {"x", "p", "nu", "s", "x_prop", "p_prop"};
+    char* vars[] = {"x", "p", "nu", "s", "x_prop", "p_prop", "adapt"};
     axis_context_t* arr[2] = {&az, &alt};
 
     char log_fn[100];
@@ -353,11 +412,19 @@ static int open_logs(void){
     /* dirlen is the index in log_fn where local paths start */
     int dirlen = strlen(log_fn);
 
+    snprintf(&log_fn[dirlen], 100-dirlen, "output/logs/kf/gate.log");
+    gate_log = fopen(log_fn, "a");
+    if(gate_log == NULL){
+        logging(ERROR, "Kalman F", "Failed to open gate log: %m");
+        return errno;
+    }
+
     for(int ii=0; ii<2; ++ii){
-        FILE** logs[6] = {&arr[ii]->x_log, &arr[ii]->p_log, &arr[ii]->nu_log,
-                &arr[ii]->s_log, &arr[ii]->x_prop_log, &arr[ii]->p_prop_log};
+        FILE** logs[7] = {&arr[ii]->x_log, &arr[ii]->p_log, &arr[ii]->nu_log,
+                &arr[ii]->s_log, &arr[ii]->x_prop_log, &arr[ii]->p_prop_log,
+                &arr[ii]->adapt_log};
 
-        for(int jj=0; jj<6; ++jj){
+        for(int jj=0; jj<7; ++jj){
 
             snprintf(&log_fn[dirlen], 100-dirlen, "output/logs/kf/%s/%s.log", axes[ii], vars[jj]);
             *logs[jj] = fopen(log_fn, "a");
@@ -374,6 +441,7 @@ static int open_logs(void){
 
 static char first_st_flag = 1;
 static size_t hist_index = 0;
+static double w_az, w_alt;
 int kf_update(telescope_att_t* cur_att){
 
     gyro_t gyro;
@@ -386,6 +454,9 @@ int kf_update(telescope_att_t* cur_att){
             st.ra = 0;
             st.dec = 0;
             st.roll = 0;
+            st.matched = 0;
+            st.mid_mono.tv_sec = 0;
+            st.mid_mono.tv_nsec = 0;
             st.new_data = 1;
             st.out_of_date = 0;
         }
@@ -396,9 +467,14 @@ int kf_update(telescope_att_t* cur_att){
         get_star_tracker(&st);
     #endif
 
+    char accept = st.new_data;
+    double az_ang = 0, alt_ang = 0;
+
     if(st.new_data){
 
-        double az_ang = 0, alt_ang = 0;
+        fix_r_scale = fix_scale(&st);
+        fix_back = fix_steps_back(&st);
+
         /* convert ra & dec to az & alt */
         #ifndef KF_TEST
             rd_to_aa(st.ra, st.dec, &az_ang, &alt_ang);
@@ -415,6 +491,16 @@ int kf_update(telescope_att_t* cur_att){
 
             first_st_flag = 0;
         }
+        else{
+            /* the az state is continuous, the fix is wrapped */
+            az_ang = ang_near(az_ang, az.x_prev[0][0]);
+
+            /* a wrong solve must not pull the estimate */
+            accept = gate_fix(az_ang, alt_ang);
+        }
+    }
+
+    if(accept){
 
         kf_axis(alt, gyro.z, &alt_ang);
 
@@ -425,6 +511,21 @@ int kf_update(telescope_att_t* cur_att){
 
         kf_axis(az, gyro_az, &az_ang);
 
+        w_alt = gyro.z;
+        w_az = gyro_az;
+
+        #ifndef KF_TEST
+            /* pair the fix with the encoders for the pointing model */
+            pm_sample(az_ang, alt_ang, &st.mid_mono);
+        #endif
+
+        kf_noise_t noise;
+        kf_get_noise(&noise);
+        bus_kf_noise_t msg = {noise.r_az, noise.q_az, noise.q2_az,
+                noise.nis_az, noise.r_alt, noise.q_alt, noise.q2_alt,
+                noise.nis_alt};
+        publish_topic(TOPIC_KF_NOISE, &msg);
+
         hist_index = 0;
     }
     else{
@@ -438,6 +539,9 @@ int kf_update(telescope_att_t* cur_att){
 
         kf_axis(az, gyro_az, NULL);
 
+        w_alt = gyro.z;
+        w_az = gyro_az;
+
         hist_index++;
     }
 
@@ -456,6 +560,140 @@ int kf_update(telescope_att_t* cur_att){
     return SUCCESS;
 }
 
+/* kf_get_state:
+ * Copy the latest state estimate and covariance of both axes. Only to be
+ * called from the control system thread, between calls to kf_update.
+ */
+void kf_get_state(kf_state_t* state){
+
+    state->az = az.x_prev[0][0];
+    state->alt = alt.x_prev[0][0];
+    state->bias_az = az.x_prev[1][0];
+    state->bias_alt = alt.x_prev[1][0];
+
+    for(int ii=0; ii<P_PREV_ROWS; ++ii){
+        for(int jj=0; jj<P_PREV_COLS; ++jj){
+            state->p_az[ii][jj] = az.P_prev[ii][jj];
+            state->p_alt[ii][jj] = alt.P_prev[ii][jj];
+        }
+    }
+
+    state->w_az = w_az;
+    state->w_alt = w_alt;
+    state->q_az = az.Q[0][0];
+    state->q2_az = az.Q2[0][0];
+    state->q_alt = alt.Q[0][0];
+    state->q2_alt = alt.Q2[0][0];
+}
+
+/* kf_get_noise:
+ * Copy the noise parameters currently used by the filter. Only to be called
+ * from the control system thread, between calls to kf_update.
+ */
+void kf_get_noise(kf_noise_t* noise){
+
+    noise->r_az = az.R[0][0];
+    noise->q_az = az.Q[0][0];
+    noise->q2_az = az.Q2[0][0];
+    noise->nis_az = adapt_az.nis;
+    noise->r_alt = alt.R[0][0];
+    noise->q_alt = alt.Q[0][0];
+    noise->q2_alt = alt.Q2[0][0];
+    noise->nis_alt = adapt_alt.nis;
+}
+
+/* Select which noise parameters are adapted from the innovations, parameters
+ * not adapted return to their nominal values at the next star tracker fix */
+void kf_adapt_enable_l(char r, char q){
+    adapt_r_flag = r;
+    adapt_q_flag = q;
+}
+
+/* kf_get_gate:
+ * Copy the gating statistics of star tracker fixes. Only to be called from
+ * the control system thread, between calls to kf_update.
+ */
+void kf_get_gate(kf_gate_t* gate){
+    *gate = gate_stat;
+}
+
+/* Set the chi-square gate of star tracker fixes, 0 disables gating */
+void kf_gate_l(double chi2){
+    gate_chi2 = chi2;
+}
+
+/* gate_fix:
+ * Gate a star tracker fix on the squared Mahalanobis distance of its
+ * innovation in both axes. After GATE_MAX_REJECT consecutive rejections the
+ * filter is reinitialised at the fix, as the filter is then more likely to be
+ * wrong than the star tracker.
+ *
+ * return:
+ *      1: fix accepted
+ *      0: fix rejected, do not update the filter with it
+ */
+static char gate_fix(double az_ang, double alt_ang){
+
+    double nu_az, s_az, nu_alt, s_alt;
+    gate_innovation(az, az_ang, &nu_az, &s_az);
+    gate_innovation(alt, alt_ang, &nu_alt, &s_alt);
+
+    double d2 = nu_az * nu_az / s_az + nu_alt * nu_alt / s_alt;
+    char accept = gate_chi2 <= 0 || d2 <= gate_chi2;
+
+    gate_stat.d2 = d2;
+
+    if(accept){
+        gate_stat.accepted++;
+        gate_stat.consecutive = 0;
+    }
+    else{
+        gate_stat.rejected++;
+        gate_stat.consecutive++;
+
+        logging(WARN, "Kalman F", "Star tracker fix rejected, d2 = %.1lf, "
+                "innovation az %+.4lf alt %+.4lf", d2, nu_az, nu_alt);
+
+        if(gate_stat.consecutive >= GATE_MAX_REJECT){
+            logging(ERROR, "Kalman F", "%d consecutive fixes rejected, "
+                    "reinitialising at az %.4lf alt %.4lf",
+                    gate_stat.consecutive, az_ang, alt_ang);
+
+            init_kalman_vars(az_ang, alt_ang);
+            hist_index = 0;
+
+            gate_stat.reinits++;
+            gate_stat.consecutive = 0;
+        }
+    }
+
+    logging_csv(gate_log, "%.3lf,%d,%ld,%ld,%d,%ld,%.3lf", d2, accept,
+            gate_stat.accepted, gate_stat.rejected, gate_stat.consecutive,
+            gate_stat.reinits, fix_r_scale);
+
+    bus_kf_gate_t msg = {d2, gate_stat.accepted, gate_stat.rejected,
+            gate_stat.consecutive, gate_stat.reinits};
+    publish_topic(TOPIC_KF_GATE, &msg);
+
+    return accept;
+}
+
+/* innovation and its covariance as computed by kf_axis for a measurement */
+static void gate_innovation(axis_context_t axis, double z, double* nu,
+        double* s){
+
+    long prop_from_index = fix_index();
+
+    if(prop_from_index < (long)hist_index){
+        *nu = z - axis.x_hist[prop_from_index][0];
+        *s = axis.p_hist[prop_from_index][0][0] + axis.R[0][0] * fix_r_scale;
+    }
+    else{
+        *nu = z - axis.x_prev[0][0];
+        *s = axis.P_prev[0][0] + axis.R[0][0] * fix_r_scale;
+    }
+}
+
 static int kf_axis(axis_context_t axis, double gyro_data, double* st_data){
 
     axis.w_meas[0][0] = gyro_data;
@@ -490,19 +728,25 @@ static int kf_axis(axis_context_t axis, double gyro_data, double* st_data){
             hist_index = save_len;
         }
 
-        /* go back to middle of exposure and re-propagate */
-        int prop_from_index = (get_st_exp() * 1000) / (2 * GYRO_SAMPLE_TIME);
+        /* go back to middle of exposure and re-propagate, a fix newer than
+         * the history is applied to the propagated state */
+        long prop_from_index = fix_index();
 
-        for(int ii=0; ii<X_PREV_ROWS; ++ii){
-            axis.x_next[ii][0] = axis.x_hist[prop_from_index][ii];
-        }
+        if(prop_from_index < (long)hist_index){
+            for(int ii=0; ii<X_PREV_ROWS; ++ii){
+                axis.x_next[ii][0] = axis.x_hist[prop_from_index][ii];
+            }
 
-        for(int ii=0; ii<P_PREV_ROWS; ++ii){
-            for(int jj=0; jj<P_PREV_COLS; ++jj){
-                axis.P_next[ii][jj] = axis.p_hist[prop_from_index][ii][jj];
+            for(int ii=0; ii<P_PREV_ROWS; ++ii){
+                for(int jj=0; jj<P_PREV_COLS; ++jj){
+                    axis.P_next[ii][jj] = axis.p_hist[prop_from_index][ii][jj];
+                }
             }
         }
 
+        /* R of this fix, adapt_noise sets the adapted R again */
+        axis.R[0][0] *= fix_r_scale;
+
         // innovation
         innovate_nu_next(axis, st_data);
         update_s_next(axis);
@@ -527,6 +771,9 @@ static int kf_axis(axis_context_t axis, double gyro_data, double* st_data){
         update_state(axis);
         update_covar(axis);
 
+        // tune R and Q for the next fix
+        adapt_noise(axis, hist_index);
+
         // save estimates (and log)
         //x_prev = x_upd;
         for(int i = 0; i < X_PREV_ROWS; i++) {
@@ -550,7 +797,7 @@ static int kf_axis(axis_context_t axis, double gyro_data, double* st_data){
             axis.P_prev[0][0], axis.P_prev[0][1], axis.P_prev[1][0], axis.P_prev[1][1]);
 
         /* re-propagation loop */
-        for(int ii = prop_from_index; ii < hist_index; ++ii){
+        for(long ii = prop_from_index; ii < (long)hist_index; ++ii){
 
             /* load gyro measurements */
             axis.w_meas[0][0] = axis.gyro_hist[ii];
@@ -641,6 +888,147 @@ static int kf_axis(axis_context_t axis, double gyro_data, double* st_data){
     return SUCCESS;
 }
 
+/* adapt_noise:
+ * Innovation based adaptive estimation of the measurement and process noise.
+ * Over a window of star tracker fixes R is estimated as
+ * mean(nu^2) - mean(H*P*H') and Q as mean(K*nu^2*K') spread over the gyro
+ * steps between fixes. Estimates are bounded relative to the nominal values
+ * set in init_kalman_vars.
+ *
+ * input:
+ *      axis: axis after the measurement update
+ *      steps: gyro samples since the previous fix
+ */
+static void adapt_noise(axis_context_t axis, size_t steps){
+
+    adapt_t* ad = axis.adapt;
+    double dt = (double)GYRO_SAMPLE_TIME/1000000000;
+
+    double nu2 = axis.nu_next[0][0] * axis.nu_next[0][0];
+    double scale = steps ? 1 / (steps * dt * dt) : 0;
+
+    /* normalised to the R of a nominal fix, R is estimated for those */
+    double w = 1 / fix_r_scale;
+
+    int idx = ad->index;
+    ad->nu2[idx] = nu2 * w;
+    ad->s[idx] = axis.S_next[0][0] * w;
+    ad->hph[idx] = (axis.S_next[0][0] - axis.R[0][0]) * w;
+    ad->dq[idx] = axis.K[0][0] * axis.K[0][0] * nu2 * scale;
+    ad->dq2[idx] = axis.K[1][0] * axis.K[1][0] * nu2 * scale;
+
+    ad->index = (idx + 1) % ADAPT_WINDOW;
+    if(ad->count < ADAPT_WINDOW){
+        ad->count++;
+    }
+
+    double nu2_m = 0, hph_m = 0, dq_m = 0, dq2_m = 0, nis = 0;
+    for(int ii=0; ii<ad->count; ++ii){
+        nu2_m += ad->nu2[ii];
+        hph_m += ad->hph[ii];
+        dq_m += ad->dq[ii];
+        dq2_m += ad->dq2[ii];
+        nis += ad->nu2[ii] / ad->s[ii];
+    }
+    nu2_m /= ad->count;
+    hph_m /= ad->count;
+    dq_m /= ad->count;
+    dq2_m /= ad->count;
+    ad->nis = nis / ad->count;
+
+    /* keep the nominal values until the window is full */
+    char full = ad->count == ADAPT_WINDOW;
+
+    axis.R[0][0] = adapt_r_flag && full ?
+            clamp(nu2_m - hph_m, ad->r_nom * ADAPT_R_MIN,
+                    ad->r_nom * ADAPT_R_MAX) :
+            ad->r_nom;
+
+    if(adapt_q_flag && full){
+        axis.Q[0][0] = clamp(dq_m, ad->q_nom * ADAPT_Q_MIN,
+                ad->q_nom * ADAPT_Q_MAX);
+        axis.Q2[0][0] = clamp(dq2_m, ad->q2_nom * ADAPT_Q_MIN,
+                ad->q2_nom * ADAPT_Q_MAX);
+    }
+    else{
+        axis.Q[0][0] = ad->q_nom;
+        axis.Q2[0][0] = ad->q2_nom;
+    }
+
+    logging_csv(axis.adapt_log, "%+.10e,%+.10e,%+.10e,%+.10e,%+.10e,%.4lf",
+            nu2_m, hph_m, axis.R[0][0], axis.Q[0][0], axis.Q2[0][0], ad->nis);
+}
+
+/* fix_scale:
+ * Measurement noise of a star tracker fix relative to the adapted R, from the
+ * match quality reported by the solver. Fixes of many stars with small
+ * residuals pull the estimate harder, few stars, large residuals or a
+ * marginal log-odds less.
+ *
+ * input:
+ *      st: the fix
+ *
+ * return:
+ *      factor to apply to R for this fix, 1 if the solver gave no quality
+ */
+static double fix_scale(const star_tracker_t* st){
+
+    if(st->matched <= 0 || st->rms <= 0){
+        return 1;
+    }
+
+    /* pointing error of the fix, unit: degrees */
+    double sigma = st->rms / 3600 / sqrt(st->matched);
+
+    /* the nominal R is the same for both axes */
+    double scale = clamp(sigma * sigma / adapt_az.r_nom, FIX_SCALE_MIN, FIX_SCALE_MAX);
+
+    double margin = clamp((FIX_LOG_ODDS_GOOD - st->log_odds) /
+            (FIX_LOG_ODDS_GOOD - FIX_LOG_ODDS_MIN), 0, 1);
+
+    return scale * (1 + (FIX_MARGINAL - 1) * margin);
+}
+
+/* fix_steps_back:
+ * Count the control steps from the middle of the star tracker exposure of a
+ * fix to now. The history holds one state per step, the state at the middle
+ * of the exposure is found that many steps back from hist_index.
+ *
+ * input:
+ *      st: the fix
+ *
+ * return:
+ *      steps back from now, fixes without a stamped exposure are taken at half
+ *      the star tracker exposure after the previous fix
+ */
+static long fix_steps_back(const star_tracker_t* st){
+
+    if(st->mid_mono.tv_sec == 0 && st->mid_mono.tv_nsec == 0){
+        return (long)hist_index - (get_st_exp() * 1000) / (2 * GYRO_SAMPLE_TIME);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double age = (now.tv_sec - st->mid_mono.tv_sec) * 1e9 +
+            (now.tv_nsec - st->mid_mono.tv_nsec);
+
+    return lround(age / GYRO_SAMPLE_TIME);
+}
+
+/* history index of the state at the middle of the fix's exposure, hist_index
+ * if the fix is newer than the history */
+static long fix_index(void){
+
+    long index = (long)hist_index - fix_back;
+
+    return index < 0 ? 0 : index > (long)hist_index ? (long)hist_index : index;
+}
+
+static double clamp(double val, double min, double max){
+    return val < min ? min : val > max ? max : val;
+}
+
 /*******************************************************************************
 ********************************************************************************
 ************************************KF**FUNCS***********************************
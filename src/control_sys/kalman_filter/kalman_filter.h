@@ -11,4 +11,51 @@
 
 int init_kalman_filter(void* args);
 
+typedef struct{
+    double az, alt;
+    double bias_az, bias_alt;
+    double p_az[2][2], p_alt[2][2];
+    double w_az, w_alt;             /* gyro rate used in the last step */
+    double q_az, q2_az, q_alt, q2_alt;
+} kf_state_t;
+
 int kf_update(telescope_att_t* cur_att);
+
+/* kf_get_state:
+ * Copy the latest state estimate and covariance of both axes. Only to be
+ * called from the control system thread, between calls to kf_update.
+ */
+void kf_get_state(kf_state_t* state);
+
+typedef struct{
+    double r_az, q_az, q2_az;       /* R, Q (angle) and Q2 (bias) in use */
+    double nis_az;                  /* mean normalised innovation squared */
+    double r_alt, q_alt, q2_alt;
+    double nis_alt;
+} kf_noise_t;
+
+/* kf_get_noise:
+ * Copy the noise parameters currently used by the filter. Only to be called
+ * from the control system thread, between calls to kf_update.
+ */
+void kf_get_noise(kf_noise_t* noise);
+
+typedef struct{
+    double d2;              /* squared Mahalanobis distance of the last fix */
+    long accepted, rejected;
+    int consecutive;        /* rejections since the last accepted fix */
+    long reinits;           /* reinitialisations after repeated rejections */
+} kf_gate_t;
+
+/* kf_get_gate:
+ * Copy the gating statistics of star tracker fixes. Only to be called from
+ * the control system thread, between calls to kf_update.
+ */
+void kf_get_gate(kf_gate_t* gate);
+
+/* Set the chi-square gate of star tracker fixes, 0 disables gating */
+void kf_gate_l(double chi2);
+
+/* Select which noise parameters are adapted from the innovations, parameters
+ * not adapted return to their nominal values at the next star tracker fix */
+void kf_adapt_enable_l(char r, char q);
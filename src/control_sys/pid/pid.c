@@ -27,6 +27,7 @@
 #include <math.h>
 
 #include "global_utils.h"
+#include "lock.h"
 #include "control_sys.h"
 #include "gimbal.h"
 #include "current_target.h"
@@ -34,7 +35,7 @@
 
 double get_current_time();
 double motor_control_step(pid_values_t* current_pid_values,
-                          pthread_mutex_t* pid_values_mutex,
+                          lock_t* pid_values_mutex,
                           control_variables_t* prev_vars,
                           control_variables_t* current_vars);
 
@@ -70,10 +71,10 @@ static pid_values_t track_alt_pid_values = {
        ,.kd = 0
 };
 
-static pthread_mutex_t az_pid_values_mutex = PTHREAD_MUTEX_INITIALIZER,
-        alt_pid_values_mutex = PTHREAD_MUTEX_INITIALIZER,
-        az_control_vars_mutex = PTHREAD_MUTEX_INITIALIZER,
-        alt_control_vars_mutex = PTHREAD_MUTEX_INITIALIZER;
+static lock_t az_pid_values_mutex = LOCK_INITIALIZER("az_pid_values_mutex"),
+        alt_pid_values_mutex = LOCK_INITIALIZER("alt_pid_values_mutex"),
+        az_control_vars_mutex = LOCK_INITIALIZER("az_control_vars_mutex"),
+        alt_control_vars_mutex = LOCK_INITIALIZER("alt_control_vars_mutex");
 
 static control_variables_t az_prev_control_vars, az_current_control_vars,
                            alt_prev_control_vars, alt_current_control_vars;
@@ -137,14 +138,19 @@ void pid_update(telescope_att_t* cur_att, motor_step_t* motor_out) {
 //    while(1) {
 //    usleep(10000); //0.01 sec TODO: Delete this, as in the end it's not a loop
 
-    pthread_mutex_lock(&az_control_vars_mutex);
-    pthread_mutex_lock(&alt_control_vars_mutex);
+    lock_acquire(&az_control_vars_mutex);
+    lock_acquire(&alt_control_vars_mutex);
 
     // Getting values from Kalman filter and tracking subsystem
     az_current_control_vars.current_position = cur_att->az;
     alt_current_control_vars.current_position = cur_att->alt;
     get_tracking_angles(&az_current_control_vars.target_position, &alt_current_control_vars.target_position);
 
+    /* turn the short way round to an az target given in another turn */
+    az_current_control_vars.target_position = ang_near(
+            az_current_control_vars.target_position,
+            az_current_control_vars.current_position);
+
     // TODO: This is for simulation only
 //    az_current_control_vars.current_position = az_prev_control_vars.pid_output;
 //    alt_current_control_vars.current_position = alt_prev_control_vars.pid_output;
@@ -263,8 +269,8 @@ void pid_update(telescope_att_t* cur_att, motor_step_t* motor_out) {
     az_prev_control_vars = az_current_control_vars;
     alt_prev_control_vars = alt_current_control_vars;
 
-    pthread_mutex_unlock(&az_control_vars_mutex);
-    pthread_mutex_unlock(&alt_control_vars_mutex);
+    lock_release(&az_control_vars_mutex);
+    lock_release(&alt_control_vars_mutex);
 
 //        if(sim_time-sim_start >= 90.0 && changer == 0) {
 //            pid_reset(); // TODO: Delete this after testing
@@ -289,7 +295,7 @@ double get_current_time(){
 
 /* PID mathematical algorithm */
 double motor_control_step(pid_values_t* current_pid_values,
-                        pthread_mutex_t* pid_values_mutex,
+                        lock_t* pid_values_mutex,
                         control_variables_t* prev_vars,
                         control_variables_t* current_vars) {
     //stabilization_timestep = current_vars->time_in_seconds - prev_vars->time_in_seconds;
@@ -300,11 +306,11 @@ double motor_control_step(pid_values_t* current_pid_values,
     current_vars->integral = prev_vars->integral + current_vars->position_error * stabilization_timestep;
     current_vars->derivative = (current_vars->position_error - prev_vars->position_error) / stabilization_timestep;
 
-    pthread_mutex_lock(pid_values_mutex);
+    lock_acquire(pid_values_mutex);
     current_vars->pid_output = (current_pid_values->kp * current_vars->position_error) +
                                (current_pid_values->ki * current_vars->integral) +
                                (current_pid_values->kd * current_vars->derivative);
-    pthread_mutex_unlock(pid_values_mutex);
+    lock_release(pid_values_mutex);
     return current_vars->pid_output;
 }
 
@@ -316,18 +322,18 @@ double motor_control_step(pid_values_t* current_pid_values,
  */
 int change_pid_values(int motor_id, double new_p, double new_i, double new_d){
     if (motor_id == 1) {
-        pthread_mutex_lock(&az_pid_values_mutex);
+        lock_acquire(&az_pid_values_mutex);
         current_az_pid_values.kp = new_p;
         current_az_pid_values.ki = new_i;
         current_az_pid_values.kd = new_d;
-        pthread_mutex_unlock(&az_pid_values_mutex);
+        lock_release(&az_pid_values_mutex);
         return 0;
     } else if (motor_id == 2) {
-        pthread_mutex_lock(&alt_pid_values_mutex);
+        lock_acquire(&alt_pid_values_mutex);
         current_alt_pid_values.kp = new_p;
         current_alt_pid_values.ki = new_i;
         current_alt_pid_values.kd = new_d;
-        pthread_mutex_unlock(&alt_pid_values_mutex);
+        lock_release(&alt_pid_values_mutex);
         return 0;
     } else {
         logging(ERROR, "PID", "change_pid_values: Wrong motor id.");
@@ -347,7 +353,7 @@ int change_pid_values(int motor_id, double new_p, double new_i, double new_d){
  */
 int change_mode_pid_values(int motor_id, int mode_id, double new_p, double new_i, double new_d){
     if (motor_id == 1) {
-        pthread_mutex_lock(&az_pid_values_mutex);
+        lock_acquire(&az_pid_values_mutex);
         if (mode_id == 1) {
             track_az_pid_values.kp = new_p;
             track_az_pid_values.ki = new_i;
@@ -358,13 +364,13 @@ int change_mode_pid_values(int motor_id, int mode_id, double new_p, double new_i
             stab_az_pid_values.kd = new_d;
         } else {
             logging(ERROR, "PID", "change_mode_pid_values: Wrong mode id.");
-            pthread_mutex_unlock(&az_pid_values_mutex);
+            lock_release(&az_pid_values_mutex);
             return 1;
         }
-        pthread_mutex_unlock(&az_pid_values_mutex);
+        lock_release(&az_pid_values_mutex);
         return 0;
     } else if (motor_id == 2) {
-        pthread_mutex_lock(&alt_pid_values_mutex);
+        lock_acquire(&alt_pid_values_mutex);
         if (mode_id == 1) {
             track_alt_pid_values.kp = new_p;
             track_alt_pid_values.ki = new_i;
@@ -375,10 +381,10 @@ int change_mode_pid_values(int motor_id, int mode_id, double new_p, double new_i
             stab_alt_pid_values.kd = new_d;
         } else {
             logging(ERROR, "PID", "change_mode_pid_values: Wrong mode id.");
-            pthread_mutex_unlock(&az_pid_values_mutex);
+            lock_release(&alt_pid_values_mutex);
             return 1;
         }
-        pthread_mutex_unlock(&alt_pid_values_mutex);
+        lock_release(&alt_pid_values_mutex);
         return 0;
     } else {
         logging(ERROR, "PID", "change_mode_pid_values: Wrong motor id.");
@@ -393,24 +399,24 @@ int change_mode_pid_values(int motor_id, int mode_id, double new_p, double new_i
  */
 int change_stabilization_mode(int on_off){
     if (on_off == 1) {
-        pthread_mutex_lock(&az_pid_values_mutex);
+        lock_acquire(&az_pid_values_mutex);
         current_az_pid_values = stab_az_pid_values;
-        pthread_mutex_unlock(&az_pid_values_mutex);
+        lock_release(&az_pid_values_mutex);
 
-        pthread_mutex_lock(&alt_pid_values_mutex);
+        lock_acquire(&alt_pid_values_mutex);
         current_alt_pid_values = stab_alt_pid_values;
-        pthread_mutex_unlock(&alt_pid_values_mutex);
+        lock_release(&alt_pid_values_mutex);
 
         logging(INFO, "PID", "Mode changed to stabilization.");
         return 0;
     } else if (on_off == 0) {
-        pthread_mutex_lock(&az_pid_values_mutex);
+        lock_acquire(&az_pid_values_mutex);
         current_az_pid_values = track_az_pid_values;
-        pthread_mutex_unlock(&az_pid_values_mutex);
+        lock_release(&az_pid_values_mutex);
 
-        pthread_mutex_lock(&alt_pid_values_mutex);
+        lock_acquire(&alt_pid_values_mutex);
         current_alt_pid_values = track_alt_pid_values;
-        pthread_mutex_unlock(&alt_pid_values_mutex);
+        lock_release(&alt_pid_values_mutex);
 
         logging(INFO, "PID", "Mode changed to tracking.");
         return 0;
@@ -420,21 +426,32 @@ int change_stabilization_mode(int on_off){
     }
 }
 
+/* Copy the control variables of the latest update of both axes */
+void pid_get_vars(control_variables_t* az, control_variables_t* alt){
+    lock_acquire(&az_control_vars_mutex);
+    *az = az_prev_control_vars;
+    lock_release(&az_control_vars_mutex);
+
+    lock_acquire(&alt_control_vars_mutex);
+    *alt = alt_prev_control_vars;
+    lock_release(&alt_control_vars_mutex);
+}
+
 /* Resets the value for integral part and for the position error */
 void pid_reset(){
-    pthread_mutex_lock(&az_control_vars_mutex);
+    lock_acquire(&az_control_vars_mutex);
     az_prev_control_vars.position_error = 0;
     az_prev_control_vars.integral = 0;
     az_current_control_vars.position_error = 0;
     az_current_control_vars.integral = 0;
-    pthread_mutex_unlock(&az_control_vars_mutex);
+    lock_release(&az_control_vars_mutex);
 
-    pthread_mutex_lock(&alt_control_vars_mutex);
+    lock_acquire(&alt_control_vars_mutex);
     alt_prev_control_vars.position_error = 0;
     alt_prev_control_vars.integral = 0;
     alt_current_control_vars.position_error = 0;
     alt_current_control_vars.integral = 0;
-    pthread_mutex_unlock(&alt_control_vars_mutex);
+    lock_release(&alt_control_vars_mutex);
 
     logging(INFO, "PID", "Resetting the integral part.");
 }
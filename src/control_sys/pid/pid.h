@@ -65,6 +65,9 @@ int change_pid_values(int motor_id, double new_p, double new_i, double new_d);
  */
 int change_mode_pid_values(int motor_id, int mode_id, double new_p, double new_i, double new_d);
 
+/* Copy the control variables of the latest update of both axes */
+void pid_get_vars(control_variables_t* az, control_variables_t* alt);
+
 /* Resets the value for integral part and for the position error */
 void pid_reset();
 
@@ -0,0 +1,731 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Pointing Model
+ * Parent Component: Control System
+ * Author(s):
+ * Purpose: Fit a pointing model of the gimbal to pairs of encoder angles and
+ *          star tracker fixes collected during flight, and correct the
+ *          gimbal slews with it.
+ * -----------------------------------------------------------------------------
+ */
+
+/**
+ * The model gives the pointing of the star tracker relative to the gondola as
+ * the encoder angles plus a correction linear in its terms:
+ *      alt: IE + TF cos(e) - AN cos(a) + AW sin(a)
+ *      az:  -AN sin(a) tan(e) - AW cos(a) tan(e) + CA sec(e) + NPAE tan(e)
+ *           + ACES sin(a) + ACEC cos(a)
+ * with a and e the encoder angles. CA and IE include the misalignment of the
+ * star tracker to the gimbal axes, AN and AW the mean tilt of the gondola.
+ *
+ * The gondola yaw is not measured, the azimuth of a fix is the yaw plus the
+ * pointing azimuth. The yaw is taken as constant over PM_WINDOW_S and removed
+ * by subtracting the mean of each window from the azimuth pairs, its drift
+ * within the window adds to the residuals. This also leaves no azimuth index
+ * term, the encoder offsets and the yaw cannot be told apart. The altitude
+ * pairs are fitted as they are.
+ *
+ * The terms are refitted by least squares every PM_FIT_S from every pair since
+ * the last reset, rejecting outliers once. A new model replaces the current
+ * one only if it fits the pairs better. The model is kept in
+ * output/pointing_model.dat and each fit is logged to
+ * output/logs/pointing_model.log, angles in arcseconds, as
+ *      time,pairs,rows,rms current,rms new,adopted,IE,TF,AN,AW,CA,NPAE,ACES,ACEC
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "global_utils.h"
+#include "lock.h"
+#include "arena.h"
+#include "ring.h"
+#include "sensors.h"
+#include "pointing_model.h"
+
+/* pairs kept, several hours at a fix every few seconds */
+#define PM_SAMPLES 4096
+
+/* entries left untouched when copying, the control loop keeps writing */
+#define PM_GUARD 1
+
+/* encoder history a fix is paired from, covers the exposure and the solve,
+ * unit: seconds */
+#define PM_ENC_S 30
+#define PM_ENC_LEN (PM_ENC_S * (1000000000 / CONTROL_SYS_WAIT))
+
+/* time between fits, unit: seconds */
+#define PM_FIT_S 120
+
+/* new pairs needed for a new fit and pairs needed for the first */
+#define PM_MIN_NEW 10
+#define PM_MIN_SAMPLES 30
+
+/* the gondola yaw is taken as constant over this time, unit: seconds */
+#define PM_WINDOW_S 60
+
+/* fastest gimbal motion a pair is taken at, unit: degrees/second */
+#define PM_RATE_MAX 0.05
+
+/* highest altitude a pair is taken at, the tan(e) terms diverge at zenith,
+ * unit: degrees */
+#define PM_ALT_MAX 80
+
+/* noise of a fix and expected size of a term, unit: degrees. Their ratio
+ * keeps terms the pairs do not constrain at zero. */
+#define PM_SIGMA_FIX (10.0 / 3600)
+#define PM_SIGMA_TERM 1.0
+
+/* residuals larger than PM_CLIP times the rms are rejected */
+#define PM_CLIP 3
+
+/* iterations of the inverse model, the correction is small */
+#define PM_INVERSE_ITER 4
+
+/* model terms, unit: degrees */
+#define PM_IE 0         /* altitude index error */
+#define PM_TF 1         /* tube flexure */
+#define PM_AN 2         /* azimuth axis tilt towards encoder az 0 */
+#define PM_AW 3         /* azimuth axis tilt towards encoder az 90 */
+#define PM_CA 4         /* star tracker not perpendicular to the altitude axis */
+#define PM_NPAE 5       /* azimuth and altitude axes not perpendicular */
+#define PM_ACES 6       /* azimuth encoder eccentricity, sine */
+#define PM_ACEC 7       /* azimuth encoder eccentricity, cosine */
+#define PM_TERMS 8
+
+typedef struct{
+    int64_t t_ns;                   /* CLOCK_MONOTONIC */
+    double enc_az, enc_alt;         /* encoder angles */
+    double az, alt;                 /* attitude of the fix */
+} pm_pair_t;
+
+typedef struct{
+    int64_t t_ns;                   /* CLOCK_MONOTONIC */
+    double az, alt;                 /* encoder angles */
+    double rate_az, rate_alt;       /* unit: degrees/second */
+    char out_of_date;
+} pm_enc_t;
+
+static void* thread_func(void* arg);
+static int fit(void);
+static long copy_pairs(long* reset);
+static int enc_at(int64_t t_ns, pm_enc_t* enc);
+static long build_rows(long count);
+static int solve(long rows, double c[PM_TERMS]);
+static double rms(long rows, const double c[PM_TERMS]);
+static long clip(long rows, const double c[PM_TERMS], double limit);
+static void terms(double enc_az, double enc_alt,
+        double p_az[PM_TERMS], double p_alt[PM_TERMS]);
+static void correction(const double c[PM_TERMS], double enc_az, double enc_alt,
+        double* d_az, double* d_alt);
+static void get_model(double c[PM_TERMS]);
+static void save_model(const double c[PM_TERMS]);
+static int64_t mono_ns(void);
+
+static lock_t mutex_pm = LOCK_INITIALIZER("mutex_pm");
+
+/* guarded by mutex_pm */
+static double model[PM_TERMS];
+static char enabled = 1;
+
+/* written by the control loop only */
+static ring_t ring;
+
+/* encoder angles of every control loop iteration, written and read by the
+ * control loop only */
+static ring_t enc_ring;
+
+/* pairs before this entry are dropped */
+static atomic_long reset_head;
+
+/* owned by the pointing model thread */
+static pm_pair_t* work;
+static double (*x)[PM_TERMS];
+static double* y;
+
+static char model_fn[100];
+static FILE* pm_log;
+
+int init_pointing_model(void* args){
+
+    /* allocate once, the control loop must not allocate memory */
+    work = arena_alloc(PM_SAMPLES * sizeof(*work), "Point Mdl");
+    x = arena_alloc(2 * PM_SAMPLES * sizeof(*x), "Point Mdl");
+    y = arena_alloc(2 * PM_SAMPLES * sizeof(*y), "Point Mdl");
+    if(ring_init(&ring, PM_SAMPLES, sizeof(pm_pair_t), "Point Mdl") ||
+            ring_init(&enc_ring, PM_ENC_LEN, sizeof(pm_enc_t), "Point Mdl") ||
+            work == NULL || x == NULL || y == NULL){
+        logging(ERROR, "Point Mdl", "Cannot allocate memory: %m");
+        return ENOMEM;
+    }
+
+    atomic_store(&reset_head, 0);
+
+    char log_fn[100];
+    strcpy(log_fn, get_top_dir());
+    strcat(log_fn, "output/logs/pointing_model.log");
+
+    pm_log = fopen(log_fn, "a");
+    if(pm_log == NULL){
+        logging(ERROR, "Point Mdl", "Failed to open log: %m");
+        return errno;
+    }
+
+    /* continue with the model of the previous run */
+    strcpy(model_fn, get_top_dir());
+    strcat(model_fn, "output/pointing_model.dat");
+
+    FILE* fp = fopen(model_fn, "r");
+    if(fp != NULL){
+        double c[PM_TERMS];
+        if(fread(c, sizeof(double), PM_TERMS, fp) == PM_TERMS){
+            memcpy(model, c, sizeof(model));
+            logging(INFO, "Point Mdl", "Loaded model: IE %.1lf\" CA %.1lf\" "
+                    "NPAE %.1lf\" AN %.1lf\" AW %.1lf\"", c[PM_IE] * 3600,
+                    c[PM_CA] * 3600, c[PM_NPAE] * 3600, c[PM_AN] * 3600,
+                    c[PM_AW] * 3600);
+        }
+        fclose(fp);
+    }
+
+    return create_thread("point_model", thread_func, 13);
+}
+
+/* pm_enc_sample:
+ * Store the current encoder angles. Called once per control system iteration,
+ * never blocks.
+ */
+void pm_enc_sample(void){
+
+    encoder_t enc;
+    get_encoder(&enc);
+
+    pm_enc_t* ent = ring_slot(&enc_ring);
+
+    ent->t_ns = mono_ns();
+    ent->az = enc.az;
+    ent->alt = enc.alt_ang;
+    ent->rate_az = enc.rate_az;
+    ent->rate_alt = enc.rate_alt;
+    ent->out_of_date = enc.out_of_date;
+
+    ring_publish(&enc_ring);
+}
+
+/* pm_sample:
+ * Pair an accepted star tracker fix with the encoder angles at the middle of
+ * its exposure. Called by the kalman filter, never blocks.
+ */
+void pm_sample(double az, double alt, const struct timespec* mid){
+
+    /* the solve takes seconds, the current angles are not those of the fix */
+    if(mid->tv_sec == 0 && mid->tv_nsec == 0){
+        return;
+    }
+
+    int64_t t_ns = (int64_t)mid->tv_sec * 1000000000 + mid->tv_nsec;
+
+    pm_enc_t enc;
+    if(enc_at(t_ns, &enc) || fabs(enc.alt) > PM_ALT_MAX ||
+            fabs(enc.rate_az) > PM_RATE_MAX || fabs(enc.rate_alt) > PM_RATE_MAX){
+        return;
+    }
+
+    pm_pair_t* pair = ring_slot(&ring);
+
+    pair->t_ns = t_ns;
+    pair->enc_az = enc.az;
+    pair->enc_alt = enc.alt;
+    pair->az = az;
+    pair->alt = alt;
+
+    ring_publish(&ring);
+}
+
+/* enc_at:
+ * Encoder angles at a time, interpolated between the two iterations around
+ * it. The rates are the larger of the two.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ERANGE: the time is not covered by the encoder history
+ *      ENODATA: the encoder was out of date at the time
+ */
+static int enc_at(int64_t t_ns, pm_enc_t* enc){
+
+    long head = ring_head(&enc_ring);
+    long lo = head > PM_ENC_LEN ? head - PM_ENC_LEN : 0;
+    long hi = head - 1;
+
+    const pm_enc_t* first = ring_at(&enc_ring, lo);
+    const pm_enc_t* last = ring_at(&enc_ring, hi);
+    if(first == NULL || last == NULL || t_ns < first->t_ns ||
+            t_ns > last->t_ns + CONTROL_SYS_WAIT){
+        return ERANGE;
+    }
+    if(t_ns >= last->t_ns){
+        lo = hi;
+    }
+
+    /* last entry at or before the time */
+    while(lo < hi){
+        long m = (lo + hi + 1) / 2;
+        const pm_enc_t* ent = ring_at(&enc_ring, m);
+        if(ent->t_ns <= t_ns){
+            lo = m;
+        }
+        else{
+            hi = m - 1;
+        }
+    }
+
+    const pm_enc_t* a = ring_at(&enc_ring, lo);
+    const pm_enc_t* b = ring_at(&enc_ring, lo + 1);
+    if(b == NULL){
+        b = a;
+    }
+    if(a->out_of_date || b->out_of_date){
+        return ENODATA;
+    }
+
+    double f = b->t_ns > a->t_ns ?
+            (double)(t_ns - a->t_ns) / (b->t_ns - a->t_ns) : 0;
+
+    /* the shorter way round for the azimuth */
+    double d_az = fmod(b->az - a->az + 540, 360) - 180;
+
+    enc->t_ns = t_ns;
+    enc->az = a->az + f * d_az;
+    enc->alt = a->alt + f * (b->alt - a->alt);
+    enc->rate_az = fmax(fabs(a->rate_az), fabs(b->rate_az));
+    enc->rate_alt = fmax(fabs(a->rate_alt), fabs(b->rate_alt));
+    enc->out_of_date = 0;
+
+    return SUCCESS;
+}
+
+void pm_enc_to_pointing(double enc_az, double enc_alt, double* az, double* alt){
+
+    double c[PM_TERMS];
+    get_model(c);
+
+    double d_az, d_alt;
+    correction(c, enc_az, enc_alt, &d_az, &d_alt);
+
+    *az = enc_az + d_az;
+    *alt = enc_alt + d_alt;
+}
+
+void pm_pointing_to_enc(double az, double alt, double* enc_az, double* enc_alt){
+
+    double c[PM_TERMS];
+    get_model(c);
+
+    double a = az, e = alt;
+
+    for(int ii=0; ii<PM_INVERSE_ITER; ++ii){
+        double d_az, d_alt;
+        correction(c, a, e, &d_az, &d_alt);
+
+        a = az - d_az;
+        e = alt - d_alt;
+    }
+
+    *enc_az = a;
+    *enc_alt = e;
+}
+
+void pm_set_l(int mode){
+
+    if(mode == PM_RESET){
+        atomic_store(&reset_head, ring_head(&ring));
+
+        lock_acquire(&mutex_pm);
+        memset(model, 0, sizeof(model));
+        lock_release(&mutex_pm);
+
+        save_model(model);
+        logging(INFO, "Point Mdl", "Model and pairs reset");
+        return;
+    }
+
+    if(mode != PM_ON && mode != PM_OFF){
+        logging(WARN, "Point Mdl", "Unknown mode %d", mode);
+        return;
+    }
+
+    lock_acquire(&mutex_pm);
+    enabled = mode == PM_ON;
+    lock_release(&mutex_pm);
+
+    logging(INFO, "Point Mdl", "Slews %s", mode == PM_ON ?
+            "corrected by the model" : "by the encoder angles");
+}
+
+static void* thread_func(void* arg){
+
+    long fitted = 0;
+
+    while(1){
+
+        sleep(PM_FIT_S);
+
+        long head = ring_head(&ring);
+        long reset = atomic_load(&reset_head);
+
+        if(fitted < reset){
+            fitted = reset;
+        }
+        if(head - fitted < PM_MIN_NEW){
+            continue;
+        }
+
+        fit();
+        fitted = head;
+    }
+
+    return NULL;
+}
+
+/* fit:
+ * Fit the terms to every pair since the last reset and replace the model if
+ * the new one fits the pairs better.
+ *
+ * return:
+ *      SUCCESS: model replaced
+ *      EAGAIN: too few pairs
+ *      EDOM: the pairs do not determine the terms
+ *      FAILURE: the current model fits as well
+ */
+static int fit(void){
+
+    long reset;
+    long count = copy_pairs(&reset);
+    if(count < PM_MIN_SAMPLES){
+        return EAGAIN;
+    }
+
+    long rows = build_rows(count);
+
+    double c[PM_TERMS];
+    if(solve(rows, c)){
+        logging(WARN, "Point Mdl", "Fit of %ld pairs failed", count);
+        return EDOM;
+    }
+
+    /* reject outliers, e.g. fixes taken while the gondola turned */
+    rows = clip(rows, c, PM_CLIP * rms(rows, c));
+    if(solve(rows, c)){
+        logging(WARN, "Point Mdl", "Fit of %ld pairs failed", count);
+        return EDOM;
+    }
+
+    double cur[PM_TERMS];
+    lock_acquire(&mutex_pm);
+    memcpy(cur, model, sizeof(cur));
+    lock_release(&mutex_pm);
+
+    double rms_cur = rms(rows, cur);
+    double rms_new = rms(rows, c);
+    char adopt = rms_new < rms_cur;
+
+    char line[200];
+    int len = snprintf(line, sizeof(line), "%ld,%ld,%.2lf,%.2lf,%d", count,
+            rows, rms_cur * 3600, rms_new * 3600, adopt);
+    for(int ii=0; ii<PM_TERMS; ++ii){
+        len += snprintf(&line[len], sizeof(line) - len, ",%.2lf", c[ii] * 3600);
+    }
+    logging_csv(pm_log, "%s", line);
+
+    if(!adopt){
+        return FAILURE;
+    }
+
+    lock_acquire(&mutex_pm);
+    /* pairs of before a reset must not bring back the old model */
+    if(atomic_load(&reset_head) == reset){
+        memcpy(model, c, sizeof(model));
+    }
+    else{
+        adopt = 0;
+    }
+    lock_release(&mutex_pm);
+
+    if(!adopt){
+        return FAILURE;
+    }
+
+    save_model(c);
+
+    logging(INFO, "Point Mdl", "New model from %ld pairs, rms %.1lf\" was "
+            "%.1lf\"", count, rms_new * 3600, rms_cur * 3600);
+
+    return SUCCESS;
+}
+
+/* copy the pairs since the last reset to work, oldest first, 0 if the copy
+ * was overwritten */
+static long copy_pairs(long* reset){
+
+    *reset = atomic_load(&reset_head);
+
+    return ring_copy(&ring, work, *reset, PM_GUARD);
+}
+
+/* build_rows:
+ * Set up the least squares problem y = x * c from the pairs in work, one row
+ * for the altitude of every pair and one for the azimuth of every pair
+ * sharing its window with another. Azimuth rows are scaled to a sky angle.
+ *
+ * return:
+ *      number of rows
+ */
+static long build_rows(long count){
+
+    long rows = 0;
+    double p_az[PM_TERMS];
+
+    for(long ii=0; ii<count; ++ii){
+        terms(work[ii].enc_az, work[ii].enc_alt, p_az, x[rows]);
+        y[rows++] = work[ii].alt - work[ii].enc_alt;
+    }
+
+    int64_t window = (int64_t)PM_WINDOW_S * 1000000000;
+
+    for(long start=0, end; start<count; start=end){
+
+        for(end=start+1; end<count && work[end].t_ns - work[start].t_ns <= window;
+                ++end);
+
+        long n = end - start;
+        if(n < 2){
+            continue;
+        }
+
+        /* azimuth relative to the first pair, the yaw is continuous */
+        double ref = work[start].az - work[start].enc_az;
+        double mean_x[PM_TERMS] = {0}, mean_y = 0;
+        double p_alt[PM_TERMS];
+
+        for(long ii=start; ii<end; ++ii){
+            double* row = x[rows + ii - start];
+            terms(work[ii].enc_az, work[ii].enc_alt, row, p_alt);
+            y[rows + ii - start] = ang_wrap180(work[ii].az - work[ii].enc_az - ref);
+
+            for(int jj=0; jj<PM_TERMS; ++jj){
+                mean_x[jj] += row[jj] / n;
+            }
+            mean_y += y[rows + ii - start] / n;
+        }
+
+        /* removes the yaw of the window */
+        for(long ii=start; ii<end; ++ii){
+            double scale = cos(work[ii].enc_alt * M_PI / 180);
+            double* row = x[rows + ii - start];
+
+            for(int jj=0; jj<PM_TERMS; ++jj){
+                row[jj] = (row[jj] - mean_x[jj]) * scale;
+            }
+            y[rows + ii - start] = (y[rows + ii - start] - mean_y) * scale;
+        }
+
+        rows += n;
+    }
+
+    return rows;
+}
+
+/* solve:
+ * Solve the regularised normal equations of the rows by Cholesky
+ * decomposition.
+ *
+ * output:
+ *      c: fitted terms
+ *
+ * return:
+ *      SUCCESS or FAILURE if the equations are singular
+ */
+static int solve(long rows, double c[PM_TERMS]){
+
+    double n[PM_TERMS][PM_TERMS] = {{0}}, b[PM_TERMS] = {0};
+    double lambda = (PM_SIGMA_FIX / PM_SIGMA_TERM) * (PM_SIGMA_FIX / PM_SIGMA_TERM);
+
+    for(long rr=0; rr<rows; ++rr){
+        for(int ii=0; ii<PM_TERMS; ++ii){
+            b[ii] += x[rr][ii] * y[rr];
+            for(int jj=0; jj<=ii; ++jj){
+                n[ii][jj] += x[rr][ii] * x[rr][jj];
+            }
+        }
+    }
+
+    for(int ii=0; ii<PM_TERMS; ++ii){
+        n[ii][ii] += lambda;
+    }
+
+    /* lower triangle in place */
+    for(int ii=0; ii<PM_TERMS; ++ii){
+        for(int jj=0; jj<=ii; ++jj){
+            double sum = n[ii][jj];
+            for(int kk=0; kk<jj; ++kk){
+                sum -= n[ii][kk] * n[jj][kk];
+            }
+
+            if(ii == jj){
+                if(sum <= 0){
+                    return FAILURE;
+                }
+                n[ii][ii] = sqrt(sum);
+            }
+            else{
+                n[ii][jj] = sum / n[jj][jj];
+            }
+        }
+    }
+
+    double z[PM_TERMS];
+    for(int ii=0; ii<PM_TERMS; ++ii){
+        double sum = b[ii];
+        for(int kk=0; kk<ii; ++kk){
+            sum -= n[ii][kk] * z[kk];
+        }
+        z[ii] = sum / n[ii][ii];
+    }
+
+    for(int ii=PM_TERMS-1; ii>=0; --ii){
+        double sum = z[ii];
+        for(int kk=ii+1; kk<PM_TERMS; ++kk){
+            sum -= n[kk][ii] * c[kk];
+        }
+        c[ii] = sum / n[ii][ii];
+    }
+
+    return SUCCESS;
+}
+
+/* rms residual of the rows with the terms c, unit: degrees */
+static double rms(long rows, const double c[PM_TERMS]){
+
+    double sum = 0;
+
+    for(long rr=0; rr<rows; ++rr){
+        double res = y[rr];
+        for(int ii=0; ii<PM_TERMS; ++ii){
+            res -= x[rr][ii] * c[ii];
+        }
+        sum += res * res;
+    }
+
+    return rows > 0 ? sqrt(sum / rows) : 0;
+}
+
+/* drop the rows with a residual larger than limit, returns the rows kept */
+static long clip(long rows, const double c[PM_TERMS], double limit){
+
+    long kept = 0;
+
+    for(long rr=0; rr<rows; ++rr){
+        double res = y[rr];
+        for(int ii=0; ii<PM_TERMS; ++ii){
+            res -= x[rr][ii] * c[ii];
+        }
+
+        if(fabs(res) <= limit){
+            memmove(x[kept], x[rr], sizeof(*x));
+            y[kept++] = y[rr];
+        }
+    }
+
+    return kept;
+}
+
+/* terms:
+ * Derivatives of the pointing azimuth and altitude by each term at the given
+ * encoder angles.
+ */
+static void terms(double enc_az, double enc_alt,
+        double p_az[PM_TERMS], double p_alt[PM_TERMS]){
+
+    if(enc_alt > PM_ALT_MAX){
+        enc_alt = PM_ALT_MAX;
+    }
+    else if(enc_alt < -PM_ALT_MAX){
+        enc_alt = -PM_ALT_MAX;
+    }
+
+    double a = enc_az * M_PI / 180;
+    double e = enc_alt * M_PI / 180;
+    double sin_a = sin(a), cos_a = cos(a);
+    double cos_e = cos(e), tan_e = tan(e);
+
+    memset(p_az, 0, PM_TERMS * sizeof(double));
+    memset(p_alt, 0, PM_TERMS * sizeof(double));
+
+    p_alt[PM_IE] = 1;
+    p_alt[PM_TF] = cos_e;
+    p_alt[PM_AN] = -cos_a;
+    p_alt[PM_AW] = sin_a;
+
+    p_az[PM_AN] = -sin_a * tan_e;
+    p_az[PM_AW] = -cos_a * tan_e;
+    p_az[PM_CA] = 1 / cos_e;
+    p_az[PM_NPAE] = tan_e;
+    p_az[PM_ACES] = sin_a;
+    p_az[PM_ACEC] = cos_a;
+}
+
+/* correction of the encoder angles by the terms c */
+static void correction(const double c[PM_TERMS], double enc_az, double enc_alt,
+        double* d_az, double* d_alt){
+
+    double p_az[PM_TERMS], p_alt[PM_TERMS];
+    terms(enc_az, enc_alt, p_az, p_alt);
+
+    *d_az = 0;
+    *d_alt = 0;
+    for(int ii=0; ii<PM_TERMS; ++ii){
+        *d_az += p_az[ii] * c[ii];
+        *d_alt += p_alt[ii] * c[ii];
+    }
+}
+
+/* the model in use, zero while disabled */
+static void get_model(double c[PM_TERMS]){
+
+    lock_acquire(&mutex_pm);
+    if(enabled){
+        memcpy(c, model, sizeof(model));
+    }
+    else{
+        memset(c, 0, sizeof(model));
+    }
+    lock_release(&mutex_pm);
+}
+
+static void save_model(const double c[PM_TERMS]){
+
+    FILE* fp = fopen(model_fn, "w");
+    if(fp == NULL){
+        logging(ERROR, "Point Mdl", "Failed to open model file: %m");
+        return;
+    }
+
+    fwrite(c, sizeof(double), PM_TERMS, fp);
+    fclose(fp);
+}
+
+static int64_t mono_ns(void){
+
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
@@ -0,0 +1,65 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Pointing Model
+ * Parent Component: Control System
+ * Author(s):
+ * Purpose: Fit a pointing model of the gimbal to pairs of encoder angles and
+ *          star tracker fixes collected during flight, and correct the
+ *          gimbal slews with it.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <time.h>
+
+/* pm_set_l() */
+#define PM_OFF 0        /* keep fitting, slews use the bare encoder angles */
+#define PM_ON 1         /* correct slews with the fitted model */
+#define PM_RESET 2      /* drop every pair and the model, e.g. new encoder offsets */
+
+/* initialise the pointing model component */
+int init_pointing_model(void* args);
+
+/* pm_enc_sample:
+ * Store the current encoder angles for pm_sample. Called once per control
+ * system iteration, never blocks.
+ */
+void pm_enc_sample(void);
+
+/* pm_sample:
+ * Pair an accepted star tracker fix with the encoder angles at the middle of
+ * its exposure. Called by the kalman filter, never blocks. Pairs taken while
+ * the gimbal moves, and fixes without a stamped exposure, are dropped.
+ *
+ * input:
+ *      az, alt: telescope attitude of the fix, unit: degrees
+ *      mid: CLOCK_MONOTONIC at the middle of the exposure, zero if unknown
+ */
+void pm_sample(double az, double alt, const struct timespec* mid);
+
+/* pm_enc_to_pointing:
+ * Direction the telescope points in, relative to the gondola, at the given
+ * encoder angles.
+ *
+ * input:
+ *      enc_az, enc_alt: encoder angles, unit: degrees
+ *
+ * output:
+ *      az, alt: pointing relative to the gondola, unit: degrees
+ */
+void pm_enc_to_pointing(double enc_az, double enc_alt, double* az, double* alt);
+
+/* pm_pointing_to_enc:
+ * Encoder angles that point the telescope in the given direction relative to
+ * the gondola, the inverse of pm_enc_to_pointing.
+ *
+ * input:
+ *      az, alt: pointing relative to the gondola, unit: degrees
+ *
+ * output:
+ *      enc_az, enc_alt: encoder angles, unit: degrees
+ */
+void pm_pointing_to_enc(double az, double alt, double* enc_az, double* enc_alt);
+
+/* Enable, disable or reset the pointing model, see PM_* */
+void pm_set_l(int mode);
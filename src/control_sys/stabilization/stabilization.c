@@ -9,16 +9,27 @@
  */
 
 #include <pthread.h>
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "current_target.h"
 #include "global_utils.h"
 #include "mode.h"
+#include "sensors.h"
 #include "control_sys.h"
 #include "gimbal.h"
 #include "pid.h"
 #include "kalman_filter.h"
+#include "exposure_planner.h"
+#include "attitude_recorder.h"
+#include "att_smoother.h"
+#include "flight_recorder.h"
+#include "pointing_model.h"
 
 static void* control_sys_thread(void* args);
+static void record_flight(const motor_step_t* steps,
+        const struct timespec* wake_time, const struct timespec* start);
 
 int init_stabilization(void* args){
     return create_thread("control_system", control_sys_thread, 30);
@@ -45,12 +56,23 @@ static void* control_sys_thread(void* args){
         //for(int ii=0; ii<10; ii++){
         while(get_mode() != RESET){
 
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
             kf_update(&cur_pos);
 
+            exp_planner_sample(&cur_pos);
+
             pid_update(&cur_pos, &motor_out);
 
             step_az_alt(&motor_out);
 
+            att_rec_sample(&motor_out);
+            att_smooth_sample();
+            pm_enc_sample();
+
+            record_flight(&motor_out, &wake_time, &start);
+
             wake_time.tv_nsec += CONTROL_SYS_WAIT;
             if(wake_time.tv_nsec >= 1000000000){
                 wake_time.tv_sec++;
@@ -62,3 +84,76 @@ static void* control_sys_thread(void* args){
 
     return NULL;
 }
+
+/* microseconds from a to b, saturated to fit the flight record */
+static uint16_t usec_u16(const struct timespec* a, const struct timespec* b){
+
+    long us = (b->tv_sec - a->tv_sec) * 1000000 +
+            (b->tv_nsec - a->tv_nsec) / 1000;
+
+    return us < 0 ? 0 : us > UINT16_MAX ? UINT16_MAX : us;
+}
+
+/* record_flight:
+ * Store the state of this iteration in the flight recorder.
+ *
+ * input:
+ *      steps: motor command of this iteration
+ *      wake_time: scheduled start of this iteration
+ *      start: actual start of this iteration
+ */
+static void record_flight(const motor_step_t* steps,
+        const struct timespec* wake_time, const struct timespec* start){
+
+    gyro_t gyro;
+    get_gyro(&gyro);
+
+    encoder_t enc;
+    get_encoder(&enc);
+
+    kf_state_t kf;
+    kf_get_state(&kf);
+
+    double target_az, target_alt;
+    get_tracking_angles(&target_az, &target_alt);
+
+    control_variables_t pid_az, pid_alt;
+    pid_get_vars(&pid_az, &pid_alt);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    fr_record_t rec = {
+        .t_ms = start->tv_sec * 1000 + start->tv_nsec / 1000000,
+        .gyro = {gyro.x, gyro.y, gyro.z},
+        .enc_az = enc.az,
+        .enc_alt = enc.alt_ang,
+        .enc_rate_az = enc.rate_az,
+        .enc_rate_alt = enc.rate_alt,
+        .kf_az = kf.az,
+        .kf_alt = kf.alt,
+        .bias_az = kf.bias_az,
+        .bias_alt = kf.bias_alt,
+        .sig_az = sqrt(fabs(kf.p_az[0][0])),
+        .sig_alt = sqrt(fabs(kf.p_alt[0][0])),
+        .target_az = target_az,
+        .target_alt = target_alt,
+        .err_az = pid_az.position_error,
+        .err_alt = pid_alt.position_error,
+        .int_az = pid_az.integral,
+        .int_alt = pid_alt.integral,
+        .der_az = pid_az.derivative,
+        .der_alt = pid_alt.derivative,
+        .out_az = pid_az.pid_output,
+        .out_alt = pid_alt.pid_output,
+        .step_az = steps->az,
+        .step_alt = steps->alt,
+        .latency_us = usec_u16(wake_time, start),
+        .exec_us = usec_u16(start, &now),
+        .mode = get_mode(),
+        .flags = (gyro.out_of_date ? FR_GYRO_OLD : 0) |
+                (enc.out_of_date ? FR_ENC_OLD : 0)
+    };
+
+    fr_push(&rec);
+}
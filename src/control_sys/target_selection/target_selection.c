@@ -21,19 +21,31 @@
 #include "camera.h"
 #include "mode.h"
 #include "gimbal.h"
+#include "exposure_planner.h"
+#include "attitude_recorder.h"
+#include "pointing_model.h"
+#include "img_processing.h"
 
 static void* sel_track_thread_func(void* arg);
 static int selection();
-static int tracking(int tar_index, char exposing_flag);
+static int tracking(int tar_index, char* exposing_flag);
 
-static double d_mod(double val, int mod);
 static void angle_calc(double dec, double ha,
         double lat, double* alt, double* az);
 static void fetch_time(double* ut_hours, double* j2000);
+static double gondola_az(const telescope_att_t* telescope_att,
+        const encoder_t* enc);
 
 static int exp_time = 30, sensor_gain = 100;
 static double az_threshold = 0.5, alt_threshold = 0.5;
 
+/* lucky imaging bursts replace the long exposure when lucky_frames > 0 */
+static int lucky_frames = 0, lucky_exp = 0, lucky_keep = 0;
+static char burst_mode = 0;
+
+/* continuous azimuth of the tracked target */
+static ang_unwrap_t track_az;
+
 FILE* sel_trck_log;
 
 int init_target_selection(void* args){
@@ -68,10 +80,23 @@ static void* sel_track_thread_func(void* arg){
 
             /* reset camera axis to center */
             int tar_index = selection();
+            ang_unwrap_reset(&track_az);
+
+            /* images of the new target do not resemble the last ones */
+            ref_keyframe();
 
             /* move up telescope for sun avoidance */
             move_alt_to(60);
 
+            /* slew blind to the target, tracking takes over from there */
+            double gon_az, gon_alt;
+            if(rd_to_gon(target_list_rd[tar_index].ra,
+                        target_list_rd[tar_index].dec, &gon_az, &gon_alt) == SUCCESS &&
+                    fabs(gon_az) < OP_FOV * 0.45){
+                move_az_to(gon_az);
+                move_alt_to(gon_alt);
+            }
+
             /* reset field rotator to clockwise position */
             reset_field_rotator();
 
@@ -82,7 +107,7 @@ static void* sel_track_thread_func(void* arg){
             /* tracking */
             while(1){
 
-                tracking(tar_index, exposing_flag);
+                tracking(tar_index, &exposing_flag);
 
                 // TODO: Check that timing is correct
                 step_roll(&steps);
@@ -120,9 +145,9 @@ static int selection(void){
 
     /* select target */
     double lst = 100.46 + 0.985647 * j2000 + gps.lon + 15 * ut_hours;
-    lst = d_mod(lst, 360);
+    lst = ang_wrap360(lst);
 
-    double gon_az = telescope_att.az - enc.az;
+    double gon_az = gondola_az(&telescope_att, &enc);
 
     target_prio_t target_prio[19];
     target_t target_list_aa[19];
@@ -138,7 +163,7 @@ static int selection(void){
         target_list_aa[ii].az = az;
 
         /* position parameter */
-        target_prio[ii].pos_param = gon_az - target_list_aa[ii].az;
+        target_prio[ii].pos_param = ang_diff(gon_az, target_list_aa[ii].az);
         target_prio[ii].pos_param = fabs(target_prio[ii].pos_param) < OP_FOV/3 ?
                 OP_FOV/3 - target_prio[ii].pos_param : 0;
 
@@ -167,11 +192,21 @@ static int selection(void){
     return tar_index;
 }
 
-static int tracking(int tar_index, char exposing_flag){
+static int tracking(int tar_index, char* exposing_flag){
 
     double az, alt;
     rd_to_aa(target_list_rd[tar_index].ra, target_list_rd[tar_index].dec, &az, &alt);
 
+    telescope_att_t telescope_att;
+    get_telescope_att(&telescope_att);
+
+    /* follow the target continuously through north, starting from the
+     * equivalent closest to the telescope */
+    if(!track_az.valid){
+        az = ang_near(az, telescope_att.az);
+    }
+    az = ang_unwrap(&track_az, az);
+
     set_tracking_angles(az, alt);
 
     logging_csv(sel_trck_log, "%+.10e,%+.10e", az, alt);
@@ -186,34 +221,60 @@ static int tracking(int tar_index, char exposing_flag){
 
     /* abort exposure if target is moving out of operational FoV */
     if(!enc.out_of_date && fabs(enc.az) > OP_FOV * 0.45){
-        if(exposing_flag){
-            abort_exp_nir();
+        if(*exposing_flag){
+            att_rec_stop((burst_mode ? lucky_abort_nir() : abort_exp_nir())
+                    == SUCCESS);
+            *exposing_flag = 0;
             logging(WARN, "Tracking",
                     "Aborted exposure due to telescope leaving operational FoV.");
         }
+        exp_planner_cancel();
         return FAILURE;
     }
 
-    telescope_att_t telescope_att;
-    get_telescope_att(&telescope_att);
-
     /* camera control */
     target_t target_err;
-    target_err.az = az - telescope_att.az;
+    target_err.az = ang_diff(az, telescope_att.az);
     target_err.alt = alt - telescope_att.alt;
 
-    if(     !telescope_att.out_of_date      &&
-            !exposing_flag                  &&
-            target_err.az < az_threshold    &&
-            target_err.alt < alt_threshold) {
+    if(     !telescope_att.out_of_date              &&
+            !*exposing_flag                         &&
+            fabs(target_err.az) < az_threshold      &&
+            fabs(target_err.alt) < alt_threshold) {
+
+        /* the mode is fixed for the duration of an exposure */
+        burst_mode = lucky_frames > 0;
+        double duration = burst_mode ?
+                (double)lucky_frames * lucky_exp / 1000000 : exp_time;
+
+        /* wait for the quietest part of the gondola oscillation */
+        if(exp_planner_ready(duration)){
+            /* record attitude during the exposure for the image sidecar */
+            att_rec_start(get_nir_frame_id());
 
-        expose_nir(exp_time * 1000000, sensor_gain);
-        exposing_flag = 1;
+            int ret = burst_mode ?
+                    lucky_start_nir(lucky_frames, lucky_exp, sensor_gain,
+                            lucky_keep) :
+                    expose_nir(exp_time * 1000000, sensor_gain);
+
+            if(ret == SUCCESS){
+                *exposing_flag = 1;
+            }
+            else{
+                att_rec_stop(0);
+            }
+        }
+    }
+    else if(!*exposing_flag){
+        exp_planner_cancel();
     }
 
-    if(exposing_flag){
+    if(*exposing_flag){
         /* save image */
-        if(save_img_nir() != EXP_NOT_READY){
+        int ret = burst_mode ? lucky_step_nir() : save_img_nir();
+        if(ret != EXP_NOT_READY){
+            att_rec_stop(ret == SUCCESS);
+            *exposing_flag = 0;
             return FAILURE;
         }
     }
@@ -231,15 +292,47 @@ void rd_to_aa(double ra, double dec, double* az, double* alt){
 
     /* calculate tracking angles */
     double lst = 100.46 + 0.985647 * j2000 + gps.lon + 15 * ut_hours;
-    lst = d_mod(lst, 360);
+    lst = ang_wrap360(lst);
 
     double ha = lst - 15 * ra;
     angle_calc(dec, ha, gps.lat, az, alt);
 }
 
-/* Modulo opperation on doubles */
-static double d_mod(double val, int mod){
-    return val - mod*(unsigned long)(val/mod);
+/* rd_to_gon:
+ * Convert ra & dec to az & alt relative to the gondola, through the gondola
+ * yaw given by the kalman filter, the encoders and the pointing model.
+ *
+ * return:
+ *      SUCCESS: az & alt set
+ *      FAILURE: the attitude or the encoders are out of date
+ */
+int rd_to_gon(double ra, double dec, double* az, double* alt){
+
+    telescope_att_t telescope_att;
+    get_telescope_att(&telescope_att);
+
+    encoder_t enc;
+    get_encoder(&enc);
+
+    if(telescope_att.out_of_date || enc.out_of_date){
+        return FAILURE;
+    }
+
+    rd_to_aa(ra, dec, az, alt);
+    *az = ang_wrap180(*az - gondola_az(&telescope_att, &enc));
+
+    return SUCCESS;
+}
+
+/* azimuth of the gondola zero, the telescope attitude less its pointing
+ * relative to the gondola */
+static double gondola_az(const telescope_att_t* telescope_att,
+        const encoder_t* enc){
+
+    double az, alt;
+    pm_enc_to_pointing(enc->az, enc->alt_ang, &az, &alt);
+
+    return telescope_att->az - az;
 }
 
 /* Calculates azimuth and altitude from declination, hour angle, and latitude */
@@ -285,3 +378,11 @@ void set_nir_exp_l(int exp){
 void set_nir_gain_l(int gain){
     sensor_gain = gain;
 }
+
+/* Set the lucky imaging burst, frames 0 selects long exposures, takes effect
+ * from the next exposure */
+void set_lucky_mode_l(int frames, int exp, int keep){
+    lucky_frames = frames;
+    lucky_exp = exp;
+    lucky_keep = keep;
+}
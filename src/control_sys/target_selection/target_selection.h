@@ -54,9 +54,23 @@ int init_target_selection(void* args);
 /* Convert ra & dec (ECI) to az & alt (ECEF) */
 void rd_to_aa(double ra, double dec, double* az, double* alt);
 
+/* rd_to_gon:
+ * Convert ra & dec to az & alt relative to the gondola, through the gondola
+ * yaw given by the kalman filter, the encoders and the pointing model.
+ *
+ * return:
+ *      SUCCESS: az & alt set
+ *      FAILURE: the attitude or the encoders are out of date
+ */
+int rd_to_gon(double ra, double dec, double* az, double* alt);
+
 /* Set the error thresholds for when to start exposing camera */
 void set_error_thresholds_az_l(double az);
 void set_error_thresholds_alt_l(double alt_ang);
 
 void set_nir_exp_l(int exp);
 void set_nir_gain_l(int gain);
+
+/* Set the lucky imaging burst, frames 0 selects long exposures, takes effect
+ * from the next exposure */
+void set_lucky_mode_l(int frames, int exp, int keep);
@@ -0,0 +1,199 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bus Client
+ * Parent Component: Data Bus
+ * Author(s):
+ * Purpose: Client library for reading data bus topics from other processes.
+ *          Built separately as libirisc-bus, not part of the OBSW executable.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "global_utils.h"
+#include "data_bus.h"
+#include "bus_client.h"
+
+static const char* const bus_topic_names[TOPIC_COUNT] = BUS_TOPIC_NAMES;
+
+static int read_index(const bus_client_t* client, uint32_t index,
+        void* msg, bus_stamp_t* stamp);
+
+/* bus_open:
+ * Map a topic read only. Reading with bus_read_next starts at the oldest
+ * message still available.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOENT: topic does not exist, OBSW not running
+ *      EPROTO: topic has a different layout version than this library
+ *      errno from shm_open, fstat or mmap
+ */
+int bus_open(bus_client_t* client, bus_topic_t topic){
+
+    struct stat st;
+
+    int fd = shm_open(bus_topic_names[topic], O_RDONLY, 0);
+    if(fd == -1){
+        return errno;
+    }
+
+    if(fstat(fd, &st) == -1 || st.st_size < BUS_HEADER_S){
+        int err = st.st_size < BUS_HEADER_S ? EPROTO : errno;
+        close(fd);
+        return err;
+    }
+
+    void* mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED){
+        return errno;
+    }
+
+    bus_header_t* hdr = mem;
+    if(hdr->magic != BUS_MAGIC || hdr->version != BUS_VERSION ||
+            hdr->topic != topic){
+        munmap(mem, st.st_size);
+        return EPROTO;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    client->hdr = hdr;
+    client->map_size = st.st_size;
+    client->lost = 0;
+
+    uint32_t head = atomic_load_explicit(&hdr->head, memory_order_acquire);
+    client->next = head > hdr->slot_count ? head - hdr->slot_count : 0;
+
+    return SUCCESS;
+}
+
+/* unmap a topic opened with bus_open */
+void bus_close(bus_client_t* client){
+    if(client->hdr != NULL){
+        munmap(client->hdr, client->map_size);
+        client->hdr = NULL;
+    }
+}
+
+/* bus_read_latest:
+ * Copy the most recently published message of a topic.
+ *
+ * output:
+ *      msg: payload, must hold the message type of the topic
+ *      stamp: index and time stamps of the message, may be NULL
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EAGAIN: nothing has been published yet
+ */
+int bus_read_latest(bus_client_t* client, void* msg, bus_stamp_t* stamp){
+
+    while(1){
+        uint32_t head = atomic_load_explicit(&client->hdr->head,
+                memory_order_acquire);
+        if(head == 0){
+            return EAGAIN;
+        }
+
+        /* retry if the publisher lapped the slot while copying */
+        if(read_index(client, head - 1, msg, stamp) == SUCCESS){
+            return SUCCESS;
+        }
+    }
+}
+
+/* bus_read_next:
+ * Copy the next unread message of a topic. If the publisher has overwritten
+ * unread messages the reader skips ahead and client->lost is increased.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EAGAIN: no new message available
+ */
+int bus_read_next(bus_client_t* client, void* msg, bus_stamp_t* stamp){
+
+    uint32_t slot_count = client->hdr->slot_count;
+
+    while(1){
+        uint32_t head = atomic_load_explicit(&client->hdr->head,
+                memory_order_acquire);
+
+        if(head == client->next){
+            return EAGAIN;
+        }
+
+        /* keep one slot of margin to the slot currently being written */
+        if(head - client->next >= slot_count){
+            uint32_t oldest = head - slot_count + 1;
+            client->lost += oldest - client->next;
+            client->next = oldest;
+        }
+
+        if(read_index(client, client->next, msg, stamp) == SUCCESS){
+            client->next++;
+            return SUCCESS;
+        }
+    }
+}
+
+/* bus_peek:
+ * Zero copy access to message index. Returns a pointer to the payload in
+ * shared memory and the slot sequence number, or NULL if the message is being
+ * written or has been overwritten. The payload is only valid if bus_peek_valid
+ * returns 1 after the caller is done reading it.
+ */
+const void* bus_peek(const bus_client_t* client, uint32_t index, uint32_t* seq){
+
+    bus_slot_t* slot = BUS_SLOT(client->hdr, index);
+
+    *seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if((*seq & 1) || slot->index != index){
+        return NULL;
+    }
+
+    return BUS_PAYLOAD(slot);
+}
+
+int bus_peek_valid(const bus_client_t* client, uint32_t index, uint32_t seq){
+
+    bus_slot_t* slot = BUS_SLOT(client->hdr, index);
+
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq;
+}
+
+/* read_index:
+ * Copy message index from its slot using the seqlock protocol.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EAGAIN: slot is being written or holds a different message
+ */
+static int read_index(const bus_client_t* client, uint32_t index,
+        void* msg, bus_stamp_t* stamp){
+
+    uint32_t seq;
+    const void* payload = bus_peek(client, index, &seq);
+    if(payload == NULL){
+        return EAGAIN;
+    }
+
+    bus_slot_t* slot = BUS_SLOT(client->hdr, index);
+    bus_stamp_t tmp = {slot->index, slot->t_mono_ns, slot->t_real_ns};
+    memcpy(msg, payload, client->hdr->msg_size);
+
+    if(!bus_peek_valid(client, index, seq) || tmp.index != index){
+        return EAGAIN;
+    }
+
+    if(stamp != NULL){
+        *stamp = tmp;
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,76 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Bus Client
+ * Parent Component: Data Bus
+ * Author(s):
+ * Purpose: Client library for reading data bus topics from other processes.
+ *          Built separately as libirisc-bus, not part of the OBSW executable.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "data_bus.h"
+
+typedef struct{
+    bus_header_t* hdr;
+    size_t map_size;
+    uint32_t next;      /* index of the next message for bus_read_next */
+    uint32_t lost;      /* messages overwritten before bus_read_next got them */
+} bus_client_t;
+
+typedef struct{
+    uint32_t index;
+    int64_t t_mono_ns;
+    int64_t t_real_ns;
+} bus_stamp_t;
+
+/* bus_open:
+ * Map a topic read only. Reading with bus_read_next starts at the oldest
+ * message still available.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOENT: topic does not exist, OBSW not running
+ *      EPROTO: topic has a different layout version than this library
+ *      errno from shm_open, fstat or mmap
+ */
+int bus_open(bus_client_t* client, bus_topic_t topic);
+
+/* unmap a topic opened with bus_open */
+void bus_close(bus_client_t* client);
+
+/* bus_read_latest:
+ * Copy the most recently published message of a topic.
+ *
+ * output:
+ *      msg: payload, must hold the message type of the topic
+ *      stamp: index and time stamps of the message, may be NULL
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EAGAIN: nothing has been published yet
+ */
+int bus_read_latest(bus_client_t* client, void* msg, bus_stamp_t* stamp);
+
+/* bus_read_next:
+ * Copy the next unread message of a topic. If the publisher has overwritten
+ * unread messages the reader skips ahead and client->lost is increased.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      EAGAIN: no new message available
+ */
+int bus_read_next(bus_client_t* client, void* msg, bus_stamp_t* stamp);
+
+/* bus_peek:
+ * Zero copy access to message index. Returns a pointer to the payload in
+ * shared memory and the slot sequence number, or NULL if the message is being
+ * written or has been overwritten. The payload is only valid if bus_peek_valid
+ * returns 1 after the caller is done reading it.
+ */
+const void* bus_peek(const bus_client_t* client, uint32_t index, uint32_t* seq);
+
+int bus_peek_valid(const bus_client_t* client, uint32_t index, uint32_t seq);
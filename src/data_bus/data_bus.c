@@ -0,0 +1,134 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Data Bus
+ * Author(s):
+ * Purpose: Publish sensor and state topics in shared memory so that other
+ *          processes can read live data without touching the real-time threads.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "global_utils.h"
+#include "data_bus.h"
+
+typedef struct{
+    uint32_t msg_size;
+    uint32_t slot_count;
+} topic_def_t;
+
+static const char* const bus_topic_names[TOPIC_COUNT] = BUS_TOPIC_NAMES;
+
+/* slot counts are chosen to hold roughly 10 seconds of the high rate topics */
+static const topic_def_t topic_defs[TOPIC_COUNT] = {
+    {sizeof(bus_gyro_t),    1024},
+    {sizeof(bus_encoder_t), 1024},
+    {sizeof(bus_gps_t),     16},
+    {sizeof(bus_kf_att_t),  1024},
+    {sizeof(bus_mode_t),    16},
+    {sizeof(bus_temp_t),    64},
+    {sizeof(bus_kf_noise_t), 64},
+    {sizeof(bus_kf_gate_t), 64}
+};
+
+static bus_header_t* topics[TOPIC_COUNT];
+
+static int create_topic(bus_topic_t topic);
+
+int init_data_bus(void* args){
+
+    for(int ii=0; ii<TOPIC_COUNT; ++ii){
+        /* the bus is not needed for flight, continue without the topic */
+        if(create_topic(ii)){
+            logging(ERROR, "Data Bus", "Failed to create topic %s: %m",
+                    bus_topic_names[ii]);
+            topics[ii] = NULL;
+        }
+    }
+
+    return SUCCESS;
+}
+
+static int create_topic(bus_topic_t topic){
+
+    uint32_t slot_size = sizeof(bus_slot_t) + topic_defs[topic].msg_size;
+    slot_size = (slot_size + 7) & ~7u;
+    size_t size = BUS_HEADER_S + (size_t)slot_size * topic_defs[topic].slot_count;
+
+    int fd = shm_open(bus_topic_names[topic], O_CREAT | O_RDWR, 0644);
+    if(fd == -1){
+        return FAILURE;
+    }
+
+    if(ftruncate(fd, size) == -1){
+        close(fd);
+        return FAILURE;
+    }
+
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED){
+        return FAILURE;
+    }
+
+    memset(mem, 0, size);
+
+    bus_header_t* hdr = mem;
+    hdr->version = BUS_VERSION;
+    hdr->topic = topic;
+    hdr->msg_size = topic_defs[topic].msg_size;
+    hdr->slot_size = slot_size;
+    hdr->slot_count = topic_defs[topic].slot_count;
+    atomic_store_explicit(&hdr->head, 0, memory_order_relaxed);
+
+    /* readers check the magic last, publish it after the rest of the header */
+    atomic_thread_fence(memory_order_release);
+    hdr->magic = BUS_MAGIC;
+
+    topics[topic] = hdr;
+
+    return SUCCESS;
+}
+
+/* publish_topic:
+ * Write a message to the next slot of a topic. Only one thread may publish on
+ * a topic at a time, callers hold the mutex protecting the published data.
+ * Does nothing if the topic could not be created at init.
+ *
+ * input:
+ *      topic: topic to publish on
+ *      msg: payload of the type belonging to the topic
+ */
+void publish_topic(bus_topic_t topic, const void* msg){
+
+    bus_header_t* hdr = topics[topic];
+    if(hdr == NULL){
+        return;
+    }
+
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+
+    uint32_t head = atomic_load_explicit(&hdr->head, memory_order_relaxed);
+    bus_slot_t* slot = BUS_SLOT(hdr, head);
+
+    /* odd sequence number marks the slot as being written */
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->index = head;
+    slot->t_mono_ns = (int64_t)mono.tv_sec * 1000000000 + mono.tv_nsec;
+    slot->t_real_ns = (int64_t)real.tv_sec * 1000000000 + real.tv_nsec;
+    memcpy(BUS_PAYLOAD(slot), msg, hdr->msg_size);
+
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+    atomic_store_explicit(&hdr->head, head + 1, memory_order_release);
+}
@@ -0,0 +1,139 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Data Bus
+ * Author(s):
+ * Purpose: Publish sensor and state topics in shared memory so that other
+ *          processes can read live data without touching the real-time threads.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* Every topic is a shared memory object, /dev/shm/irisc_<topic name>, holding
+ * a bus_header_t followed by slot_count slots. Each slot is a bus_slot_t
+ * followed by the message payload and is protected by a seqlock: the sequence
+ * number is odd while the slot is being written. A reader copies the payload
+ * and accepts it only if the sequence number was even and unchanged.
+ *
+ * head is the total number of messages published on the topic, message n is
+ * stored in slot n % slot_count.
+ */
+
+#define BUS_MAGIC 0x53425249 /* "IRBS" */
+#define BUS_VERSION 1
+
+/* size reserved for the header, keeps head on its own cache line */
+#define BUS_HEADER_S 64
+
+typedef enum{
+    TOPIC_GYRO = 0,
+    TOPIC_ENCODER,
+    TOPIC_GPS,
+    TOPIC_KF_ATT,
+    TOPIC_MODE,
+    TOPIC_TEMP,
+    TOPIC_KF_NOISE,
+    TOPIC_KF_GATE,
+    TOPIC_COUNT
+} bus_topic_t;
+
+/* message payloads */
+typedef struct{
+    double x, y, z;
+} bus_gyro_t;
+
+typedef struct{
+    double az, alt_ang;
+    double rate_az, rate_alt;
+} bus_encoder_t;
+
+typedef struct{
+    float lat, lon, alt;
+} bus_gps_t;
+
+typedef struct{
+    double az, alt;
+} bus_kf_att_t;
+
+typedef struct{
+    int32_t mode;
+} bus_mode_t;
+
+typedef struct{
+    double
+            pcb_0,
+            pcb_1,
+            pcb_2,
+            ambient,
+            motor_az,
+            motor_alt,
+            motor_roll,
+            motor_focus,
+            telescope_0,
+            telescope_1,
+            encoder_0,
+            encoder_1,
+            nir,
+            guiding,
+            cpu;
+} bus_temp_t;
+
+typedef struct{
+    double r_az, q_az, q2_az, nis_az;
+    double r_alt, q_alt, q2_alt, nis_alt;
+} bus_kf_noise_t;
+
+typedef struct{
+    double d2;
+    int64_t accepted, rejected;
+    int32_t consecutive;
+    int64_t reinits;
+} bus_kf_gate_t;
+
+/* shared memory layout */
+typedef struct{
+    uint32_t magic, version;
+    uint32_t topic, msg_size;
+    uint32_t slot_size, slot_count;
+    _Atomic uint32_t head;
+} bus_header_t;
+
+typedef struct{
+    _Atomic uint32_t seq;
+    uint32_t index;
+    int64_t t_mono_ns;
+    int64_t t_real_ns;
+} bus_slot_t;
+
+#define BUS_SLOT(hdr, i) ((bus_slot_t*)((char*)(hdr) + BUS_HEADER_S + \
+            (size_t)((i) % (hdr)->slot_count) * (hdr)->slot_size))
+#define BUS_PAYLOAD(slot) ((void*)((char*)(slot) + sizeof(bus_slot_t)))
+
+/* name of the shared memory object for each topic, in bus_topic_t order */
+#define BUS_TOPIC_NAMES { \
+    "/irisc_gyro", \
+    "/irisc_encoder", \
+    "/irisc_gps", \
+    "/irisc_kf_att", \
+    "/irisc_mode", \
+    "/irisc_temp", \
+    "/irisc_kf_noise", \
+    "/irisc_kf_gate" \
+}
+
+/* initialise the data bus component */
+int init_data_bus(void* args);
+
+/* publish_topic:
+ * Write a message to the next slot of a topic. Only one thread may publish on
+ * a topic at a time, callers hold the mutex protecting the published data.
+ * Does nothing if the topic could not be created at init.
+ *
+ * input:
+ *      topic: topic to publish on
+ *      msg: payload of the type belonging to the topic
+ */
+void publish_topic(bus_topic_t topic, const void* msg);
@@ -7,6 +7,7 @@
  */
 
 #include "global_utils.h"
+#include "lock.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -27,8 +28,8 @@
 
 static int sockfd, newsockfd, init_flag = 0;
 
-pthread_mutex_t e_link_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t e_link_mutex_read = PTHREAD_MUTEX_INITIALIZER;
+lock_t e_link_mutex = LOCK_INITIALIZER("e_link_mutex");
+lock_t e_link_mutex_read = LOCK_INITIALIZER("e_link_mutex_read");
 
 static void* thread_socket(void*);
 static unsigned int sleep_time = 30000;
@@ -41,7 +42,7 @@ int init_elink(void* args){
 
 int write_elink(char *buffer, int bytes){
 
-    pthread_mutex_lock( &e_link_mutex );
+    lock_acquire( &e_link_mutex );
 
     int n;
 
@@ -55,19 +56,19 @@ int write_elink(char *buffer, int bytes){
             n=write(newsockfd, buffer, bytes);
         } while (n<0);
 
-        pthread_mutex_unlock( &e_link_mutex );
+        lock_release( &e_link_mutex );
         return FAILURE;
     }
 
     usleep(sleep_time);
-    pthread_mutex_unlock( &e_link_mutex );
+    lock_release( &e_link_mutex );
 
     return SUCCESS;
 }
 
 int read_elink(char *buffer, int bytes){
 
-    pthread_mutex_lock( &e_link_mutex_read );
+    lock_acquire( &e_link_mutex_read );
 
     printf("read_elink\n");
 
@@ -84,7 +85,7 @@ int read_elink(char *buffer, int bytes){
     printf("Bytes read: %d\n", n);
     printf("Bytes to read: %d\n", bytes);
 
-    pthread_mutex_unlock( &e_link_mutex_read );
+    lock_release( &e_link_mutex_read );
 
     if (n<0){
         logging(ERROR, "e_link", "ERROR reading from socket: %s\n", strerror(errno));
@@ -100,8 +101,8 @@ int read_elink(char *buffer, int bytes){
 
 static void* thread_socket(void* param){
 
-    pthread_mutex_lock( &e_link_mutex );
-    pthread_mutex_lock( &e_link_mutex_read );
+    lock_acquire( &e_link_mutex );
+    lock_acquire( &e_link_mutex_read );
 
     socklen_t clilen;
     struct sockaddr_in serv_addr, cli_addr;
@@ -150,8 +151,8 @@ static void* thread_socket(void* param){
             continue;
         }
         logging(INFO, "e_link", "Accepted connection to GS");
-        pthread_mutex_unlock( &e_link_mutex );
-        pthread_mutex_unlock( &e_link_mutex_read );
+        lock_release( &e_link_mutex );
+        lock_release( &e_link_mutex_read );
         init_flag = 1;
     }
 
@@ -172,3 +173,8 @@ int set_datarate (unsigned short datarate){
 
     return SUCCESS;
 }
+
+double get_datarate (void){
+    /* one packet of up to 1500 bytes per sleep_time */
+    return 1500.0 * 1000000 / sleep_time;
+}
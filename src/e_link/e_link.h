@@ -21,3 +21,6 @@ void close_socket( void );
 
 /* limit datarate for TM by setting time between each packet sent*/
 int set_datarate (unsigned short datarate);
+
+/* the datarate set by set_datarate, unit: bytes/second */
+double get_datarate (void);
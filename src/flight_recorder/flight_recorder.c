@@ -0,0 +1,318 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Flight Recorder
+ * Author(s):
+ * Purpose: Keep the last minute of every control loop iteration in memory and
+ *          write it to disk for priority downlink when something goes wrong:
+ *          an error log, a crash or a command from ground.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "global_utils.h"
+#include "lock.h"
+#include "arena.h"
+#include "ring.h"
+#include "img_processing.h"
+#include "flight_recorder.h"
+
+/* history kept in memory, unit: seconds */
+#define FR_SECONDS 60
+
+/* records after the trigger included in the dump, unit: seconds */
+#define FR_POST_S 5
+
+/* shortest time between two dumps, an error storm gives one dump */
+#define FR_HOLDOFF_S 60
+
+#define FR_RATE (1000000000 / CONTROL_SYS_WAIT)
+#define FR_LEN (FR_SECONDS * FR_RATE)
+
+/* records left untouched when copying, the control loop keeps writing */
+#define FR_GUARD FR_RATE
+
+static void* thread_func(void* arg);
+static int write_dump(const char* fn, const fr_header_t* hdr, long count);
+static void fill_header(fr_header_t* hdr, int trigger, const char* reason);
+static void log_hook(int level, const char* module_name, const char* msg);
+static void crash_handler(int signum);
+static void queue_crash(void);
+
+static lock_t mutex_fr = LOCK_INITIALIZER("mutex_fr");
+static pthread_cond_t cond_fr = PTHREAD_COND_INITIALIZER;
+
+/* written by the control loop only */
+static ring_t ring;
+
+/* owned by the dump thread */
+static fr_record_t* dump;
+
+static char pending = 0;
+static fr_header_t pending_hdr;
+static struct timespec last_dump;
+
+static char out_fp[100];
+static char crash_fn[100];
+
+static const int fatal_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+int init_flight_recorder(void* args){
+
+    strcpy(out_fp, get_top_dir());
+    strcat(out_fp, "output/compression/");
+
+    /* written from the signal handler, where nothing can be allocated */
+    strcpy(crash_fn, get_top_dir());
+    strcat(crash_fn, "output/fr_crash.bin");
+
+    dump = arena_alloc(FR_LEN * sizeof(*dump), "Flight Rec");
+    if(ring_init(&ring, FR_LEN, sizeof(fr_record_t), "Flight Rec") ||
+            dump == NULL){
+        logging(ERROR, "Flight Rec", "Cannot allocate memory: %m");
+        return ENOMEM;
+    }
+
+    /* touch every page now, not while dumping */
+    memset(dump, 0, FR_LEN * sizeof(*dump));
+
+    /* allow a dump right away */
+    clock_gettime(CLOCK_MONOTONIC, &last_dump);
+    last_dump.tv_sec -= FR_HOLDOFF_S;
+
+    /* the crash dump of the previous run */
+    queue_crash();
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = crash_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESETHAND;
+
+    for(size_t ii=0; ii<sizeof(fatal_signals)/sizeof(*fatal_signals); ++ii){
+        sigaction(fatal_signals[ii], &sa, NULL);
+    }
+
+    set_log_hook(log_hook);
+
+    return create_thread("flight_rec", thread_func, 8);
+}
+
+/* fr_push:
+ * Add one record, the oldest is overwritten. Called once per control system
+ * iteration, never blocks.
+ */
+void fr_push(const fr_record_t* rec){
+
+    fr_record_t* slot = ring_slot(&ring);
+    *slot = *rec;
+
+    ring_publish(&ring);
+}
+
+/* fr_trigger:
+ * Request a dump. The records of a few seconds after the trigger are included,
+ * the dump is written and queued for downlink in the background. Triggers
+ * while a dump is pending, or shortly after one, are ignored.
+ *
+ * input:
+ *      trigger: FR_TRIG_ERROR or FR_TRIG_COMMAND
+ *      reason: short description stored in the dump, may be NULL
+ *
+ * return:
+ *      SUCCESS: dump will be written
+ *      EBUSY: a dump is pending or was just written
+ */
+int fr_trigger(int trigger, const char* reason){
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    lock_acquire(&mutex_fr);
+
+    /* a command from ground is not held off by the previous dump */
+    if(pending || (trigger != FR_TRIG_COMMAND &&
+                now.tv_sec - last_dump.tv_sec < FR_HOLDOFF_S)){
+
+        lock_release(&mutex_fr);
+        return EBUSY;
+    }
+
+    fill_header(&pending_hdr, trigger, reason);
+    pending = 1;
+
+    pthread_cond_signal(&cond_fr);
+    lock_release(&mutex_fr);
+
+    /* not an error, that would trigger again */
+    logging(INFO, "Flight Rec", "Dump triggered: %s",
+            reason != NULL ? reason : "");
+
+    return SUCCESS;
+}
+
+static void* thread_func(void* arg){
+
+    while(1){
+
+        lock_acquire(&mutex_fr);
+        while(!pending){
+            lock_cond_wait(&cond_fr, &mutex_fr);
+        }
+        fr_header_t hdr = pending_hdr;
+        lock_release(&mutex_fr);
+
+        /* what happened next is often the interesting part */
+        struct timespec post = {FR_POST_S, 0};
+        nanosleep(&post, NULL);
+
+        long count = ring_copy(&ring, dump, 0, FR_GUARD);
+
+        char fn[sizeof(out_fp) + 40];
+        snprintf(fn, sizeof(fn), "%sfr_%lld.bin", out_fp,
+                (long long)(hdr.trigger_real_ns / 1000000000));
+
+        if(count == 0){
+            logging(WARN, "Flight Rec", "Recorder overtaken while copying, "
+                    "dump skipped");
+        }
+        else if(write_dump(fn, &hdr, count) == SUCCESS){
+            logging(INFO, "Flight Rec", "Wrote %ld records to %s", count, fn);
+            queue_image(fn, FLIGHT_RECORD);
+        }
+
+        lock_acquire(&mutex_fr);
+        clock_gettime(CLOCK_MONOTONIC, &last_dump);
+        pending = 0;
+        lock_release(&mutex_fr);
+    }
+
+    return NULL;
+}
+
+/* write_dump:
+ * Write a header and the copied records.
+ *
+ * return:
+ *      SUCCESS: dump written
+ *      EIO: writing failed, nothing left on disk
+ */
+static int write_dump(const char* fn, const fr_header_t* hdr, long count){
+
+    fr_header_t out = *hdr;
+    out.record_count = count;
+
+    FILE* fp = fopen(fn, "wb");
+    if(fp == NULL){
+        logging(WARN, "Flight Rec", "Could not open %s: %m", fn);
+        return EIO;
+    }
+
+    if(     fwrite(&out, sizeof(out), 1, fp) != 1 ||
+            fwrite(dump, sizeof(*dump), count, fp) != (size_t)count){
+
+        logging(WARN, "Flight Rec", "Failed to write %s: %m", fn);
+        fclose(fp);
+        remove(fn);
+        return EIO;
+    }
+    fclose(fp);
+
+    return SUCCESS;
+}
+
+/* fill everything but the record count, async-signal-safe */
+static void fill_header(fr_header_t* hdr, int trigger, const char* reason){
+
+    struct timespec real, mono;
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = FR_MAGIC;
+    hdr->version = FR_VERSION;
+    hdr->record_size = sizeof(fr_record_t);
+    hdr->trigger = trigger;
+    hdr->trigger_real_ns = (int64_t)real.tv_sec * 1000000000 + real.tv_nsec;
+    hdr->trigger_ms = mono.tv_sec * 1000 + mono.tv_nsec / 1000000;
+    hdr->sample_time_ns = CONTROL_SYS_WAIT;
+
+    if(reason != NULL){
+        for(size_t ii=0; ii<sizeof(hdr->reason) - 1 && reason[ii]; ++ii){
+            hdr->reason[ii] = reason[ii];
+        }
+    }
+}
+
+static void log_hook(int level, const char* module_name, const char* msg){
+
+    char reason[64];
+    snprintf(reason, 64, "%s: %s", module_name, msg);
+
+    fr_trigger(FR_TRIG_ERROR, reason);
+}
+
+/* crash_handler:
+ * Write the whole ring as it is straight to disk, only async-signal-safe
+ * calls are allowed here. The dump is queued for downlink on the next start.
+ * The signal is raised again to get the default action.
+ */
+static void crash_handler(int signum){
+
+    fr_header_t hdr;
+    char reason[] = "signal 00";
+    reason[7] = '0' + signum / 10 % 10;
+    reason[8] = '0' + signum % 10;
+    fill_header(&hdr, FR_TRIG_SIGNAL, reason);
+
+    const fr_record_t* rec = ring.buf;
+    long head = ring_head(&ring);
+    long count = head < FR_LEN ? head : FR_LEN;
+    long first = head % FR_LEN;
+    hdr.record_count = count;
+
+    int fd = open(crash_fn, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd != -1){
+        write(fd, &hdr, sizeof(hdr));
+
+        /* oldest first, the ring starts at head once it has wrapped */
+        if(count == FR_LEN){
+            write(fd, &rec[first], (FR_LEN - first) * sizeof(*rec));
+            write(fd, rec, first * sizeof(*rec));
+        }
+        else{
+            write(fd, rec, count * sizeof(*rec));
+        }
+
+        fsync(fd);
+        close(fd);
+    }
+
+    raise(signum);
+}
+
+/* queue the crash dump left by the previous run for downlink */
+static void queue_crash(void){
+
+    if(access(crash_fn, F_OK)){
+        return;
+    }
+
+    char fn[sizeof(out_fp) + 40];
+    snprintf(fn, sizeof(fn), "%sfr_crash_%lld.bin", out_fp, (long long)time(NULL));
+
+    if(rename(crash_fn, fn)){
+        logging(WARN, "Flight Rec", "Could not move crash dump: %m");
+        return;
+    }
+
+    logging(WARN, "Flight Rec", "Previous run crashed, sending %s", fn);
+    queue_image(fn, FLIGHT_RECORD);
+}
@@ -0,0 +1,85 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Flight Recorder
+ * Author(s):
+ * Purpose: Keep the last minute of every control loop iteration in memory and
+ *          write it to disk for priority downlink when something goes wrong:
+ *          an error log, a crash or a command from ground.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Dump file layout, native byte order (little endian):
+ *      fr_header_t
+ *      fr_record_t[record_count], oldest first
+ */
+#define FR_MAGIC 0x52464952 /* "IRFR" */
+#define FR_VERSION 1
+
+/* fr_record_t.flags */
+#define FR_GYRO_OLD 0x1     /* gyro data out of date */
+#define FR_ENC_OLD 0x2      /* encoder data out of date */
+
+/* fr_header_t.trigger */
+#define FR_TRIG_ERROR 1     /* error or critical log message */
+#define FR_TRIG_COMMAND 2   /* requested from ground */
+#define FR_TRIG_SIGNAL 3    /* fatal signal, reason holds its number */
+
+typedef struct{
+    uint32_t magic;
+    uint16_t version, record_size;
+    uint32_t record_count;
+    uint32_t trigger;
+    int64_t trigger_real_ns;        /* CLOCK_REALTIME of the trigger */
+    uint32_t trigger_ms;            /* fr_record_t.t_ms of the trigger */
+    uint32_t sample_time_ns;        /* nominal time between records */
+    char reason[64];                /* module and message of the trigger */
+} fr_header_t;
+
+/* one control loop iteration, angles in degrees */
+typedef struct{
+    uint32_t t_ms;                  /* CLOCK_MONOTONIC */
+    float gyro[3];                  /* degrees/second */
+    float enc_az, enc_alt;
+    float enc_rate_az, enc_rate_alt;
+    float kf_az, kf_alt;
+    float bias_az, bias_alt;
+    float sig_az, sig_alt;          /* standard deviation of the angles */
+    float target_az, target_alt;
+    float err_az, err_alt;          /* pid terms */
+    float int_az, int_alt;
+    float der_az, der_alt;
+    float out_az, out_alt;
+    int16_t step_az, step_alt;      /* motor command */
+    uint16_t latency_us;            /* wake up after the scheduled time */
+    uint16_t exec_us;               /* time spent in the iteration */
+    uint8_t mode;
+    uint8_t flags;
+    uint16_t reserved;
+} fr_record_t;
+
+/* initialise the flight recorder component */
+int init_flight_recorder(void* args);
+
+/* fr_push:
+ * Add one record, the oldest is overwritten. Called once per control system
+ * iteration, never blocks.
+ */
+void fr_push(const fr_record_t* rec);
+
+/* fr_trigger:
+ * Request a dump. The records of a few seconds after the trigger are included,
+ * the dump is written and queued for downlink in the background. Triggers
+ * while a dump is pending, or shortly after one, are ignored.
+ *
+ * input:
+ *      trigger: FR_TRIG_ERROR or FR_TRIG_COMMAND
+ *      reason: short description stored in the dump, may be NULL
+ *
+ * return:
+ *      SUCCESS: dump will be written
+ *      EBUSY: a dump is pending or was just written
+ */
+int fr_trigger(int trigger, const char* reason);
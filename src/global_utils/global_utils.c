@@ -16,8 +16,10 @@
 #include <libgen.h>
 #include <limits.h>
 #include <errno.h>
+#include <math.h>
 
 #include "global_utils.h"
+#include "alloc_check.h"
 
 #define TOP_DIR_S 100
 
@@ -29,6 +31,8 @@ static const char* const top_dir_p = top_dir;
 
 int debug_mode = 1;
 
+static log_hook_t log_hook = NULL;
+
 int init_global_utils(void* args){
 
     char* launch_arg = (char*) args;
@@ -157,9 +161,20 @@ int logging(int level, char module_name[12],
             logging_levels[level], module_name, buffer);
     fflush(stderr);
 
+    log_hook_t hook = __atomic_load_n(&log_hook, __ATOMIC_ACQUIRE);
+    if(hook != NULL && level >= ERROR){
+        hook(level, module_name, buffer);
+    }
+
     return SUCCESS;
 }
 
+/* called with every ERROR and CRIT message after it has been logged, NULL
+ * disables. Used by the flight recorder to dump on errors. */
+void set_log_hook(log_hook_t hook){
+    __atomic_store_n(&log_hook, hook, __ATOMIC_RELEASE);
+}
+
 void logging_csv(FILE* stream, const char* format, ...){
     struct timespec now;
     clock_gettime(CLOCK_REALTIME, &now);
@@ -229,7 +244,11 @@ int create_thread(char* comp_name, void* (*thread_func)(void*), int prio){
         return ret;
     }
 
-    ret = pthread_create(&tid, &attr, thread_func, NULL);
+    void* (*start)(void*) = thread_func;
+    void* arg = NULL;
+    alloc_check_thread(comp_name, &start, &arg);
+
+    ret = pthread_create(&tid, &attr, start, arg);
     if(ret != 0){
         fprintf(stderr,
             "Failed pthread_create of %s component. "
@@ -241,3 +260,52 @@ int create_thread(char* comp_name, void* (*thread_func)(void*), int prio){
 
     return SUCCESS;
 }
+
+/* wrap an angle to [0, 360) */
+double ang_wrap360(double ang){
+
+    ang = fmod(ang, 360);
+    if(ang < 0){
+        ang += 360;
+    }
+
+    /* a tiny negative input rounds up to exactly 360 */
+    return ang < 360 ? ang : 0;
+}
+
+/* wrap an angle to [-180, 180) */
+double ang_wrap180(double ang){
+    return ang_wrap360(ang + 180) - 180;
+}
+
+/* shortest signed rotation from "from" to "to", in [-180, 180) */
+double ang_diff(double to, double from){
+    return ang_wrap180(to - from);
+}
+
+/* the equivalent of ang closest to ref, ref + ang_diff(ang, ref) */
+double ang_near(double ang, double ref){
+    return ref + ang_diff(ang, ref);
+}
+
+/* ang_unwrap:
+ * Add a wrapped angle to a continuous one. Consecutive samples must be less
+ * than 180 degrees apart. The first sample after a reset is taken as is.
+ */
+double ang_unwrap(ang_unwrap_t* acc, double ang){
+
+    if(!acc->valid){
+        acc->value = ang;
+        acc->valid = 1;
+    }
+    else{
+        acc->value = ang_near(ang, acc->value);
+    }
+
+    return acc->value;
+}
+
+/* restart an accumulator, e.g. when switching to a new target */
+void ang_unwrap_reset(ang_unwrap_t* acc){
+    acc->valid = 0;
+}
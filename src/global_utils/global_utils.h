@@ -31,6 +31,12 @@
 
 #define GYRO_TRIG_PIN 25
 
+/* the GPIO wired to the camera trigger inputs is given with the build,
+ * -DCAM_TRIG_PIN=<gpio>, as it is only used with CAM_HW_TRIGGER */
+#if defined(CAM_HW_TRIGGER) && !defined(CAM_TRIG_PIN)
+    #error "CAM_HW_TRIGGER needs CAM_TRIG_PIN, the GPIO of the camera trigger"
+#endif
+
 #define TEMP_SAMPLE_TIME             1  /* unit: seconds     */
 #define GPS_SAMPLE_TIME              4  /* unit: seconds     */
 #define GYRO_SAMPLE_TIME      10000000  /* unit: nanoseconds */
@@ -77,7 +83,54 @@ int logging(int level, char module_name[12],
 
 void logging_csv(FILE* stream, const char* format, ...);
 
+/* called with every ERROR and CRIT message after it has been logged, NULL
+ * disables. Used by the flight recorder to dump on errors. */
+typedef void (*log_hook_t)(int level, const char* module_name,
+        const char* msg);
+void set_log_hook(log_hook_t hook);
+
 /* a call to pthread_create with additional thread attributes,
  * specifically priority
  */
 int create_thread(char* comp_name, void *(*thread_func)(void *), int prio);
+
+/* Angles, unit: degrees.
+ * Wrapped angles are kept in [0, 360) or [-180, 180). Continuous angles are
+ * never wrapped and follow the motion through any number of turns, which is
+ * what the kalman filter and the control loop integrate. Differences between
+ * angles must always be taken with ang_diff.
+ */
+
+/* wrap an angle to [0, 360) */
+double ang_wrap360(double ang);
+
+/* wrap an angle to [-180, 180) */
+double ang_wrap180(double ang);
+
+/* shortest signed rotation from "from" to "to", in [-180, 180) */
+double ang_diff(double to, double from);
+
+/* the equivalent of ang closest to ref, ref + ang_diff(ang, ref) */
+double ang_near(double ang, double ref);
+
+/* accumulator turning a sequence of wrapped angles into a continuous one */
+typedef struct{
+    double value;
+    char valid;
+} ang_unwrap_t;
+
+/* ang_unwrap:
+ * Add a wrapped angle to a continuous one. Consecutive samples must be less
+ * than 180 degrees apart. The first sample after a reset is taken as is.
+ *
+ * input:
+ *      acc: accumulator, zero initialised or cleared with ang_unwrap_reset
+ *      ang: new sample, wrapped or not
+ *
+ * return:
+ *      the continuous angle
+ */
+double ang_unwrap(ang_unwrap_t* acc, double ang);
+
+/* restart an accumulator, e.g. when switching to a new target */
+void ang_unwrap_reset(ang_unwrap_t* acc);
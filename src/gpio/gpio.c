@@ -16,20 +16,21 @@
 
 #include "gpio.h"
 #include "global_utils.h"
+#include "lock.h"
 
 #define PATH_MAX 40
 
-static void close_unlock(int fd, pthread_mutex_t* mutex);
+static void close_unlock(int fd, lock_t* mutex);
 
-static pthread_mutex_t mutex_export;
-static pthread_mutex_t mutex_unexport;
-static pthread_mutex_t mutex_direction;
-static pthread_mutex_t mutex_read;
-static pthread_mutex_t mutex_write;
+static lock_t mutex_export;
+static lock_t mutex_unexport;
+static lock_t mutex_direction;
+static lock_t mutex_read;
+static lock_t mutex_write;
 
 int init_gpio(void* args){
 
-    int ret = pthread_mutex_init(&mutex_export, NULL);
+    int ret = lock_init(&mutex_export, "mutex_export", 0);
     if( ret ){
         logging(ERROR, "GPIO",
                 "The initialisation of the gpio export mutex failed: %d, (%s)",
@@ -37,7 +38,7 @@ int init_gpio(void* args){
         return ret;
     }
 
-    ret = pthread_mutex_init(&mutex_unexport, NULL);
+    ret = lock_init(&mutex_unexport, "mutex_unexport", 0);
     if( ret ){
         logging(ERROR, "GPIO",
                 "The initialisation of the gpio unexport mutex failed: %d, (%s)",
@@ -45,7 +46,7 @@ int init_gpio(void* args){
         return ret;
     }
 
-    ret = pthread_mutex_init(&mutex_direction, NULL);
+    ret = lock_init(&mutex_direction, "mutex_direction", 0);
     if( ret ){
         logging(ERROR, "GPIO",
                 "The initialisation of the gpio direction mutex failed: %d, (%s)",
@@ -53,7 +54,7 @@ int init_gpio(void* args){
         return ret;
     }
 
-    ret = pthread_mutex_init(&mutex_read, NULL);
+    ret = lock_init(&mutex_read, "mutex_read", 0);
     if( ret ){
         logging(ERROR, "GPIO",
                 "The initialisation of the gpio read mutex failed: %d, (%s)",
@@ -61,7 +62,7 @@ int init_gpio(void* args){
         return ret;
     }
 
-    ret = pthread_mutex_init(&mutex_write, NULL);
+    ret = lock_init(&mutex_write, "mutex_write", 0);
     if( ret ){
         logging(ERROR, "GPIO",
                 "The initialisation of the gpio write mutex failed: %d, (%s)",
@@ -74,18 +75,18 @@ int init_gpio(void* args){
 
 int gpio_export(int pin){
 
-    pthread_mutex_lock(&mutex_export);
+    lock_acquire(&mutex_export);
 
     int fd = open("/sys/class/gpio/export", O_WRONLY);
     if(fd == -1){
         if(errno == EBUSY){
             logging(WARN, "GPIO", "Pin %d already exported", pin);
-            pthread_mutex_unlock(&mutex_export);
+            lock_release(&mutex_export);
             return SUCCESS;
         }
         logging(ERROR, "GPIO", "Failed to export pin: %d, (%s)",
                 pin, strerror(errno));
-        pthread_mutex_unlock(&mutex_export);
+        lock_release(&mutex_export);
         return errno;
     }
 
@@ -95,7 +96,7 @@ int gpio_export(int pin){
     if(ret == -1){
         if(errno == EBUSY){
             logging(WARN, "GPIO", "Pin %d already exported", pin);
-            pthread_mutex_unlock(&mutex_export);
+            lock_release(&mutex_export);
             return SUCCESS;
         }
         logging(ERROR, "GPIO", "Failed to export pin: %d, (%s)",
@@ -115,13 +116,13 @@ int gpio_export(int pin){
 
 int gpio_unexport(int pin){
 
-    pthread_mutex_lock(&mutex_unexport);
+    lock_acquire(&mutex_unexport);
 
     int fd = open("/sys/class/gpio/unexport", O_WRONLY);
     if(fd == -1){
         logging(ERROR, "GPIO", "Failed to unexport pin: %d, (%s)",
                 pin, strerror(errno));
-        pthread_mutex_unlock(&mutex_unexport);
+        lock_release(&mutex_unexport);
         return errno;
     }
 
@@ -150,13 +151,13 @@ int gpio_direction(int pin, int dir){
     char path[PATH_MAX];
     snprintf(path, PATH_MAX, "/sys/class/gpio/gpio%d/direction", pin);
 
-    pthread_mutex_lock(&mutex_direction);
+    lock_acquire(&mutex_direction);
 
     int fd = open(path, O_WRONLY);
     if(fd == -1){
         logging(ERROR, "GPIO", "Failed to set direction of pin: %d, (%s)",
                 pin, strerror(errno));
-        pthread_mutex_unlock(&mutex_direction);
+        lock_release(&mutex_direction);
         return errno;
     }
 
@@ -183,13 +184,13 @@ int gpio_read(int pin, int* val){
     char path[PATH_MAX], value[2];
     snprintf(path, PATH_MAX, "/sys/class/gpio/gpio%d/value", pin);
 
-    pthread_mutex_lock(&mutex_read);
+    lock_acquire(&mutex_read);
 
     int fd = open(path, O_RDONLY);
     if(fd == -1){
         logging(ERROR, "GPIO", "Failed to read pin: %d, (%s)",
                 pin, strerror(errno));
-        pthread_mutex_unlock(&mutex_read);
+        lock_release(&mutex_read);
         return errno;
     }
 
@@ -212,13 +213,13 @@ int gpio_write(int pin, int val){
     char path[PATH_MAX];
     snprintf(path, PATH_MAX, "/sys/class/gpio/gpio%d/value", pin);
 
-    pthread_mutex_lock(&mutex_write);
+    lock_acquire(&mutex_write);
 
     int fd = open(path, O_WRONLY);
     if(fd == -1){
         logging(ERROR, "GPIO", "Failed to write to pin: %d, (%s)",
                 pin, strerror(errno));
-        pthread_mutex_unlock(&mutex_write);
+        lock_release(&mutex_write);
         return errno;
     }
 
@@ -238,7 +239,7 @@ int gpio_write(int pin, int val){
     return FAILURE;
 }
 
-static void close_unlock(int fd, pthread_mutex_t* mutex){
+static void close_unlock(int fd, lock_t* mutex){
     close(fd);
-    pthread_mutex_unlock(mutex);
+    lock_release(mutex);
 }
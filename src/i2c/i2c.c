@@ -13,13 +13,14 @@
 #include <linux/i2c-dev.h>  // for I2C_SLAVE
 
 #include "global_utils.h"   // for logging, SUCCESS,  & FAILURE
+#include "lock.h"
 #include "i2c.h"            // for write_i2c
 
 static int fd_i2c_1 = -1;
 static int fd_i2c_5 = -1;
 
-static pthread_mutex_t mutex_i2c_1 = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t mutex_i2c_5 = PTHREAD_MUTEX_INITIALIZER;
+static lock_t mutex_i2c_1 = LOCK_INITIALIZER("mutex_i2c_1");
+static lock_t mutex_i2c_5 = LOCK_INITIALIZER("mutex_i2c_5");
 
 int init_i2c(void* args){
 
@@ -47,32 +48,32 @@ int init_i2c(void* args){
 ssize_t read_i2c(int dev_num, unsigned char addr, void* buf, size_t count){
 
     int fd;
-    pthread_mutex_t mutex_i2c;
+    lock_t* mutex_i2c;
 
     switch(dev_num){
         case 1:
             fd = fd_i2c_1;
-            mutex_i2c = mutex_i2c_1;
+            mutex_i2c = &mutex_i2c_1;
             break;
         case 5:
             fd = fd_i2c_5;
-            mutex_i2c = mutex_i2c_5;
+            mutex_i2c = &mutex_i2c_5;
             break;
         default:
             errno = ENODEV;
             return FAILURE;
     }
 
-    pthread_mutex_lock(&mutex_i2c);
+    lock_acquire(mutex_i2c);
 
     if(ioctl(fd, I2C_SLAVE, addr) == -1){
-        pthread_mutex_unlock(&mutex_i2c);
+        lock_release(mutex_i2c);
         return FAILURE;
     }
 
     ssize_t ret = read(fd, buf, count);
 
-    pthread_mutex_unlock(&mutex_i2c);
+    lock_release(mutex_i2c);
 
     return ret;
 }
@@ -80,32 +81,32 @@ ssize_t read_i2c(int dev_num, unsigned char addr, void* buf, size_t count){
 ssize_t write_i2c(int dev_num, unsigned char addr, const void* buf, size_t count){
 
     int fd;
-    pthread_mutex_t mutex_i2c;
+    lock_t* mutex_i2c;
 
     switch(dev_num){
         case 1:
             fd = fd_i2c_1;
-            mutex_i2c = mutex_i2c_1;
+            mutex_i2c = &mutex_i2c_1;
             break;
         case 5:
             fd = fd_i2c_5;
-            mutex_i2c = mutex_i2c_5;
+            mutex_i2c = &mutex_i2c_5;
             break;
         default:
             errno = ENODEV;
             return FAILURE;
     }
 
-    pthread_mutex_lock(&mutex_i2c);
+    lock_acquire(mutex_i2c);
 
     if(ioctl(fd, I2C_SLAVE, addr) == -1){
-        pthread_mutex_unlock(&mutex_i2c);
+        lock_release(mutex_i2c);
         return FAILURE;
     }
 
     ssize_t ret = write(fd, buf, count);
 
-    pthread_mutex_unlock(&mutex_i2c);
+    lock_release(mutex_i2c);
 
     return ret;
 }
@@ -123,42 +124,42 @@ int write_read_i2c(int dev_num, unsigned char addr, const void* write_buf,
     *read_ret = -2;
 
     int fd;
-    pthread_mutex_t mutex_i2c;
+    lock_t* mutex_i2c;
 
     switch(dev_num){
         case 1:
             fd = fd_i2c_1;
-            mutex_i2c = mutex_i2c_1;
+            mutex_i2c = &mutex_i2c_1;
             break;
         case 5:
             fd = fd_i2c_5;
-            mutex_i2c = mutex_i2c_5;
+            mutex_i2c = &mutex_i2c_5;
             break;
         default:
             errno = ENODEV;
             return FAILURE;
     }
 
-    pthread_mutex_lock(&mutex_i2c);
+    lock_acquire(mutex_i2c);
 
     if(ioctl(fd, I2C_SLAVE, addr) == -1){
-        pthread_mutex_unlock(&mutex_i2c);
+        lock_release(mutex_i2c);
         return FAILURE;
     }
 
     *write_ret = write(fd, write_buf, write_count);
     if(*write_ret != write_count){
-        pthread_mutex_unlock(&mutex_i2c);
+        lock_release(mutex_i2c);
         return FAILURE;
     }
 
     *read_ret = read(fd, read_buf, read_count);
     if(*read_ret != read_count){
-        pthread_mutex_unlock(&mutex_i2c);
+        lock_release(mutex_i2c);
         return FAILURE;
     }
 
-    pthread_mutex_unlock(&mutex_i2c);
+    lock_release(mutex_i2c);
 
     return SUCCESS;
 }
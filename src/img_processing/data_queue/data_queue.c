@@ -13,14 +13,18 @@
 #include <string.h>
 
 #include "global_utils.h"
+#include "lock.h"
 
 #include "data_queue.h"
 
-pthread_mutex_t data_mutex = PTHREAD_MUTEX_INITIALIZER;
+lock_t data_mutex = LOCK_INITIALIZER("data_mutex");
 pthread_cond_t data_queue_non_empty_cond = PTHREAD_COND_INITIALIZER;
 
 static data_node *data_queue = NULL;
 
+/* nodes in data_queue, guarded by data_mutex */
+static int data_count = 0;
+
 int init_data_queue(void* args) {
     return SUCCESS;
 }
@@ -67,10 +71,10 @@ char *peek_data(data_node **head) {
  * @return      Data from the popped node.
  */
 struct node pop_data(data_node **head) {
-    pthread_mutex_lock(&data_mutex);
+    lock_acquire(&data_mutex);
 
     while (is_empty_data(head)) {
-        pthread_cond_wait(&data_queue_non_empty_cond, &data_mutex);
+        lock_cond_wait(&data_queue_non_empty_cond, &data_mutex);
     }
 
     data_node *temp = *head;
@@ -80,9 +84,11 @@ struct node pop_data(data_node **head) {
     ret.priority = temp->priority;
     ret.type = temp->type;
 
+    data_count--;
+
     free(temp);
 
-    pthread_mutex_unlock(&data_mutex);
+    lock_release(&data_mutex);
     return ret;
 }
 
@@ -95,7 +101,7 @@ struct node pop_data(data_node **head) {
  */
 void push_data(data_node **head, char *f, int p, int type) {
     
-    pthread_mutex_lock(&data_mutex);
+    lock_acquire(&data_mutex);
     data_node *start = (*head);
 
     if (!is_empty_data(head)) {
@@ -124,7 +130,9 @@ void push_data(data_node **head, char *f, int p, int type) {
         *head = new_data_node(f, p, type);
     }
 
-    pthread_mutex_unlock(&data_mutex);
+    data_count++;
+
+    lock_release(&data_mutex);
     pthread_cond_signal(&data_queue_non_empty_cond);
 }
 
@@ -156,3 +164,10 @@ struct node read_data_queue() {
     struct node temp = pop_data(&data_queue);
     return temp;
 }
+
+int data_queue_depth(void) {
+    lock_acquire(&data_mutex);
+    int count = data_count;
+    lock_release(&data_mutex);
+    return count;
+}
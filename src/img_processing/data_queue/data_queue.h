@@ -28,3 +28,6 @@ int store_data_local(char *f, int p, int type);
 
 /* Return the data of the oldest message of the highest priority. */
 struct node read_data_queue();
+
+/* Return the number of files waiting in the queue */
+int data_queue_depth(void);
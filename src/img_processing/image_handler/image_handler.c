@@ -10,6 +10,7 @@
 #include "global_utils.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <zstd.h>
 #include <errno.h>
@@ -18,20 +19,209 @@
 #include <limits.h>
 #include <time.h>
 #include <unistd.h>
+#include <libgen.h>
 
+#include "arena.h"
+#include "lock.h"
 #include "data_queue.h"
 #include "img_processing.h"
 #include "telemetry.h"
+#include "e_link.h"
+#include "quick_look.h"
+
+/**
+ * The compression level and the number of zstd workers are chosen per file
+ * by a controller, starting from COMPRESSION_LEVEL, after every compression:
+ *      queue:   CL_DEPTH_HIGH files are waiting, the compressor falls behind.
+ *               Add a worker if the CPU is idle enough, else lower the level.
+ *      cpu:     the CPU is less than CL_IDLE_LOW idle, lower the level and
+ *               drop a worker, the control loop comes first.
+ *      backlog: the downlink queue takes longer than CL_BACKLOG_HIGH_S to send
+ *               and the handler keeps up with time to spare, raise the level
+ *               for a better ratio. Only if the measured speed of the next
+ *               level keeps the handler busy less than CL_DUTY_MAX.
+ *      recovered: nothing is waiting and the CPU is idle again, step back up
+ *               towards COMPRESSION_LEVEL after falling behind.
+ *      link:    the downlink queue takes less than CL_BACKLOG_LOW_S to send,
+ *               step back towards COMPRESSION_LEVEL and drop idle workers.
+ * Changes are reported in telemetry and every file is logged to
+ * output/logs/compression.log as
+ *      time,level,workers,queue,backlog bytes,backlog s,cpu idle,MB/s,duty,ratio
+ */
+
+/* levels the controller chooses from */
+#define CL_MIN 1
+#define CL_MAX 19
+
+/* most zstd worker threads, besides the handler */
+#define CL_WORKERS_MAX 2
+
+/* files waiting when the compressor is falling behind */
+#define CL_DEPTH_HIGH 3
+
+/* CPU idle fractions below which compression backs off, and needed before
+ * spending more on compression */
+#define CL_IDLE_LOW 0.10
+#define CL_IDLE_SPARE 0.25
+
+/* downlink backlog worth a better ratio and too short to matter,
+ * unit: seconds */
+#define CL_BACKLOG_HIGH_S 900
+#define CL_BACKLOG_LOW_S 120
+
+/* busiest the handler may become by raising the level, fraction of time */
+#define CL_DUTY_MAX 0.5
+
+/* weight of the latest file in the averages */
+#define CL_EWMA 0.2
+
+/* shortest interval the CPU idle is measured over, files compressed quicker
+ * reuse the last measurement, unit: clock ticks of all CPUs */
+#define CL_IDLE_TICKS 100
+
+/**
+ * Files are written in the zstd seekable format: the input is cut into
+ * independent frames of SEEK_CHUNK bytes, followed by a seek table in a
+ * skippable frame, all little endian:
+ *      u32 0x184D2A5E, u32 size of the rest of the skippable frame
+ *      per frame: u32 compressed size, u32 decompressed size
+ *      u32 number of frames, u8 descriptor (0, no checksums in the table, every
+ *      frame carries its own), u32 0x8F92EAB1
+ * Any zstd decoder reads the result as one file. A transfer cut short on the
+ * ground still decodes frame by frame up to the last complete frame, and a
+ * range of a stored file is extracted onboard by decompressing only the frames
+ * it covers, see queue_range().
+ */
+
+/* decompressed size of each frame */
+#define SEEK_CHUNK (1L << 20)
+
+/* frames in the seek table, the last frame takes the rest of a larger file */
+#define SEEK_FRAMES_MAX 1024
+
+#define SEEK_SKIPPABLE_MAGIC 0x184D2A5E
+#define SEEK_MAGIC 0x8F92EAB1
+#define SEEK_FOOTER 9
+
+/**
+ * With ref_interval > 0, main and star tracker images of the same target are
+ * compressed against the previous image of their stream: frame k of an image
+ * gets frame k of the previous raw image as a zstd prefix. The images line up
+ * pixel for pixel, the background and the stars of a stare compress to almost
+ * nothing. The first image after a change of target or of image size, and
+ * then every ref_interval-th image, is a keyframe compressed on its own.
+ * A delta file starts with a skippable frame naming its reference, listed
+ * first in the seek table with no decompressed bytes:
+ *      u32 0x184D2A51, u32 size of the rest of the skippable frame
+ *      u32 SEEK_CHUNK, name of the reference as sent, null terminated
+ * Ground decodes a delta file after its reference, giving every frame the
+ * same frame of the decoded reference as prefix.
+ */
+
+#define REF_MAGIC 0x184D2A51
+
+/* longest chain of references down to a keyframe */
+#define REF_INTERVAL_MAX 32
+
+/* window covering the prefix and the frame */
+#define REF_WINDOW_LOG 21
+
+/**
+ * With quick look on, or on auto while the downlink takes longer than
+ * CL_BACKLOG_HIGH_S to send, a main image is also quantized in steps of its
+ * noise, see quick_look.h, and only that copy is sent as <name>_ql.fit.zst.
+ * The lossless file is kept and ground may fetch parts of it with
+ * queue_range(). It is never a reference, the next main image sent lossless
+ * is a keyframe. Auto stops once the backlog is below CL_BACKLOG_LOW_S.
+ */
+
+/* default quantization step, unit: sigma */
+#define QL_STEP 1.0
+
+typedef struct{
+    char raw[100];      /* previous raw image, kept as the reference */
+    char name[100];     /* its compressed name as sent */
+    long size;          /* size of the raw image, unit: bytes */
+    int deltas;         /* images compressed against a reference since the
+                         * keyframe */
+    int target;         /* ref_target when it was compressed */
+    char valid;
+} ref_stream_t;
 
 int img_main_counter = 0;
 int img_startracker_counter = 0;
 
 /* prototypes declaration */
 static void* thread_func(void*);
-int compression_stream(const char* in_filename, const char* out_filename);
+int compression_stream(const char* in_filename, const char* out_filename,
+        const ref_stream_t* ref);
+static void cl_update(long in_bytes, long out_bytes, double seconds,
+        const struct timespec* end);
+static double cpu_idle(void);
+static int alloc_buffers(void);
+static void put_le32(FILE* fp, uint32_t val);
+static uint32_t get_le32(const unsigned char* buf);
+static int extract_range(const char* request, char* tmp_name, char* out_name);
+static int read_range(FILE* fp, const char* dir, const char* name, long offset,
+        long len, FILE* out);
+static int seek_table(FILE* fp, long* table, long* entry, long* frames);
+static int seek_frame(FILE* fp, long table, long entry, long index, long* c_pos,
+        long* c_size, long* d_size);
+static int ref_header(FILE* fp, char* name);
+static int decode_chunk(const char* dir, const char* name, long chunk,
+        void** buf, long* n);
+static int decode_frame(FILE* fp, long c_pos, long c_size, const void* prefix,
+        long p_len, void* dst, long* n);
+static int alloc_ref_buffers(void);
+static const ref_stream_t* ref_choose(ref_stream_t* ref, const char* filepath,
+        const char* out_name);
+static void ref_keep(ref_stream_t* ref, char delta, const char* filepath,
+        const char* out_name);
+static int decompress_frame(FILE* fp, long c_pos, long c_size, long d_pos,
+        long offset, long len, FILE* out);
+static void send_range(struct node* req);
+static char ql_active(void);
+static int make_quick_look(const char* filepath, const char* out_name,
+        char* ql_name);
 
 static char st_fp[100];
 static char nir_fp[100];
+static char log_fp[100];
+static char sanity_fp[100];
+static char tmp_fp[100];
+
+/* reused by every compression, only the image handler thread compresses */
+static void* buff_in = NULL;
+static void* buff_out = NULL;
+static ZSTD_CCtx* cctx = NULL;
+static ZSTD_DCtx* dctx = NULL;
+static size_t buff_size;
+
+/* compressed and decompressed size of every frame of the file being written */
+static uint32_t seek_entries[SEEK_FRAMES_MAX][2];
+
+/* reference frames, the streams are only used by the image handler thread */
+static ref_stream_t ref_main, ref_st;
+static void* ref_buf[2] = {NULL, NULL};     /* SEEK_CHUNK each */
+
+static lock_t ref_lock = LOCK_INITIALIZER("ref_frames");
+static int ref_interval = 0;
+static int ref_target = 0;
+
+/* quick look, set by the command thread */
+static lock_t ql_lock = LOCK_INITIALIZER("quick_look");
+static int ql_mode = QL_OFF;
+static double ql_step = QL_STEP;
+static char ql_auto_on = 0;
+
+/* compression level controller, only used by the image handler thread */
+static int cl_level = COMPRESSION_LEVEL;
+static int cl_workers = 0;
+static int cl_workers_max = CL_WORKERS_MAX;
+static double cl_speed[CL_MAX + 1];    /* per level, unit: MB/s */
+static double cl_duty = 0;             /* fraction of time compressing */
+static struct timespec cl_last_end;
+static FILE* cl_log;
 
 int init_image_handler(void* args) {
 
@@ -41,6 +231,31 @@ int init_image_handler(void* args) {
     strcpy(nir_fp, get_top_dir());
     strcat(nir_fp, "output/nir/");
 
+    strcpy(log_fp, get_top_dir());
+    strcat(log_fp, "output/logs/");
+
+    strcpy(sanity_fp, get_top_dir());
+    strcat(sanity_fp, "output/sanity/");
+
+    strcpy(tmp_fp, get_top_dir());
+    strcat(tmp_fp, "output/compression/");
+
+    strcpy(ref_main.raw, tmp_fp);
+    strcat(ref_main.raw, "ref_main.fit");
+
+    strcpy(ref_st.raw, tmp_fp);
+    strcat(ref_st.raw, "ref_st.fit");
+
+    char log_fn[100];
+    strcpy(log_fn, log_fp);
+    strcat(log_fn, "compression.log");
+
+    cl_log = fopen(log_fn, "a");
+    if(cl_log == NULL){
+        logging(ERROR, "Img Handler", "Failed to open compression log: %m");
+        return errno;
+    }
+
     return create_thread("image_handler", thread_func, 19);
 
 }
@@ -54,7 +269,17 @@ static size_t fread_return_size(void* buffer, size_t sizeToRead, FILE* file)
     return FAILURE;
 }
 
-static int compress_file(const char* file_name_in, const char* file_name_out, int c_level) {
+/* compress_file:
+ * Compress a file in the seekable format, see the top of this file.
+ *
+ * input:
+ *      file_name_in, file_name_out: raw and compressed file
+ *      c_level, workers: zstd compression level and worker threads
+ *      ref: previous image of the stream to compress against, NULL for a
+ *           keyframe
+ */
+static int compress_file(const char* file_name_in, const char* file_name_out,
+        int c_level, int workers, const ref_stream_t* ref) {
 
     size_t ret;
 
@@ -66,78 +291,1043 @@ static int compress_file(const char* file_name_in, const char* file_name_out, in
     FILE* file_out = fopen(file_name_out, "wb");
     if(file_out==NULL){
         logging(ERROR, "image_handler", "Could not open out file");
+        fclose(file_in);
         return FAILURE;
     }
 
-    
-    size_t const buff_in_size = ZSTD_CStreamInSize();
-    void* const buff_in = malloc(buff_in_size);
-    size_t const buff_out_size = ZSTD_CStreamInSize();
-    void* const buff_out = malloc(buff_out_size);
+    if(alloc_buffers()){
+        fclose(file_out);
+        fclose(file_in);
+        return FAILURE;
+    }
 
-    ZSTD_CCtx* const cctx = ZSTD_createCCtx();
+    FILE* file_ref = NULL;
+    if(ref != NULL){
+        file_ref = fopen(ref->raw, "rb");
+        if(file_ref == NULL || alloc_ref_buffers()){
+            logging(ERROR, "Img Handler", "Could not open reference %s",
+                    ref->raw);
+            if(file_ref != NULL){
+                fclose(file_ref);
+            }
+            fclose(file_out);
+            fclose(file_in);
+            return FAILURE;
+        }
+    }
+
+    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
 
     ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, c_level);
     ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
-    ret = ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, 0);
-    if(ZSTD_isError(ret)){
+    ret = ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, workers);
+    if(ZSTD_isError(ret) && workers > 0){
+        /* libzstd built without threads, compress in this thread only */
+        logging(WARN, "Img Handler", "No zstd workers: %s", ZSTD_getErrorName(ret));
+        cl_workers = cl_workers_max = 0;
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, 0);
+    }
+    else if(ZSTD_isError(ret)){
         logging(ERROR, "Img Handler", "Failed to set workers to 0, %d", ret);
     }
 
-    size_t const to_read = buff_in_size;
     size_t read;
-    
-    while ((read = fread_return_size(buff_in, to_read, file_in))) {
+    int frames = 0;
+    long frame_in = 0, frame_start = 0, written = 0;
+
+    if(file_ref != NULL){
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, REF_WINDOW_LOG);
+
+        long name_len = strlen(ref->name) + 1;
+        put_le32(file_out, REF_MAGIC);
+        put_le32(file_out, 4 + name_len);
+        put_le32(file_out, SEEK_CHUNK);
+        fwrite(ref->name, 1, name_len, file_out);
+
+        written = frame_start = 12 + name_len;
+        seek_entries[0][0] = written;
+        seek_entries[0][1] = 0;
+        frames = 1;
+    }
+
+    while(1){
+
+        /* never read across the end of a frame */
+        size_t to_read = buff_size;
+        if(frames < SEEK_FRAMES_MAX - 1 && SEEK_CHUNK - frame_in < to_read){
+            to_read = SEEK_CHUNK - frame_in;
+        }
+
+        read = fread_return_size(buff_in, to_read, file_in);
         if(read==-1){
+            if(file_ref != NULL){
+                fclose(file_ref);
+            }
+            fclose(file_out);
+            fclose(file_in);
             return FAILURE;
         }
 
         int const last_chunk = (read < to_read);
-        
-        ZSTD_EndDirective const mode = last_chunk ? ZSTD_e_end : ZSTD_e_continue;
+
+        /* the file ended on a frame boundary */
+        if(last_chunk && read == 0 && frame_in == 0 && frames > 0){
+            break;
+        }
+
+        /* the same frame of the reference, a prefix only lasts one frame */
+        if(frame_in == 0 && file_ref != NULL){
+            long chunk = frames - 1;
+            size_t ref_len = 0;
+            if(fseek(file_ref, chunk * SEEK_CHUNK, SEEK_SET) == 0){
+                ref_len = fread(ref_buf[0], 1, SEEK_CHUNK, file_ref);
+            }
+            if(ref_len > 0){
+                ZSTD_CCtx_refPrefix(cctx, ref_buf[0], ref_len);
+            }
+        }
+
+        frame_in += read;
+        int const end_frame = last_chunk ||
+                (frame_in == SEEK_CHUNK && frames < SEEK_FRAMES_MAX - 1);
+
+        ZSTD_EndDirective const mode = end_frame ? ZSTD_e_end : ZSTD_e_continue;
         ZSTD_inBuffer input = { buff_in, read, 0 };
         int finished;
         
         do {
-            ZSTD_outBuffer output = { buff_out, buff_out_size, 0 };
+            ZSTD_outBuffer output = { buff_out, buff_size, 0 };
             size_t const remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
 
             if(ZSTD_isError(remaining)){
                 logging(ERROR, "Img Handler", "compressStream2 failed, %d", remaining);
+                if(file_ref != NULL){
+                    fclose(file_ref);
+                }
+                fclose(file_out);
+                fclose(file_in);
                 return FAILURE;
             }
 
             fwrite(buff_out, 1, output.pos, file_out);
+            written += output.pos;
 
-            finished = last_chunk ? (remaining == 0) : (input.pos == input.size);
+            finished = end_frame ? (remaining == 0) : (input.pos == input.size);
 
         } while (!finished);
 
+        if(end_frame){
+            seek_entries[frames][0] = written - frame_start;
+            seek_entries[frames][1] = frame_in;
+            frames++;
+            frame_start = written;
+            frame_in = 0;
+        }
+
+        if(last_chunk){
+            break;
+        }
     }
 
-    ZSTD_freeCCtx(cctx);
-    fclose(file_out);
+    put_le32(file_out, SEEK_SKIPPABLE_MAGIC);
+    put_le32(file_out, frames * 8 + SEEK_FOOTER);
+    for(int ii=0; ii<frames; ++ii){
+        put_le32(file_out, seek_entries[ii][0]);
+        put_le32(file_out, seek_entries[ii][1]);
+    }
+    put_le32(file_out, frames);
+    fputc(0, file_out);
+    put_le32(file_out, SEEK_MAGIC);
+
+    if(file_ref != NULL){
+        fclose(file_ref);
+    }
+
+    int err = ferror(file_out);
+    if(fclose(file_out) || err){
+        logging(ERROR, "Img Handler", "Failed to write %s", file_name_out);
+        fclose(file_in);
+        return FAILURE;
+    }
     fclose(file_in);
-    free(buff_in);
-    free(buff_out);
 
     return SUCCESS;
 
 }
 
+/* buffers and contexts are allocated once, the contexts keep their tables
+ * between files */
+static int alloc_buffers(void){
+
+    if(cctx != NULL){
+        return SUCCESS;
+    }
+
+    /* decompression takes any buffer sizes, streaming is only faster with
+     * the sizes of zstd */
+    buff_size = ZSTD_CStreamInSize();
+    if(buff_size < ZSTD_CStreamOutSize()){
+        buff_size = ZSTD_CStreamOutSize();
+    }
+
+    buff_in = arena_alloc(buff_size, "Img Handler");
+    buff_out = arena_alloc(buff_size, "Img Handler");
+    dctx = ZSTD_createDCtx();
+    cctx = ZSTD_createCCtx();
+    if(buff_in == NULL || buff_out == NULL || dctx == NULL || cctx == NULL){
+        logging(ERROR, "Img Handler", "Cannot allocate compression buffers");
+        ZSTD_freeDCtx(dctx);
+        ZSTD_freeCCtx(cctx);
+        dctx = NULL;
+        cctx = NULL;
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/* the buffers holding frames of references, when first needed */
+static int alloc_ref_buffers(void){
+
+    for(int ii=0; ii<2; ++ii){
+        if(ref_buf[ii] == NULL){
+            ref_buf[ii] = arena_alloc(SEEK_CHUNK, "Img Handler");
+        }
+        if(ref_buf[ii] == NULL){
+            logging(ERROR, "Img Handler", "Cannot allocate reference buffers");
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+static void put_le32(FILE* fp, uint32_t val){
+
+    for(int ii=0; ii<4; ++ii){
+        fputc((val >> (8 * ii)) & 0xFF, fp);
+    }
+}
+
+static uint32_t get_le32(const unsigned char* buf){
+
+    return buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+/* extract_range:
+ * Decompress a range of a stored file into the compression directory, see
+ * queue_range().
+ *
+ * input:
+ *      request: "<name>@<offset>+<length>", name of a file in an output
+ *               directory
+ *
+ * output:
+ *      tmp_name: file holding the range, 100 characters
+ *      out_name: where the range is compressed to, 100 characters
+ *
+ * return:
+ *      SUCCESS: range written to tmp_name
+ *      ENOENT: no such file in the output directories
+ *      ERANGE: the file ends before offset
+ *      otherwise an error number
+ */
+static int extract_range(const char* request, char* tmp_name, char* out_name){
+
+    char name[100];
+    long offset, len;
+
+    strcpy(name, request);
+    char* at = strrchr(name, '@');
+    if(at == NULL || sscanf(at + 1, "%ld+%ld", &offset, &len) != 2){
+        return EINVAL;
+    }
+    *at = '\0';
+
+    const char* dirs[] = {nir_fp, st_fp, log_fp, sanity_fp};
+    char in_name[100];
+    const char* dir = NULL;
+
+    for(size_t ii=0; ii<sizeof(dirs)/sizeof(*dirs); ++ii){
+        if(snprintf(in_name, 100, "%s%s", dirs[ii], name) < 100 &&
+                access(in_name, R_OK) == 0){
+            dir = dirs[ii];
+            break;
+        }
+    }
+    if(dir == NULL){
+        return ENOENT;
+    }
+
+    /* IMG_MAIN_12:00:00.fit.zst -> IMG_MAIN_12:00:00.fit@1048576+4096.zst */
+    size_t stem = strlen(name);
+    if(stem > 4 && strcmp(&name[stem - 4], ".zst") == 0){
+        name[stem - 4] = '\0';
+    }
+    if(snprintf(tmp_name, 100, "%s%s@%ld+%ld", tmp_fp, name, offset, len) >= 100 ||
+            snprintf(out_name, 100, "%s%s@%ld+%ld.zst", dir, name, offset,
+            len) >= 100){
+        return ENAMETOOLONG;
+    }
+
+    FILE* fp = fopen(in_name, "rb");
+    if(fp == NULL){
+        return errno;
+    }
+    FILE* out = fopen(tmp_name, "wb");
+    if(out == NULL){
+        int ret = errno;
+        fclose(fp);
+        return ret;
+    }
+
+    int ret = alloc_buffers();
+    if(ret == SUCCESS){
+        ret = read_range(fp, dir, &in_name[strlen(dir)], offset, len, out);
+    }
+
+    if(ret == SUCCESS && ftell(out) == 0){
+        ret = ERANGE;
+    }
+    if(fclose(out) && ret == SUCCESS){
+        ret = errno;
+    }
+    fclose(fp);
+
+    if(ret != SUCCESS){
+        remove(tmp_name);
+    }
+
+    return ret;
+}
+
+/* read_range:
+ * Write len bytes from offset of the decompressed file to out. Only the frames
+ * in the seek table covering the range are decompressed, a file without a
+ * seek table is decompressed from the start. The frames of a delta file are
+ * decoded with their references from dir.
+ */
+static int read_range(FILE* fp, const char* dir, const char* name, long offset,
+        long len, FILE* out){
+
+    long table, entry, frames;
+
+    if(offset < 0 || len <= 0 || fseek(fp, 0L, SEEK_END)){
+        return EINVAL;
+    }
+
+    int ret = seek_table(fp, &table, &entry, &frames);
+    if(ret == ENOMSG){
+        return decompress_frame(fp, 0, ftell(fp), 0, offset, len, out);
+    }
+    else if(ret != SUCCESS){
+        return ret;
+    }
+
+    char ref[100];
+    ret = ref_header(fp, ref);
+    if(ret != SUCCESS && ret != ENOMSG){
+        return ret;
+    }
+    char delta = ret == SUCCESS;
+    ret = SUCCESS;
+
+    long c_pos = 0, d_pos = 0;
+    for(long ii=0; ii<frames && d_pos < offset + len; ++ii){
+
+        unsigned char buf[8];
+        if(fseek(fp, table + 8 + ii * entry, SEEK_SET) || fread(buf, 1, 8, fp) != 8){
+            return EIO;
+        }
+        long c_size = get_le32(&buf[0]);
+        long d_size = get_le32(&buf[4]);
+
+        if(d_pos + d_size > offset && !delta){
+            ret = decompress_frame(fp, c_pos, c_size, d_pos, offset, len, out);
+        }
+        else if(d_pos + d_size > offset){
+            /* the reference header is frame 0 */
+            void* chunk = NULL;
+            long n = 0;
+            ret = decode_chunk(dir, name, ii - 1, &chunk, &n);
+            if(ret == SUCCESS){
+                long from = offset > d_pos ? offset : d_pos;
+                long to = offset + len < d_pos + n ? offset + len : d_pos + n;
+                fwrite((char*)chunk + (from - d_pos), 1, to - from, out);
+            }
+        }
+        if(ret != SUCCESS){
+            return ret;
+        }
+
+        c_pos += c_size;
+        d_pos += d_size;
+    }
+
+    return ferror(out) ? EIO : SUCCESS;
+}
+
+/* seek_table:
+ * Find the seek table at the end of a file.
+ *
+ * output:
+ *      table: position of the table
+ *      entry: size of an entry, unit: bytes
+ *      frames: number of entries
+ *
+ * return:
+ *      SUCCESS: table found
+ *      ENOMSG: no seek table, e.g. a file written as one frame
+ *      EINVAL: corrupt table
+ */
+static int seek_table(FILE* fp, long* table, long* entry, long* frames){
+
+    unsigned char buf[SEEK_FOOTER];
+
+    if(fseek(fp, 0L, SEEK_END)){
+        return errno;
+    }
+    long size = ftell(fp);
+
+    if(size < SEEK_FOOTER + 8 || fseek(fp, size - SEEK_FOOTER, SEEK_SET) ||
+            fread(buf, 1, SEEK_FOOTER, fp) != SEEK_FOOTER ||
+            get_le32(&buf[5]) != SEEK_MAGIC){
+        return ENOMSG;
+    }
+
+    *frames = get_le32(&buf[0]);
+
+    /* reserved bits are 0, bit 7 adds a checksum to every entry */
+    if(buf[4] & 0x7C){
+        return EINVAL;
+    }
+    *entry = buf[4] & 0x80 ? 12 : 8;
+    *table = size - SEEK_FOOTER - *frames * *entry - 8;
+
+    if(*table < 0 || fseek(fp, *table, SEEK_SET) || fread(buf, 1, 8, fp) != 8 ||
+            get_le32(&buf[0]) != SEEK_SKIPPABLE_MAGIC ||
+            get_le32(&buf[4]) != *frames * *entry + SEEK_FOOTER){
+        return EINVAL;
+    }
+
+    return SUCCESS;
+}
+
+/* position and sizes of frame index of a seek table */
+static int seek_frame(FILE* fp, long table, long entry, long index, long* c_pos,
+        long* c_size, long* d_size){
+
+    unsigned char buf[8];
+
+    *c_pos = 0;
+    for(long ii=0; ii<=index; ++ii){
+        if(fseek(fp, table + 8 + ii * entry, SEEK_SET) || fread(buf, 1, 8, fp) != 8){
+            return EIO;
+        }
+        if(ii < index){
+            *c_pos += get_le32(&buf[0]);
+        }
+    }
+
+    *c_size = get_le32(&buf[0]);
+    *d_size = get_le32(&buf[4]);
+
+    return SUCCESS;
+}
+
+/* ref_header:
+ * Name of the reference of a delta file, 100 characters.
+ *
+ * return:
+ *      SUCCESS: delta file
+ *      ENOMSG: keyframe or a file compressed on its own
+ *      EINVAL: corrupt header
+ */
+static int ref_header(FILE* fp, char* name){
+
+    unsigned char buf[4 + 100];
+
+    if(fseek(fp, 0L, SEEK_SET) || fread(buf, 1, 8, fp) != 8 ||
+            get_le32(&buf[0]) != REF_MAGIC){
+        return ENOMSG;
+    }
+
+    long size = get_le32(&buf[4]);
+    if(size < 6 || size > (long)sizeof(buf) || fread(buf, 1, size, fp) != size ||
+            get_le32(&buf[0]) != SEEK_CHUNK || buf[size - 1] != '\0' ||
+            strchr((char*)&buf[4], '/') != NULL){
+        return EINVAL;
+    }
+
+    strcpy(name, (char*)&buf[4]);
+
+    return SUCCESS;
+}
+
+/* decode_chunk:
+ * Decompress frame chunk of the data of a delta file. The chain of references
+ * is followed down to the keyframe and decoded back up, frame chunk of each
+ * is the prefix of the next.
+ *
+ * input:
+ *      dir, name: the delta file
+ *      chunk: frame of the data, the reference header not counted
+ *
+ * output:
+ *      buf: one of ref_buf holding the frame
+ *      n: size of the frame, unit: bytes
+ */
+static int decode_chunk(const char* dir, const char* name, long chunk,
+        void** buf, long* n){
+
+    char chain[REF_INTERVAL_MAX][100];
+    char fn[200];
+    int depth = 0, ret;
+
+    if(alloc_ref_buffers()){
+        return ENOMEM;
+    }
+
+    strcpy(chain[0], name);
+    while(1){
+        if(snprintf(fn, sizeof(fn), "%s%s", dir, chain[depth]) >= (int)sizeof(fn)){
+            return ENAMETOOLONG;
+        }
+        FILE* fp = fopen(fn, "rb");
+        if(fp == NULL){
+            return errno;
+        }
+        char ref[100];
+        ret = ref_header(fp, ref);
+        fclose(fp);
+
+        if(ret == ENOMSG){
+            break;
+        }
+        else if(ret != SUCCESS){
+            return ret;
+        }
+        else if(++depth == REF_INTERVAL_MAX){
+            return ELOOP;
+        }
+        strcpy(chain[depth], ref);
+    }
+
+    /* the keyframe first, the buffers take turns */
+    const void* prefix = NULL;
+    long p_len = 0;
+
+    for(int ii=depth; ii>=0; --ii){
+
+        if(snprintf(fn, sizeof(fn), "%s%s", dir, chain[ii]) >= (int)sizeof(fn)){
+            return ENAMETOOLONG;
+        }
+        FILE* fp = fopen(fn, "rb");
+        if(fp == NULL){
+            return errno;
+        }
+
+        long table, entry, frames, c_pos, c_size, d_size;
+        long index = chunk + (ii < depth ? 1 : 0);
+
+        ret = seek_table(fp, &table, &entry, &frames);
+        if(ret == SUCCESS && index >= frames){
+            ret = ERANGE;
+        }
+        if(ret == SUCCESS){
+            ret = seek_frame(fp, table, entry, index, &c_pos, &c_size, &d_size);
+        }
+        if(ret == SUCCESS){
+            ret = decode_frame(fp, c_pos, c_size, prefix, p_len, ref_buf[ii & 1],
+                    &p_len);
+        }
+        fclose(fp);
+
+        if(ret != SUCCESS){
+            return ret;
+        }
+        prefix = ref_buf[ii & 1];
+    }
+
+    *buf = (void*)prefix;
+    *n = p_len;
+
+    return SUCCESS;
+}
+
+/* decode_frame:
+ * Decompress one frame of at most SEEK_CHUNK bytes into dst, with a prefix
+ * if not NULL.
+ */
+static int decode_frame(FILE* fp, long c_pos, long c_size, const void* prefix,
+        long p_len, void* dst, long* n){
+
+    if(fseek(fp, c_pos, SEEK_SET)){
+        return errno;
+    }
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+    if(prefix != NULL){
+        ZSTD_DCtx_refPrefix(dctx, prefix, p_len);
+    }
+
+    ZSTD_outBuffer output = { dst, SEEK_CHUNK, 0 };
+    size_t ret = 1;
+
+    while(c_size > 0){
+
+        size_t to_read = (size_t)c_size < buff_size ? (size_t)c_size : buff_size;
+        size_t read = fread(buff_in, 1, to_read, fp);
+        if(read == 0){
+            return EIO;
+        }
+        c_size -= read;
+
+        ZSTD_inBuffer input = { buff_in, read, 0 };
+        while(input.pos < input.size){
+            ret = ZSTD_decompressStream(dctx, &output, &input);
+            if(ZSTD_isError(ret)){
+                logging(ERROR, "Img Handler", "decompressStream failed: %s",
+                        ZSTD_getErrorName(ret));
+                return EIO;
+            }
+            if(output.pos == output.size && input.pos < input.size){
+                return EFBIG;
+            }
+        }
+    }
+
+    /* 0 once the frame is complete */
+    if(ret != 0){
+        return EIO;
+    }
+
+    *n = output.pos;
+
+    return SUCCESS;
+}
+
+/* decompress_frame:
+ * Decompress c_size bytes from c_pos, which decompress to the bytes from
+ * d_pos, and write the part in the range to out.
+ */
+static int decompress_frame(FILE* fp, long c_pos, long c_size, long d_pos,
+        long offset, long len, FILE* out){
+
+    if(fseek(fp, c_pos, SEEK_SET)){
+        return errno;
+    }
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+
+    long end = offset + len;
+
+    while(c_size > 0 && d_pos < end){
+
+        size_t to_read = (size_t)c_size < buff_size ? (size_t)c_size : buff_size;
+        size_t read = fread(buff_in, 1, to_read, fp);
+        if(read == 0){
+            return EIO;
+        }
+        c_size -= read;
+
+        ZSTD_inBuffer input = { buff_in, read, 0 };
+        ZSTD_outBuffer output;
+
+        do {
+            output = (ZSTD_outBuffer){ buff_out, buff_size, 0 };
+            size_t const ret = ZSTD_decompressStream(dctx, &output, &input);
+
+            if(ZSTD_isError(ret)){
+                logging(ERROR, "Img Handler", "decompressStream failed: %s",
+                        ZSTD_getErrorName(ret));
+                return EIO;
+            }
+
+            long from = offset > d_pos ? offset : d_pos;
+            long to = end < d_pos + (long)output.pos ? end : d_pos + (long)output.pos;
+            if(to > from){
+                fwrite((char*)buff_out + (from - d_pos), 1, to - from, out);
+            }
+            d_pos += output.pos;
+
+        } while((input.pos < input.size || output.pos == output.size) &&
+                d_pos < end);
+    }
+
+    return ferror(out) ? EIO : SUCCESS;
+}
+
 /* compression_stream:
  * Compresses a file.
  *
  * input:
  * in_filename: filepath of file to be compressed.
  * out_filename: filepath for storage location
+ * ref: previous image to compress against, NULL to compress on its own
  */
-int compression_stream(const char* in_filename, const char* out_filename) {
+int compression_stream(const char* in_filename, const char* out_filename,
+        const ref_stream_t* ref) {
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int ret = compress_file(in_filename, out_filename, cl_level, cl_workers, ref);
 
-    return compress_file(in_filename, out_filename, COMPRESSION_LEVEL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    struct stat st_in, st_out;
+    if(ret == SUCCESS && stat(in_filename, &st_in) == 0 &&
+            stat(out_filename, &st_out) == 0){
+
+        double seconds = (end.tv_sec - start.tv_sec) +
+                (end.tv_nsec - start.tv_nsec) / 1e9;
+        cl_update(st_in.st_size, st_out.st_size, seconds, &end);
+    }
+
+    return ret;
 
 }
 
+/* cl_update:
+ * Choose the level and workers of the next file, see the top of this file.
+ *
+ * input:
+ *      in_bytes, out_bytes: size of the file before and after compression
+ *      seconds: time spent compressing it
+ *      end: CLOCK_MONOTONIC when the compression ended
+ */
+static void cl_update(long in_bytes, long out_bytes, double seconds,
+        const struct timespec* end){
+
+    double mb = in_bytes / 1e6;
+    double speed = seconds > 0 ? mb / seconds : 0;
+
+    cl_speed[cl_level] = cl_speed[cl_level] > 0 ?
+            (1 - CL_EWMA) * cl_speed[cl_level] + CL_EWMA * speed : speed;
+
+    /* time since the previous file, idle waiting included */
+    if(cl_last_end.tv_sec > 0){
+        double wall = (end->tv_sec - cl_last_end.tv_sec) +
+                (end->tv_nsec - cl_last_end.tv_nsec) / 1e9;
+        if(wall > 0){
+            double duty = seconds / wall;
+            cl_duty = (1 - CL_EWMA) * cl_duty + CL_EWMA * (duty < 1 ? duty : 1);
+        }
+    }
+    cl_last_end = *end;
+
+    int depth = data_queue_depth();
+    long backlog = downlink_backlog();
+    double backlog_s = backlog / get_datarate();
+    double idle = cpu_idle();
+
+    int level = cl_level, workers = cl_workers;
+    const char* reason = NULL;
+
+    if(depth >= CL_DEPTH_HIGH){
+        if(idle >= CL_IDLE_SPARE && workers < cl_workers_max){
+            workers++;
+        }
+        else{
+            level = level - 2 > CL_MIN ? level - 2 : CL_MIN;
+        }
+        reason = "queue";
+    }
+    else if(idle >= 0 && idle < CL_IDLE_LOW){
+        level = level > CL_MIN ? level - 1 : CL_MIN;
+        workers = workers > 0 ? workers - 1 : 0;
+        reason = "cpu";
+    }
+    else if(backlog_s > CL_BACKLOG_HIGH_S && depth == 0 &&
+            idle >= CL_IDLE_SPARE && level < CL_MAX){
+
+        /* a level not measured yet is taken as 30 % slower */
+        double next = cl_speed[level + 1] > 0 ?
+                cl_speed[level + 1] : 0.7 * cl_speed[level];
+
+        if(next > 0 && cl_duty * cl_speed[level] / next < CL_DUTY_MAX){
+            level++;
+            reason = "backlog";
+        }
+    }
+    else if(level < COMPRESSION_LEVEL && depth == 0 && idle >= CL_IDLE_SPARE){
+        level++;
+        reason = "recovered";
+    }
+    else if(backlog_s < CL_BACKLOG_LOW_S && depth == 0){
+        if(level > COMPRESSION_LEVEL){
+            level--;
+        }
+        workers = workers > 0 ? workers - 1 : 0;
+        reason = "link";
+    }
+
+    logging_csv(cl_log, "%d,%d,%d,%ld,%.0lf,%.2lf,%.1lf,%.2lf,%.3lf", cl_level,
+            cl_workers, depth, backlog, backlog_s, idle, speed, cl_duty,
+            in_bytes > 0 ? (double)out_bytes / in_bytes : 0);
+
+    if(level == cl_level && workers == cl_workers){
+        return;
+    }
+
+    char msg[200];
+    snprintf(msg, sizeof(msg), "Compression level %d->%d, workers %d->%d (%s): "
+            "queue %d, backlog %ld kB %.0lf s, idle %.0lf%%, %.1lf MB/s",
+            cl_level, level, cl_workers, workers, reason, depth, backlog / 1000,
+            backlog_s, idle * 100, speed);
+
+    logging(INFO, "Img Handler", "%s", msg);
+    send_telemetry(msg, 1, 0, 0);
+
+    cl_level = level;
+    cl_workers = workers;
+}
+
+/* fraction of CPU time idle since the previous measurement, -1 if unknown */
+static double cpu_idle(void){
+
+    static unsigned long long idle_prev = 0, total_prev = 0;
+    static double frac = -1;
+
+    FILE* fp = fopen("/proc/stat", "r");
+    if(fp == NULL){
+        return -1;
+    }
+
+    unsigned long long v[8] = {0};
+    int n = fscanf(fp, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &v[0],
+            &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+    fclose(fp);
+
+    if(n < 4){
+        return -1;
+    }
+
+    /* idle and iowait */
+    unsigned long long idle = v[3] + v[4], total = 0;
+    for(int ii=0; ii<8; ++ii){
+        total += v[ii];
+    }
+
+    if(total < total_prev + CL_IDLE_TICKS){
+        return frac;
+    }
+
+    frac = total_prev > 0 ? (double)(idle - idle_prev) / (total - total_prev) : -1;
+
+    idle_prev = idle;
+    total_prev = total;
+
+    return frac;
+}
+
+/* ref_choose:
+ * The reference to compress an image against, NULL for a keyframe.
+ *
+ * input:
+ *      ref: stream of the image, NULL if not a main or star tracker image
+ *      filepath: the raw image
+ *      out_name: where it is compressed to
+ */
+static const ref_stream_t* ref_choose(ref_stream_t* ref, const char* filepath,
+        const char* out_name){
+
+    if(ref == NULL){
+        return NULL;
+    }
+
+    lock_acquire(&ref_lock);
+    int interval = ref_interval, target = ref_target;
+    lock_release(&ref_lock);
+
+    struct stat st;
+    char base[100];
+    strcpy(base, out_name);
+
+    /* every frame must line up with a whole frame of the reference, and a
+     * name reused within the same second would overwrite the reference */
+    if(interval == 0 || !ref->valid || ref->target != target ||
+            ref->deltas + 1 >= interval || stat(filepath, &st) ||
+            st.st_size != ref->size ||
+            st.st_size > SEEK_CHUNK * (SEEK_FRAMES_MAX - 2) ||
+            strcmp(basename(base), ref->name) == 0){
+        return NULL;
+    }
+
+    return ref;
+}
+
+/* ref_keep:
+ * Keep a compressed image as the reference of the next image of its stream,
+ * or remove it.
+ *
+ * input:
+ *      ref: stream of the image, NULL if not a main or star tracker image
+ *      delta: the image was compressed against the reference
+ *      filepath: the raw image
+ *      out_name: where it was compressed to
+ */
+static void ref_keep(ref_stream_t* ref, char delta, const char* filepath,
+        const char* out_name){
+
+    if(ref == NULL){
+        remove(filepath);
+        return;
+    }
+
+    lock_acquire(&ref_lock);
+    int interval = ref_interval, target = ref_target;
+    lock_release(&ref_lock);
+
+    struct stat st;
+    if(interval == 0 || stat(filepath, &st) || rename(filepath, ref->raw)){
+        remove(filepath);
+        ref->valid = 0;
+        return;
+    }
+
+    char base[100];
+    strcpy(base, out_name);
+    strcpy(ref->name, basename(base));
+    ref->size = st.st_size;
+    ref->deltas = delta ? ref->deltas + 1 : 0;
+    ref->target = target;
+    ref->valid = 1;
+}
+
+void ref_frames_local(int interval){
+
+    if(interval < 0){
+        interval = 0;
+    }
+    else if(interval > REF_INTERVAL_MAX){
+        interval = REF_INTERVAL_MAX;
+    }
+
+    lock_acquire(&ref_lock);
+    ref_interval = interval;
+    lock_release(&ref_lock);
+
+    logging(INFO, "Img Handler", "Keyframe interval set to %d", interval);
+}
+
+void ref_keyframe_local(void){
+
+    lock_acquire(&ref_lock);
+    ref_target++;
+    lock_release(&ref_lock);
+}
+
+/* whether the next main image is sent as quick look, see the top of this
+ * file */
+static char ql_active(void){
+
+    lock_acquire(&ql_lock);
+    int mode = ql_mode;
+    lock_release(&ql_lock);
+
+    if(mode != QL_AUTO){
+        ql_auto_on = 0;
+        return mode == QL_ON;
+    }
+
+    double backlog_s = downlink_backlog() / get_datarate();
+
+    if(ql_auto_on != (ql_auto_on ? backlog_s >= CL_BACKLOG_LOW_S :
+                backlog_s > CL_BACKLOG_HIGH_S)){
+
+        ql_auto_on = !ql_auto_on;
+
+        char msg[100];
+        snprintf(msg, sizeof(msg), "Quick look %s, backlog %.0lf s",
+                ql_auto_on ? "started" : "stopped", backlog_s);
+        logging(INFO, "Img Handler", "%s", msg);
+        send_telemetry(msg, 1, 0, 0);
+    }
+
+    return ql_auto_on;
+}
+
+/* make_quick_look:
+ * Quantize and compress a main image, IMG_MAIN_12:00:00.fit.zst becomes
+ * IMG_MAIN_12:00:00_ql.fit.zst.
+ *
+ * input:
+ *      filepath: the raw image
+ *      out_name: its lossless compressed file
+ *
+ * output:
+ *      ql_name: the quick look to send, 100 characters
+ */
+static int make_quick_look(const char* filepath, const char* out_name,
+        char* ql_name){
+
+    char tmp_name[100];
+    size_t len = strlen(out_name);
+
+    if(len < 8 || strcmp(&out_name[len - 8], ".fit.zst") != 0 ||
+            snprintf(ql_name, 100, "%.*s_ql.fit.zst", (int)(len - 8),
+            out_name) >= 100 ||
+            snprintf(tmp_name, 100, "%sql.fit", tmp_fp) >= 100){
+        return ENAMETOOLONG;
+    }
+
+    lock_acquire(&ql_lock);
+    double step = ql_step;
+    lock_release(&ql_lock);
+
+    int ret = quick_look(filepath, tmp_name, step);
+    if(ret == SUCCESS && compression_stream(tmp_name, ql_name, NULL)){
+        ret = EIO;
+    }
+    remove(tmp_name);
+
+    return ret;
+}
+
+void quick_look_local(int mode, double step){
+
+    if(mode != QL_OFF && mode != QL_ON && mode != QL_AUTO){
+        logging(WARN, "Img Handler", "Invalid quick look mode %d", mode);
+        return;
+    }
+
+    lock_acquire(&ql_lock);
+    ql_mode = mode;
+    if(step > 0){
+        ql_step = step;
+    }
+    step = ql_step;
+    lock_release(&ql_lock);
+
+    logging(INFO, "Img Handler", "Quick look mode %d, step %.2lf sigma", mode,
+            step);
+}
+
+/* extract, compress and downlink a range requested with queue_range(), a
+ * failed request is reported and dropped */
+static void send_range(struct node* req){
+
+    char tmp_name[100], out_name[100], msg[200];
+
+    int ret = extract_range(req->filepath, tmp_name, out_name);
+    if(ret == SUCCESS){
+        if(compression_stream(tmp_name, out_name, NULL)){
+            ret = EIO;
+        }
+        remove(tmp_name);
+    }
+
+    if(ret == SUCCESS){
+        send_telemetry(out_name, req->priority, 1, 0);
+    }
+    else{
+        snprintf(msg, sizeof(msg), "Range %s not sent: %s", req->filepath,
+                strerror(ret));
+        logging(WARN, "Img Handler", "%s", msg);
+        send_telemetry(msg, 1, 0, 0);
+    }
+}
+
 static void* thread_func(void* param){
 
     char out_name[100];
@@ -162,13 +1352,81 @@ static void* thread_func(void* param){
 
             sprintf(out_name, "%sIMG_ST_%02d:%02d:%02d.fit.zst", st_fp,
                     date_time.tm_hour, date_time.tm_min, date_time.tm_sec);
+
+        } else if (temp.type==IMAGE_SIDECAR || temp.type==IMAGE_CATALOG){
+
+            /* keep the frame id in the name, e.g. nir0012.att.zst */
+            char base[100];
+            strcpy(base, temp.filepath);
+            if(snprintf(out_name, sizeof(out_name), "%s%s.zst", nir_fp,
+                    basename(base)) >= (int)sizeof(out_name)){
+                logging(ERROR, "Img Handler", "Name too long, not sent: %s",
+                        temp.filepath);
+                continue;
+            }
+
+        } else if (temp.type==FLIGHT_RECORD){
+
+            char base[100];
+            strcpy(base, temp.filepath);
+            if(snprintf(out_name, sizeof(out_name), "%s%s.zst", log_fp,
+                    basename(base)) >= (int)sizeof(out_name)){
+                logging(ERROR, "Img Handler", "Name too long, not sent: %s",
+                        temp.filepath);
+                continue;
+            }
+
+        } else if (temp.type==IMAGE_SANITY){
+
+            char base[100];
+            strcpy(base, temp.filepath);
+            if(snprintf(out_name, sizeof(out_name), "%s%s.zst", sanity_fp,
+                    basename(base)) >= (int)sizeof(out_name)){
+                logging(ERROR, "Img Handler", "Name too long, not sent: %s",
+                        temp.filepath);
+                continue;
+            }
+
+        } else if (temp.type==IMAGE_RANGE){
+
+            send_range(&temp);
+            continue;
         }
 
-        if(compression_stream(temp.filepath, out_name)){
+        ref_stream_t* ref = temp.type == IMAGE_MAIN ? &ref_main :
+                temp.type == IMAGE_STARTRACKER ? &ref_st : NULL;
+        const ref_stream_t* use = ref_choose(ref, temp.filepath, out_name);
+
+        if(compression_stream(temp.filepath, out_name, use)){
+            /* retried as a keyframe */
+            if(ref != NULL){
+                ref->valid = 0;
+            }
             queue_image(temp.filepath, temp.type);
         } else {
-            send_telemetry(out_name, temp.priority, 1, 0);
-            remove(temp.filepath);
+            char* sent = out_name;
+            char ql_name[100];
+
+            if(temp.type == IMAGE_MAIN && ql_active()){
+                int ret = make_quick_look(temp.filepath, out_name, ql_name);
+                if(ret == SUCCESS){
+                    sent = ql_name;
+                }
+                else{
+                    logging(WARN, "Img Handler", "No quick look of %s, sent "
+                            "lossless: %d", out_name, ret);
+                }
+            }
+
+            send_telemetry(sent, temp.priority, 1, 0);
+
+            /* ground never gets a lossless image sent as quick look, the next
+             * one is a keyframe */
+            if(sent != out_name){
+                ref->valid = 0;
+                ref = NULL;
+            }
+            ref_keep(ref, use != NULL, temp.filepath, out_name);
         }
     }
 
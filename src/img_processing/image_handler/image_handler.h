@@ -11,3 +11,15 @@
 
 /* initialise the image handler component */
 int init_image_handler(void* args);
+
+/* Compress main and star tracker images against the previous image of their
+ * stream, every interval-th image is a keyframe. 0 compresses every image on
+ * its own. */
+void ref_frames_local(int interval);
+
+/* Make the next main and star tracker images keyframes */
+void ref_keyframe_local(void);
+
+/* Set the quick look mode, see QL_*, and the quantization step in sigma, 0
+ * keeps the step */
+void quick_look_local(int mode, double step);
@@ -7,20 +7,26 @@
  */
 
 #include <string.h>
+#include <stdio.h>
+#include <errno.h>
 
 #include "global_utils.h"
 #include <pthread.h>
 #include "data_queue.h"
 #include "image_handler.h"
+#include "quick_look.h"
+#include "source_catalog.h"
 #include "img_processing.h"
 
-#define MODULE_COUNT 2
+#define MODULE_COUNT 4
 
 static int send_st_cmd = 0;
 
 /* This list controls the order of initialisation */
 static const module_init_t init_sequence[MODULE_COUNT] = {
     {"data_queue", &init_data_queue},
+    {"quick_look", &init_quick_look},
+    {"source_catalog", &init_source_catalog},
     {"image_handler", &init_image_handler}
 };
 
@@ -40,6 +46,16 @@ int queue_image(char *filepath, int type){
 
     if(type==IMAGE_MAIN){
         p = 40;
+    } else if(type==IMAGE_SIDECAR){
+        /* right behind the image it belongs to */
+        p = 41;
+    } else if(type==IMAGE_CATALOG){
+        /* ahead of the images, a few kB of science results */
+        p = 38;
+    } else if(type==FLIGHT_RECORD){
+        p = 20;
+    } else if(type==IMAGE_SANITY){
+        p = 60;
     } else if(type==IMAGE_STARTRACKER && send_st_cmd){
         p = 30;
         send_st_cmd=0;
@@ -52,6 +68,49 @@ int queue_image(char *filepath, int type){
     return SUCCESS;
 }
 
+int queue_range(const char* name, long offset, long len){
+
+    char req[100];
+
+    /* only names in the output directories, the rest of the request is
+     * parsed after the last @ */
+    if(name[0] == '\0' || name[0] == '.' || strchr(name, '/') != NULL ||
+            offset < 0 || len <= 0 ||
+            snprintf(req, sizeof(req), "%s@%ld+%ld", name, offset, len) >=
+            (int)sizeof(req)){
+        return EINVAL;
+    }
+
+    /* ahead of the images, ground is waiting for it */
+    store_data_local(req, 35, IMAGE_RANGE);
+
+    return SUCCESS;
+}
+
+void set_ref_frames(int interval){
+    ref_frames_local(interval);
+}
+
+void ref_keyframe(void){
+    ref_keyframe_local();
+}
+
+void set_quick_look(int mode, double step){
+    quick_look_local(mode, step);
+}
+
+unsigned short* catalog_buffer(int width, int height){
+    return catalog_buffer_local(width, height);
+}
+
+void catalog_submit(int frame_id, long long start_real_ns){
+    catalog_submit_local(frame_id, start_real_ns);
+}
+
+void set_catalog(int enable, double sigma, double radius){
+    catalog_set_local(enable, sigma, radius);
+}
+
 void send_st(void){
     send_st_cmd = 1;
 
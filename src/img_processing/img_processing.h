@@ -10,14 +10,98 @@
 
 #define IMAGE_MAIN 1
 #define IMAGE_STARTRACKER 2
+#define IMAGE_SIDECAR 3 /* attitude record, matches its image by FRAMEID */
+#define FLIGHT_RECORD 4 /* flight recorder dump, sent before any image */
+#define IMAGE_SANITY 5 /* sanity camera snapshot, sent after every image */
+#define IMAGE_RANGE 6 /* part of a stored file, see queue_range */
+#define IMAGE_CATALOG 7 /* source catalog of a NIR frame, sent before it */
+
+/* set_quick_look() */
+#define QL_OFF 0    /* main images are sent lossless */
+#define QL_ON 1     /* main images are sent quantized, the lossless is kept */
+#define QL_AUTO 2   /* quantized while the downlink is saturated */
 
 /* initialise the img processing component */
 int init_img_processing(void* args);
 
 /* enqueue an image with meta data in the queue to be processed. 
- *p is the priority. Type should be IMAGE_STARTRACKER or IMAGE_MAIN 
+ *p is the priority. Type should be IMAGE_STARTRACKER, IMAGE_MAIN,
+ *IMAGE_SIDECAR, FLIGHT_RECORD, IMAGE_SANITY or IMAGE_CATALOG
  */
 int queue_image( char *filepath, int type);
 
+/* queue_range:
+ * Send part of a file already sent to ground, e.g. the rest of a transfer
+ * that was cut short. The range is decompressed from the stored file,
+ * compressed on its own and sent as <name without .zst>@<offset>+<len>.zst
+ * before the images.
+ *
+ * input:
+ *      name: name of the file as sent, e.g. IMG_MAIN_12:00:00.fit.zst
+ *      offset, len: range of the decompressed file, unit: bytes
+ *
+ * return:
+ *      SUCCESS: range queued
+ *      EINVAL: not a file name or an empty range
+ */
+int queue_range(const char* name, long offset, long len);
+
+/* set_ref_frames:
+ * Compress consecutive main and star tracker images of the same target
+ * against the previous image, see image_handler.c for the format ground has
+ * to decode.
+ *
+ * input:
+ *      interval: images from one keyframe to the next, at most 32. 0
+ *                compresses every image on its own.
+ */
+void set_ref_frames(int interval);
+
+/* Start the next main and star tracker images with a keyframe, called when
+ * the target changes */
+void ref_keyframe(void);
+
+/* set_quick_look:
+ * Send main images quantized in steps of their noise, several times smaller
+ * than lossless. The lossless images are kept onboard, see queue_range.
+ *
+ * input:
+ *      mode: QL_OFF, QL_ON or QL_AUTO
+ *      step: quantization step, unit: sigma. 0 keeps the step, 1 by default
+ */
+void set_quick_look(int mode, double step);
+
+/* catalog_buffer:
+ * Get the buffer to copy a NIR frame into for its source catalog, see
+ * source_catalog.h for the catalog format. Hand it back with catalog_submit.
+ *
+ * input:
+ *      width, height: frame size in pixels
+ *
+ * return:
+ *      buffer of width*height pixels, NULL if no catalog is made of the frame:
+ *      catalogs are off, the previous frame is still measured or no memory
+ */
+unsigned short* catalog_buffer(int width, int height);
+
+/* catalog_submit:
+ * Measure the frame copied into the catalog buffer and send its catalog
+ * before the image.
+ *
+ * input:
+ *      frame_id: FRAMEID of the image, negative gives the buffer back unused
+ *      start_real_ns: CLOCK_REALTIME at exposure start, unit: nanoseconds
+ */
+void catalog_submit(int frame_id, long long start_real_ns);
+
+/* set_catalog:
+ * input:
+ *      enable: 1 to make a source catalog of every NIR frame, 0 to stop
+ *      sigma: detection threshold above the background, unit: noise. 0 keeps
+ *             the threshold, 5 by default
+ *      radius: aperture radius, unit: pixels. 0 keeps the radius, 4 by default
+ */
+void set_catalog(int enable, double sigma, double radius);
+
 /* Give the next startracker image a higher priority */
 void send_st(void);
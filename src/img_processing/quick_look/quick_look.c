@@ -0,0 +1,315 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Quick Look
+ * Parent Component: Img Processing
+ * Author(s):
+ * Purpose: Quantize images in units of their own noise for quick look
+ *          products that compress several times better than the raw data.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fitsio.h>
+
+#include "global_utils.h"
+#include "arena.h"
+#include "quick_look.h"
+
+/* smallest side of the tiles the noise is measured in, doubled until the
+ * tiles fit QL_TILES_MAX, unit: pixels */
+#define QL_TILE_MIN 32
+#define QL_TILES_MAX 4096
+
+/* signal levels of the noise fit, tiles are sorted by mean and the median of
+ * each level is fitted, stars and hot pixels only move the upper tiles */
+#define QL_BINS 8
+
+/* shot noise below this is not fitted, unit: ADU^2 per ADU */
+#define QL_B_MIN 1e-3
+
+/* rounding noise of integer data, unit: ADU^2 */
+#define QL_VAR_MIN (1.0 / 12)
+
+typedef struct{
+    double mean, var;
+} tile_t;
+
+static int noise_fit(const unsigned short* px, long w, long h, double* a,
+        double* b);
+static int compare_tiles(const void* p1, const void* p2);
+static int compare_doubles(const void* p1, const void* p2);
+static double transform(double x, double a, double b);
+
+/* only used by the image handler thread, buffers grow with the image and the
+ * old ones stay in the arena */
+static unsigned short* pixels = NULL;
+static long pixels_size = 0;
+static unsigned short* lut = NULL;
+static tile_t tiles[QL_TILES_MAX];
+
+int init_quick_look(void* args){
+    return SUCCESS;
+}
+
+int quick_look(const char* in_fn, const char* out_fn, double step){
+
+    fitsfile *in = NULL, *out = NULL;
+    int ret = 0, close_ret = 0;
+    int bitpix = 0, naxis = 0, anynul;
+    long naxes[2] = {0, 0};
+
+    if(!(step > 0)){
+        return EINVAL;
+    }
+
+    fits_open_file(&in, in_fn, READONLY, &ret);
+    fits_get_img_param(in, 2, &bitpix, &naxis, naxes, &ret);
+    if(ret != 0){
+        fits_report_error(stderr, ret);
+        if(in != NULL){
+            fits_close_file(in, &close_ret);
+        }
+        return FAILURE;
+    }
+
+    long npix = naxes[0] * naxes[1];
+    if(bitpix != SHORT_IMG || naxis != 2 || npix < 2){
+        fits_close_file(in, &close_ret);
+        return EINVAL;
+    }
+
+    if(lut == NULL){
+        lut = arena_alloc(65536 * sizeof(*lut), "Quick Look");
+    }
+    if(pixels_size < npix){
+        pixels = arena_alloc(npix * sizeof(*pixels), "Quick Look");
+        pixels_size = pixels == NULL ? 0 : npix;
+    }
+    if(lut == NULL || pixels == NULL){
+        logging(ERROR, "Quick Look", "Cannot allocate image buffers");
+        fits_close_file(in, &close_ret);
+        return ENOMEM;
+    }
+
+    fits_read_img(in, TUSHORT, 1, npix, NULL, pixels, &anynul, &ret);
+    if(ret != 0){
+        fits_report_error(stderr, ret);
+        fits_close_file(in, &close_ret);
+        return FAILURE;
+    }
+
+    double a, b;
+    noise_fit(pixels, naxes[0], naxes[1], &a, &b);
+
+    unsigned short x_min = 65535, x_max = 0;
+    for(long ii=0; ii<npix; ++ii){
+        if(pixels[ii] < x_min){
+            x_min = pixels[ii];
+        }
+        if(pixels[ii] > x_max){
+            x_max = pixels[ii];
+        }
+    }
+
+    double zero = transform(x_min, a, b);
+    if(lround((transform(x_max, a, b) - zero) / step) > 65535){
+        fits_close_file(in, &close_ret);
+        return ERANGE;
+    }
+
+    /* only the levels in the image, a table is cheaper than a square root
+     * per pixel */
+    for(long xx=x_min; xx<=x_max; ++xx){
+        lut[xx] = lround((transform(xx, a, b) - zero) / step);
+    }
+    for(long ii=0; ii<npix; ++ii){
+        pixels[ii] = lut[pixels[ii]];
+    }
+
+    int out_bitpix = lut[x_max] <= 255 ? BYTE_IMG : USHORT_IMG;
+
+    int fn_len = strlen(out_fn);
+    char fn_f[fn_len+2];
+    fn_f[0] = '!';
+    memcpy(&fn_f[1], out_fn, fn_len + 1);
+
+    fits_create_file(&out, fn_f, &ret);
+    fits_create_img(out, out_bitpix, 2, naxes, &ret);
+
+    /* keep the cards of the camera, the structure is new and the checksums
+     * are written again */
+    const char* skip[] = {"SIMPLE", "BITPIX", "NAXIS", "NAXIS1", "NAXIS2",
+            "EXTEND", "BZERO", "BSCALE", "CHECKSUM", "DATASUM", "COMMENT"};
+    int nkeys = 0;
+    fits_get_hdrspace(in, &nkeys, NULL, &ret);
+
+    for(int ii=1; ii<=nkeys && ret == 0; ++ii){
+        char card[FLEN_CARD], name[FLEN_KEYWORD];
+        int len, keep = 1;
+
+        fits_read_record(in, ii, card, &ret);
+        fits_get_keyname(card, name, &len, &ret);
+        for(size_t jj=0; jj<sizeof(skip)/sizeof(*skip); ++jj){
+            keep = keep && strcmp(name, skip[jj]) != 0;
+        }
+        if(keep){
+            fits_write_record(out, card, &ret);
+        }
+    }
+
+    char mode[4];
+    strcpy(mode, b > 0 ? "GAT" : "LIN");
+    fits_update_key(out, TSTRING, "QLMODE", mode,
+            "quick look, quantized in steps of the noise", &ret);
+    fits_update_key(out, TDOUBLE, "QLA", &a, "noise var = QLA + QLB*x, ADU^2",
+            &ret);
+    fits_update_key(out, TDOUBLE, "QLB", &b, "shot noise, ADU^2 per ADU", &ret);
+    fits_update_key(out, TDOUBLE, "QLSTEP", &step, "quantization step, sigma",
+            &ret);
+    fits_update_key(out, TDOUBLE, "QLZERO", &zero, "transform of the lowest "
+            "pixel", &ret);
+    fits_write_comment(out, "y = QLZERO + pixel*QLSTEP, GAT: x = ((b*y/2)^2 - "
+            "3/8*b^2 - a)/b, LIN: x = y*sqrt(a)", &ret);
+
+    fits_write_img(out, TUSHORT, 1, npix, pixels, &ret);
+    fits_write_chksum(out, &ret);
+
+    if(out != NULL){
+        fits_close_file(out, &ret);
+    }
+    fits_close_file(in, &close_ret);
+
+    if(ret != 0){
+        fits_report_error(stderr, ret);
+        return FAILURE;
+    }
+
+    logging(DEBUG, "Quick Look", "Noise a %.2lf b %.4lf, %d levels", a, b,
+            lut[x_max] + 1);
+
+    return SUCCESS;
+}
+
+/* noise_fit:
+ * Fit the noise of an image as var = a + b*x. The variance of every tile is
+ * measured from the differences of neighbouring pixels, which leaves out the
+ * background gradient, and the medians of QL_BINS levels of signal are fitted
+ * with least squares.
+ *
+ * input:
+ *      px, w, h: the image
+ *
+ * output:
+ *      a: noise variance at x = 0, may be negative with a bias level,
+ *         unit: ADU^2
+ *      b: 0 if too small to fit, then a is the variance of the image,
+ *         unit: ADU^2 per ADU
+ *
+ * return:
+ *      number of tiles measured
+ */
+static int noise_fit(const unsigned short* px, long w, long h, double* a,
+        double* b){
+
+    long side = QL_TILE_MIN;
+    while((w / side) * (h / side) > QL_TILES_MAX){
+        side *= 2;
+    }
+    if(side > w || side > h){
+        side = w < h ? w : h;
+    }
+
+    int n = 0;
+    for(long ty=0; ty+side<=h; ty+=side){
+        for(long tx=0; tx+side<=w; tx+=side){
+
+            double sum = 0, d_sum = 0, d_sq = 0;
+            for(long yy=ty; yy<ty+side; ++yy){
+                const unsigned short* row = &px[yy * w + tx];
+                sum += row[0];
+                for(long xx=1; xx<side; ++xx){
+                    double d = (double)row[xx] - row[xx - 1];
+                    sum += row[xx];
+                    d_sum += d;
+                    d_sq += d * d;
+                }
+            }
+
+            /* the difference of two pixels has twice their variance */
+            double d_n = side * (side - 1);
+            tiles[n].mean = sum / (side * side);
+            tiles[n].var = (d_sq - d_sum * d_sum / d_n) / d_n / 2;
+            n++;
+        }
+    }
+
+    qsort(tiles, n, sizeof(*tiles), compare_tiles);
+
+    double bin_mean[QL_BINS], bin_var[QL_BINS], var[QL_TILES_MAX];
+    int bins = n < QL_BINS ? n : QL_BINS;
+
+    for(int kk=0; kk<bins; ++kk){
+        int start = kk * n / bins, end = (kk + 1) * n / bins;
+        for(int ii=start; ii<end; ++ii){
+            var[ii - start] = tiles[ii].var;
+        }
+        qsort(var, end - start, sizeof(*var), compare_doubles);
+
+        bin_mean[kk] = tiles[(start + end) / 2].mean;
+        bin_var[kk] = var[(end - start) / 2];
+    }
+
+    double m_mean = 0, v_mean = 0, cov = 0, m_var = 0;
+    for(int kk=0; kk<bins; ++kk){
+        m_mean += bin_mean[kk] / bins;
+        v_mean += bin_var[kk] / bins;
+    }
+    for(int kk=0; kk<bins; ++kk){
+        cov += (bin_mean[kk] - m_mean) * (bin_var[kk] - v_mean);
+        m_var += (bin_mean[kk] - m_mean) * (bin_mean[kk] - m_mean);
+    }
+
+    /* a flat frame has no range of signal to fit the shot noise over */
+    *b = m_var > 0 ? cov / m_var : 0;
+    *a = v_mean - *b * m_mean;
+
+    if(*b < QL_B_MIN){
+        *b = 0;
+        qsort(bin_var, bins, sizeof(*bin_var), compare_doubles);
+        *a = bins > 0 ? bin_var[bins / 2] : 0;
+    }
+    if(*b == 0 && *a < QL_VAR_MIN){
+        *a = QL_VAR_MIN;
+    }
+
+    return n;
+}
+
+/* to unit noise variance, see quick_look() */
+static double transform(double x, double a, double b){
+
+    if(b == 0){
+        return x / sqrt(a);
+    }
+
+    double arg = b * x + 0.375 * b * b + a;
+
+    return arg > 0 ? 2 / b * sqrt(arg) : 0;
+}
+
+static int compare_tiles(const void* p1, const void* p2){
+
+    double m1 = ((const tile_t*)p1)->mean, m2 = ((const tile_t*)p2)->mean;
+
+    return (m1 > m2) - (m1 < m2);
+}
+
+static int compare_doubles(const void* p1, const void* p2){
+
+    double d1 = *(const double*)p1, d2 = *(const double*)p2;
+
+    return (d1 > d2) - (d1 < d2);
+}
@@ -0,0 +1,41 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Quick Look
+ * Parent Component: Img Processing
+ * Author(s):
+ * Purpose: Quantize images in units of their own noise for quick look
+ *          products that compress several times better than the raw data.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+/* initialise the quick look component */
+int init_quick_look(void* args);
+
+/* quick_look:
+ * Write a copy of a 16 bit image quantized in steps of its noise. The noise
+ * of every frame is fitted as var = a + b*x from tiles of the frame, read
+ * noise and shot noise, and the pixels are mapped to unit variance by the
+ * generalized Anscombe transform
+ *      f(x) = 2/b * sqrt(b*x + 3/8*b^2 + a)
+ * or f(x) = x/sqrt(a) if the shot noise is too small to fit. The output holds
+ *      q = round((f(x) - QLZERO) / QLSTEP)
+ * in 8 bits if the range allows, else 16 bits. The header keeps the cards of
+ * the input and adds QLMODE ('GAT' or 'LIN'), QLA, QLB, QLSTEP and QLZERO to
+ * invert it on ground with y = QLZERO + q*QLSTEP:
+ *      GAT: x = ((b*y/2)^2 - 3/8*b^2 - a) / b
+ *      LIN: x = y*sqrt(a)
+ *
+ * input:
+ *      in_fn: 16 bit FITS image
+ *      out_fn: quantized image
+ *      step: quantization step, unit: sigma
+ *
+ * return:
+ *      SUCCESS: quick look written
+ *      EINVAL: not a two dimensional 16 bit image, or step not positive
+ *      ENOMEM: no memory for the image
+ *      ERANGE: the quantized range does not fit 16 bits, take a larger step
+ *      FAILURE: fits error, written to stderr
+ */
+int quick_look(const char* in_fn, const char* out_fn, double step);
@@ -0,0 +1,642 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Source Catalog
+ * Parent Component: Img Processing
+ * Author(s):
+ * Purpose: Detect and measure the sources of every NIR frame onboard and
+ *          send the list ahead of the image, a few kB against tens of MB.
+ * -----------------------------------------------------------------------------
+ */
+
+/**
+ * The NIR camera copies each saved frame into the catalog buffer, frames that
+ * arrive while the previous one is measured get no catalog. The frame is
+ * measured in four passes:
+ *      background: median and MAD of every CAT_TILE tile, median filtered
+ *                  over 3x3 tiles so a bright star does not lift its tile
+ *      detection:  local maxima above bg + sigma*noise of their tile with at
+ *                  least CAT_NEIGHBOURS neighbours above half of it, which
+ *                  leaves out hot pixels and cosmic rays
+ *      merging:    peaks within an aperture radius of a brighter peak belong
+ *                  to the same source
+ *      photometry: centroid, second moments and sum above the interpolated
+ *                  background in a circular aperture around the centroid
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "global_utils.h"
+#include "lock.h"
+#include "arena.h"
+#include "img_processing.h"
+#include "source_catalog.h"
+
+#define PIXEL_MAX 4095          /* data is scaled to 12 bits by fetch_img */
+#define SATURATION 4000         /* as in lucky imaging */
+
+/* smallest side of the background tiles, doubled until the tiles fit
+ * CAT_TILES_MAX, unit: pixels */
+#define CAT_TILE 128
+#define CAT_TILES_MAX 4096
+
+/* pixel stride within a tile when estimating its background */
+#define CAT_BG_STRIDE 2
+
+/* neighbours of a peak above half the threshold */
+#define CAT_NEIGHBOURS 2
+
+/* peaks kept before merging, the faintest half is dropped when full */
+#define CAT_CAND_MAX (2 * CAT_SOURCES_MAX)
+
+/* defaults and limits of catalog_set_local */
+#define CAT_SIGMA 5.0
+#define CAT_SIGMA_MIN 2.0
+#define CAT_SIGMA_MAX 100.0
+#define CAT_RADIUS 4.0
+#define CAT_RADIUS_MIN 1.0
+#define CAT_RADIUS_MAX 16.0
+
+/* catalog buffer states */
+#define CAT_FREE 0
+#define CAT_FILLING 1   /* owned by the camera until catalog_submit_local */
+#define CAT_PENDING 2   /* owned by the catalog thread */
+
+typedef struct{
+    int peak, x, y;
+} peak_t;
+
+static void* thread_func(void* arg);
+static int make_catalog(void);
+static void background(void);
+static int detect(double sigma, int* detected);
+static int merge(int count, double radius);
+static void measure(const peak_t* src, double radius, cat_record_t* rec);
+static double bg_at(double x, double y);
+static void tile_median(const unsigned short* img, int x0, int y0, int x1,
+        int y1, float* bg, float* noise);
+static float median3x3(const float* map, int tx, int ty);
+static int compare_peaks(const void* p1, const void* p2);
+static int compare_floats(const void* p1, const void* p2);
+
+static lock_t mutex_cat = LOCK_INITIALIZER("mutex_cat");
+static pthread_cond_t cond_cat = PTHREAD_COND_INITIALIZER;
+
+/* guarded by mutex_cat */
+static int state = CAT_FREE;
+static int enabled = 1;
+static double det_sigma = CAT_SIGMA, ap_radius = CAT_RADIUS;
+static unsigned short* frame = NULL;
+static size_t frame_size = 0;
+static int width, height;
+static cat_header_t header;
+
+/* owned by the catalog thread */
+static int tile, tiles_x, tiles_y;
+static float tile_bg[CAT_TILES_MAX], tile_noise[CAT_TILES_MAX];
+static float map_bg[CAT_TILES_MAX], map_noise[CAT_TILES_MAX];
+static peak_t cand[CAT_CAND_MAX];
+static cat_record_t records[CAT_SOURCES_MAX];
+
+static char out_fp[100];
+
+int init_source_catalog(void* args){
+
+    strcpy(out_fp, get_top_dir());
+    strcat(out_fp, "output/compression/");
+
+    return create_thread("src_catalog", thread_func, 14);
+}
+
+unsigned short* catalog_buffer_local(int w, int h){
+
+    unsigned short* buffer = NULL;
+    size_t size = (size_t)w * h;
+
+    lock_acquire(&mutex_cat);
+
+    if(enabled && state == CAT_FREE && w > 2 && h > 2 &&
+            w <= UINT16_MAX && h <= UINT16_MAX){
+
+        /* a larger frame, the old buffer stays in the arena */
+        if(frame_size < size){
+            frame = arena_alloc(size * sizeof(*frame), "Src Catalog");
+            frame_size = frame == NULL ? 0 : size;
+        }
+
+        if(frame != NULL){
+            width = w;
+            height = h;
+            state = CAT_FILLING;
+            buffer = frame;
+        }
+    }
+
+    lock_release(&mutex_cat);
+
+    return buffer;
+}
+
+void catalog_submit_local(int frame_id, int64_t start_real_ns){
+
+    lock_acquire(&mutex_cat);
+
+    if(state == CAT_FILLING){
+        if(frame_id < 0){
+            state = CAT_FREE;
+        }
+        else{
+            memset(&header, 0, sizeof(header));
+            header.frame_id = frame_id;
+            header.start_real_ns = start_real_ns;
+            state = CAT_PENDING;
+            pthread_cond_signal(&cond_cat);
+        }
+    }
+
+    lock_release(&mutex_cat);
+}
+
+void catalog_set_local(int enable, double sigma, double radius){
+
+    lock_acquire(&mutex_cat);
+
+    enabled = enable != 0;
+    if(sigma > 0){
+        det_sigma = sigma < CAT_SIGMA_MIN ? CAT_SIGMA_MIN :
+                sigma > CAT_SIGMA_MAX ? CAT_SIGMA_MAX : sigma;
+    }
+    if(radius > 0){
+        ap_radius = radius < CAT_RADIUS_MIN ? CAT_RADIUS_MIN :
+                radius > CAT_RADIUS_MAX ? CAT_RADIUS_MAX : radius;
+    }
+
+    logging(INFO, "Src Catalog", "Catalogs %s, threshold %.1lf sigma, "
+            "aperture %.1lf px", enabled ? "on" : "off", det_sigma, ap_radius);
+
+    lock_release(&mutex_cat);
+}
+
+static void* thread_func(void* arg){
+
+    lock_acquire(&mutex_cat);
+
+    while(1){
+
+        while(state != CAT_PENDING){
+            lock_cond_wait(&cond_cat, &mutex_cat);
+        }
+
+        /* the buffer and the header are left alone until the state is free */
+        header.sigma = det_sigma;
+        header.radius = ap_radius;
+        lock_release(&mutex_cat);
+
+        int ret = make_catalog();
+        if(ret){
+            logging(WARN, "Src Catalog", "No catalog of frame %d: %s",
+                    header.frame_id, strerror(ret));
+        }
+
+        lock_acquire(&mutex_cat);
+        state = CAT_FREE;
+    }
+
+    return NULL;
+}
+
+/* make_catalog:
+ * Measure the frame in the buffer, write nir<frame id>.cat and queue it.
+ *
+ * return:
+ *      SUCCESS: catalog queued
+ *      EIO: writing the catalog failed
+ */
+static int make_catalog(void){
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    background();
+
+    int detected;
+    int count = merge(detect(header.sigma, &detected), header.radius);
+
+    for(int ii=0; ii<count; ++ii){
+        measure(&cand[ii], header.radius, &records[ii]);
+    }
+
+    float bg[CAT_TILES_MAX], noise[CAT_TILES_MAX];
+    int tiles = tiles_x * tiles_y;
+    memcpy(bg, map_bg, tiles * sizeof(*bg));
+    memcpy(noise, map_noise, tiles * sizeof(*noise));
+    qsort(bg, tiles, sizeof(*bg), compare_floats);
+    qsort(noise, tiles, sizeof(*noise), compare_floats);
+
+    header.magic = CAT_MAGIC;
+    header.version = CAT_VERSION;
+    header.record_size = sizeof(cat_record_t);
+    header.record_count = count;
+    header.width = width;
+    header.height = height;
+    header.detected = detected;
+    header.tile = tile;
+    header.bg = bg[tiles / 2];
+    header.noise = noise[tiles / 2];
+
+    char fn[sizeof(out_fp) + 20];
+    snprintf(fn, sizeof(fn), "%snir%04d.cat", out_fp, header.frame_id);
+
+    FILE* fp = fopen(fn, "wb");
+    if(fp == NULL){
+        logging(ERROR, "Src Catalog", "Could not open %s: %m", fn);
+        return EIO;
+    }
+
+    if(     fwrite(&header, sizeof(header), 1, fp) != 1 ||
+            fwrite(records, sizeof(*records), count, fp) != (size_t)count){
+
+        logging(ERROR, "Src Catalog", "Failed to write %s: %m", fn);
+        fclose(fp);
+        remove(fn);
+        return EIO;
+    }
+    fclose(fp);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    logging(DEBUG, "Src Catalog", "Frame %d: %d sources of %d peaks, bg %.1f "
+            "noise %.1f, %.0lf ms", header.frame_id, count, detected, header.bg,
+            header.noise, (t1.tv_sec - t0.tv_sec) * 1e3 +
+            (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+    queue_image(fn, IMAGE_CATALOG);
+    return SUCCESS;
+}
+
+/* background:
+ * Measure the background and noise of every tile into map_bg and map_noise,
+ * tiles at the right and bottom edge may be smaller.
+ */
+static void background(void){
+
+    tile = CAT_TILE;
+    while(((width + tile - 1) / tile) * ((height + tile - 1) / tile) >
+            CAT_TILES_MAX){
+        tile *= 2;
+    }
+    tiles_x = (width + tile - 1) / tile;
+    tiles_y = (height + tile - 1) / tile;
+
+    for(int ty=0; ty<tiles_y; ++ty){
+        for(int tx=0; tx<tiles_x; ++tx){
+            int x1 = (tx + 1) * tile < width ? (tx + 1) * tile : width;
+            int y1 = (ty + 1) * tile < height ? (ty + 1) * tile : height;
+
+            tile_median(frame, tx * tile, ty * tile, x1, y1,
+                    &tile_bg[ty * tiles_x + tx], &tile_noise[ty * tiles_x + tx]);
+        }
+    }
+
+    for(int ty=0; ty<tiles_y; ++ty){
+        for(int tx=0; tx<tiles_x; ++tx){
+            map_bg[ty * tiles_x + tx] = median3x3(tile_bg, tx, ty);
+            map_noise[ty * tiles_x + tx] = median3x3(tile_noise, tx, ty);
+        }
+    }
+}
+
+/* detect:
+ * Find the local maxima above the threshold of their tile into cand, sorted
+ * by peak. Ties on flat tops, e.g. saturated cores, go to the first pixel.
+ *
+ * input:
+ *      sigma: detection threshold, unit: noise
+ *
+ * output:
+ *      detected: number of peaks found
+ *
+ * return:
+ *      number of peaks kept in cand, the brightest
+ */
+static int detect(double sigma, int* detected){
+
+    int count = 0, floor = 0;
+    *detected = 0;
+
+    for(int yy=1; yy<height-1; ++yy){
+        const unsigned short* row = &frame[(long)yy * width];
+        const unsigned short* up = row - width;
+        const unsigned short* down = row + width;
+        int ty = yy / tile;
+
+        for(int tx=0; tx<tiles_x; ++tx){
+            double bg = map_bg[ty * tiles_x + tx];
+            double noise = map_noise[ty * tiles_x + tx];
+            int thr = ceil(bg + sigma * noise);
+            int half = ceil(bg + sigma * noise / 2);
+            if(thr < floor){
+                thr = floor;
+            }
+
+            int x0 = tx * tile > 1 ? tx * tile : 1;
+            int x1 = (tx + 1) * tile < width - 1 ? (tx + 1) * tile : width - 1;
+
+            for(int xx=x0; xx<x1; ++xx){
+                int v = row[xx];
+                if(v <= thr){
+                    continue;
+                }
+
+                if(     v <= up[xx-1] || v <= up[xx] || v <= up[xx+1] ||
+                        v <= row[xx-1] || v < row[xx+1] ||
+                        v < down[xx-1] || v < down[xx] || v < down[xx+1]){
+                    continue;
+                }
+
+                int above = (up[xx-1] > half) + (up[xx] > half) +
+                        (up[xx+1] > half) + (row[xx-1] > half) +
+                        (row[xx+1] > half) + (down[xx-1] > half) +
+                        (down[xx] > half) + (down[xx+1] > half);
+                if(above < CAT_NEIGHBOURS){
+                    continue;
+                }
+
+                (*detected)++;
+
+                /* keep the brightest half and only look for brighter peaks */
+                if(count == CAT_CAND_MAX){
+                    header.flags |= CAT_FLAG_TRUNCATED;
+                    qsort(cand, count, sizeof(*cand), compare_peaks);
+                    count = CAT_SOURCES_MAX;
+                    floor = cand[count - 1].peak;
+                    if(thr < floor){
+                        thr = floor;
+                    }
+                    if(v <= thr){
+                        continue;
+                    }
+                }
+
+                cand[count].peak = v;
+                cand[count].x = xx;
+                cand[count].y = yy;
+                count++;
+            }
+        }
+    }
+
+    qsort(cand, count, sizeof(*cand), compare_peaks);
+
+    return count;
+}
+
+/* merge:
+ * Drop the peaks within one aperture radius of a brighter peak, they belong
+ * to the same source, and flag sources whose apertures overlap.
+ *
+ * input:
+ *      count: number of peaks kept by detect
+ *      radius: aperture radius, unit: pixels
+ *
+ * return:
+ *      number of sources left at the start of cand, at most CAT_SOURCES_MAX
+ */
+static int merge(int count, double radius){
+
+    int kept = 0;
+    double r2 = radius * radius;
+
+    for(int ii=0; ii<count; ++ii){
+        char dup = 0, crowded = 0;
+
+        for(int jj=0; jj<kept; ++jj){
+            double dx = cand[ii].x - cand[jj].x, dy = cand[ii].y - cand[jj].y;
+            double d2 = dx * dx + dy * dy;
+
+            if(d2 <= r2){
+                dup = 1;
+                break;
+            }
+            if(d2 <= 4 * r2){
+                crowded = 1;
+                records[jj].flags |= CAT_SRC_CROWDED;
+            }
+        }
+
+        if(!dup && kept == CAT_SOURCES_MAX){
+            header.flags |= CAT_FLAG_TRUNCATED;
+            break;
+        }
+        if(!dup){
+            cand[kept] = cand[ii];
+            records[kept].flags = crowded ? CAT_SRC_CROWDED : 0;
+            kept++;
+        }
+    }
+
+    return kept;
+}
+
+/* measure:
+ * Centroid, second moments and aperture sum of a source. The aperture is
+ * moved to the centroid twice, the sums are taken around the second.
+ *
+ * input:
+ *      src: peak of the source
+ *      radius: aperture radius, unit: pixels
+ *
+ * output:
+ *      rec: the record, flags from merge are kept
+ */
+static void measure(const peak_t* src, double radius, cat_record_t* rec){
+
+    double cx = src->x, cy = src->y;
+    double bg = bg_at(cx, cy);
+    double r2 = radius * radius;
+    int reach = ceil(radius) + 1;
+
+    double flux = 0, wsum = 0, wx = 0, wy = 0, wxx = 0, wyy = 0, wxy = 0;
+    int npix = 0;
+    char edge = 0, saturated = 0;
+
+    for(int pass=0; pass<3; ++pass){
+        flux = wsum = wx = wy = wxx = wyy = wxy = 0;
+        npix = 0;
+        edge = saturated = 0;
+
+        int x0 = floor(cx) - reach, x1 = floor(cx) + reach;
+        int y0 = floor(cy) - reach, y1 = floor(cy) + reach;
+
+        for(int yy=y0; yy<=y1; ++yy){
+            for(int xx=x0; xx<=x1; ++xx){
+                double dx = xx - cx, dy = yy - cy;
+                if(dx * dx + dy * dy > r2){
+                    continue;
+                }
+                if(xx < 0 || yy < 0 || xx >= width || yy >= height){
+                    edge = 1;
+                    continue;
+                }
+
+                int v = frame[(long)yy * width + xx];
+                double s = v - bg;
+
+                saturated |= v >= SATURATION;
+                flux += s;
+                npix++;
+
+                /* the moments only weigh the source, not the noise below */
+                if(s > 0){
+                    wsum += s;
+                    wx += s * dx;
+                    wy += s * dy;
+                    wxx += s * dx * dx;
+                    wyy += s * dy * dy;
+                    wxy += s * dx * dy;
+                }
+            }
+        }
+
+        /* the last pass measures around the centroid of the one before */
+        if(pass == 2 || wsum <= 0){
+            break;
+        }
+        double nx = cx + wx / wsum, ny = cy + wy / wsum;
+        if(fabs(nx - src->x) > radius || fabs(ny - src->y) > radius){
+            break;
+        }
+        cx = nx;
+        cy = ny;
+    }
+
+    double mx = 0, my = 0;
+    if(wsum > 0){
+        mx = wx / wsum;
+        my = wy / wsum;
+    }
+
+    rec->x = cx + mx;
+    rec->y = cy + my;
+    rec->flux = flux;
+    rec->flux_err = map_noise[(src->y / tile) * tiles_x + src->x / tile] *
+            sqrt(npix);
+    rec->bg = bg;
+    rec->mxx = wsum > 0 ? wxx / wsum - mx * mx : 0;
+    rec->myy = wsum > 0 ? wyy / wsum - my * my : 0;
+    rec->mxy = wsum > 0 ? wxy / wsum - mx * my : 0;
+    rec->peak = src->peak;
+    rec->flags |= (saturated ? CAT_SRC_SATURATED : 0) |
+            (edge ? CAT_SRC_EDGE : 0);
+}
+
+/* background at a pixel, bilinear between the tile centres */
+static double bg_at(double x, double y){
+
+    double fx = (x + 0.5) / tile - 0.5, fy = (y + 0.5) / tile - 0.5;
+    fx = fx < 0 ? 0 : fx > tiles_x - 1 ? tiles_x - 1 : fx;
+    fy = fy < 0 ? 0 : fy > tiles_y - 1 ? tiles_y - 1 : fy;
+
+    int tx = fx, ty = fy;
+    int tx1 = tx + 1 < tiles_x ? tx + 1 : tx;
+    int ty1 = ty + 1 < tiles_y ? ty + 1 : ty;
+    fx -= tx;
+    fy -= ty;
+
+    double top = map_bg[ty * tiles_x + tx] * (1 - fx) +
+            map_bg[ty * tiles_x + tx1] * fx;
+    double bottom = map_bg[ty1 * tiles_x + tx] * (1 - fx) +
+            map_bg[ty1 * tiles_x + tx1] * fx;
+
+    return top * (1 - fy) + bottom * fy;
+}
+
+/* tile_median:
+ * Estimate the background and noise of a tile from every CAT_BG_STRIDE
+ * pixel by the median and the median absolute deviation, as the background
+ * of lucky imaging.
+ */
+static void tile_median(const unsigned short* img, int x0, int y0, int x1,
+        int y1, float* bg, float* noise){
+
+    static unsigned int hist[PIXEL_MAX + 1], dev[PIXEL_MAX + 1];
+    long count = 0, cum = 0;
+    int lo = PIXEL_MAX, hi = 0, median, mad;
+
+    for(int yy=y0; yy<y1; yy+=CAT_BG_STRIDE){
+        const unsigned short* row = &img[(long)yy * width];
+        for(int xx=x0; xx<x1; xx+=CAT_BG_STRIDE){
+            int v = row[xx] < PIXEL_MAX ? row[xx] : PIXEL_MAX;
+            hist[v]++;
+            lo = v < lo ? v : lo;
+            hi = v > hi ? v : hi;
+            count++;
+        }
+    }
+
+    for(median=lo; median<hi; ++median){
+        cum += hist[median];
+        if(cum >= (count + 1) / 2){
+            break;
+        }
+    }
+
+    /* only the bins in use are walked and cleared again */
+    int dev_max = 0;
+    for(int ii=lo; ii<=hi; ++ii){
+        int d = abs(ii - median);
+        dev[d] += hist[ii];
+        dev_max = d > dev_max ? d : dev_max;
+        hist[ii] = 0;
+    }
+
+    cum = 0;
+    for(mad=0; mad<dev_max; ++mad){
+        cum += dev[mad];
+        if(cum >= (count + 1) / 2){
+            break;
+        }
+    }
+    memset(dev, 0, (dev_max + 1) * sizeof(*dev));
+
+    /* integer data, the noise is at least the rounding of one level */
+    *bg = median;
+    *noise = mad > 0 ? 1.4826 * mad : 0.5;
+}
+
+/* median of a tile and its neighbours */
+static float median3x3(const float* map, int tx, int ty){
+
+    float vals[9];
+    int n = 0;
+
+    for(int yy=ty-1; yy<=ty+1; ++yy){
+        for(int xx=tx-1; xx<=tx+1; ++xx){
+            if(xx >= 0 && yy >= 0 && xx < tiles_x && yy < tiles_y){
+                vals[n++] = map[yy * tiles_x + xx];
+            }
+        }
+    }
+
+    qsort(vals, n, sizeof(*vals), compare_floats);
+
+    return vals[n / 2];
+}
+
+/* brightest peak first */
+static int compare_peaks(const void* p1, const void* p2){
+
+    int v1 = ((const peak_t*)p1)->peak, v2 = ((const peak_t*)p2)->peak;
+
+    return (v1 < v2) - (v1 > v2);
+}
+
+static int compare_floats(const void* p1, const void* p2){
+
+    float f1 = *(const float*)p1, f2 = *(const float*)p2;
+
+    return (f1 > f2) - (f1 < f2);
+}
@@ -0,0 +1,92 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Source Catalog
+ * Parent Component: Img Processing
+ * Author(s):
+ * Purpose: Detect and measure the sources of every NIR frame onboard and
+ *          send the list ahead of the image, a few kB against tens of MB.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Catalog file layout, native byte order (little endian):
+ *      cat_header_t
+ *      cat_record_t[record_count]      brightest peak first
+ *
+ * Positions are in pixels from the centre of the first pixel of the FITS
+ * image, add 1 for FITS pixel coordinates. flux_err is the background noise
+ * in the aperture only, the shot noise of the source is added on ground where
+ * the gain is known.
+ */
+#define CAT_MAGIC 0x54435249 /* "IRCT" */
+#define CAT_VERSION 1
+
+#define CAT_FLAG_TRUNCATED 0x1 /* more sources than CAT_SOURCES_MAX, the
+                                  faintest are left out */
+
+/* cat_record_t.flags */
+#define CAT_SRC_SATURATED 0x1  /* a pixel of the aperture is saturated */
+#define CAT_SRC_EDGE 0x2       /* the aperture is cut by the frame edge */
+#define CAT_SRC_CROWDED 0x4    /* apertures of two sources overlap */
+
+#define CAT_SOURCES_MAX 4096
+
+typedef struct{
+    uint32_t magic;
+    uint16_t version, record_size;
+    int32_t frame_id;               /* FRAMEID of the matching image */
+    uint32_t record_count;
+    int64_t start_real_ns;          /* CLOCK_REALTIME at exposure start */
+    uint16_t width, height;         /* unit: pixels */
+    uint32_t detected;              /* peaks found, before merging */
+    uint32_t flags;
+    uint32_t tile;                  /* side of the background tiles, pixels */
+    float bg, noise;                /* median background and noise, ADU */
+    float sigma;                    /* detection threshold, unit: noise */
+    float radius;                   /* aperture radius, unit: pixels */
+} cat_header_t;
+
+typedef struct{
+    float x, y;                     /* centroid, unit: pixels */
+    float flux, flux_err;           /* sum in the aperture above bg, ADU */
+    float bg;                       /* background under the source, ADU */
+    float mxx, myy, mxy;            /* second moments, unit: pixels^2 */
+    uint16_t peak;                  /* brightest pixel, ADU */
+    uint16_t flags;                 /* CAT_SRC_* */
+} cat_record_t;
+
+/* initialise the source catalog component */
+int init_source_catalog(void* args);
+
+/* catalog_buffer_local:
+ * Get the buffer to copy the next frame into. The caller owns it until
+ * catalog_submit_local.
+ *
+ * input:
+ *      width, height: frame size in pixels
+ *
+ * return:
+ *      buffer of width*height pixels, NULL while catalogs are off, the
+ *      previous frame is still measured or no memory is available
+ */
+unsigned short* catalog_buffer_local(int width, int height);
+
+/* catalog_submit_local:
+ * Measure the frame in the buffer and queue its catalog as IMAGE_CATALOG.
+ *
+ * input:
+ *      frame_id: FRAMEID of the image, negative gives the buffer back unused
+ *      start_real_ns: CLOCK_REALTIME at exposure start
+ */
+void catalog_submit_local(int frame_id, int64_t start_real_ns);
+
+/* catalog_set_local:
+ * input:
+ *      enable: 1 to measure every NIR frame, 0 to stop
+ *      sigma: detection threshold above the background, unit: noise. 0 keeps
+ *             the threshold
+ *      radius: aperture radius, unit: pixels. 0 keeps the radius
+ */
+void catalog_set_local(int enable, double sigma, double radius);
@@ -30,10 +30,15 @@
 #include "telemetry.h"
 #include "thermal.h"
 #include "control_sys.h"
+#include "data_bus.h"
 #include "watchdog.h"
+#include "flight_recorder.h"
+#include "lock.h"
+#include "arena.h"
+#include "alloc_check.h"
 
 /* not including init */
-#define MODULE_COUNT 13
+#define MODULE_COUNT 18
 
 static int init_func(char* const argv[]);
 static void check_flags(void);
@@ -49,12 +54,17 @@ static void normal_m(void);
 static int ret;
 
 static char gyro_wake_flag = '0', rotate_flag, float_flag;
+
+/* the encoder poller keeps its condition mutex while running, it must only be
+ * signalled when idle */
+static char enc_wake_flag = '0';
 static char rotate_flag_fn[100], float_flag_fn[100];
 static char stderr_buf[4096];
 
 /* This list controls the order of initialisation */
 static const module_init_t init_sequence[MODULE_COUNT] = {
     {"watchdog", &init_watchdog},
+    {"data_bus", &init_data_bus},
     {"mode", &init_mode},
     {"gpio", &init_gpio},
     {"i2c", &init_i2c},
@@ -62,7 +72,11 @@ static const module_init_t init_sequence[MODULE_COUNT] = {
     {"e_link", &init_elink},
     {"command", &init_command},
     {"global_utils", &init_global_utils},
+    {"lock", &init_lock},
+    {"arena", &init_arena},
+    {"alloc_check", &init_alloc_check},
     {"img_processing", &init_img_processing},
+    {"flight_rec", &init_flight_recorder},
     {"sensors", &init_sensors},
     {"telemetry", &init_telemetry},
     {"thermal", &init_thermal},
@@ -128,6 +142,8 @@ int main(int argc, char* const argv[]){
     }
     /* initialization sequence done */
 
+    alloc_check_arm();
+
     check_flags();
 
     #ifdef SEQ_TEST
@@ -229,7 +245,7 @@ static int state_machine(void){
 //TODO: rotate telescope
 static void sleep_m(void){
 
-    int fd, ret;
+    int fd;
 
     if(float_flag == '1'){
         set_mode(RESET);
@@ -268,17 +284,25 @@ static void sleep_m(void){
         pthread_cond_signal(&cond_gyro);
         pthread_mutex_unlock(&mutex_cond_gyro);
 
+        /* the encoder rates are needed for the rotation rate check */
+        logging(INFO, "MODE", "waking encoder");
+        pthread_mutex_lock(&mutex_cond_enc);
+        pthread_cond_signal(&cond_enc);
+        pthread_mutex_unlock(&mutex_cond_enc);
+
         gyro_wake_flag = '1';
+        enc_wake_flag = '1';
     }
 
     if(!gps.out_of_date && gps.alt > 15000){
         /* check gondola rotation rate */
 
         encoder_t enc;
-        do{
-            ret = enc_single_samp(&enc);
-            usleep(1000);
-        } while(ret != SUCCESS);
+        get_encoder(&enc);
+
+        if(enc.out_of_date){
+            return;
+        }
 
         double sin_alt_ang = sin(enc.alt_ang * M_PI / 180);
         double cos_alt_ang = cos(enc.alt_ang * M_PI / 180);
@@ -290,7 +314,10 @@ static void sleep_m(void){
             return;
         }
 
-        double ang_rate = gyro.y * sin_alt_ang - gyro.x * cos_alt_ang;
+        /* the gyro sees the gondola rotation plus the gimbal rotation
+         * measured by the encoder, only the gondola counts */
+        double ang_rate = gyro.y * sin_alt_ang - gyro.x * cos_alt_ang +
+                enc.rate_az;
 
         if(fabs(ang_rate) < GON_ROT_THRESHOLD){
             /* write flag to storage */
@@ -324,6 +351,10 @@ static void normal_m(void){
 #endif
 
 static void reset_m(void){
+
+    /* the encoder poller goes idle in RESET */
+    enc_wake_flag = '0';
+
     for(int ii=0; ii<45; ++ii){
         logging(INFO, "MODE", "resetting: %d/%d", ii, 45);
         sleep(1);
@@ -338,10 +369,15 @@ static void reset_m(void){
 
 static void wake_m(void){
 
-    logging(INFO, "MODE", "waking encoder");
-    pthread_mutex_lock(&mutex_cond_enc);
-    pthread_cond_signal(&cond_enc);
-    pthread_mutex_unlock(&mutex_cond_enc);
+    /* already running if woken in SLEEP */
+    if(enc_wake_flag == '0'){
+        logging(INFO, "MODE", "waking encoder");
+        pthread_mutex_lock(&mutex_cond_enc);
+        pthread_cond_signal(&cond_enc);
+        pthread_mutex_unlock(&mutex_cond_enc);
+
+        enc_wake_flag = '1';
+    }
 
     logging(INFO, "MODE", "waking control system");
     pthread_mutex_lock(&mutex_cond_cont_sys);
@@ -0,0 +1,379 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Lock
+ * Author(s):
+ * Purpose: Mutexes with priority inheritance for state shared between threads
+ *          of different priorities. Built with LOCK_PROFILE, the wait and hold
+ *          times of every lock are collected in histograms and written to
+ *          output/logs/lock_profile.log to find priority inversions.
+ * -----------------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "global_utils.h"
+#include "lock.h"
+
+static int lock_setup(lock_t* lock);
+
+/* serialises the creation of statically initialised locks */
+static pthread_mutex_t mutex_setup = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef LOCK_PROFILE
+
+/* most locks that can be profiled, later ones work but are not reported */
+#define LOCK_MAX 128
+
+/* time between two reports, unit: seconds */
+#define LOCK_REPORT_S 60
+
+static void* thread_func(void* arg);
+static void report(FILE* fp);
+static void taken(lock_t* lock);
+static void releasing(lock_t* lock);
+static void add_hist(unsigned long* hist, double us);
+static int thread_prio(void);
+static double elapsed_us(const struct timespec* from);
+
+static lock_t* locks[LOCK_MAX];
+static int lock_count = 0;
+
+static FILE* profile_log;
+
+/* priority of the calling thread, looked up on first use */
+static __thread int own_prio = -1;
+
+#endif
+
+int init_lock(void* args){
+
+#ifdef LOCK_PROFILE
+    char log_fn[100];
+
+    strcpy(log_fn, get_top_dir());
+    strcat(log_fn, "output/logs/lock_profile.log");
+
+    profile_log = fopen(log_fn, "a");
+    if(profile_log == NULL){
+        logging(ERROR, "Lock", "Failed to open profile log: %m");
+        return errno;
+    }
+
+    return create_thread("lock_profile", thread_func, 6);
+#else
+    return SUCCESS;
+#endif
+}
+
+/* lock_init:
+ * Initialise a lock at runtime, e.g. one in dynamically allocated memory.
+ *
+ * input:
+ *      lock: lock to initialise
+ *      name: name in the profile, must outlive the lock
+ *      flags: 0 or LOCK_RECURSIVE
+ *
+ * return:
+ *      SUCCESS: lock ready
+ *      otherwise the error number of pthread_mutex_init
+ */
+int lock_init(lock_t* lock, const char* name, int flags){
+
+    memset(lock, 0, sizeof(*lock));
+    lock->name = name;
+    lock->flags = flags;
+
+    return lock_setup(lock);
+}
+
+/* take a lock, blocking. Returns as pthread_mutex_lock. */
+int lock_acquire(lock_t* lock){
+
+    int ret = lock_setup(lock);
+    if(ret){
+        return ret;
+    }
+
+#ifdef LOCK_PROFILE
+    ret = pthread_mutex_trylock(&lock->mutex);
+
+    if(ret == EBUSY){
+
+        /* only read to blame the holder, a stale value is harmless */
+        int owner_prio = __atomic_load_n(&lock->owner_prio, __ATOMIC_RELAXED);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        ret = pthread_mutex_lock(&lock->mutex);
+        if(ret){
+            return ret;
+        }
+
+        /* statistics are only touched while holding the lock */
+        double wait = elapsed_us(&start);
+        lock_stats_t* stats = &lock->stats;
+
+        stats->contended++;
+        add_hist(stats->wait_hist, wait);
+
+        /* -1 when the holder released it in the meantime */
+        if(owner_prio >= 0 && owner_prio < thread_prio()){
+            stats->inversions++;
+        }
+
+        /* names are copied, either thread may have exited by the report.
+         * The owner is the thread that released the lock to this one. */
+        if(wait > stats->wait_max){
+            stats->wait_max = wait;
+            prctl(PR_GET_NAME, stats->worst_waiter);
+            memcpy(stats->worst_owner, lock->owner, sizeof(lock->owner));
+        }
+    }
+    else if(ret){
+        return ret;
+    }
+
+    taken(lock);
+    return SUCCESS;
+#else
+    return pthread_mutex_lock(&lock->mutex);
+#endif
+}
+
+/* take a lock if free. Returns as pthread_mutex_trylock. */
+int lock_try(lock_t* lock){
+
+    int ret = lock_setup(lock);
+    if(ret){
+        return ret;
+    }
+
+    ret = pthread_mutex_trylock(&lock->mutex);
+
+#ifdef LOCK_PROFILE
+    if(ret == SUCCESS){
+        taken(lock);
+    }
+#endif
+
+    return ret;
+}
+
+/* release a lock taken by the calling thread */
+int lock_release(lock_t* lock){
+
+#ifdef LOCK_PROFILE
+    releasing(lock);
+#endif
+
+    return pthread_mutex_unlock(&lock->mutex);
+}
+
+/* wait on a condition variable, as pthread_cond_wait */
+int lock_cond_wait(pthread_cond_t* cond, lock_t* lock){
+
+#ifdef LOCK_PROFILE
+    /* the lock is not held while waiting */
+    releasing(lock);
+    int ret = pthread_cond_wait(cond, &lock->mutex);
+    taken(lock);
+    return ret;
+#else
+    return pthread_cond_wait(cond, &lock->mutex);
+#endif
+}
+
+/* wait on a condition variable with a timeout, as pthread_cond_timedwait */
+int lock_cond_timedwait(pthread_cond_t* cond, lock_t* lock,
+        const struct timespec* abstime){
+
+#ifdef LOCK_PROFILE
+    releasing(lock);
+    int ret = pthread_cond_timedwait(cond, &lock->mutex, abstime);
+    taken(lock);
+    return ret;
+#else
+    return pthread_cond_timedwait(cond, &lock->mutex, abstime);
+#endif
+}
+
+/* lock_setup:
+ * Create the mutex of a lock on first use.
+ *
+ * return:
+ *      SUCCESS: mutex ready
+ *      otherwise the error number of pthread_mutex_init
+ */
+static int lock_setup(lock_t* lock){
+
+    if(__atomic_load_n(&lock->ready, __ATOMIC_ACQUIRE)){
+        return SUCCESS;
+    }
+
+    int ret = SUCCESS;
+
+    pthread_mutex_lock(&mutex_setup);
+
+    if(!lock->ready){
+
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+        if(lock->flags & LOCK_RECURSIVE){
+            pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        }
+
+        ret = pthread_mutex_init(&lock->mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+
+        if(ret == SUCCESS){
+#ifdef LOCK_PROFILE
+            lock->owner_prio = -1;
+            if(lock_count < LOCK_MAX){
+                locks[lock_count++] = lock;
+            }
+#endif
+            __atomic_store_n(&lock->ready, 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    pthread_mutex_unlock(&mutex_setup);
+
+    return ret;
+}
+
+#ifdef LOCK_PROFILE
+
+/* book keeping after the lock has been taken */
+static void taken(lock_t* lock){
+
+    /* recursive locks are timed from the outermost acquisition */
+    if(lock->depth++){
+        return;
+    }
+
+    lock->stats.acquired++;
+    clock_gettime(CLOCK_MONOTONIC, &lock->taken);
+
+    prctl(PR_GET_NAME, lock->owner);
+    __atomic_store_n(&lock->owner_prio, thread_prio(), __ATOMIC_RELAXED);
+}
+
+/* book keeping before the lock is released */
+static void releasing(lock_t* lock){
+
+    if(--lock->depth){
+        return;
+    }
+
+    double hold = elapsed_us(&lock->taken);
+
+    add_hist(lock->stats.hold_hist, hold);
+    if(hold > lock->stats.hold_max){
+        lock->stats.hold_max = hold;
+    }
+
+    __atomic_store_n(&lock->owner_prio, -1, __ATOMIC_RELAXED);
+}
+
+static void add_hist(unsigned long* hist, double us){
+
+    int bin = 0;
+    while(us >= 1 && bin < LOCK_BINS - 1){
+        us /= 2;
+        bin++;
+    }
+
+    hist[bin]++;
+}
+
+/* scheduling priority of the calling thread, 0 if not real time */
+static int thread_prio(void){
+
+    if(own_prio < 0){
+        int policy;
+        struct sched_param param;
+
+        own_prio = pthread_getschedparam(pthread_self(), &policy, &param) ?
+                0 : param.sched_priority;
+    }
+
+    return own_prio;
+}
+
+static double elapsed_us(const struct timespec* from){
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - from->tv_sec) * 1e6 +
+            (now.tv_nsec - from->tv_nsec) / 1e3;
+}
+
+static void* thread_func(void* arg){
+
+    while(1){
+        sleep(LOCK_REPORT_S);
+        report(profile_log);
+    }
+
+    return NULL;
+}
+
+/* report:
+ * Write the statistics of every lock, one line each:
+ *      name,acquired,contended,inversions,wait max,hold max,
+ *      worst waiter,its holder,wait histogram...,hold histogram...
+ */
+static void report(FILE* fp){
+
+    pthread_mutex_lock(&mutex_setup);
+    int count = lock_count;
+    pthread_mutex_unlock(&mutex_setup);
+
+    for(int ii=0; ii<count; ++ii){
+
+        lock_t* lock = locks[ii];
+
+        /* the statistics belong to the holder of the lock */
+        pthread_mutex_lock(&lock->mutex);
+        lock_stats_t stats = lock->stats;
+        pthread_mutex_unlock(&lock->mutex);
+
+        const char* waiter = stats.contended ? stats.worst_waiter : "-";
+        const char* owner = stats.contended ? stats.worst_owner : "-";
+
+        char line[1024];
+        int len = snprintf(line, sizeof(line), "%s,%lu,%lu,%lu,%.1lf,%.1lf,%s,%s",
+                lock->name, stats.acquired, stats.contended, stats.inversions,
+                stats.wait_max, stats.hold_max, waiter, owner);
+
+        for(int jj=0; jj<LOCK_BINS; ++jj){
+            len += snprintf(line + len, sizeof(line) - len, ",%lu",
+                    stats.wait_hist[jj]);
+        }
+        for(int jj=0; jj<LOCK_BINS; ++jj){
+            len += snprintf(line + len, sizeof(line) - len, ",%lu",
+                    stats.hold_hist[jj]);
+        }
+
+        logging_csv(fp, "%s", line);
+
+        if(stats.inversions){
+            logging(WARN, "Lock", "%s: %lu waits on a lower priority holder, "
+                    "worst %.0lf us (%s waiting on %s)", lock->name,
+                    stats.inversions, stats.wait_max, waiter, owner);
+        }
+    }
+}
+
+#endif
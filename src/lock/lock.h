@@ -0,0 +1,86 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Lock
+ * Author(s):
+ * Purpose: Mutexes with priority inheritance for state shared between threads
+ *          of different priorities. Built with LOCK_PROFILE, the wait and hold
+ *          times of every lock are collected in histograms and written to
+ *          output/logs/lock_profile.log to find priority inversions.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <time.h>
+
+/* lock_t.flags */
+#define LOCK_RECURSIVE 0x1  /* may be taken again by the thread holding it */
+
+#ifdef LOCK_PROFILE
+/* bin 0 below 1 us, bin k from 2^(k-1) us up to 2^k us, last bin open */
+#define LOCK_BINS 18
+
+typedef struct{
+    unsigned long acquired;         /* number of acquisitions */
+    unsigned long contended;        /* acquisitions that had to wait */
+    unsigned long inversions;       /* waits on a lower priority holder */
+    unsigned long wait_hist[LOCK_BINS], hold_hist[LOCK_BINS];
+    double wait_max, hold_max;      /* unit: microseconds */
+    char worst_waiter[16];          /* thread names, copied when recorded */
+    char worst_owner[16];
+} lock_stats_t;
+#endif
+
+/* Initialise statically with LOCK_INITIALIZER, the mutex itself is created
+ * on first use since a priority inheritance mutex has no static initialiser.
+ */
+typedef struct{
+    pthread_mutex_t mutex;
+    const char* name;
+    int flags;
+    int ready;
+#ifdef LOCK_PROFILE
+    char owner[16];                 /* name of the thread holding it last */
+    int owner_prio;
+    int depth;
+    struct timespec taken;
+    lock_stats_t stats;
+#endif
+} lock_t;
+
+#define LOCK_INITIALIZER(lock_name) {.name = (lock_name)}
+#define LOCK_RECURSIVE_INITIALIZER(lock_name) \
+        {.name = (lock_name), .flags = LOCK_RECURSIVE}
+
+/* initialise the lock component, starts the profile report if enabled */
+int init_lock(void* args);
+
+/* lock_init:
+ * Initialise a lock at runtime, e.g. one in dynamically allocated memory.
+ *
+ * input:
+ *      lock: lock to initialise
+ *      name: name in the profile, must outlive the lock
+ *      flags: 0 or LOCK_RECURSIVE
+ *
+ * return:
+ *      SUCCESS: lock ready
+ *      otherwise the error number of pthread_mutex_init
+ */
+int lock_init(lock_t* lock, const char* name, int flags);
+
+/* take a lock, blocking. Returns as pthread_mutex_lock. */
+int lock_acquire(lock_t* lock);
+
+/* take a lock if free. Returns as pthread_mutex_trylock. */
+int lock_try(lock_t* lock);
+
+/* release a lock taken by the calling thread */
+int lock_release(lock_t* lock);
+
+/* wait on a condition variable, as pthread_cond_wait */
+int lock_cond_wait(pthread_cond_t* cond, lock_t* lock);
+
+/* wait on a condition variable with a timeout, as pthread_cond_timedwait */
+int lock_cond_timedwait(pthread_cond_t* cond, lock_t* lock,
+        const struct timespec* abstime);
@@ -8,10 +8,12 @@
 
 #include <pthread.h>
 
+#include "data_bus.h"
 #include "global_utils.h"
+#include "lock.h"
 #include "mode.h"
 
-static pthread_mutex_t mutex_mode;
+static lock_t mutex_mode;
 static char mode;
 
 static const char* modes[] = {
@@ -25,7 +27,7 @@ int init_mode(void* args){
 
     mode = SLEEP;
 
-    int res = pthread_mutex_init(&mutex_mode, NULL);
+    int res = lock_init(&mutex_mode, "mutex_mode", 0);
     if( res ){
         logging(ERROR, "MODE",
             "The initialisation of the mode mutex failed with code %d.",
@@ -38,10 +40,13 @@ int init_mode(void* args){
 
 void set_mode(char ch){
 
-    pthread_mutex_lock( &mutex_mode );
+    lock_acquire( &mutex_mode );
     mode = ch;
     logging(INFO, "MODE", "Entering %s mode", modes[(size_t)ch]);
-    pthread_mutex_unlock( &mutex_mode );
+
+    bus_mode_t msg = {ch};
+    publish_topic(TOPIC_MODE, &msg);
+    lock_release( &mutex_mode );
 
 }
 
@@ -49,9 +54,9 @@ char get_mode(void){
 
     char ch;
 
-    pthread_mutex_lock( &mutex_mode );
+    lock_acquire( &mutex_mode );
     ch = mode;
-    pthread_mutex_unlock( &mutex_mode );
+    lock_release( &mutex_mode );
 
     return ch;
 }
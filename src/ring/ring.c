@@ -0,0 +1,120 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Ring
+ * Author(s):
+ * Purpose: Fixed size history written by one real-time thread that never
+ *          blocks, and copied out by other threads which detect when the
+ *          writer overtook their copy.
+ * -----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "global_utils.h"
+#include "arena.h"
+#include "ring.h"
+
+/* ring_init:
+ * Allocate the elements from the arena and touch every page, the writer must
+ * not take page faults.
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOMEM: no memory available
+ */
+int ring_init(ring_t* ring, long len, size_t size, const char* owner){
+
+    ring->buf = arena_alloc(len * size, owner);
+    if(ring->buf == NULL){
+        return ENOMEM;
+    }
+
+    memset(ring->buf, 0, len * size);
+
+    ring->size = size;
+    ring->len = len;
+    atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+
+    return SUCCESS;
+}
+
+/* slot of the next element, filled by the writer before ring_publish */
+void* ring_slot(ring_t* ring){
+
+    long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    return (char*)ring->buf + (head % ring->len) * ring->size;
+}
+
+/* make the element filled in ring_slot visible to readers, the oldest element
+ * is overwritten */
+void ring_publish(ring_t* ring){
+
+    long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    /* the next ring_slot overwrites element head + 1 - len. Keep those
+     * stores after the head store, or a reader could copy torn data and still
+     * see the old head in ring_copy, same as the data bus sequence number */
+    atomic_thread_fence(memory_order_release);
+}
+
+/* number of elements published since the start */
+long ring_head(ring_t* ring){
+    return atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+/* ring_at:
+ * Read back a published element in place. Only for the writer thread, a
+ * reader could see the element overwritten while using it.
+ *
+ * return:
+ *      the element, NULL if it is not written yet or already overwritten
+ */
+const void* ring_at(ring_t* ring, long index){
+
+    long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if(index < 0 || index >= head || index < head - ring->len){
+        return NULL;
+    }
+
+    return (char*)ring->buf + (index % ring->len) * ring->size;
+}
+
+/* ring_copy:
+ * Copy the latest elements, oldest first. The writer is never stopped, the
+ * copy is discarded if the writer overtook it.
+ *
+ * return:
+ *      number of elements copied, 0 if the copy was overwritten
+ */
+long ring_copy(ring_t* ring, void* out, long from, long guard){
+
+    long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    long first = head - (ring->len - guard);
+    if(first < from){
+        first = from;
+    }
+    if(first < 0){
+        first = 0;
+    }
+
+    for(long ii=first; ii<head; ++ii){
+        memcpy((char*)out + (ii - first) * ring->size,
+                (char*)ring->buf + (ii % ring->len) * ring->size, ring->size);
+    }
+
+    /* the writer fills the slot of element after, which held element
+     * after - len, before publishing it. Any copied element from there on
+     * may be torn. */
+    atomic_thread_fence(memory_order_acquire);
+    long after = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if(after - first >= ring->len){
+        return 0;
+    }
+
+    return head - first;
+}
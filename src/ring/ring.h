@@ -0,0 +1,74 @@
+/* -----------------------------------------------------------------------------
+ * Component Name: Ring
+ * Author(s):
+ * Purpose: Fixed size history written by one real-time thread that never
+ *          blocks, and copied out by other threads which detect when the
+ *          writer overtook their copy.
+ * -----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef struct{
+    void* buf;
+    size_t size;            /* size of an element, unit: bytes */
+    long len;               /* number of elements */
+    atomic_long head;       /* elements written since the start */
+} ring_t;
+
+/* ring_init:
+ * Allocate the elements from the arena and touch every page, the writer must
+ * not take page faults.
+ *
+ * input:
+ *      len: number of elements kept
+ *      size: size of an element, unit: bytes
+ *      owner: name of the allocating component, for the log
+ *
+ * return:
+ *      SUCCESS: operation is successful
+ *      ENOMEM: no memory available
+ */
+int ring_init(ring_t* ring, long len, size_t size, const char* owner);
+
+/* slot of the next element, filled by the writer before ring_publish */
+void* ring_slot(ring_t* ring);
+
+/* make the element filled in ring_slot visible to readers, the oldest element
+ * is overwritten */
+void ring_publish(ring_t* ring);
+
+/* number of elements published since the start */
+long ring_head(ring_t* ring);
+
+/* ring_at:
+ * Read back a published element in place. Only for the writer thread, a
+ * reader could see the element overwritten while using it.
+ *
+ * input:
+ *      index: index of the element, counted like ring_head
+ *
+ * return:
+ *      the element, NULL if it is not written yet or already overwritten
+ */
+const void* ring_at(ring_t* ring, long index);
+
+/* ring_copy:
+ * Copy the latest elements, oldest first. The writer is never stopped, the
+ * copy is discarded if the writer overtook it.
+ *
+ * input:
+ *      from: index of the oldest element wanted, counted like ring_head
+ *      guard: elements at the old end left out, the writer keeps writing
+ *             while copying and would otherwise tear the copy at once
+ *
+ * output:
+ *      out: the elements, room for len - guard of them
+ *
+ * return:
+ *      number of elements copied, 0 if the copy was overwritten
+ */
+long ring_copy(ring_t* ring, void* out, long from, long guard);
@@ -9,20 +9,24 @@
 
 #include <pthread.h>
 
+#include "data_bus.h"
 #include "global_utils.h"
+#include "lock.h"
 #include "sensors.h"
 #include "encoder.h"
 
-static pthread_mutex_t mutex_encoder;
+static lock_t mutex_encoder;
 static encoder_t encoder_local;
 
 int init_encoder(void* args){
 
     encoder_local.az = 0;
     encoder_local.alt_ang = 0;
+    encoder_local.rate_az = 0;
+    encoder_local.rate_alt = 0;
     encoder_local.out_of_date = 1;
 
-    int ret = pthread_mutex_init( &mutex_encoder, NULL );
+    int ret = lock_init(&mutex_encoder, "mutex_encoder", 0);
     if( ret ){
         logging(ERROR, "INIT",
                 "The initialisation of the encoder mutex failed with code %d.\n",
@@ -35,31 +39,39 @@ int init_encoder(void* args){
 
 void get_encoder_local(encoder_t* encoder){
 
-    pthread_mutex_lock(&mutex_encoder);
+    lock_acquire(&mutex_encoder);
 
     encoder->az = encoder_local.az;
     encoder->alt_ang = encoder_local.alt_ang;
+    encoder->rate_az = encoder_local.rate_az;
+    encoder->rate_alt = encoder_local.rate_alt;
     encoder->out_of_date = encoder_local.out_of_date;
 
-    pthread_mutex_unlock(&mutex_encoder);
+    lock_release(&mutex_encoder);
 }
 
 void set_encoder(encoder_t* encoder){
 
-    pthread_mutex_lock(&mutex_encoder);
+    lock_acquire(&mutex_encoder);
 
     encoder_local.az = encoder->az;
     encoder_local.alt_ang = encoder->alt_ang;
+    encoder_local.rate_az = encoder->rate_az;
+    encoder_local.rate_alt = encoder->rate_alt;
     encoder_local.out_of_date = 0;
 
-    pthread_mutex_unlock(&mutex_encoder);
+    bus_encoder_t msg = {encoder->az, encoder->alt_ang, encoder->rate_az,
+            encoder->rate_alt};
+    publish_topic(TOPIC_ENCODER, &msg);
+
+    lock_release(&mutex_encoder);
 }
 
 void encoder_out_of_date(void){
 
-    pthread_mutex_lock(&mutex_encoder);
+    lock_acquire(&mutex_encoder);
 
     encoder_local.out_of_date = 1;
 
-    pthread_mutex_unlock(&mutex_encoder);
+    lock_release(&mutex_encoder);
 }
@@ -8,11 +8,13 @@
 
 #include <pthread.h>
 
+#include "data_bus.h"
 #include "global_utils.h"
+#include "lock.h"
 #include "sensors.h"
 #include "gps.h"
 
-static pthread_mutex_t mutex_gps;
+static lock_t mutex_gps;
 static gps_t gps_local;
 
 
@@ -23,7 +25,7 @@ int init_gps(void* args){
     gps_local.alt = 0;
     gps_local.out_of_date = 1;
 
-    int ret = pthread_mutex_init( &mutex_gps, NULL );
+    int ret = lock_init(&mutex_gps, "mutex_gps", 0);
     if( ret ){
         logging(ERROR, "GPS",
                 "The initialisation of the gps mutex failed with code %d.\n",
@@ -36,33 +38,36 @@ int init_gps(void* args){
 
 void get_gps_local(gps_t* gps){
 
-    pthread_mutex_lock(&mutex_gps);
+    lock_acquire(&mutex_gps);
 
     gps->lat = gps_local.lat;
     gps->lon = gps_local.lon;
     gps->alt = gps_local.alt;
     gps->out_of_date = gps_local.out_of_date;
 
-    pthread_mutex_unlock(&mutex_gps);
+    lock_release(&mutex_gps);
 }
 
 void set_gps(gps_t* gps){
 
-    pthread_mutex_lock(&mutex_gps);
+    lock_acquire(&mutex_gps);
 
     gps_local.lat = gps->lat;
     gps_local.lon = gps->lon;
     gps_local.alt = gps->alt;
     gps_local.out_of_date = 0;
 
-    pthread_mutex_unlock(&mutex_gps);
+    bus_gps_t msg = {gps->lat, gps->lon, gps->alt};
+    publish_topic(TOPIC_GPS, &msg);
+
+    lock_release(&mutex_gps);
 }
 
 void gps_out_of_date(void){
 
-    pthread_mutex_lock(&mutex_gps);
+    lock_acquire(&mutex_gps);
 
     gps_local.out_of_date = 1;
 
-    pthread_mutex_unlock(&mutex_gps);
+    lock_release(&mutex_gps);
 }
@@ -10,12 +10,14 @@
 #include <pthread.h>
 #include <string.h>
 
+#include "data_bus.h"
 #include "global_utils.h"
+#include "lock.h"
 #include "sensors.h"
 #include "gyroscope.h"
 
-static pthread_mutex_t mutex_gyro = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t mutex_gyro_temp = PTHREAD_MUTEX_INITIALIZER;
+static lock_t mutex_gyro = LOCK_INITIALIZER("mutex_gyro");
+static lock_t mutex_gyro_temp = LOCK_INITIALIZER("mutex_gyro_temp");
 static gyro_t gyro_local;
 static double gyro_temp;
 
@@ -31,48 +33,51 @@ int init_gyroscope(void* args){
 
 void get_gyro_local(gyro_t* gyro){
 
-    pthread_mutex_lock(&mutex_gyro);
+    lock_acquire(&mutex_gyro);
 
     *gyro = gyro_local;
 
-    pthread_mutex_unlock(&mutex_gyro);
+    lock_release(&mutex_gyro);
 }
 
 void set_gyro(gyro_t* gyro){
 
-    pthread_mutex_lock(&mutex_gyro);
+    lock_acquire(&mutex_gyro);
 
     gyro_local = *gyro;
     gyro_local.out_of_date = 0;
 
-    pthread_mutex_unlock(&mutex_gyro);
+    bus_gyro_t msg = {gyro->x, gyro->y, gyro->z};
+    publish_topic(TOPIC_GYRO, &msg);
+
+    lock_release(&mutex_gyro);
 }
 
 /* set the out of date flag on the gyro data */
 void gyro_out_of_date(void){
 
-    pthread_mutex_lock(&mutex_gyro);
+    lock_acquire(&mutex_gyro);
 
     gyro_local.out_of_date = 1;
 
-    pthread_mutex_unlock(&mutex_gyro);
+    lock_release(&mutex_gyro);
 }
 
 double get_gyro_temp_l(void){
-    pthread_mutex_lock(&mutex_gyro_temp);
+    lock_acquire(&mutex_gyro_temp);
 
     double temp = gyro_temp;
 
-    pthread_mutex_unlock(&mutex_gyro_temp);
+    lock_release(&mutex_gyro_temp);
 
     return temp;
 }
 
 void set_gyro_temp_l(double temp){
 
-    pthread_mutex_lock(&mutex_gyro_temp);
+    lock_acquire(&mutex_gyro_temp);
 
     gyro_temp = temp;
 
-    pthread_mutex_unlock(&mutex_gyro_temp);
+    lock_release(&mutex_gyro_temp);
 }
@@ -15,6 +15,8 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <math.h>
+#include <stdatomic.h>
 
 #include "global_utils.h"
 #include "sensors.h"
@@ -27,9 +29,38 @@
 #define AZ 0
 #define ALT_ANG 1
 
-static int checksum_ctl(unsigned char data[2][2]);
+/* encoder resolution, 14 bits per revolution */
+#define ENC_COUNTS 0x4000
+
+/* reads combined into one sample, a single bad read is outvoted */
+#define ENC_OVERSAMPLE 3
+
+/* deviation from the predicted angle that is taken as a glitch, the gimbal
+ * cannot move this far in one sample, unit: degrees */
+#define ENC_GLITCH_DEG 1.0
+
+/* consecutive glitches after which the jump is taken as real */
+#define ENC_GLITCH_MAX 10
+
+/* tracking loop differentiator, natural frequency 4 Hz. KP = 2 * zeta * wn
+ * with zeta = 1, critically damped so the rate does not overshoot after a
+ * step in angle */
+#define ENC_LOOP_WN (2 * M_PI * 4.0)
+#define ENC_LOOP_KP (2 * ENC_LOOP_WN)
+#define ENC_LOOP_KI (ENC_LOOP_WN * ENC_LOOP_WN)
+
+/* tracking loop state of one axis */
+typedef struct{
+    double ang, rate;       /* unit: degrees, degrees/second */
+    int missed;             /* consecutive samples rejected or missing */
+    char valid;
+} enc_loop_t;
+
+static int checksum_ctl(const int valid[2]);
 static int checksum_ctl_enc(unsigned char data[2]);
-static void proc(unsigned char data[2][2], encoder_t* enc);
+static double combine(const unsigned short* counts, int n);
+static void proc(const double counts[2], encoder_t* enc);
+static char loop_step(enc_loop_t* loop, double ang, char have);
 static void* thread_func(void* args);
 static void active_m(void);
 static int read_offsets(void);
@@ -153,20 +184,41 @@ static int read_offsets(void){
     return SUCCESS;
 }
 
-/* fetch a single sample from the encoder */
+/* fetch a single sample from the encoder, the median of ENC_OVERSAMPLE reads
+ * with a correct checksum */
 int enc_single_samp_ll(encoder_t* enc){
 
     unsigned char data[2][2];
+    unsigned short counts[2][ENC_OVERSAMPLE];
+    int valid[2] = {0, 0};
+
+    for(int ii=0; ii<ENC_OVERSAMPLE; ++ii){
 
-    read(fd_spi00, data[AZ], 2);
-    read(fd_spi01, data[ALT_ANG], 2);
+        read(fd_spi00, data[AZ], 2);
+        read(fd_spi01, data[ALT_ANG], 2);
 
-    if(checksum_ctl(data)){
+        for(int jj=0; jj<2; ++jj){
+            if(checksum_ctl_enc(data[jj]) == SUCCESS){
+                counts[jj][valid[jj]++] =
+                        (unsigned short)(data[jj][0] & 0x3F) << 8 |
+                        (unsigned short)data[jj][1];
+            }
+        }
+    }
+
+    if(checksum_ctl(valid)){
         errno = EIO;
         return FAILURE;
     }
 
-    proc(data, enc);
+    double comb[2];
+    for(int ii=0; ii<2; ++ii){
+        comb[ii] = combine(counts[ii], valid[ii]);
+    }
+
+    proc(comb, enc);
+    enc->rate_az = 0;
+    enc->rate_alt = 0;
     return SUCCESS;
 }
 
@@ -198,21 +250,139 @@ static void* thread_func(void* args){
 }
 
 static encoder_t enc;
+static enc_loop_t loop[2];
+
+/* set when the offsets change, the angles jump */
+static atomic_char loop_reset;
+
 static void active_m(void){
 
-    if(enc_single_samp(&enc)){
+    if(atomic_exchange(&loop_reset, 0)){
+        loop[AZ].valid = 0;
+        loop[ALT_ANG].valid = 0;
+    }
+
+    char have = enc_single_samp(&enc) == SUCCESS;
+
+    char rej_az = loop_step(&loop[AZ], enc.az, have);
+    char rej_alt = loop_step(&loop[ALT_ANG], enc.alt_ang, have);
+
+    if(!have){
         encoder_out_of_date();
+        return;
+    }
+
+    /* a glitch is replaced by the prediction of the loop */
+    if(rej_az){
+        enc.az = loop[AZ].ang;
+    }
+    if(rej_alt){
+        enc.alt_ang = loop[ALT_ANG].ang;
+    }
+
+    enc.rate_az = loop[AZ].rate;
+    enc.rate_alt = loop[ALT_ANG].rate;
+
+    logging_csv(encoder_log, "%010.6lf,%010.6lf,%+.6lf,%+.6lf,%d",
+            enc.az, enc.alt_ang, enc.rate_az, enc.rate_alt,
+            rej_az | rej_alt << 1);
+
+    set_encoder(&enc);
+}
+
+/* loop_step:
+ * Advance the tracking loop differentiator of one axis by one sample. The
+ * loop predicts the angle from its rate estimate and corrects both with the
+ * deviation of the measurement, a PLL without the oscillator:
+ *      ang  += dt * (rate + Kp * err)
+ *      rate += dt * Ki * err
+ *
+ * input:
+ *      loop: state of the axis
+ *      ang: measured angle
+ *      have: 0 if no measurement was available
+ *
+ * return:
+ *      0: measurement used
+ *      1: measurement missing or rejected as a glitch
+ */
+static char loop_step(enc_loop_t* loop, double ang, char have){
+
+    double dt = (double)ENCODER_SAMPLE_TIME / 1000000000;
+
+    if(have && (!loop->valid || loop->missed >= ENC_GLITCH_MAX)){
+        loop->ang = ang;
+        loop->rate = 0;
+        loop->missed = 0;
+        loop->valid = 1;
+        return 0;
+    }
+
+    if(!loop->valid){
+        return 1;
+    }
+
+    double pred = ang_wrap180(loop->ang + dt * loop->rate);
+    double err = have ? ang_diff(ang, pred) : 0;
+
+    if(!have || fabs(err) > ENC_GLITCH_DEG){
+        loop->ang = pred;
+        loop->missed++;
+        return 1;
+    }
+
+    loop->ang = ang_wrap180(pred + dt * ENC_LOOP_KP * err);
+    loop->rate += dt * ENC_LOOP_KI * err;
+    loop->missed = 0;
+
+    return 0;
+}
+
+/* combine:
+ * Merge the reads of one encoder, median of three or mean of two. Counts are
+ * taken relative to the first read so reads on both sides of zero agree.
+ *
+ * return:
+ *      combined count, in [0, ENC_COUNTS)
+ */
+static double combine(const unsigned short* counts, int n){
+
+    int rel[ENC_OVERSAMPLE];
+    for(int ii=0; ii<n; ++ii){
+        rel[ii] = ((counts[ii] - counts[0] + ENC_COUNTS / 2) & (ENC_COUNTS - 1))
+                - ENC_COUNTS / 2;
+    }
+
+    double mid;
+    if(n == 1){
+        mid = 0;
+    }
+    else if(n == 2){
+        mid = (rel[0] + rel[1]) / 2.0;
     }
     else{
-        set_encoder(&enc);
+        int a = rel[0], b = rel[1], c = rel[2];
+        mid = a > b ? (b > c ? b : (a > c ? c : a)) :
+                      (a > c ? a : (b > c ? c : b));
     }
+
+    mid += counts[0];
+    if(mid < 0){
+        mid += ENC_COUNTS;
+    }
+    else if(mid >= ENC_COUNTS){
+        mid -= ENC_COUNTS;
+    }
+
+    return mid;
 }
 
-static int checksum_ctl(unsigned char data[2][2]){
+/* fails if no read of an encoder had a correct checksum */
+static int checksum_ctl(const int valid[2]){
     int ctl[2];
 
     for(int ii=0; ii<2; ++ii){
-        ctl[ii] = checksum_ctl_enc(data[ii]);
+        ctl[ii] = valid[ii] == 0;
     }
 
     if(ctl[AZ]){
@@ -305,6 +475,8 @@ int set_offsets(void){
     fwrite((void*)&alt_offset, sizeof(double), 1, encoder_offset_alt);
     fclose(encoder_offset_alt);
 
+    atomic_store(&loop_reset, 1);
+
     char buffer[100];
     snprintf(buffer, 100, "Encoder offsets set to %lg az, %lg alt",
             az_offset, alt_offset);
@@ -313,21 +485,19 @@ int set_offsets(void){
     return SUCCESS;
 }
 
-static void proc(unsigned char data[2][2], encoder_t* enc){
-    unsigned short data_s[2];
+static void proc(const double counts[2], encoder_t* enc){
     double ang[2];
 
     for(int ii=0; ii<2; ++ii){
-        data_s[ii] = (unsigned short)(data[ii][0] & 0x3F) << 8 | (unsigned short)data[ii][1];
-        ang[ii] = 360.0 * (double)data_s[ii] / (double)0x4000;
+        ang[ii] = 360.0 * counts[ii] / (double)ENC_COUNTS;
     }
 
     #ifdef ENCODER_DEBUG
         logging(DEBUG, "Encoder", "ra: %lf \t dec: %lf", ang[AZ], ang[ALT_ANG]);
     #endif
 
-    enc->az = ang[AZ] - az_offset;
-    enc->alt_ang = 360 - ang[ALT_ANG] - alt_offset;
-
-    logging_csv(encoder_log, "%010.6lf,%010.6lf", enc->az, enc->alt_ang);
+    /* the gimbal cannot turn past half a revolution from its zero, a signed
+     * angle is continuous over its whole range */
+    enc->az = ang_wrap180(ang[AZ] - az_offset);
+    enc->alt_ang = ang_wrap180(360 - ang[ALT_ANG] - alt_offset);
 }
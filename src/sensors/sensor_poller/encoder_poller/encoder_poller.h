@@ -14,5 +14,6 @@ int init_encoder_poller(void* args);
 /* set offsets for the azimuth and altitude angle encoders */
 int set_offsets(void);
 
-/* fetch a single sample from the encoder */
+/* fetch a single sample from the encoder, the median of ENC_OVERSAMPLE reads
+ * with a correct checksum */
 int enc_single_samp_ll(encoder_t* enc);
@@ -25,6 +25,9 @@
 
 #define ST_WAIT_TIME 10*1000*1000
 
+/* values returned by irisc_tetra */
+#define ST_RETURN_LEN 7
+
 /* macros used in popen2 */
 #define READ 0
 #define WRITE 1
@@ -50,7 +53,8 @@ static int exp_time = 2, gain = 300;
 
 /* filenames for images */
 static char st_fn[100], out_fp[100];
-static float st_return[4];
+static float st_return[ST_RETURN_LEN];
+static struct timespec st_mid;  /* middle of the exposure being solved */
 static FILE* star_tracker_log;
 
 #ifndef ST_TEST
@@ -115,6 +119,9 @@ static void active_m(void){
             st_out_of_date();
             return;
         }
+
+        /* the filter applies the fix at the middle of the exposure */
+        get_guiding_mid_exp(&st_mid);
     #endif
 
     /* star tracker calculations */
@@ -176,8 +183,9 @@ static int call_tetra(float st_return[]){
         logging(DEBUG, "Star Tracker",
                 "Star tracker sample time: %ld.%09ld s",
                 diff.tv_sec, diff.tv_nsec);
-        logging(DEBUG, "Star Tracker", "Output: %f, %f, %f, %f",
-                st_return[0], st_return[1], st_return[2], st_return[3]);
+        logging(DEBUG, "Star Tracker", "Output: %f, %f, %f, %f, %.0f, %f, %f",
+                st_return[0], st_return[1], st_return[2], st_return[3],
+                st_return[4], st_return[5], st_return[6]);
     #else
         irisc_tetra(st_return);
     #endif
@@ -190,9 +198,13 @@ static int call_tetra(float st_return[]){
     st.ra = st_return[0];
     st.dec = st_return[1];
     st.roll = st_return[2];
+    st.matched = (int)st_return[4];
+    st.rms = st_return[5];
+    st.log_odds = st_return[6];
+    st.mid_mono = st_mid;
 
-    logging_csv(star_tracker_log, "%010.6f,%010.7f,%010.6f",
-            st.ra, st.dec, st.roll);
+    logging_csv(star_tracker_log, "%010.6f,%010.7f,%010.6f,%d,%.3f,%.2f",
+            st.ra, st.dec, st.roll, st.matched, st.rms, st.log_odds);
 
     set_star_tracker(&st);
 
@@ -202,38 +214,37 @@ static int call_tetra(float st_return[]){
 /*
  * Purpose: This is the interface to run the Astrometry.net program from the
  *          main OBSW.
- * Usage: A float array of length 4 i passed, and values from the star tracker
- *          is returned in this array in order:
+ * Usage: A float array of length ST_RETURN_LEN is passed, and values from the
+ *          star tracker are returned in this array in order:
  *          0: RA
  *          1: Dec
  *          2: Roll
  *          3: FoV
+ *          4: number of matched stars
+ *          5: RMS residual of the matched stars, unit: arcsec
+ *          6: log-odds of the solution
  *
- *          The name of the parameter is printed by the star tracker, but then ignored.
- *          If no attitude could be calculated all of these will be 0. This
- *          can obviously not happen if an attitude is calculated, as FoV will
- *          always have a positive non-zero value.
+ *          The star tracker prints IRISC followed by name value pairs in this
+ *          order, the name is ignored. The match quality (4-6) is 0 if the
+ *          solver does not print it. If no attitude could be calculated all
+ *          of these will be 0. This can obviously not happen if an attitude
+ *          is calculated, as FoV will always have a positive non-zero value.
  */
 static void irisc_tetra(float st_return[]) {
 
     char st_img_path[100];
 
-    /*
-    char exe_path[100];
-    strcpy(exe_path, get_top_dir());
-    strcat(exe_path,"usr/local/astrometry/bin/solve-field");
-    */
     strcpy(st_img_path, get_top_dir());
-    strcat(st_img_path,"output/guiding/star_tracker/st_img.fit ");
+    strcat(st_img_path,"output/guiding/star_tracker/st_img.fit");
 
     /* lisFlag, 1 if we are completely lost in space. 0 for only slightly. */
     static int lisFlag = 1;
-    static char* oldRa[2] = "0";
-    static char* oldDec[2]; = "0";
+    static char oldRa[16] = "0";
+    static char oldDec[16] = "0";
     char* stRad = "15";
-    
-    
-    char* cmd[8] = {
+
+    /* search around the previous solution unless lost in space */
+    char* cmd[] = {
         "chrt",
         "-f",
         "23",
@@ -243,56 +254,62 @@ static void irisc_tetra(float st_return[]) {
         "--scale-low",
         "1",
         st_img_path,
-        NULL
-    };
-
-    char* raDecFlags[7] = {
-        "--ra",
-        raCurr,
+        lisFlag ? NULL : "--ra",   /* argv ends here when lost in space */
+        oldRa,
         "--dec",
-        decCurr,
+        oldDec,
         "--radius",
         stRad,
-        NULL 
+        NULL
     };
 
-    char* raDecCmd[16];
-
     int out_fd = -1;
 
+    memset(st_return, 0, ST_RETURN_LEN * sizeof(*st_return));
+
     st_running = 1;
+    py_pid = popen2(cmd, NULL, &out_fd);
+    lisFlag = 0;
 
-    if (!lisFlag) {
-        strcpy(raDecCmd, cmd);
-        strcat(raDecCmd, raDecCmd);
-        py_pid = popen2(raDecCmd, NULL, &out_fd);
-    } else {
-        py_pid = popen2(cmd, NULL, &out_fd);
-        lisFlag = 0;
+    if(py_pid < 0){
+        st_running = 0;
+        logging(ERROR, "Star Tracker", "Failed to start the solver: %m");
+        lisFlag = 1;
+        return;
     }
+
     waitpid(py_pid, NULL, 0);
     st_running = 0;
 
     FILE* oFPtr = fdopen(out_fd, "r");
+    if(oFPtr == NULL){
+        close(out_fd);
+        lisFlag = 1;
+        return;
+    }
 
     char buffer[200];
+    int found = 0;
 
-    while (1) {
-        fscanf(oFPtr, "%s", buffer);
+    while (fscanf(oFPtr, "%199s", buffer) == 1) {
         if (!strcmp(buffer, "IRISC")) {
+            found = 1;
             break;
         }
     }
 
-    for (int i = 0; i < 4; i++) {
-        fscanf( oFPtr, "%*s %f", &st_return[i]);
+    /* the match quality is optional, an older solver stops after FoV */
+    for (int i = 0; found && i < ST_RETURN_LEN; i++) {
+        if(fscanf( oFPtr, "%*s %f", &st_return[i]) != 1){
+            break;
+        }
     }
 
     if(fabs(st_return[3]) < 0.001){
         lisFlag = 1;
     } else {
-        sprintf(oldRa, "%d", (int)st_return[1]);
-        sprintf(oldDec, "%d", (int)st_return[2]);
+        snprintf(oldRa, sizeof(oldRa), "%d", (int)st_return[0]);
+        snprintf(oldDec, sizeof(oldDec), "%d", (int)st_return[1]);
     }
     fclose(oFPtr);
     return;
@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <time.h>
+
 extern pthread_mutex_t mutex_cond_st;
 extern pthread_cond_t cond_st;
 
@@ -34,11 +36,18 @@ typedef struct{
 
 typedef struct{
     double az, alt_ang;
+    double rate_az, rate_alt;   /* unit: degrees/second */
     char out_of_date;
 } encoder_t;
 
 typedef struct{
     double ra, dec, roll;
+    /* match quality of the solve, matched is 0 if the solver gave none */
+    int matched;                /* stars matched to the catalogue */
+    double rms;                 /* rms residual of the matched stars, unit: arcsec */
+    double log_odds;            /* log-odds of the solution */
+    struct timespec mid_mono;   /* CLOCK_MONOTONIC at mid exposure, zero if
+                                   the exposure was not stamped */
     char out_of_date, new_data;
 } star_tracker_t;
 
@@ -89,7 +98,8 @@ void set_st_gain(int st_gain);
 
 int get_st_exp(void);
 
-/* fetch a single sample from the encoder */
+/* fetch a single sample from the encoder, bypassing the encoder poller. The
+ * rates are not estimated and set to 0. */
 int enc_single_samp(encoder_t* enc);
 
 /* fetch the temperature of the gyroscope */
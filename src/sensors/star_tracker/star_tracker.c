@@ -10,10 +10,11 @@
 #include <pthread.h>
 
 #include "global_utils.h"
+#include "lock.h"
 #include "sensors.h"
 #include "star_tracker.h"
 
-static pthread_mutex_t mutex_st;
+static lock_t mutex_st;
 static star_tracker_t st_local;
 
 int init_star_tracker(void* args){
@@ -21,10 +22,13 @@ int init_star_tracker(void* args){
     st_local.ra = 0;
     st_local.dec = 0;
     st_local.roll = 0;
+    st_local.matched = 0;
+    st_local.rms = 0;
+    st_local.log_odds = 0;
     st_local.out_of_date = 1;
     st_local.new_data = 0;
 
-    int ret = pthread_mutex_init( &mutex_st, NULL );
+    int ret = lock_init(&mutex_st, "mutex_st", 0);
     if( ret ){
         logging(ERROR, "INIT",
                 "The initialisation of the star tracker"
@@ -37,37 +41,45 @@ int init_star_tracker(void* args){
 
 void get_star_tracker_local(star_tracker_t* st){
 
-    pthread_mutex_lock(&mutex_st);
+    lock_acquire(&mutex_st);
 
     st->ra = st_local.ra;
     st->dec = st_local.dec;
     st->roll = st_local.roll;
+    st->matched = st_local.matched;
+    st->rms = st_local.rms;
+    st->log_odds = st_local.log_odds;
+    st->mid_mono = st_local.mid_mono;
     st->out_of_date = st_local.out_of_date;
     st->new_data = st_local.new_data;
 
     st_local.new_data = 0;
 
-    pthread_mutex_unlock(&mutex_st);
+    lock_release(&mutex_st);
 }
 
 void set_star_tracker(star_tracker_t* st){
 
-    pthread_mutex_lock(&mutex_st);
+    lock_acquire(&mutex_st);
 
     st_local.ra = st->ra;
     st_local.dec = st->dec;
     st_local.roll = st->roll;
+    st_local.matched = st->matched;
+    st_local.rms = st->rms;
+    st_local.log_odds = st->log_odds;
+    st_local.mid_mono = st->mid_mono;
     st_local.out_of_date = 0;
     st_local.new_data = 1;
 
-    pthread_mutex_unlock(&mutex_st);
+    lock_release(&mutex_st);
 }
 
 void st_out_of_date(void){
 
-    pthread_mutex_lock(&mutex_st);
+    lock_acquire(&mutex_st);
 
     st_local.out_of_date = 1;
 
-    pthread_mutex_unlock(&mutex_st);
+    lock_release(&mutex_st);
 }
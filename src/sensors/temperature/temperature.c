@@ -9,11 +9,13 @@
 
 #include <pthread.h>
 
+#include "data_bus.h"
 #include "global_utils.h"
+#include "lock.h"
 #include "sensors.h"
 
 static temp_t temp_local = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
-static pthread_mutex_t mutex_temp = PTHREAD_MUTEX_INITIALIZER;
+static lock_t mutex_temp = LOCK_INITIALIZER("mutex_temp");
 
 int init_temperature(void* args){
     return SUCCESS;
@@ -21,29 +23,37 @@ int init_temperature(void* args){
 
 void get_temp_l(temp_t* temp){
 
-    pthread_mutex_lock(&mutex_temp);
+    lock_acquire(&mutex_temp);
 
     *temp = temp_local;
 
-    pthread_mutex_unlock(&mutex_temp);
+    lock_release(&mutex_temp);
 }
 
 void set_temp(temp_t* temp){
 
-    pthread_mutex_lock(&mutex_temp);
+    lock_acquire(&mutex_temp);
 
     temp_local = *temp;
     temp_local.out_of_date = 0;
 
-    pthread_mutex_unlock(&mutex_temp);
+    bus_temp_t msg = {
+        temp->pcb_0, temp->pcb_1, temp->pcb_2, temp->ambient,
+        temp->motor_az, temp->motor_alt, temp->motor_roll, temp->motor_focus,
+        temp->telescope_0, temp->telescope_1, temp->encoder_0, temp->encoder_1,
+        temp->nir, temp->guiding, temp->cpu
+    };
+    publish_topic(TOPIC_TEMP, &msg);
+
+    lock_release(&mutex_temp);
 }
 
 /* set the out of date flag on the temp data */
 void temp_out_of_date(void){
 
-    pthread_mutex_lock(&mutex_temp);
+    lock_acquire(&mutex_temp);
 
     temp_local.out_of_date = 1;
 
-    pthread_mutex_unlock(&mutex_temp);
+    lock_release(&mutex_temp);
 }
@@ -80,7 +80,7 @@ static void* thread_func(void* param){
 
 static unsigned short send_file(char *filepath, unsigned short packets_sent, int priority){
 
-    int max_packet_size = 1400-6;
+    int max_packet_size = DOWNLINK_PAYLOAD;
     char buffer[max_packet_size];
     char msg[max_packet_size];
     unsigned short n, packets, current_packet;
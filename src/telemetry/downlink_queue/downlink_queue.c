@@ -20,16 +20,21 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "global_utils.h"
+#include "lock.h"
 
 #include "downlink_queue.h"
 
-pthread_mutex_t downlink_mutex = PTHREAD_MUTEX_INITIALIZER;
+lock_t downlink_mutex = LOCK_INITIALIZER("downlink_mutex");
 pthread_cond_t queue_non_empty_cond = PTHREAD_COND_INITIALIZER;
 
 static downlink_node *downlink_queue = NULL;
 
+/* bytes left to send of every node, guarded by downlink_mutex */
+static long queued_bytes = 0;
+
 int init_downlink_queue(void* args) {
     return SUCCESS;
 }
@@ -39,13 +44,16 @@ int init_downlink_queue(void* args) {
  *
  * @param d     Filepath of data to be sent.
  * @param p     Priority of the data.
+ * @param bytes Bytes left to send.
  */
-downlink_node *new_node(char *f, int p, int flag, unsigned short packets_sent){
+downlink_node *new_node(char *f, int p, int flag, unsigned short packets_sent,
+        long bytes){
     downlink_node *temp = (downlink_node *) malloc(sizeof(downlink_node));
     strncpy(temp->filepath, f, 100);
     temp->priority = p;
     temp->flag = flag;
     temp->packets_sent = packets_sent;
+    temp->bytes = bytes;
     temp->next = NULL;
 
     return temp;
@@ -92,7 +100,7 @@ struct node pop(downlink_node **head) {
         #ifdef DOWNLINK_DEBUG
         logging(DEBUG, "downlink_queue", "Waiting for item in queue");
         #endif
-        pthread_cond_wait(&queue_non_empty_cond, &downlink_mutex);
+        lock_cond_wait(&queue_non_empty_cond, &downlink_mutex);
     }
     #ifdef DOWNLINK_DEBUG
     logging(DEBUG, "downlink_queue", "Item in queue, starting pop");
@@ -105,6 +113,9 @@ struct node pop(downlink_node **head) {
     ret.flag = temp->flag;
     ret.packets_sent = temp->packets_sent;
     ret.priority = temp->priority;
+    ret.bytes = temp->bytes;
+
+    queued_bytes -= temp->bytes;
 
     free(temp);
 
@@ -117,14 +128,16 @@ struct node pop(downlink_node **head) {
  * @param head  Pointer to the first node of the linked list.
  * @param f     Filepath of data to be sent.
  * @param p     Priority of the data.
+ * @param bytes Bytes left to send.
  */
-void push(downlink_node **head, char *f, int p, int flag, unsigned short packets_sent) {
+void push(downlink_node **head, char *f, int p, int flag, unsigned short packets_sent,
+        long bytes) {
 
     downlink_node *start = (*head);
 
     if (!is_empty(head)) {
         // Create new node
-        downlink_node *temp = new_node(f, p, flag, packets_sent);
+        downlink_node *temp = new_node(f, p, flag, packets_sent, bytes);
         // Special Case: The head of list has lesser
         // priority than new node. So insert new
         // node before head node and change head node.
@@ -145,8 +158,10 @@ void push(downlink_node **head, char *f, int p, int flag, unsigned short packets
             start->next = temp;
         }
     } else {
-        *head = new_node(f, p, flag, packets_sent); 
+        *head = new_node(f, p, flag, packets_sent, bytes);
     }
+
+    queued_bytes += bytes;
     
     pthread_cond_signal(&queue_non_empty_cond);
 }
@@ -163,9 +178,18 @@ void push(downlink_node **head, char *f, int p, int flag, unsigned short packets
  * @return      0
  */
 int send_telemetry_local(char *f, int p, int flag, unsigned short packets_sent) {
-    pthread_mutex_lock(&downlink_mutex);
-    push(&downlink_queue, f, p, flag, packets_sent);
-    pthread_mutex_unlock(&downlink_mutex);
+
+    /* what is left of a file that has been partly sent */
+    long bytes = strlen(f);
+    struct stat st;
+    if(flag == 1 && stat(f, &st) == 0){
+        bytes = st.st_size - (long)packets_sent * DOWNLINK_PAYLOAD;
+        bytes = bytes > 0 ? bytes : 0;
+    }
+
+    lock_acquire(&downlink_mutex);
+    push(&downlink_queue, f, p, flag, packets_sent, bytes);
+    lock_release(&downlink_mutex);
     return SUCCESS;
 }
 
@@ -178,15 +202,24 @@ int send_telemetry_local(char *f, int p, int flag, unsigned short packets_sent)
  * @return      filepath from the first node of the linked list.
  */
 struct node read_downlink_queue() {
-    pthread_mutex_lock(&downlink_mutex);
+    lock_acquire(&downlink_mutex);
     struct node temp = pop(&downlink_queue);
-    pthread_mutex_unlock(&downlink_mutex);
+    lock_release(&downlink_mutex);
     return temp;
 }
 
+long downlink_bytes_local(void){
+
+    lock_acquire(&downlink_mutex);
+    long bytes = queued_bytes;
+    lock_release(&downlink_mutex);
+
+    return bytes;
+}
+
 void check_downlink_list_local(void){
 
-    pthread_mutex_lock(&downlink_mutex);
+    lock_acquire(&downlink_mutex);
     
     const struct node *temp = downlink_queue;
 
@@ -213,7 +246,7 @@ void check_downlink_list_local(void){
 
     }
 
-    pthread_mutex_unlock(&downlink_mutex);
+    lock_release(&downlink_mutex);
 
 
     return;
@@ -9,6 +9,9 @@
 
 #pragma once
 
+/* bytes of a file sent in each packet */
+#define DOWNLINK_PAYLOAD (1400-6)
+
 /**
  * Node structure declaration.
  */
@@ -17,6 +20,7 @@ typedef struct node {
     int priority;       // Lower values indicate higher priority
     int flag;           // If 1 data is in a file, if 0 data as a string.
     unsigned short packets_sent;
+    long bytes;         // Bytes left to send.
     struct node *next;  // Pointer to the node next on the list.
 
 } downlink_node;
@@ -34,4 +38,7 @@ struct node read_downlink_queue();
 /* Return the highest priority in the queue */
 int queue_priority();
 
+/* Return the bytes left to send of every message in the queue */
+long downlink_bytes_local(void);
+
 void check_downlink_list_local(void);
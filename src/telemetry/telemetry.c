@@ -39,6 +39,10 @@ int send_telemetry(char *filepath, int p, int flag, unsigned short packets_sent)
     return send_telemetry_local(filepath, p, flag, packets_sent);
 }
 
+long downlink_backlog(void){
+    return downlink_bytes_local();
+}
+
 void check_downlink_list(void){
     check_downlink_list_local();
 
@@ -13,4 +13,7 @@ int init_telemetry(void* args);
 
 /* put data into the downlink queue */
 int send_telemetry(char *filepath, int p, int flag, unsigned short packets_sent);
+
+/* bytes waiting in the downlink queue */
+long downlink_backlog(void);
 void check_downlink_list(void);